@@ -0,0 +1,426 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks of the conversion, decoding, encoding and validation functions
+ *
+ * usage: bench_utf_conv [--filter SUBSTRING] [--repetitions N] [--min-time MS] [--size BYTES] [--csv]
+ *
+ * Every function runs on generated corpora :
+ * - ascii : pure ASCII text
+ * - latin1 : ASCII with ~30% of Latin-1 letters (2 bytes in UTF-8), also the Windows-1252 benchmarks input
+ * - cjk : CJK ideographs (3 bytes in UTF-8, 2 or 4 bytes in GB18030) with some ASCII punctuation
+ * - emoji : supplementary planes characters (4 bytes in UTF-8, surrogate pairs in UTF-16) and spaces
+ * - supplementary : emoji and CJK extension B ideographs only, long runs of 4 bytes sequences
+ * - mixed : a blend of all the above
+ * - invalid : the mixed corpus with a corrupted byte every ~1000 bytes, the functions are resumed after each error
+ *
+ * Each benchmark is run once as a warmup, then for each repetition as many times as needed to reach the minimum time.
+ * The report gives the mean time per run, its coefficient of variation across the repetitions,
+ * the throughput in GB/s (input bytes) and in codepoints/s.
+ * The iconv_* benchmarks run the same conversions with iconv(3), as a reference.
+ * The instruction set of the vectorized kernels can be forced with the UTF_CONV_ISA environment variable.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <iconv.h>
+
+#include "utf_conv.h"
+
+enum Encoding {
+    UTF8 = 0,
+    UTF16LE,
+    UTF16BE,
+    UTF32LE,
+    UTF32BE,
+    LATIN1,
+    WINDOWS1252,
+    GB18030,
+    N_ENCODINGS
+};
+
+/* size of a code unit, the invalid corpus is resumed one code unit after each error */
+static const size_t unit_size[N_ENCODINGS] = {1, 2, 2, 4, 4, 1, 1, 1};
+
+/* The Latin-1 and Windows-1252 versions of a corpus are empty if it has some codepoints they can't represent */
+struct Corpus {
+    std::string name;
+    std::string data[N_ENCODINGS];
+    std::vector<uint32_t> unicode;
+};
+
+/* A range of codepoints and its weight in a corpus */
+struct CpRange {
+    uint32_t first, last;
+    unsigned weight;
+};
+
+static Corpus make_corpus(const char *name, const std::vector<CpRange> &ranges, size_t size, std::mt19937 &gen) {
+    Corpus corpus;
+    corpus.name = name;
+    unsigned total_weight = 0;
+    for (const CpRange &range : ranges) {
+        total_weight += range.weight;
+    }
+    size_t utf8_len = 0;
+    while (utf8_len < size) {
+        unsigned pick = gen() % total_weight;
+        size_t i = 0;
+        while (pick >= ranges[i].weight) {
+            pick -= ranges[i].weight;
+            i++;
+        }
+        uint32_t cp = ranges[i].first + gen() % (ranges[i].last - ranges[i].first + 1);
+        corpus.unicode.push_back(cp);
+        utf8_len += UTF::impl::CpToUtf8::length(cp);
+    }
+
+    char *buffer = NULL;
+    size_t buffer_size = 0, written = 0;
+    UTF::RetCode (*encoders[N_ENCODINGS])(const uint32_t *, size_t, char **, size_t *, size_t *, size_t *) = {
+            UTF::encode_utf8, UTF::encode_utf16le, UTF::encode_utf16be, UTF::encode_utf32le, UTF::encode_utf32be, UTF::encode_latin1,
+            UTF::encode_windows1252, UTF::encode_gb18030};
+    for (int e = 0; e < N_ENCODINGS; e++) {
+        if (encoders[e](corpus.unicode.data(), corpus.unicode.size(), &buffer, &buffer_size, NULL, &written) == UTF::RetCode::OK) {
+            corpus.data[e].assign(buffer, written);
+        }
+    }
+    free(buffer);
+    return corpus;
+}
+
+/* The same corpus, with a random byte replaced every ~1000 bytes */
+static Corpus make_invalid_corpus(const Corpus &valid, std::mt19937 &gen) {
+    Corpus corpus = valid;
+    corpus.name = "invalid";
+    for (int e = 0; e < N_ENCODINGS; e++) {
+        std::string &data = corpus.data[e];
+        for (size_t i = gen() % 1000; i < data.size(); i += 500 + gen() % 1000) {
+            data[i] = char(gen() % 256);
+        }
+    }
+    for (size_t i = gen() % 250; i < corpus.unicode.size(); i += 125 + gen() % 250) {
+        corpus.unicode[i] = 0xD800 + gen() % 0x800;
+    }
+    return corpus;
+}
+
+struct Benchmark {
+    std::string name;
+    const Corpus *corpus;
+    size_t input_bytes;
+    size_t codepoints;
+    std::function<void()> run;
+};
+
+typedef UTF::RetCode (*ConvFunc)(const char *, size_t, char **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*DecodeFunc)(const char *, size_t, uint32_t **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*EncodeFunc)(const uint32_t *, size_t, char **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*ValidateFunc)(const char *, size_t, size_t *, size_t *);
+
+/* output buffers shared by all the benchmarks, they are only allocated during the warmup */
+static char *conv_buffer = NULL;
+static size_t conv_buffer_size = 0;
+static uint32_t *decode_buffer = NULL;
+static size_t decode_buffer_size = 0;
+
+/* The corpora without a version in the input or output encoding are skipped */
+static void add_conv(std::vector<Benchmark> &benchmarks, const std::vector<Corpus> &corpora, const char *name, Encoding from, Encoding to, ConvFunc conv) {
+    for (const Corpus &corpus : corpora) {
+        if (corpus.data[from].empty() || corpus.data[to].empty()) {
+            continue;
+        }
+        const std::string &input = corpus.data[from];
+        size_t unit = unit_size[from];
+        benchmarks.push_back({std::string(name) + "/" + corpus.name, &corpus, input.size(), corpus.unicode.size(), [&input, unit, conv]() {
+            size_t pos = 0;
+            while (pos < input.size()) {
+                size_t consumed = 0, written = 0;
+                UTF::RetCode r = conv(input.data() + pos, input.size() - pos, &conv_buffer, &conv_buffer_size, &consumed, &written);
+                pos += consumed + (r != UTF::RetCode::OK ? unit : 0);
+            }
+        }});
+    }
+}
+
+static void add_decode(std::vector<Benchmark> &benchmarks, const std::vector<Corpus> &corpora, const char *name, Encoding from, DecodeFunc decode) {
+    for (const Corpus &corpus : corpora) {
+        if (corpus.data[from].empty()) {
+            continue;
+        }
+        const std::string &input = corpus.data[from];
+        size_t unit = unit_size[from];
+        benchmarks.push_back({std::string(name) + "/" + corpus.name, &corpus, input.size(), corpus.unicode.size(), [&input, unit, decode]() {
+            size_t pos = 0;
+            while (pos < input.size()) {
+                size_t consumed = 0, written = 0;
+                UTF::RetCode r = decode(input.data() + pos, input.size() - pos, &decode_buffer, &decode_buffer_size, &consumed, &written);
+                pos += consumed + (r != UTF::RetCode::OK ? unit : 0);
+            }
+        }});
+    }
+}
+
+static void add_encode(std::vector<Benchmark> &benchmarks, const std::vector<Corpus> &corpora, const char *name, Encoding to, EncodeFunc encode) {
+    for (const Corpus &corpus : corpora) {
+        if (corpus.data[to].empty()) {
+            continue;
+        }
+        const std::vector<uint32_t> &input = corpus.unicode;
+        benchmarks.push_back({std::string(name) + "/" + corpus.name, &corpus, input.size() * 4, input.size(), [&input, encode]() {
+            size_t pos = 0;
+            while (pos < input.size()) {
+                size_t consumed = 0, written = 0;
+                UTF::RetCode r = encode(input.data() + pos, input.size() - pos, &conv_buffer, &conv_buffer_size, &consumed, &written);
+                pos += consumed + (r != UTF::RetCode::OK ? 1 : 0);
+            }
+        }});
+    }
+}
+
+static void add_validate(std::vector<Benchmark> &benchmarks, const std::vector<Corpus> &corpora, const char *name, Encoding from, ValidateFunc validate) {
+    for (const Corpus &corpus : corpora) {
+        if (corpus.data[from].empty()) {
+            continue;
+        }
+        const std::string &input = corpus.data[from];
+        size_t unit = unit_size[from];
+        benchmarks.push_back({std::string(name) + "/" + corpus.name, &corpus, input.size(), corpus.unicode.size(), [&input, unit, validate]() {
+            size_t pos = 0;
+            while (pos < input.size()) {
+                size_t consumed = 0, length = 0;
+                UTF::RetCode r = validate(input.data() + pos, input.size() - pos, &consumed, &length);
+                pos += consumed + (r != UTF::RetCode::OK ? unit : 0);
+            }
+        }});
+    }
+}
+
+/* Same as add_conv with iconv, the descriptor is kept for the whole process */
+static void add_iconv(std::vector<Benchmark> &benchmarks, const std::vector<Corpus> &corpora, const char *name, Encoding from, Encoding to,
+        const char *from_charset, const char *to_charset) {
+    iconv_t cd = iconv_open(to_charset, from_charset);
+    if (cd == (iconv_t) -1) {
+        return;
+    }
+    for (const Corpus &corpus : corpora) {
+        if (corpus.data[from].empty() || corpus.data[to].empty()) {
+            continue;
+        }
+        const std::string &input = corpus.data[from];
+        size_t unit = unit_size[from];
+        benchmarks.push_back({std::string(name) + "/" + corpus.name, &corpus, input.size(), corpus.unicode.size(), [&input, unit, cd]() {
+            // large enough for any conversion, iconv never stops on E2BIG
+            if (conv_buffer_size < input.size() * 4 + 16) {
+                conv_buffer_size = input.size() * 4 + 16;
+                conv_buffer = (char *) realloc(conv_buffer, conv_buffer_size);
+            }
+            char *in = (char *) input.data();
+            size_t in_left = input.size();
+            char *out = conv_buffer;
+            size_t out_left = conv_buffer_size;
+            iconv(cd, NULL, NULL, NULL, NULL);
+            while (in_left != 0) {
+                if (iconv(cd, &in, &in_left, &out, &out_left) == (size_t) -1) {
+                    size_t skip = in_left < unit ? in_left : unit;
+                    in += skip;
+                    in_left -= skip;
+                }
+            }
+        }});
+    }
+}
+
+#define ADD_CONV(NAME, FROM, TO) add_conv(benchmarks, corpora, #NAME, FROM, TO, static_cast<ConvFunc>(UTF::NAME))
+#define ADD_DECODE(NAME, FROM) add_decode(benchmarks, corpora, #NAME, FROM, static_cast<DecodeFunc>(UTF::NAME))
+#define ADD_ENCODE(NAME, TO) add_encode(benchmarks, corpora, #NAME, TO, static_cast<EncodeFunc>(UTF::NAME))
+#define ADD_VALIDATE(NAME, FROM) add_validate(benchmarks, corpora, #NAME, FROM, static_cast<ValidateFunc>(UTF::NAME))
+
+static void usage(FILE *out) {
+    fprintf(out,
+            "usage: bench_utf_conv [--filter SUBSTRING] [--repetitions N] [--min-time MS] [--size BYTES] [--csv]\n"
+            "  --filter : only run the benchmarks whose name contains SUBSTRING (e.g. \"conv_utf8\", \"/cjk\")\n"
+            "  --repetitions : number of measures of each benchmark (default 10)\n"
+            "  --min-time : minimum duration of a measure in milliseconds (default 10)\n"
+            "  --size : size of the UTF-8 version of the corpora (default 1000000)\n"
+            "  --csv : CSV output\n");
+}
+
+int main(int argc, char **argv) {
+    std::string filter;
+    int repetitions = 10;
+    double min_time = 0.010;
+    size_t size = 1000000;
+    bool csv = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]) / 1e3;
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else {
+            usage(strcmp(argv[i], "--help") == 0 ? stdout : stderr);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+    if (repetitions < 1) {
+        repetitions = 1;
+    }
+
+    std::mt19937 gen(42);
+    std::vector<Corpus> corpora;
+    corpora.reserve(7);
+    corpora.push_back(make_corpus("ascii", {{0x20, 0x7E, 95}, {0x0A, 0x0A, 5}}, size, gen));
+    corpora.push_back(make_corpus("latin1", {{0x20, 0x7E, 70}, {0xC0, 0xFF, 30}}, size, gen));
+    corpora.push_back(make_corpus("cjk", {{0x4E00, 0x9FFF, 90}, {0x20, 0x2F, 10}}, size, gen));
+    corpora.push_back(make_corpus("emoji", {{0x1F300, 0x1FAFF, 80}, {0x20, 0x20, 20}}, size, gen));
+    corpora.push_back(make_corpus("supplementary", {{0x1F300, 0x1FAFF, 50}, {0x20000, 0x2A6DF, 50}}, size, gen));
+    corpora.push_back(make_corpus("mixed", {{0x20, 0x7E, 50}, {0xC0, 0xFF, 10}, {0x391, 0x3C9, 5}, {0x410, 0x44F, 5},
+            {0x4E00, 0x9FFF, 20}, {0x1F300, 0x1FAFF, 10}}, size, gen));
+    corpora.push_back(make_invalid_corpus(corpora.back(), gen));
+
+    std::vector<Benchmark> benchmarks;
+    ADD_CONV(conv_utf8_to_utf16le, UTF8, UTF16LE);
+    ADD_CONV(conv_utf8_to_utf16be, UTF8, UTF16BE);
+    ADD_CONV(conv_utf8_to_utf32le, UTF8, UTF32LE);
+    ADD_CONV(conv_utf8_to_utf32be, UTF8, UTF32BE);
+    ADD_CONV(conv_utf16le_to_utf8, UTF16LE, UTF8);
+    ADD_CONV(conv_utf16le_to_utf16be, UTF16LE, UTF16BE);
+    ADD_CONV(conv_utf16le_to_utf32le, UTF16LE, UTF32LE);
+    ADD_CONV(conv_utf16le_to_utf32be, UTF16LE, UTF32BE);
+    ADD_CONV(conv_utf16be_to_utf8, UTF16BE, UTF8);
+    ADD_CONV(conv_utf16be_to_utf16le, UTF16BE, UTF16LE);
+    ADD_CONV(conv_utf16be_to_utf32le, UTF16BE, UTF32LE);
+    ADD_CONV(conv_utf16be_to_utf32be, UTF16BE, UTF32BE);
+    ADD_CONV(conv_utf32le_to_utf8, UTF32LE, UTF8);
+    ADD_CONV(conv_utf32le_to_utf16le, UTF32LE, UTF16LE);
+    ADD_CONV(conv_utf32le_to_utf16be, UTF32LE, UTF16BE);
+    ADD_CONV(conv_utf32le_to_utf32be, UTF32LE, UTF32BE);
+    ADD_CONV(conv_utf32be_to_utf8, UTF32BE, UTF8);
+    ADD_CONV(conv_utf32be_to_utf16le, UTF32BE, UTF16LE);
+    ADD_CONV(conv_utf32be_to_utf16be, UTF32BE, UTF16BE);
+    ADD_CONV(conv_utf32be_to_utf32le, UTF32BE, UTF32LE);
+    ADD_CONV(conv_latin1_to_utf8, LATIN1, UTF8);
+    ADD_CONV(conv_latin1_to_utf16le, LATIN1, UTF16LE);
+    ADD_CONV(conv_latin1_to_utf16be, LATIN1, UTF16BE);
+    ADD_CONV(conv_latin1_to_utf32le, LATIN1, UTF32LE);
+    ADD_CONV(conv_latin1_to_utf32be, LATIN1, UTF32BE);
+    ADD_CONV(conv_utf8_to_latin1, UTF8, LATIN1);
+    ADD_CONV(conv_utf16le_to_latin1, UTF16LE, LATIN1);
+    ADD_CONV(conv_utf16be_to_latin1, UTF16BE, LATIN1);
+    ADD_CONV(conv_utf32le_to_latin1, UTF32LE, LATIN1);
+    ADD_CONV(conv_utf32be_to_latin1, UTF32BE, LATIN1);
+    ADD_CONV(conv_windows1252_to_utf8, WINDOWS1252, UTF8);
+    ADD_CONV(conv_windows1252_to_utf16le, WINDOWS1252, UTF16LE);
+    ADD_CONV(conv_utf8_to_windows1252, UTF8, WINDOWS1252);
+    ADD_CONV(conv_utf16le_to_windows1252, UTF16LE, WINDOWS1252);
+    ADD_CONV(conv_gb18030_to_utf8, GB18030, UTF8);
+    ADD_CONV(conv_gb18030_to_utf16le, GB18030, UTF16LE);
+    ADD_CONV(conv_utf8_to_gb18030, UTF8, GB18030);
+    ADD_CONV(conv_utf16le_to_gb18030, UTF16LE, GB18030);
+    add_iconv(benchmarks, corpora, "iconv_gb18030_to_utf8", GB18030, UTF8, "GB18030", "UTF-8");
+    add_iconv(benchmarks, corpora, "iconv_utf8_to_gb18030", UTF8, GB18030, "UTF-8", "GB18030");
+    ADD_DECODE(decode_utf8, UTF8);
+    ADD_DECODE(decode_utf16le, UTF16LE);
+    ADD_DECODE(decode_utf16be, UTF16BE);
+    ADD_DECODE(decode_utf32le, UTF32LE);
+    ADD_DECODE(decode_utf32be, UTF32BE);
+    ADD_DECODE(decode_latin1, LATIN1);
+    ADD_DECODE(decode_windows1252, WINDOWS1252);
+    ADD_DECODE(decode_gb18030, GB18030);
+    ADD_ENCODE(encode_utf8, UTF8);
+    ADD_ENCODE(encode_utf16le, UTF16LE);
+    ADD_ENCODE(encode_utf16be, UTF16BE);
+    ADD_ENCODE(encode_utf32le, UTF32LE);
+    ADD_ENCODE(encode_utf32be, UTF32BE);
+    ADD_ENCODE(encode_latin1, LATIN1);
+    ADD_ENCODE(encode_windows1252, WINDOWS1252);
+    ADD_ENCODE(encode_gb18030, GB18030);
+    ADD_VALIDATE(validate_utf8, UTF8);
+    ADD_VALIDATE(validate_utf16le, UTF16LE);
+    ADD_VALIDATE(validate_utf16be, UTF16BE);
+    ADD_VALIDATE(validate_utf32le, UTF32LE);
+    ADD_VALIDATE(validate_utf32be, UTF32BE);
+
+    static const char *isa_names[] = {"scalar", "swar", "sse42", "avx2", "avx512"};
+    if (csv) {
+        printf("benchmark,isa,input_bytes,codepoints,mean_ns,cv_percent,gb_per_s,mcp_per_s\n");
+    } else {
+        printf("instruction set : %s, corpus size : %zu bytes (UTF-8), %d repetitions\n",
+                isa_names[UTF::get_isa_level()], size, repetitions);
+        printf("%-40s %14s %8s %10s %12s\n", "Benchmark", "Time", "CV", "GB/s", "Mcp/s");
+    }
+
+    for (const Benchmark &benchmark : benchmarks) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        // warmup : caches, output buffers allocation
+        benchmark.run();
+
+        std::vector<double> times;
+        for (int rep = 0; rep < repetitions; rep++) {
+            size_t iterations = 0;
+            auto start = std::chrono::steady_clock::now();
+            double elapsed;
+            do {
+                benchmark.run();
+                iterations++;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (elapsed < min_time);
+            times.push_back(elapsed / iterations);
+        }
+
+        double mean = 0, variance = 0;
+        for (double t : times) {
+            mean += t;
+        }
+        mean /= times.size();
+        for (double t : times) {
+            variance += (t - mean) * (t - mean);
+        }
+        variance /= times.size();
+        double cv = mean > 0 ? 100 * sqrt(variance) / mean : 0;
+        double gb_per_s = benchmark.input_bytes / mean / 1e9;
+        double mcp_per_s = benchmark.codepoints / mean / 1e6;
+
+        if (csv) {
+            printf("%s,%s,%zu,%zu,%.0f,%.2f,%.3f,%.1f\n", benchmark.name.c_str(), isa_names[UTF::get_isa_level()],
+                    benchmark.input_bytes, benchmark.codepoints, mean * 1e9, cv, gb_per_s, mcp_per_s);
+        } else {
+            printf("%-40s %11.1f us %7.1f%% %10.3f %12.1f\n", benchmark.name.c_str(), mean * 1e6, cv, gb_per_s, mcp_per_s);
+        }
+        fflush(stdout);
+    }
+
+    free(conv_buffer);
+    free(decode_buffer);
+    return 0;
+}
@@ -22,11 +22,17 @@
 
 #include "charset_conv_iconv.h"
 #include "utf_conv.h"
+#include "utf_conv_stream.h"
+#include "utf_conv_parallel.h"
+#include "utf_conv_iterator.h"
+#include "utf_conv_index.h"
 
 #include <vector>
+#include <deque>
 #include <iterator>
 #include <fstream>
 #include <chrono>
+#include <random>
 
 /*
  * Test a conversion/encoder/decoder function with a src and an expected result
@@ -116,6 +122,64 @@ static bool do_test_decode_one(const char *test_name, const char *func_name,
     return true;
 }
 
+/*
+ * Test a conversion/encoder/decoder function with a src and an expected result
+ * This is the version for the fixed output buffer functions
+ * The conversion is resumed with output buffers of several capacities, and must stop on the character boundaries
+ */
+template <typename src_type, typename dst_type>
+static bool do_test_fixed(const char *test_name, const char *func_name,
+        UTF::RetCode (*conv)(const src_type *, size_t, dst_type *, size_t, size_t *, size_t *),
+        const src_type *src, size_t src_len, const dst_type *ref, size_t ref_len) {
+    static const size_t capacities[] = {0, 1, 3, 4, 7, 64, 1000};
+    for (size_t capacity : capacities) {
+        std::vector<dst_type> test_conv;
+        size_t total_consumed = 0;
+        UTF::RetCode r = UTF::RetCode::OK;
+        do {
+            // exact size allocation to catch the overflows with the sanitizers
+            dst_type *buffer = (dst_type *) malloc(capacity * sizeof(dst_type) + 1);
+            size_t consumed = 0, written = 0;
+            r = conv(src + total_consumed, src_len - total_consumed, buffer, capacity, &consumed, &written);
+            test_conv.insert(test_conv.end(), buffer, buffer + written);
+            free(buffer);
+            total_consumed += consumed;
+            if (r == UTF::RetCode::E_OUTPUT_FULL && written == 0) {
+                // the next character is larger than the buffer
+                break;
+            }
+        } while (r == UTF::RetCode::E_OUTPUT_FULL);
+        bool ok = test_conv.size() <= ref_len && std::equal(test_conv.begin(), test_conv.end(), ref);
+        if (r == UTF::RetCode::OK) {
+            ok = ok && total_consumed == src_len && test_conv.size() == ref_len;
+        } else {
+            ok = ok && r == UTF::RetCode::E_OUTPUT_FULL && capacity < 4 && total_consumed < src_len;
+        }
+        if (!ok) {
+            printf("[%s fixed %zu] %s : KO (%d) (%zu %zu | %zu %zu)\n", test_name, capacity, func_name, (int) r, test_conv.size(), ref_len, total_consumed, src_len);
+            assert(ok);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Test an output size function with a src and the size of the expected result
+ */
+template <typename src_type>
+static bool do_test_length(const char *test_name, const char *func_name,
+        size_t (*length)(const src_type *, size_t), const src_type *src, size_t src_len, size_t ref_len) {
+    size_t len = length(src, src_len);
+    if (len == ref_len) {
+        return true;
+    } else {
+        printf("[%s length] %s : KO (%zu %zu)\n", test_name, func_name, len, ref_len);
+        assert(len == ref_len);
+        return false;
+    }
+}
+
 /*
  * Run all conversions tests (valid tests)
  * str_utf8 is the source
@@ -218,12 +282,82 @@ static void do_tests(const char *test_name, const char *str_utf8) {
     do_test_buffer(test_name, "UTF-32BE -> UNICODE", UTF::decode_utf32be, str_utf32be.data(), str_utf32be_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
     do_test_buffer(test_name, "UNICODE -> UTF-32BE", UTF::encode_utf32be, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf32be.data(), str_utf32be_len);
     
+    do_test_fixed(test_name, "UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, str_utf8, str_utf8_len, str_utf16le.data(), str_utf16le_len);
+    do_test_fixed(test_name, "UTF-8 -> UTF-16BE", UTF::conv_utf8_to_utf16be, str_utf8, str_utf8_len, str_utf16be.data(), str_utf16be_len);
+    do_test_fixed(test_name, "UTF-8 -> UTF-32LE", UTF::conv_utf8_to_utf32le, str_utf8, str_utf8_len, str_utf32le.data(), str_utf32le_len);
+    do_test_fixed(test_name, "UTF-8 -> UTF-32BE", UTF::conv_utf8_to_utf32be, str_utf8, str_utf8_len, str_utf32be.data(), str_utf32be_len);
+    do_test_fixed(test_name, "UTF-8 -> UNICODE", UTF::decode_utf8, str_utf8, str_utf8_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
+    do_test_fixed(test_name, "UNICODE -> UTF-8", UTF::encode_utf8, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf8, str_utf8_len);
+    do_test_fixed(test_name, "UTF-16LE -> UTF-8", UTF::conv_utf16le_to_utf8, str_utf16le.data(), str_utf16le_len, str_utf8, str_utf8_len);
+    do_test_fixed(test_name, "UTF-16LE -> UTF-16BE", UTF::conv_utf16le_to_utf16be, str_utf16le.data(), str_utf16le_len, str_utf16be.data(), str_utf16be_len);
+    do_test_fixed(test_name, "UTF-16LE -> UTF-32LE", UTF::conv_utf16le_to_utf32le, str_utf16le.data(), str_utf16le_len, str_utf32le.data(), str_utf32le_len);
+    do_test_fixed(test_name, "UTF-16LE -> UTF-32BE", UTF::conv_utf16le_to_utf32be, str_utf16le.data(), str_utf16le_len, str_utf32be.data(), str_utf32be_len);
+    do_test_fixed(test_name, "UTF-16LE -> UNICODE", UTF::decode_utf16le, str_utf16le.data(), str_utf16le_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
+    do_test_fixed(test_name, "UNICODE -> UTF-16LE", UTF::encode_utf16le, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf16le.data(), str_utf16le_len);
+    do_test_fixed(test_name, "UTF-16BE -> UTF-8", UTF::conv_utf16be_to_utf8, str_utf16be.data(), str_utf16be_len, str_utf8, str_utf8_len);
+    do_test_fixed(test_name, "UTF-16BE -> UTF-16LE", UTF::conv_utf16be_to_utf16le, str_utf16be.data(), str_utf16be_len, str_utf16le.data(), str_utf16le_len);
+    do_test_fixed(test_name, "UTF-16BE -> UTF-32LE", UTF::conv_utf16be_to_utf32le, str_utf16be.data(), str_utf16be_len, str_utf32le.data(), str_utf32le_len);
+    do_test_fixed(test_name, "UTF-16BE -> UTF-32BE", UTF::conv_utf16be_to_utf32be, str_utf16be.data(), str_utf16be_len, str_utf32be.data(), str_utf32be_len);
+    do_test_fixed(test_name, "UTF-16BE -> UNICODE", UTF::decode_utf16be, str_utf16be.data(), str_utf16be_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
+    do_test_fixed(test_name, "UNICODE -> UTF-16BE", UTF::encode_utf16be, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf16be.data(), str_utf16be_len);
+    do_test_fixed(test_name, "UTF-32LE -> UTF-8", UTF::conv_utf32le_to_utf8, str_utf32le.data(), str_utf32le_len, str_utf8, str_utf8_len);
+    do_test_fixed(test_name, "UTF-32LE -> UTF-16LE", UTF::conv_utf32le_to_utf16le, str_utf32le.data(), str_utf32le_len, str_utf16le.data(), str_utf16le_len);
+    do_test_fixed(test_name, "UTF-32LE -> UTF-16BE", UTF::conv_utf32le_to_utf16be, str_utf32le.data(), str_utf32le_len, str_utf16be.data(), str_utf16be_len);
+    do_test_fixed(test_name, "UTF-32LE -> UTF-32BE", UTF::conv_utf32le_to_utf32be, str_utf32le.data(), str_utf32le_len, str_utf32be.data(), str_utf32be_len);
+    do_test_fixed(test_name, "UTF-32LE -> UNICODE", UTF::decode_utf32le, str_utf32le.data(), str_utf32le_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
+    do_test_fixed(test_name, "UNICODE -> UTF-32LE", UTF::encode_utf32le, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf32le.data(), str_utf32le_len);
+    do_test_fixed(test_name, "UTF-32BE -> UTF-8", UTF::conv_utf32be_to_utf8, str_utf32be.data(), str_utf32be_len, str_utf8, str_utf8_len);
+    do_test_fixed(test_name, "UTF-32BE -> UTF-16LE", UTF::conv_utf32be_to_utf16le, str_utf32be.data(), str_utf32be_len, str_utf16le.data(), str_utf16le_len);
+    do_test_fixed(test_name, "UTF-32BE -> UTF-16BE", UTF::conv_utf32be_to_utf16be, str_utf32be.data(), str_utf32be_len, str_utf16be.data(), str_utf16be_len);
+    do_test_fixed(test_name, "UTF-32BE -> UTF-32LE", UTF::conv_utf32be_to_utf32le, str_utf32be.data(), str_utf32be_len, str_utf32le.data(), str_utf32le_len);
+    do_test_fixed(test_name, "UTF-32BE -> UNICODE", UTF::decode_utf32be, str_utf32be.data(), str_utf32be_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
+    do_test_fixed(test_name, "UNICODE -> UTF-32BE", UTF::encode_utf32be, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf32be.data(), str_utf32be_len);
+
     do_test_decode_one(test_name, "UTF-8 -> UNICODE", UTF::decode_one_utf8, str_utf8, str_utf8_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
     do_test_decode_one(test_name, "UTF-16LE -> UNICODE", UTF::decode_one_utf16le, str_utf16le.data(), str_utf16le_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
     do_test_decode_one(test_name, "UTF-16BE -> UNICODE", UTF::decode_one_utf16be, str_utf16be.data(), str_utf16be_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
     do_test_decode_one(test_name, "UTF-32LE -> UNICODE", UTF::decode_one_utf32le, str_utf32le.data(), str_utf32le_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
     do_test_decode_one(test_name, "UTF-32BE -> UNICODE", UTF::decode_one_utf32be, str_utf32be.data(), str_utf32be_len, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4);
-    
+
+    do_test_length(test_name, "UTF-8 -> UTF-16", UTF::utf16_length_from_utf8, str_utf8, str_utf8_len, str_utf16le_len);
+    do_test_length(test_name, "UTF-8 -> UTF-32", UTF::utf32_length_from_utf8, str_utf8, str_utf8_len, str_utf32le_len);
+    do_test_length(test_name, "UTF-8 -> UNICODE", UTF::unicode_length_from_utf8, str_utf8, str_utf8_len, unicode_ref_len / 4);
+    do_test_length(test_name, "UTF-16LE -> UTF-8", UTF::utf8_length_from_utf16le, str_utf16le.data(), str_utf16le_len, str_utf8_len);
+    do_test_length(test_name, "UTF-16LE -> UTF-32", UTF::utf32_length_from_utf16le, str_utf16le.data(), str_utf16le_len, str_utf32le_len);
+    do_test_length(test_name, "UTF-16LE -> UNICODE", UTF::unicode_length_from_utf16le, str_utf16le.data(), str_utf16le_len, unicode_ref_len / 4);
+    do_test_length(test_name, "UTF-16BE -> UTF-8", UTF::utf8_length_from_utf16be, str_utf16be.data(), str_utf16be_len, str_utf8_len);
+    do_test_length(test_name, "UTF-16BE -> UTF-32", UTF::utf32_length_from_utf16be, str_utf16be.data(), str_utf16be_len, str_utf32be_len);
+    do_test_length(test_name, "UTF-16BE -> UNICODE", UTF::unicode_length_from_utf16be, str_utf16be.data(), str_utf16be_len, unicode_ref_len / 4);
+    do_test_length(test_name, "UTF-32LE -> UTF-8", UTF::utf8_length_from_utf32le, str_utf32le.data(), str_utf32le_len, str_utf8_len);
+    do_test_length(test_name, "UTF-32LE -> UTF-16", UTF::utf16_length_from_utf32le, str_utf32le.data(), str_utf32le_len, str_utf16le_len);
+    do_test_length(test_name, "UTF-32LE -> UNICODE", UTF::unicode_length_from_utf32le, str_utf32le.data(), str_utf32le_len, unicode_ref_len / 4);
+    do_test_length(test_name, "UTF-32BE -> UTF-8", UTF::utf8_length_from_utf32be, str_utf32be.data(), str_utf32be_len, str_utf8_len);
+    do_test_length(test_name, "UTF-32BE -> UTF-16", UTF::utf16_length_from_utf32be, str_utf32be.data(), str_utf32be_len, str_utf16be_len);
+    do_test_length(test_name, "UTF-32BE -> UNICODE", UTF::unicode_length_from_utf32be, str_utf32be.data(), str_utf32be_len, unicode_ref_len / 4);
+    do_test_length(test_name, "UNICODE -> UTF-8", UTF::utf8_length_from_unicode, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf8_len);
+    do_test_length(test_name, "UNICODE -> UTF-16", UTF::utf16_length_from_unicode, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf16le_len);
+    do_test_length(test_name, "UNICODE -> UTF-32", UTF::utf32_length_from_unicode, (uint32_t *) unicode_ref.data(), unicode_ref_len / 4, str_utf32le_len);
+
+    // the getline-style functions allocate their output once : from the largest output size when it is close to the input size,
+    // from the precomputed size with Growth::EXACT, and nothing for an empty input
+    char *test_conv = NULL;
+    size_t test_conv_size = 0;
+    UTF::RetCode r = UTF::conv_utf8_to_utf16le(str_utf8, str_utf8_len, &test_conv, &test_conv_size, &consumed, NULL);
+    assert(r == UTF::RetCode::OK && test_conv_size == (str_utf8_len == 0 ? 0 : str_utf8_len * 2 + 4));
+    free(test_conv);
+    test_conv = NULL;
+    test_conv_size = 0;
+    r = UTF::conv_utf16be_to_utf8(str_utf16be.data(), str_utf16be_len, &test_conv, &test_conv_size, &consumed, NULL);
+    assert(r == UTF::RetCode::OK && test_conv_size == (str_utf8_len == 0 ? 0 : size_t(str_utf16be_len) / 2 * 3 + 4));
+    free(test_conv);
+    test_conv = NULL;
+    test_conv_size = 0;
+    // UTF-8 -> UTF-32 : up to 4 times the input size, counted first
+    r = UTF::conv_utf8_to_utf32le(str_utf8, str_utf8_len, &test_conv, &test_conv_size, &consumed, NULL,
+            UTF::MallocAllocator(), UTF::Growth::EXACT);
+    size_t expected_size = str_utf8_len * 4 <= str_utf8_len * 2 + 16 ? str_utf8_len * 4 : size_t(str_utf32le_len);
+    assert(r == UTF::RetCode::OK && test_conv_size == (str_utf8_len == 0 ? 0 : expected_size + 4));
+    free(test_conv);
 }
 
 /*
@@ -311,6 +445,30 @@ static void benchmark_utf8_utf16le(const char *str_utf8, int n_runs=100) {
         auto end = std::chrono::high_resolution_clock::now();
         printf("bench conv_utf8_to_utf16le (back_inserter) : %" PRIu64 " ns\n", std::chrono::nanoseconds(end - start).count() / (uint64_t) n_runs);
     }
+    {
+        std::vector<char> output;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_runs; i++) {
+            size_t consumed = 0, written = 0;
+            output.clear();
+            UTF::RetCode r = UTF::conv_utf8_to_utf16le(str_utf8, str_utf8_len, std::back_inserter(output), &consumed, &written);
+            assert(r == UTF::RetCode::OK && consumed == str_utf8_len);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("bench conv_utf8_to_utf16le (vector back_inserter) : %" PRIu64 " ns\n", std::chrono::nanoseconds(end - start).count() / (uint64_t) n_runs);
+    }
+    {
+        std::u16string output;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_runs; i++) {
+            size_t consumed = 0, written = 0;
+            output.clear();
+            UTF::RetCode r = UTF::conv_utf8_to_utf16le(str_utf8, str_utf8_len, output, &consumed, &written);
+            assert(r == UTF::RetCode::OK && consumed == str_utf8_len);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("bench conv_utf8_to_utf16le (u16string) : %" PRIu64 " ns\n", std::chrono::nanoseconds(end - start).count() / (uint64_t) n_runs);
+    }
 
     free(test_conv);
 }
@@ -361,10 +519,306 @@ static void benchmark_utf16le_utf8(const char *str_utf8, int n_runs=100) {
         auto end = std::chrono::high_resolution_clock::now();
         printf("bench conv_utf16le_to_utf8 (back_inserter) : %" PRIu64 " ns\n", std::chrono::nanoseconds(end - start).count() / (uint64_t) n_runs);
     }
+    {
+        std::vector<char> output;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_runs; i++) {
+            size_t consumed = 0, written = 0;
+            output.clear();
+            UTF::RetCode r = UTF::conv_utf16le_to_utf8(str_utf16le.data(), str_utf16le_len, std::back_inserter(output), &consumed, &written);
+            assert(r == UTF::RetCode::OK && (ssize_t) consumed == str_utf16le_len);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("bench conv_utf16le_to_utf8 (vector back_inserter) : %" PRIu64 " ns\n", std::chrono::nanoseconds(end - start).count() / (uint64_t) n_runs);
+    }
 
     free(test_conv);
 }
 
+/*
+ * Run the conversion tests on ASCII runs of various lengths surrounded by non-ASCII characters
+ * to exercise the block boundaries of the vectorized kernels
+ */
+static void test_ascii_runs() {
+    for (size_t n = 0; n < 80; n++) {
+        std::string input_data("é");
+        for (size_t i = 0; i < n; i++) {
+            input_data.push_back('a' + (i % 26));
+        }
+        input_data += "€";
+        input_data.append(input_data.rbegin() + 3, input_data.rend() - 2);
+        input_data += "\xF0\x9F\x98\xBA";
+        do_tests("ascii_runs", input_data.c_str());
+        do_tests("ascii_runs", input_data.c_str() + 2);
+
+        // the vectorized kernels must stop on the invalid byte
+        std::string invalid_data(n, 'a');
+        invalid_data += "\xFF";
+        invalid_data.append(40, 'b');
+        char *test_conv = NULL;
+        size_t test_conv_size = 0;
+        size_t consumed = 0, written = 0;
+        UTF::RetCode r = UTF::conv_utf8_to_utf16le(invalid_data.data(), invalid_data.size(), &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::E_INVALID && consumed == n && written == 2 * n);
+        r = UTF::conv_utf8_to_utf32be(invalid_data.data(), invalid_data.size(), &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::E_INVALID && consumed == n && written == 4 * n);
+        std::vector<char> test_conv_vector;
+        r = UTF::conv_utf8_to_utf16be(invalid_data.data(), invalid_data.size(), std::back_inserter(test_conv_vector), &consumed, &written);
+        assert(r == UTF::RetCode::E_INVALID && consumed == n && written == 2 * n && test_conv_vector.size() == 2 * n);
+        free(test_conv);
+    }
+}
+
+/*
+ * Compare validate_utf8 with a reference built on decode_one_utf8 (no vectorized kernel)
+ * on random streams of valid characters with random corruptions
+ */
+static void test_utf8_validate_random() {
+    static const char *samples[] = {"a", "z", "\n", "é", "ß", "€", "✏", "中", "\xF0\x9F\x98\xBA", "\xF4\x8F\xBF\xBF"};
+    std::mt19937 gen(42);
+    for (int n = 0; n < 5000; n++) {
+        std::string input_data;
+        size_t n_chars = gen() % 200;
+        for (size_t i = 0; i < n_chars; i++) {
+            // mostly ASCII, to exercise the ASCII blocks too
+            input_data += samples[gen() % 4 == 0 ? gen() % 10 : gen() % 3];
+        }
+        if (!input_data.empty() && n % 2 == 1) {
+            size_t n_errors = 1 + gen() % 3;
+            for (size_t i = 0; i < n_errors; i++) {
+                input_data[gen() % input_data.size()] = char(gen() % 256);
+            }
+        }
+        if (!input_data.empty() && n % 5 == 0) {
+            input_data.resize(gen() % input_data.size());
+        }
+
+        UTF::RetCode ref_r = UTF::RetCode::OK;
+        size_t ref_consumed = 0, ref_length = 0;
+        while (ref_consumed < input_data.size()) {
+            uint32_t cp;
+            size_t c = 0;
+            ref_r = UTF::decode_one_utf8(input_data.data() + ref_consumed, input_data.size() - ref_consumed, &cp, &c);
+            if (ref_r != UTF::RetCode::OK) {
+                break;
+            }
+            ref_consumed += c;
+            ref_length++;
+        }
+
+        size_t consumed = 0, length = 0;
+        UTF::RetCode r = UTF::validate_utf8(input_data.data(), input_data.size(), &consumed, &length);
+        if (r != ref_r || consumed != ref_consumed || length != ref_length) {
+            printf("[random validate] UTF-8 : KO (%d %d) (%zu %zu | %zu %zu)\n", (int) r, (int) ref_r, consumed, ref_consumed, length, ref_length);
+            assert(r == ref_r);
+            assert(consumed == ref_consumed);
+            assert(length == ref_length);
+        }
+    }
+}
+
+/*
+ * Compare the conversions of the active instruction set with the scalar ones (no vectorized kernel)
+ * on random streams of valid characters with random corruptions, in the getline-style and fixed buffer versions
+ */
+typedef UTF::RetCode (*ConvFunction)(const char *, size_t, char **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*FixedConvFunction)(const char *, size_t, char *, size_t, size_t *, size_t *);
+
+static void do_test_conv_random(const char *func_name, ConvFunction conv, FixedConvFunction fixed_conv,
+        const std::string &input_data, size_t output_len) {
+    UTF::IsaLevel level = UTF::get_isa_level();
+    std::vector<char> ref_fixed(output_len + 1), test_fixed(output_len + 1);
+    char *ref = NULL, *test = NULL;
+    size_t ref_size = 0, test_size = 0;
+    size_t ref_consumed = 0, ref_written = 0, consumed = 0, written = 0;
+    size_t ref_fixed_consumed = 0, ref_fixed_written = 0, fixed_consumed = 0, fixed_written = 0;
+
+    UTF::set_isa_level(UTF::IsaLevel::ISA_SCALAR);
+    UTF::RetCode ref_r = conv(input_data.data(), input_data.size(), &ref, &ref_size, &ref_consumed, &ref_written);
+    UTF::RetCode ref_fixed_r = fixed_conv(input_data.data(), input_data.size(), ref_fixed.data(), output_len, &ref_fixed_consumed, &ref_fixed_written);
+    UTF::set_isa_level(level);
+    UTF::RetCode r = conv(input_data.data(), input_data.size(), &test, &test_size, &consumed, &written);
+    UTF::RetCode fixed_r = fixed_conv(input_data.data(), input_data.size(), test_fixed.data(), output_len, &fixed_consumed, &fixed_written);
+
+    if (r != ref_r || consumed != ref_consumed || written != ref_written || (written != 0 && memcmp(ref, test, written) != 0)
+            || fixed_r != ref_fixed_r || fixed_consumed != ref_fixed_consumed || fixed_written != ref_fixed_written
+            || memcmp(ref_fixed.data(), test_fixed.data(), fixed_written) != 0) {
+        printf("[random conv] %s : KO (%d %d) (%zu %zu | %zu %zu) fixed (%d %d) (%zu %zu | %zu %zu)\n", func_name,
+                (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written,
+                (int) fixed_r, (int) ref_fixed_r, fixed_consumed, ref_fixed_consumed, fixed_written, ref_fixed_written);
+        assert(r == ref_r && consumed == ref_consumed && written == ref_written);
+        assert(written == 0 || memcmp(ref, test, written) == 0);
+        assert(fixed_r == ref_fixed_r && fixed_consumed == ref_fixed_consumed && fixed_written == ref_fixed_written);
+        assert(memcmp(ref_fixed.data(), test_fixed.data(), fixed_written) == 0);
+    }
+    free(ref);
+    free(test);
+}
+
+/* Same as do_test_conv_random for the decoding and validation functions */
+typedef UTF::RetCode (*DecodeFunction)(const char *, size_t, uint32_t **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*FixedDecodeFunction)(const char *, size_t, uint32_t *, size_t, size_t *, size_t *);
+typedef UTF::RetCode (*ValidateFunction)(const char *, size_t, size_t *, size_t *);
+
+static void do_test_decode_random(const char *func_name, DecodeFunction decode, FixedDecodeFunction fixed_decode, ValidateFunction validate,
+        const std::string &input_data, size_t output_len) {
+    UTF::IsaLevel level = UTF::get_isa_level();
+    std::vector<uint32_t> ref_fixed(output_len + 1), test_fixed(output_len + 1);
+    uint32_t *ref = NULL, *test = NULL;
+    size_t ref_size = 0, test_size = 0;
+    size_t ref_consumed = 0, ref_written = 0, consumed = 0, written = 0;
+    size_t ref_fixed_consumed = 0, ref_fixed_written = 0, fixed_consumed = 0, fixed_written = 0;
+    size_t ref_valid = 0, ref_length = 0, valid = 0, length = 0;
+
+    UTF::set_isa_level(UTF::IsaLevel::ISA_SCALAR);
+    UTF::RetCode ref_r = decode(input_data.data(), input_data.size(), &ref, &ref_size, &ref_consumed, &ref_written);
+    UTF::RetCode ref_fixed_r = fixed_decode(input_data.data(), input_data.size(), ref_fixed.data(), output_len, &ref_fixed_consumed, &ref_fixed_written);
+    UTF::RetCode ref_valid_r = validate(input_data.data(), input_data.size(), &ref_valid, &ref_length);
+    UTF::set_isa_level(level);
+    UTF::RetCode r = decode(input_data.data(), input_data.size(), &test, &test_size, &consumed, &written);
+    UTF::RetCode fixed_r = fixed_decode(input_data.data(), input_data.size(), test_fixed.data(), output_len, &fixed_consumed, &fixed_written);
+    UTF::RetCode valid_r = validate(input_data.data(), input_data.size(), &valid, &length);
+
+    if (r != ref_r || consumed != ref_consumed || written != ref_written || (written != 0 && memcmp(ref, test, written * 4) != 0)
+            || fixed_r != ref_fixed_r || fixed_consumed != ref_fixed_consumed || fixed_written != ref_fixed_written
+            || memcmp(ref_fixed.data(), test_fixed.data(), fixed_written * 4) != 0
+            || valid_r != ref_valid_r || valid != ref_valid || length != ref_length) {
+        printf("[random decode] %s : KO (%d %d) (%zu %zu | %zu %zu) fixed (%d %d) (%zu %zu | %zu %zu) validate (%d %d) (%zu %zu | %zu %zu)\n", func_name,
+                (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written,
+                (int) fixed_r, (int) ref_fixed_r, fixed_consumed, ref_fixed_consumed, fixed_written, ref_fixed_written,
+                (int) valid_r, (int) ref_valid_r, valid, ref_valid, length, ref_length);
+        assert(r == ref_r && consumed == ref_consumed && written == ref_written);
+        assert(written == 0 || memcmp(ref, test, written * 4) == 0);
+        assert(fixed_r == ref_fixed_r && fixed_consumed == ref_fixed_consumed && fixed_written == ref_fixed_written);
+        assert(memcmp(ref_fixed.data(), test_fixed.data(), fixed_written * 4) == 0);
+        assert(valid_r == ref_valid_r && valid == ref_valid && length == ref_length);
+    }
+    free(ref);
+    free(test);
+}
+
+/* Same as do_test_conv_random for the encoding functions */
+typedef UTF::RetCode (*EncodeFunction)(const uint32_t *, size_t, char **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*FixedEncodeFunction)(const uint32_t *, size_t, char *, size_t, size_t *, size_t *);
+
+static void do_test_encode_random(const char *func_name, EncodeFunction encode, FixedEncodeFunction fixed_encode,
+        const std::vector<uint32_t> &input_data, size_t output_len) {
+    UTF::IsaLevel level = UTF::get_isa_level();
+    std::vector<char> ref_fixed(output_len + 1), test_fixed(output_len + 1);
+    char *ref = NULL, *test = NULL;
+    size_t ref_size = 0, test_size = 0;
+    size_t ref_consumed = 0, ref_written = 0, consumed = 0, written = 0;
+    size_t ref_fixed_consumed = 0, ref_fixed_written = 0, fixed_consumed = 0, fixed_written = 0;
+
+    UTF::set_isa_level(UTF::IsaLevel::ISA_SCALAR);
+    UTF::RetCode ref_r = encode(input_data.data(), input_data.size(), &ref, &ref_size, &ref_consumed, &ref_written);
+    UTF::RetCode ref_fixed_r = fixed_encode(input_data.data(), input_data.size(), ref_fixed.data(), output_len, &ref_fixed_consumed, &ref_fixed_written);
+    UTF::set_isa_level(level);
+    UTF::RetCode r = encode(input_data.data(), input_data.size(), &test, &test_size, &consumed, &written);
+    UTF::RetCode fixed_r = fixed_encode(input_data.data(), input_data.size(), test_fixed.data(), output_len, &fixed_consumed, &fixed_written);
+
+    if (r != ref_r || consumed != ref_consumed || written != ref_written || (written != 0 && memcmp(ref, test, written) != 0)
+            || fixed_r != ref_fixed_r || fixed_consumed != ref_fixed_consumed || fixed_written != ref_fixed_written
+            || memcmp(ref_fixed.data(), test_fixed.data(), fixed_written) != 0) {
+        printf("[random encode] %s : KO (%d %d) (%zu %zu | %zu %zu) fixed (%d %d) (%zu %zu | %zu %zu)\n", func_name,
+                (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written,
+                (int) fixed_r, (int) ref_fixed_r, fixed_consumed, ref_fixed_consumed, fixed_written, ref_fixed_written);
+        assert(r == ref_r && consumed == ref_consumed && written == ref_written);
+        assert(written == 0 || memcmp(ref, test, written) == 0);
+        assert(fixed_r == ref_fixed_r && fixed_consumed == ref_fixed_consumed && fixed_written == ref_fixed_written);
+        assert(memcmp(ref_fixed.data(), test_fixed.data(), fixed_written) == 0);
+    }
+    free(ref);
+    free(test);
+}
+
+static void test_conv_random() {
+    static const char *samples[] = {"a", "z", "\n", "é", "ß", "€", "✏", "中", "\xF0\x9F\x98\xBA", "\xF4\x8F\xBF\xBF"};
+    std::mt19937 gen(42);
+    for (int n = 0; n < 2000; n++) {
+        std::string input_data;
+        size_t n_chars = gen() % 300;
+        // from mostly ASCII to mostly non-ASCII streams
+        size_t ascii_rate = gen() % 5;
+        for (size_t i = 0; i < n_chars; i++) {
+            input_data += samples[gen() % 4 < ascii_rate ? gen() % 3 : gen() % 8 + (gen() % 8 == 0 ? 2 : 0)];
+        }
+
+        std::string utf16le, utf16be, utf32le, utf32be;
+        UTF::conv_utf8_to_utf16le(input_data.data(), input_data.size(), std::back_inserter(utf16le), NULL, NULL);
+        UTF::conv_utf8_to_utf16be(input_data.data(), input_data.size(), std::back_inserter(utf16be), NULL, NULL);
+        UTF::conv_utf8_to_utf32le(input_data.data(), input_data.size(), std::back_inserter(utf32le), NULL, NULL);
+        UTF::conv_utf8_to_utf32be(input_data.data(), input_data.size(), std::back_inserter(utf32be), NULL, NULL);
+
+        if (!input_data.empty() && n % 2 == 1) {
+            size_t n_errors = 1 + gen() % 3;
+            for (size_t i = 0; i < n_errors; i++) {
+                input_data[gen() % input_data.size()] = char(gen() % 256);
+                // lone surrogates and random code units
+                uint16_t unit = gen() % 2 ? uint16_t(0xD800 + gen() % 0x800) : uint16_t(gen());
+                size_t pos = 2 * (gen() % (utf16le.size() / 2));
+                utf16le[pos] = char(unit & 0xFF);
+                utf16le[pos + 1] = char(unit >> 8);
+                utf16be[pos] = char(unit >> 8);
+                utf16be[pos + 1] = char(unit & 0xFF);
+                // surrogates, codepoints above 0x10FFFF and random values
+                uint32_t cp = gen() % 3 == 0 ? 0xD800 + gen() % 0x800 : (gen() % 2 ? 0x110000 + gen() % 0x1000 : uint32_t(gen()));
+                pos = 4 * (gen() % (utf32le.size() / 4));
+                for (int b = 0; b < 4; b++) {
+                    utf32le[pos + b] = char(cp >> (8 * b));
+                    utf32be[pos + 3 - b] = char(cp >> (8 * b));
+                }
+            }
+        }
+        if (!input_data.empty() && n % 5 == 0) {
+            input_data.resize(gen() % input_data.size());
+            utf16le.resize(gen() % utf16le.size());
+            utf16be.resize(gen() % utf16be.size());
+            utf32le.resize(gen() % utf32le.size());
+            utf32be.resize(gen() % utf32be.size());
+        }
+
+        size_t output_len = gen() % 1000;
+        do_test_conv_random("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le, input_data, output_len);
+        do_test_conv_random("UTF-8 -> UTF-16BE", UTF::conv_utf8_to_utf16be, UTF::conv_utf8_to_utf16be, input_data, output_len);
+        do_test_conv_random("UTF-8 -> UTF-32LE", UTF::conv_utf8_to_utf32le, UTF::conv_utf8_to_utf32le, input_data, output_len);
+        do_test_conv_random("UTF-8 -> UTF-32BE", UTF::conv_utf8_to_utf32be, UTF::conv_utf8_to_utf32be, input_data, output_len);
+        do_test_conv_random("UTF-16LE -> UTF-8", UTF::conv_utf16le_to_utf8, UTF::conv_utf16le_to_utf8, utf16le, output_len);
+        do_test_conv_random("UTF-16BE -> UTF-8", UTF::conv_utf16be_to_utf8, UTF::conv_utf16be_to_utf8, utf16be, output_len);
+        do_test_conv_random("UTF-16LE -> UTF-16BE", UTF::conv_utf16le_to_utf16be, UTF::conv_utf16le_to_utf16be, utf16le, output_len);
+        do_test_conv_random("UTF-16BE -> UTF-16LE", UTF::conv_utf16be_to_utf16le, UTF::conv_utf16be_to_utf16le, utf16be, output_len);
+        do_test_conv_random("UTF-32LE -> UTF-32BE", UTF::conv_utf32le_to_utf32be, UTF::conv_utf32le_to_utf32be, utf32le, output_len);
+        do_test_conv_random("UTF-32BE -> UTF-32LE", UTF::conv_utf32be_to_utf32le, UTF::conv_utf32be_to_utf32le, utf32be, output_len);
+        do_test_conv_random("UTF-32LE -> UTF-8", UTF::conv_utf32le_to_utf8, UTF::conv_utf32le_to_utf8, utf32le, output_len);
+        do_test_conv_random("UTF-32BE -> UTF-8", UTF::conv_utf32be_to_utf8, UTF::conv_utf32be_to_utf8, utf32be, output_len);
+        do_test_conv_random("UTF-32LE -> UTF-16LE", UTF::conv_utf32le_to_utf16le, UTF::conv_utf32le_to_utf16le, utf32le, output_len);
+        do_test_conv_random("UTF-32LE -> UTF-16BE", UTF::conv_utf32le_to_utf16be, UTF::conv_utf32le_to_utf16be, utf32le, output_len);
+        do_test_conv_random("UTF-32BE -> UTF-16LE", UTF::conv_utf32be_to_utf16le, UTF::conv_utf32be_to_utf16le, utf32be, output_len);
+        do_test_conv_random("UTF-32BE -> UTF-16BE", UTF::conv_utf32be_to_utf16be, UTF::conv_utf32be_to_utf16be, utf32be, output_len);
+        do_test_conv_random("UTF-16LE -> UTF-32LE", UTF::conv_utf16le_to_utf32le, UTF::conv_utf16le_to_utf32le, utf16le, output_len);
+        do_test_conv_random("UTF-16LE -> UTF-32BE", UTF::conv_utf16le_to_utf32be, UTF::conv_utf16le_to_utf32be, utf16le, output_len);
+        do_test_conv_random("UTF-16BE -> UTF-32LE", UTF::conv_utf16be_to_utf32le, UTF::conv_utf16be_to_utf32le, utf16be, output_len);
+        do_test_conv_random("UTF-16BE -> UTF-32BE", UTF::conv_utf16be_to_utf32be, UTF::conv_utf16be_to_utf32be, utf16be, output_len);
+
+        std::vector<uint32_t> codepoints(utf32le.size() / 4);
+        for (size_t i = 0; i < codepoints.size(); i++) {
+            codepoints[i] = uint32_t(uint8_t(utf32le[4 * i])) | uint32_t(uint8_t(utf32le[4 * i + 1])) << 8
+                    | uint32_t(uint8_t(utf32le[4 * i + 2])) << 16 | uint32_t(uint8_t(utf32le[4 * i + 3])) << 24;
+        }
+        do_test_encode_random("UTF-8", UTF::encode_utf8, UTF::encode_utf8, codepoints, output_len);
+        do_test_encode_random("UTF-16LE", UTF::encode_utf16le, UTF::encode_utf16le, codepoints, output_len);
+        do_test_encode_random("UTF-16BE", UTF::encode_utf16be, UTF::encode_utf16be, codepoints, output_len);
+        do_test_encode_random("UTF-32LE", UTF::encode_utf32le, UTF::encode_utf32le, codepoints, output_len);
+        do_test_encode_random("UTF-32BE", UTF::encode_utf32be, UTF::encode_utf32be, codepoints, output_len);
+
+        do_test_decode_random("UTF-8", UTF::decode_utf8, UTF::decode_utf8, UTF::validate_utf8, input_data, output_len / 4);
+        do_test_decode_random("UTF-16LE", UTF::decode_utf16le, UTF::decode_utf16le, UTF::validate_utf16le, utf16le, output_len / 4);
+        do_test_decode_random("UTF-16BE", UTF::decode_utf16be, UTF::decode_utf16be, UTF::validate_utf16be, utf16be, output_len / 4);
+        do_test_decode_random("UTF-32LE", UTF::decode_utf32le, UTF::decode_utf32le, UTF::validate_utf32le, utf32le, output_len / 4);
+        do_test_decode_random("UTF-32BE", UTF::decode_utf32be, UTF::decode_utf32be, UTF::validate_utf32be, utf32be, output_len / 4);
+    }
+}
+
 /*
  * test some decoder errors
  */
@@ -556,7 +1010,1305 @@ static void test_encode_errors() {
     free(test_conv);
 }
 
-int main() {
+/*
+ * Latin-1 : the 256 characters against iconv, and the characters that can't be encoded
+ */
+static void test_latin1() {
+    std::string latin1;
+    for (int i = 0; i < 4 * 256; i++) {
+        latin1 += char(i % 256);
+    }
+    static const char *charsets[] = {"UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"};
+    typedef UTF::RetCode (*LatinConvFunction)(const char *, size_t, char **, size_t *, size_t *, size_t *);
+    static const LatinConvFunction from_latin1[] = {UTF::conv_latin1_to_utf8, UTF::conv_latin1_to_utf16le,
+            UTF::conv_latin1_to_utf16be, UTF::conv_latin1_to_utf32le, UTF::conv_latin1_to_utf32be};
+    static const LatinConvFunction to_latin1[] = {UTF::conv_utf8_to_latin1, UTF::conv_utf16le_to_latin1,
+            UTF::conv_utf16be_to_latin1, UTF::conv_utf32le_to_latin1, UTF::conv_utf32be_to_latin1};
+    char *test_conv = NULL;
+    size_t test_conv_size = 0;
+    size_t consumed = 0, written = 0;
+    UTF::RetCode r;
+
+    for (int c = 0; c < 5; c++) {
+        std::vector<char> ref;
+        ssize_t ref_len = iconv_convert(charsets[c], "ISO-8859-1", latin1.data(), latin1.size(), ref, &consumed);
+        assert(consumed == latin1.size());
+        r = from_latin1[c](latin1.data(), latin1.size(), &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && consumed == latin1.size() && written == size_t(ref_len));
+        assert(memcmp(test_conv, ref.data(), written) == 0);
+        r = to_latin1[c](ref.data(), ref_len, &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && consumed == size_t(ref_len) && written == latin1.size());
+        assert(memcmp(test_conv, latin1.data(), written) == 0);
+    }
+    assert(UTF::utf8_length_from_latin1(latin1.data(), latin1.size()) == 4 * (128 + 2 * 128));
+    assert(UTF::latin1_length_from_utf8("h\xC3\xA9", 3) == 2);
+
+    std::vector<uint32_t> codepoints;
+    r = UTF::decode_latin1(latin1.data(), latin1.size(), std::back_inserter(codepoints), &consumed, &written);
+    assert(r == UTF::RetCode::OK && written == latin1.size());
+    for (size_t i = 0; i < codepoints.size(); i++) {
+        assert(codepoints[i] == i % 256);
+    }
+    r = UTF::encode_latin1(codepoints.data(), codepoints.size(), &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::OK && written == latin1.size() && memcmp(test_conv, latin1.data(), written) == 0);
+
+    // characters above 0xFF
+    r = UTF::conv_utf8_to_latin1("abc\xE2\x82\xAC", 6, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 3 && written == 3);
+    const unsigned char unit_utf16le[] = {0x61, 0x00, 0xFF, 0x00, 0x00, 0x01};
+    r = UTF::conv_utf16le_to_latin1((const char *) unit_utf16le, sizeof(unit_utf16le), &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 4 && written == 2);
+    uint32_t encoding = 0x100;
+    r = UTF::encode_latin1(&encoding, 1, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 0);
+    // truncated sequence
+    r = UTF::conv_utf8_to_latin1("ab\xC3", 3, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_TRUNCATED && consumed == 2 && written == 2);
+
+    free(test_conv);
+}
+
+/* Same as test_conv_random for the Latin-1 conversions, with some characters above 0xFF in the UTF streams */
+static void test_latin1_random() {
+    std::mt19937 gen(42);
+    for (int n = 0; n < 2000; n++) {
+        std::string latin1;
+        size_t n_chars = gen() % 300;
+        size_t ascii_rate = gen() % 5;
+        for (size_t i = 0; i < n_chars; i++) {
+            latin1 += char(gen() % 4 < ascii_rate ? 0x20 + gen() % 0x5F : 0x80 + gen() % 0x80);
+        }
+
+        std::string utf8, utf16le, utf16be, utf32le, utf32be;
+        UTF::conv_latin1_to_utf8(latin1.data(), latin1.size(), std::back_inserter(utf8), NULL, NULL);
+        UTF::conv_latin1_to_utf16le(latin1.data(), latin1.size(), std::back_inserter(utf16le), NULL, NULL);
+        UTF::conv_latin1_to_utf16be(latin1.data(), latin1.size(), std::back_inserter(utf16be), NULL, NULL);
+        UTF::conv_latin1_to_utf32le(latin1.data(), latin1.size(), std::back_inserter(utf32le), NULL, NULL);
+        UTF::conv_latin1_to_utf32be(latin1.data(), latin1.size(), std::back_inserter(utf32be), NULL, NULL);
+
+        if (!latin1.empty() && n % 2 == 1) {
+            size_t n_errors = 1 + gen() % 3;
+            for (size_t i = 0; i < n_errors; i++) {
+                // random bytes and characters above 0xFF
+                utf8[gen() % utf8.size()] = char(gen() % 256);
+                utf8.insert(gen() % utf8.size(), "\xE2\x82\xAC");
+                uint16_t unit = uint16_t(0x100 + gen() % 0xFF00);
+                size_t pos = 2 * (gen() % (utf16le.size() / 2));
+                utf16le[pos] = char(unit & 0xFF);
+                utf16le[pos + 1] = char(unit >> 8);
+                utf16be[pos] = char(unit >> 8);
+                utf16be[pos + 1] = char(unit & 0xFF);
+                uint32_t cp = gen() % 2 ? 0x100 + gen() % 0x10000 : uint32_t(gen());
+                pos = 4 * (gen() % (utf32le.size() / 4));
+                for (int b = 0; b < 4; b++) {
+                    utf32le[pos + b] = char(cp >> (8 * b));
+                    utf32be[pos + 3 - b] = char(cp >> (8 * b));
+                }
+            }
+        }
+        if (!latin1.empty() && n % 5 == 0) {
+            utf8.resize(gen() % utf8.size());
+            utf16le.resize(gen() % utf16le.size());
+        }
+
+        size_t output_len = gen() % 1000;
+        do_test_conv_random("Latin-1 -> UTF-8", UTF::conv_latin1_to_utf8, UTF::conv_latin1_to_utf8, latin1, output_len);
+        do_test_conv_random("Latin-1 -> UTF-16LE", UTF::conv_latin1_to_utf16le, UTF::conv_latin1_to_utf16le, latin1, output_len);
+        do_test_conv_random("Latin-1 -> UTF-16BE", UTF::conv_latin1_to_utf16be, UTF::conv_latin1_to_utf16be, latin1, output_len);
+        do_test_conv_random("Latin-1 -> UTF-32LE", UTF::conv_latin1_to_utf32le, UTF::conv_latin1_to_utf32le, latin1, output_len);
+        do_test_conv_random("Latin-1 -> UTF-32BE", UTF::conv_latin1_to_utf32be, UTF::conv_latin1_to_utf32be, latin1, output_len);
+        do_test_conv_random("UTF-8 -> Latin-1", UTF::conv_utf8_to_latin1, UTF::conv_utf8_to_latin1, utf8, output_len);
+        do_test_conv_random("UTF-16LE -> Latin-1", UTF::conv_utf16le_to_latin1, UTF::conv_utf16le_to_latin1, utf16le, output_len);
+        do_test_conv_random("UTF-16BE -> Latin-1", UTF::conv_utf16be_to_latin1, UTF::conv_utf16be_to_latin1, utf16be, output_len);
+        do_test_conv_random("UTF-32LE -> Latin-1", UTF::conv_utf32le_to_latin1, UTF::conv_utf32le_to_latin1, utf32le, output_len);
+        do_test_conv_random("UTF-32BE -> Latin-1", UTF::conv_utf32be_to_latin1, UTF::conv_utf32be_to_latin1, utf32be, output_len);
+
+        std::vector<uint32_t> codepoints(utf32le.size() / 4);
+        for (size_t i = 0; i < codepoints.size(); i++) {
+            codepoints[i] = uint32_t(uint8_t(utf32le[4 * i])) | uint32_t(uint8_t(utf32le[4 * i + 1])) << 8
+                    | uint32_t(uint8_t(utf32le[4 * i + 2])) << 16 | uint32_t(uint8_t(utf32le[4 * i + 3])) << 24;
+        }
+        do_test_encode_random("Latin-1", UTF::encode_latin1, UTF::encode_latin1, codepoints, output_len);
+        do_test_decode_random("Latin-1", UTF::decode_latin1, UTF::decode_latin1, UTF::validate_latin1, latin1, output_len / 4);
+    }
+}
+
+/*
+ * Single-byte code pages : the 256 bytes against iconv (the bytes iconv rejects must be invalid), the round trips
+ * through every UTF, and the random streams of each instruction set against the scalar conversions
+ */
+typedef UTF::RetCode (*CodePageConvFunction)(const char *, size_t, char **, size_t *, size_t *, size_t *);
+typedef UTF::RetCode (*CodePageFixedConvFunction)(const char *, size_t, char *, size_t, size_t *, size_t *);
+typedef UTF::RetCode (*CodePageDecodeOneFunction)(const char *, size_t, uint32_t *, size_t *);
+typedef UTF::RetCode (*CodePageEncodeFunction)(const uint32_t *, size_t, char **, size_t *, size_t *, size_t *);
+
+struct CodePageFunctions {
+    const char *name;
+    const char *iconv_name;
+    CodePageConvFunction from[5];
+    CodePageConvFunction to[5];
+    CodePageFixedConvFunction fixed_from[5];
+    CodePageFixedConvFunction fixed_to[5];
+    DecodeFunction decode;
+    FixedDecodeFunction fixed_decode;
+    CodePageDecodeOneFunction decode_one;
+    EncodeFunction encode;
+    FixedEncodeFunction fixed_encode;
+    ValidateFunction validate;
+    size_t (*utf8_length)(const char *, size_t);
+};
+
+#define CODE_PAGE_FUNCTIONS(NAME, ICONV_NAME, FUNC) \
+    {NAME, ICONV_NAME, \
+        {UTF::conv_ ## FUNC ## _to_utf8, UTF::conv_ ## FUNC ## _to_utf16le, UTF::conv_ ## FUNC ## _to_utf16be, \
+            UTF::conv_ ## FUNC ## _to_utf32le, UTF::conv_ ## FUNC ## _to_utf32be}, \
+        {UTF::conv_utf8_to_ ## FUNC, UTF::conv_utf16le_to_ ## FUNC, UTF::conv_utf16be_to_ ## FUNC, \
+            UTF::conv_utf32le_to_ ## FUNC, UTF::conv_utf32be_to_ ## FUNC}, \
+        {UTF::conv_ ## FUNC ## _to_utf8, UTF::conv_ ## FUNC ## _to_utf16le, UTF::conv_ ## FUNC ## _to_utf16be, \
+            UTF::conv_ ## FUNC ## _to_utf32le, UTF::conv_ ## FUNC ## _to_utf32be}, \
+        {UTF::conv_utf8_to_ ## FUNC, UTF::conv_utf16le_to_ ## FUNC, UTF::conv_utf16be_to_ ## FUNC, \
+            UTF::conv_utf32le_to_ ## FUNC, UTF::conv_utf32be_to_ ## FUNC}, \
+        UTF::decode_ ## FUNC, UTF::decode_ ## FUNC, UTF::decode_one_ ## FUNC, \
+        UTF::encode_ ## FUNC, UTF::encode_ ## FUNC, UTF::validate_ ## FUNC, UTF::utf8_length_from_ ## FUNC}
+
+static const CodePageFunctions code_pages[] = {
+    CODE_PAGE_FUNCTIONS("Windows-1250", "WINDOWS-1250", windows1250),
+    CODE_PAGE_FUNCTIONS("Windows-1251", "WINDOWS-1251", windows1251),
+    CODE_PAGE_FUNCTIONS("Windows-1252", "WINDOWS-1252", windows1252),
+    CODE_PAGE_FUNCTIONS("ISO-8859-2", "ISO-8859-2", iso8859_2),
+    CODE_PAGE_FUNCTIONS("ISO-8859-5", "ISO-8859-5", iso8859_5),
+    CODE_PAGE_FUNCTIONS("ISO-8859-15", "ISO-8859-15", iso8859_15),
+    CODE_PAGE_FUNCTIONS("KOI8-R", "KOI8-R", koi8r),
+    CODE_PAGE_FUNCTIONS("KOI8-U", "KOI8-U", koi8u),
+};
+
+static const CodePageFunctions gb_charsets[] = {
+    CODE_PAGE_FUNCTIONS("GB18030", "GB18030", gb18030),
+    CODE_PAGE_FUNCTIONS("GBK", "GBK", gbk),
+};
+
+#undef CODE_PAGE_FUNCTIONS
+
+static void test_code_pages() {
+    static const char *charsets[] = {"UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"};
+    char *test_conv = NULL;
+    size_t test_conv_size = 0;
+    size_t consumed = 0, written = 0;
+    UTF::RetCode r;
+
+    for (const CodePageFunctions &page : code_pages) {
+        // the mapped bytes, and the unmapped ones which must be rejected in the middle of a stream
+        std::string mapped;
+        for (int b = 0; b < 256; b++) {
+            const char byte = char(b);
+            std::vector<char> ref;
+            uint32_t cp = 0;
+            if (iconv_convert("UTF-32LE", page.iconv_name, &byte, 1, ref, &consumed) == 4) {
+                mapped += byte;
+                r = page.decode_one(&byte, 1, &cp, &consumed);
+                assert(r == UTF::RetCode::OK && consumed == 1);
+                assert(memcmp(&cp, ref.data(), 4) == 0);
+            } else {
+                r = page.decode_one(&byte, 1, &cp, &consumed);
+                assert(r == UTF::RetCode::E_INVALID);
+                std::string invalid = "abcdefghijklmnopqrstuvwxyz";
+                invalid[20] = byte;
+                for (int c = 0; c < 5; c++) {
+                    r = page.from[c](invalid.data(), invalid.size(), &test_conv, &test_conv_size, &consumed, &written);
+                    assert(r == UTF::RetCode::E_INVALID && consumed == 20);
+                }
+                size_t valid = 0, length = 0;
+                r = page.validate(invalid.data(), invalid.size(), &valid, &length);
+                assert(r == UTF::RetCode::E_INVALID && valid == 20 && length == 20);
+            }
+        }
+        std::string input;
+        for (int i = 0; i < 4; i++) {
+            input += mapped;
+        }
+
+        for (int c = 0; c < 5; c++) {
+            std::vector<char> ref;
+            ssize_t ref_len = iconv_convert(charsets[c], page.iconv_name, input.data(), input.size(), ref, &consumed);
+            assert(consumed == input.size());
+            r = page.from[c](input.data(), input.size(), &test_conv, &test_conv_size, &consumed, &written);
+            assert(r == UTF::RetCode::OK && consumed == input.size() && written == size_t(ref_len));
+            assert(memcmp(test_conv, ref.data(), written) == 0);
+            if (c == 0) {
+                assert(page.utf8_length(input.data(), input.size()) == size_t(ref_len));
+            }
+            r = page.to[c](ref.data(), ref_len, &test_conv, &test_conv_size, &consumed, &written);
+            assert(r == UTF::RetCode::OK && consumed == size_t(ref_len) && written == input.size());
+            assert(memcmp(test_conv, input.data(), written) == 0);
+        }
+
+        uint32_t *codepoints = NULL;
+        size_t codepoints_size = 0;
+        r = page.decode(input.data(), input.size(), &codepoints, &codepoints_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && written == input.size());
+        r = page.encode(codepoints, written, &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && written == input.size() && memcmp(test_conv, input.data(), written) == 0);
+        free(codepoints);
+    }
+
+    // characters the code page can't represent
+    r = UTF::conv_utf8_to_iso8859_2("abc\xE2\x82\xAC", 6, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 3 && written == 3);
+    r = UTF::conv_utf8_to_iso8859_15("abc\xE2\x82\xAC", 6, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::OK && written == 4 && test_conv[3] == '\xA4');
+    r = UTF::conv_utf8_to_windows1252("\xC2\xA4\xC2\x81", 4, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 2 && written == 1 && test_conv[0] == '\xA4');
+    const unsigned char unit_utf16le[] = {0x61, 0x00, 0x10, 0x04, 0x00, 0x4E};
+    r = UTF::conv_utf16le_to_koi8r((const char *) unit_utf16le, sizeof(unit_utf16le), &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 4 && written == 2 && test_conv[1] == '\xE1');
+    uint32_t encoding[] = {0x41, 0x1F600};
+    r = UTF::encode_windows1251(encoding, 2, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 1 && written == 1);
+    // truncated sequence
+    assert(UTF::koi8r_length_from_utf8("\xD0\x96x", 3) == 2);
+    r = UTF::conv_utf8_to_windows1250("ab\xC5", 3, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_TRUNCATED && consumed == 2 && written == 2);
+
+    free(test_conv);
+}
+
+/* Same as test_latin1_random for the single-byte code pages, with some unmapped bytes and characters */
+static void test_code_pages_random() {
+    static const char *names[] = {"UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"};
+    std::mt19937 gen(42);
+    for (const CodePageFunctions &page : code_pages) {
+        // the mapped bytes above 0x7F
+        std::string upper;
+        for (int b = 0x80; b < 0x100; b++) {
+            const char byte = char(b);
+            uint32_t cp = 0;
+            size_t consumed = 0;
+            if (page.decode_one(&byte, 1, &cp, &consumed) == UTF::RetCode::OK) {
+                upper += byte;
+            }
+        }
+        for (int n = 0; n < 300; n++) {
+            std::string input;
+            size_t n_chars = gen() % 300;
+            size_t ascii_rate = gen() % 5;
+            for (size_t i = 0; i < n_chars; i++) {
+                input += gen() % 4 < ascii_rate ? char(0x20 + gen() % 0x5F) : upper[gen() % upper.size()];
+            }
+
+            std::string utf[5];
+            for (int c = 0; c < 5; c++) {
+                char *conv = NULL;
+                size_t conv_size = 0, consumed = 0, written = 0;
+                page.from[c](input.data(), input.size(), &conv, &conv_size, &consumed, &written);
+                utf[c].assign(conv, written);
+                free(conv);
+            }
+            std::vector<uint32_t> codepoints(utf[3].size() / 4);
+            for (size_t i = 0; i < codepoints.size(); i++) {
+                codepoints[i] = uint32_t(uint8_t(utf[3][4 * i])) | uint32_t(uint8_t(utf[3][4 * i + 1])) << 8
+                        | uint32_t(uint8_t(utf[3][4 * i + 2])) << 16;
+            }
+
+            if (!input.empty() && n % 2 == 1) {
+                size_t n_errors = 1 + gen() % 3;
+                for (size_t i = 0; i < n_errors; i++) {
+                    // random bytes (the unmapped ones are invalid) and characters that may not be mapped
+                    input[gen() % input.size()] = char(gen() % 256);
+                    utf[0].insert(gen() % utf[0].size(), gen() % 2 ? "\xE2\x82\xAC" : "\xD0\x96");
+                    uint16_t unit = uint16_t(0x80 + gen() % 0x2200);
+                    size_t pos = 2 * (gen() % (utf[1].size() / 2));
+                    utf[1][pos] = char(unit & 0xFF);
+                    utf[1][pos + 1] = char(unit >> 8);
+                    utf[2][pos] = char(unit >> 8);
+                    utf[2][pos + 1] = char(unit & 0xFF);
+                    uint32_t cp = gen() % 2 ? 0x80 + gen() % 0x2200 : uint32_t(gen());
+                    pos = 4 * (gen() % (utf[3].size() / 4));
+                    for (int b = 0; b < 4; b++) {
+                        utf[3][pos + b] = char(cp >> (8 * b));
+                        utf[4][pos + 3 - b] = char(cp >> (8 * b));
+                    }
+                    codepoints[pos / 4] = cp;
+                }
+            }
+            if (!input.empty() && n % 5 == 0) {
+                utf[0].resize(gen() % utf[0].size());
+                utf[1].resize(gen() % utf[1].size());
+            }
+
+            size_t output_len = gen() % 1000;
+            for (int c = 0; c < 5; c++) {
+                std::string from_name = std::string(page.name) + " -> " + names[c];
+                std::string to_name = std::string(names[c]) + " -> " + page.name;
+                do_test_conv_random(from_name.c_str(), page.from[c], page.fixed_from[c], input, output_len);
+                do_test_conv_random(to_name.c_str(), page.to[c], page.fixed_to[c], utf[c], output_len);
+            }
+            do_test_encode_random(page.name, page.encode, page.fixed_encode, codepoints, output_len);
+            do_test_decode_random(page.name, page.decode, page.fixed_decode, page.validate, input, output_len / 4);
+        }
+    }
+}
+
+/* Four bytes GB18030 sequence of a linear index */
+static std::string gb18030_four_bytes(uint32_t linear) {
+    std::string sequence(4, '\0');
+    sequence[0] = char(0x81 + linear / 12600);
+    sequence[1] = char(0x30 + linear / 1260 % 10);
+    sequence[2] = char(0x81 + linear / 10 % 126);
+    sequence[3] = char(0x30 + linear % 10);
+    return sequence;
+}
+
+/*
+ * GB18030 and GBK : every two bytes sequence and every BMP four bytes sequence against iconv,
+ * every codepoint of the BMP and some of the supplementary planes against the iconv encoder, the round trips
+ * through every UTF and the errors
+ */
+static void test_gb18030() {
+    static const char *charsets[] = {"UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"};
+    const CodePageFunctions &gb18030 = gb_charsets[0];
+    const CodePageFunctions &gbk = gb_charsets[1];
+    char *test_conv = NULL;
+    size_t test_conv_size = 0;
+    size_t consumed = 0, written = 0;
+    uint32_t cp = 0;
+    UTF::RetCode r;
+
+    // every two bytes sequence is mapped, the BMP four bytes sequences are mapped except 2 gaps
+    std::string input;
+    for (int b1 = 0x81; b1 <= 0xFE; b1++) {
+        for (int b2 = 0x40; b2 <= 0xFE; b2++) {
+            if (b2 != 0x7F) {
+                input += char(b1);
+                input += char(b2);
+            }
+        }
+    }
+    size_t n_unmapped = 0;
+    for (uint32_t linear = 0; linear < 39420; linear++) {
+        std::string sequence = gb18030_four_bytes(linear);
+        if (gb18030.decode_one(sequence.data(), 4, &cp, &consumed) == UTF::RetCode::OK) {
+            assert(consumed == 4);
+            input += sequence;
+        } else {
+            std::vector<char> ref;
+            assert(iconv_convert("UTF-32LE", "GB18030", sequence.data(), 4, ref, &consumed) < 0);
+            n_unmapped++;
+        }
+    }
+    assert(n_unmapped == 18);
+    for (uint32_t supplementary : {0x10000u, 0x1F600u, 0x20087u, 0x2A6D6u, 0x10FFFFu}) {
+        input += gb18030_four_bytes(189000 + supplementary - 0x10000);
+    }
+
+    for (int c = 0; c < 5; c++) {
+        std::vector<char> ref;
+        ssize_t ref_len = iconv_convert(charsets[c], "GB18030", input.data(), input.size(), ref, &consumed);
+        assert(ref_len > 0 && consumed == input.size());
+        r = gb18030.from[c](input.data(), input.size(), &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && consumed == input.size() && written == size_t(ref_len));
+        assert(memcmp(test_conv, ref.data(), written) == 0);
+        if (c == 0) {
+            assert(gb18030.utf8_length(input.data(), input.size()) == size_t(ref_len));
+            assert(UTF::gb18030_length_from_utf8(ref.data(), ref_len) == input.size() - 2);
+        }
+        // the four bytes sequence of U+20087 is encoded with its two bytes sequence
+        std::vector<char> back;
+        ssize_t back_len = iconv_convert("GB18030", charsets[c], ref.data(), ref_len, back, &consumed);
+        assert(back_len > 0 && consumed == size_t(ref_len));
+        r = gb18030.to[c](ref.data(), ref_len, &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && consumed == size_t(ref_len) && written == size_t(back_len));
+        assert(memcmp(test_conv, back.data(), written) == 0);
+    }
+
+    // the encoder against iconv, the codepoints it rejects must be rejected by iconv
+    std::vector<uint32_t> codepoints;
+    for (uint32_t c = 0; c <= 0x10FFFF; c += c < 0x10000 ? 1 : 0x101) {
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            continue;
+        }
+        r = gb18030.encode(&c, 1, &test_conv, &test_conv_size, &consumed, &written);
+        if (r == UTF::RetCode::OK) {
+            codepoints.push_back(c);
+        } else {
+            std::vector<char> ref;
+            assert(iconv_convert("GB18030", "UTF-32LE", (const char *) &c, 4, ref, &consumed) < 0);
+        }
+    }
+    {
+        std::vector<char> ref;
+        ssize_t ref_len = iconv_convert("GB18030", "UTF-32LE", (const char *) codepoints.data(), codepoints.size() * 4, ref, &consumed);
+        assert(ref_len > 0 && consumed == codepoints.size() * 4);
+        r = gb18030.encode(codepoints.data(), codepoints.size(), &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && consumed == codepoints.size() && written == size_t(ref_len));
+        assert(memcmp(test_conv, ref.data(), written) == 0);
+        uint32_t *decoded = NULL;
+        size_t decoded_size = 0;
+        r = gb18030.decode(ref.data(), ref_len, &decoded, &decoded_size, &consumed, &written);
+        assert(r == UTF::RetCode::OK && written == codepoints.size());
+        assert(memcmp(decoded, codepoints.data(), written * 4) == 0);
+        free(decoded);
+    }
+
+    // GBK : the two bytes sequences accepted by iconv, no four bytes sequence, the euro sign on 1 byte
+    for (size_t i = 0; i < 2 * 126 * 190; i += 2) {
+        std::vector<char> ref;
+        if (iconv_convert("UTF-32LE", "GBK", input.data() + i, 2, ref, &consumed) == 4) {
+            r = gbk.decode_one(input.data() + i, 2, &cp, &consumed);
+            assert(r == UTF::RetCode::OK && consumed == 2 && memcmp(&cp, ref.data(), 4) == 0);
+        }
+    }
+    r = gbk.decode_one("\x81\x30\x81\x30", 4, &cp, &consumed);
+    assert(r == UTF::RetCode::E_INVALID);
+    r = gbk.from[0]("a\x80", 2, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::OK && written == 4 && memcmp(test_conv, "a\xE2\x82\xAC", 4) == 0);
+    r = gbk.to[0]("\xE2\x82\xAC\xE4\xB8\xAD", 6, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::OK && written == 3 && memcmp(test_conv, "\x80\xD6\xD0", 3) == 0);
+    r = gbk.to[0]("ab\xC2\x80", 4, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 2 && written == 2);
+    uint32_t supplementary[] = {0x41, 0x1F600};
+    r = gbk.encode(supplementary, 2, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 1 && written == 1);
+    r = gb18030.encode(supplementary, 2, &test_conv, &test_conv_size, &consumed, &written);
+    assert(r == UTF::RetCode::OK && written == 5 && memcmp(test_conv, "A\x94\x39\xFC\x36", 5) == 0);
+
+    // invalid and truncated sequences
+    static const char *invalid[] = {"ab\x80", "ab\xFF", "ab\x81\x7F", "ab\x81\x30\x20\x30", "ab\x81\x30\x81\x3A",
+            "ab\x84\x31\xA5\x30", "ab\xE3\x32\x9A\x36", "ab\xFE\x39\xFE\x39"};
+    for (const char *sequence : invalid) {
+        size_t len = strlen(sequence);
+        r = gb18030.decode_one(sequence + 2, len - 2, &cp, &consumed);
+        assert(r == UTF::RetCode::E_INVALID);
+        for (int c = 0; c < 5; c++) {
+            r = gb18030.from[c](sequence, len, &test_conv, &test_conv_size, &consumed, &written);
+            assert(r == UTF::RetCode::E_INVALID && consumed == 2);
+        }
+        size_t valid = 0, length = 0;
+        r = gb18030.validate(sequence, len, &valid, &length);
+        assert(r == UTF::RetCode::E_INVALID && valid == 2 && length == 2);
+    }
+    static const char *truncated[] = {"ab\x81", "ab\x81\x30", "ab\x81\x30\x81"};
+    for (const char *sequence : truncated) {
+        r = gb18030.from[0](sequence, strlen(sequence), &test_conv, &test_conv_size, &consumed, &written);
+        assert(r == UTF::RetCode::E_TRUNCATED && consumed == 2 && written == 2);
+    }
+
+    // round trip of a Chinese text
+    for (std::ifstream file("test_file_chinese_utf8"); file;) {
+        std::string utf8;
+        std::copy(std::istream_iterator<char>(file), std::istream_iterator<char>(), std::back_inserter(utf8));
+        std::vector<char> ref;
+        ssize_t ref_len = iconv_convert("GB18030", "UTF-8", utf8.data(), utf8.size(), ref, &consumed);
+        for (const CodePageFunctions &charset : gb_charsets) {
+            r = charset.to[0](utf8.data(), utf8.size(), &test_conv, &test_conv_size, &consumed, &written);
+            assert(r == UTF::RetCode::OK && written == size_t(ref_len) && memcmp(test_conv, ref.data(), written) == 0);
+            assert(charset.utf8_length(ref.data(), ref_len) == utf8.size());
+            r = charset.from[0](ref.data(), ref_len, &test_conv, &test_conv_size, &consumed, &written);
+            assert(r == UTF::RetCode::OK && written == utf8.size() && memcmp(test_conv, utf8.data(), written) == 0);
+        }
+        break;
+    }
+
+    free(test_conv);
+}
+
+/* Same as test_code_pages_random for GB18030 and GBK */
+static void test_gb18030_random() {
+    static const char *names[] = {"UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"};
+    // a four bytes sequence of the BMP, of the supplementary planes, and a two bytes sequence above 0xFFFF
+    static const char *samples[] = {"\x81\x30\x81\x30", "\x94\x39\xFC\x36", "\xFE\x51"};
+    std::mt19937 gen(42);
+    for (const CodePageFunctions &charset : gb_charsets) {
+        bool four_bytes = &charset == &gb_charsets[0];
+        for (int n = 0; n < 300; n++) {
+            std::string input;
+            size_t n_chars = gen() % 300;
+            size_t ascii_rate = gen() % 5;
+            for (size_t i = 0; i < n_chars; i++) {
+                if (gen() % 4 < ascii_rate) {
+                    input += char(0x20 + gen() % 0x5F);
+                } else if (gen() % 8 != 0) {
+                    uint32_t b2 = 0x40 + gen() % 190;
+                    input += char(0x81 + gen() % 126);
+                    input += char(b2 + (b2 >= 0x7F));
+                } else {
+                    input += samples[four_bytes ? gen() % 3 : 2];
+                }
+            }
+
+            std::string utf[5];
+            for (int c = 0; c < 5; c++) {
+                char *conv = NULL;
+                size_t conv_size = 0, consumed = 0, written = 0;
+                UTF::RetCode r = charset.from[c](input.data(), input.size(), &conv, &conv_size, &consumed, &written);
+                assert(r == UTF::RetCode::OK);
+                utf[c].assign(conv, written);
+                free(conv);
+            }
+            std::vector<uint32_t> codepoints(utf[3].size() / 4);
+            if (!codepoints.empty()) {
+                memcpy(codepoints.data(), utf[3].data(), utf[3].size());
+            }
+
+            if (!input.empty() && n % 2 == 1) {
+                size_t n_errors = 1 + gen() % 3;
+                for (size_t i = 0; i < n_errors; i++) {
+                    // random bytes, and characters that may not be mapped (GBK) or not in the tables (surrogates)
+                    input[gen() % input.size()] = char(gen() % 256);
+                    utf[0].insert(gen() % utf[0].size(), gen() % 2 ? "\xC2\x80" : "\xF0\x9F\x98\x80");
+                    uint16_t unit = uint16_t(0x80 + gen() % 0xFF80);
+                    size_t pos = 2 * (gen() % (utf[1].size() / 2));
+                    utf[1][pos] = char(unit & 0xFF);
+                    utf[1][pos + 1] = char(unit >> 8);
+                    utf[2][pos] = char(unit >> 8);
+                    utf[2][pos + 1] = char(unit & 0xFF);
+                    uint32_t cp = gen() % 2 ? 0x80 + gen() % 0x10000 : uint32_t(gen());
+                    pos = 4 * (gen() % (utf[3].size() / 4));
+                    for (int b = 0; b < 4; b++) {
+                        utf[3][pos + b] = char(cp >> (8 * b));
+                        utf[4][pos + 3 - b] = char(cp >> (8 * b));
+                    }
+                    codepoints[pos / 4] = cp;
+                }
+            }
+            if (!input.empty() && n % 5 == 0) {
+                input.resize(gen() % input.size());
+                utf[0].resize(gen() % utf[0].size());
+                utf[1].resize(gen() % utf[1].size());
+            }
+
+            size_t output_len = gen() % 1000;
+            for (int c = 0; c < 5; c++) {
+                std::string from_name = std::string(charset.name) + " -> " + names[c];
+                std::string to_name = std::string(names[c]) + " -> " + charset.name;
+                do_test_conv_random(from_name.c_str(), charset.from[c], charset.fixed_from[c], input, output_len);
+                do_test_conv_random(to_name.c_str(), charset.to[c], charset.fixed_to[c], utf[c], output_len);
+            }
+            do_test_encode_random(charset.name, charset.encode, charset.fixed_encode, codepoints, output_len);
+            do_test_decode_random(charset.name, charset.decode, charset.fixed_decode, charset.validate, input, output_len / 4);
+        }
+    }
+}
+
+/*
+ * Feed a StreamConverter with chunks of every size from 1 to 9 bytes, for the 3 output flavors
+ */
+template<typename Read, typename Encode>
+static void do_test_stream(const char *func_name, const std::vector<char> &src, const std::vector<char> &ref) {
+    for (size_t chunk = 1; chunk < 10; chunk++) {
+        UTF::StreamConverter<Read, Encode> conv_iterator, conv_fixed, conv_buffer;
+        std::vector<char> out_iterator, out_fixed, out_buffer;
+        char *test_conv = NULL;
+        size_t test_conv_size = 0;
+        for (size_t i = 0; i < src.size(); i += chunk) {
+            // exact size allocation to catch the overflows with the sanitizers
+            size_t n = std::min(chunk, src.size() - i);
+            char *data = (char *) malloc(n);
+            memcpy(data, src.data() + i, n);
+
+            size_t consumed = 0, written = 0;
+            UTF::RetCode r = conv_iterator.convert(data, n, std::back_inserter(out_iterator), &consumed, &written);
+            assert(r == UTF::RetCode::OK && consumed == n);
+
+            size_t fixed_consumed = 0;
+            while (fixed_consumed < n) {
+                char fixed[5];
+                r = conv_fixed.convert(data + fixed_consumed, n - fixed_consumed, fixed, sizeof(fixed), &consumed, &written);
+                assert(r == UTF::RetCode::OK || r == UTF::RetCode::E_OUTPUT_FULL);
+                out_fixed.insert(out_fixed.end(), fixed, fixed + written);
+                fixed_consumed += consumed;
+            }
+
+            r = conv_buffer.convert(data, n, &test_conv, &test_conv_size, &consumed, &written);
+            assert(r == UTF::RetCode::OK && consumed == n);
+            out_buffer.insert(out_buffer.end(), test_conv, test_conv + written);
+            free(data);
+        }
+        free(test_conv);
+        if (out_iterator != ref || out_fixed != ref || out_buffer != ref) {
+            printf("[stream %zu] %s : KO\n", chunk, func_name);
+            assert(out_iterator == ref && out_fixed == ref && out_buffer == ref);
+        }
+        assert(conv_iterator.finish() == UTF::RetCode::OK);
+        assert(conv_fixed.finish() == UTF::RetCode::OK);
+        assert(conv_buffer.finish() == UTF::RetCode::OK);
+    }
+}
+
+/*
+ * Test the stream converters with characters split between chunks
+ */
+static void test_stream_converter() {
+    const char *str_utf8 = "aé€\xF0\x9F\x98\xBA chaîne \xF0\xa0\x9c\x8e 42€ çàéù b";
+    size_t str_utf8_len = strlen(str_utf8);
+    std::vector<char> utf8(str_utf8, str_utf8 + str_utf8_len);
+    std::vector<char> utf16le, utf16be, utf32be;
+    size_t consumed;
+    iconv_convert("UTF-16LE", "UTF-8", str_utf8, str_utf8_len, utf16le, &consumed);
+    iconv_convert("UTF-16BE", "UTF-8", str_utf8, str_utf8_len, utf16be, &consumed);
+    iconv_convert("UTF-32BE", "UTF-8", str_utf8, str_utf8_len, utf32be, &consumed);
+
+    do_test_stream<UTF::impl::ReadUtf8Cp, UTF::impl::CpToUtf16le>("UTF-8 -> UTF-16LE", utf8, utf16le);
+    do_test_stream<UTF::impl::ReadUtf8Cp, UTF::impl::CpToUtf32be>("UTF-8 -> UTF-32BE", utf8, utf32be);
+    do_test_stream<UTF::impl::ReadUtf16leCp, UTF::impl::CpToUtf8>("UTF-16LE -> UTF-8", utf16le, utf8);
+    do_test_stream<UTF::impl::ReadUtf16beCp, UTF::impl::CpToUtf32be>("UTF-16BE -> UTF-32BE", utf16be, utf32be);
+    do_test_stream<UTF::impl::ReadUtf32beCp, UTF::impl::CpToUtf16le>("UTF-32BE -> UTF-16LE", utf32be, utf16le);
+
+    // incomplete sequence at the end of the stream
+    UTF::StreamConverter<UTF::impl::ReadUtf8Cp, UTF::impl::CpToUtf16le> conv;
+    std::vector<char> out;
+    size_t written;
+    UTF::RetCode r = conv.convert("a\xE2\x82", 3, std::back_inserter(out), &consumed, &written);
+    assert(r == UTF::RetCode::OK && consumed == 3 && written == 2 && conv.pending() == 2);
+    assert(conv.finish() == UTF::RetCode::E_TRUNCATED && conv.pending() == 0);
+
+    // invalid sequence split between 2 chunks, it is reported at the beginning of the second chunk
+    r = conv.convert("a\xE2", 2, std::back_inserter(out), &consumed, &written);
+    assert(r == UTF::RetCode::OK && consumed == 2 && conv.pending() == 1);
+    r = conv.convert("bc", 2, std::back_inserter(out), &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 0 && written == 0 && conv.pending() == 1);
+    conv.reset();
+    r = conv.convert("bc\xFF", 3, std::back_inserter(out), &consumed, &written);
+    assert(r == UTF::RetCode::E_INVALID && consumed == 2 && written == 4 && conv.pending() == 0);
+
+    // a pending high surrogate
+    UTF::StreamConverter<UTF::impl::ReadUtf16leCp, UTF::impl::CpToUtf8> conv16;
+    out.clear();
+    r = conv16.convert("\x3D\xD8\x3A", 3, std::back_inserter(out), &consumed, &written);
+    assert(r == UTF::RetCode::OK && consumed == 3 && written == 0 && conv16.pending() == 3);
+    r = conv16.convert("\xDE", 1, std::back_inserter(out), &consumed, &written);
+    assert(r == UTF::RetCode::OK && consumed == 1 && written == 4 && conv16.pending() == 0);
+    assert(out == std::vector<char>({'\xF0', '\x9F', '\x98', '\xBA'}));
+}
+
+/*
+ * Compare a multi-threaded conversion with the serial one (same output, return code, consumed and written)
+ */
+static void do_test_parallel(const char *func_name,
+        UTF::RetCode (*conv)(const char *, size_t, char **, size_t *, size_t *, size_t *),
+        UTF::RetCode (*conv_parallel)(const char *, size_t, char **, size_t *, size_t *, size_t *, unsigned, size_t),
+        const std::string &src) {
+    char *ref = NULL, *test_conv = NULL;
+    size_t ref_size = 0, test_conv_size = 0;
+    size_t ref_consumed = 0, ref_written = 0;
+    UTF::RetCode ref_r = conv(src.data(), src.size(), &ref, &ref_size, &ref_consumed, &ref_written);
+    static const unsigned n_threads[] = {2, 3, 7};
+    static const size_t min_chunk_lens[] = {1, 16};
+    for (unsigned n : n_threads) {
+        for (size_t min_chunk_len : min_chunk_lens) {
+            size_t consumed = 0, written = 0;
+            UTF::RetCode r = conv_parallel(src.data(), src.size(), &test_conv, &test_conv_size, &consumed, &written, n, min_chunk_len);
+            if (r != ref_r || consumed != ref_consumed || written != ref_written || (written != 0 && memcmp(test_conv, ref, written) != 0)) {
+                printf("[parallel %u %zu] %s : KO (%d %d) (%zu %zu | %zu %zu)\n", n, min_chunk_len, func_name, (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written);
+                assert(r == ref_r);
+                assert(consumed == ref_consumed);
+                assert(written == ref_written);
+                assert(written == 0 || memcmp(test_conv, ref, written) == 0);
+            }
+        }
+    }
+    free(ref);
+    free(test_conv);
+}
+
+/*
+ * Test the multi-threaded conversions on random streams, with random corruptions
+ */
+static void test_parallel() {
+    static const char *samples[] = {"a", "z", "\n", "é", "ß", "€", "✏", "中", "\xF0\x9F\x98\xBA", "\xF4\x8F\xBF\xBF"};
+    std::mt19937 gen(7);
+    for (int n = 0; n < 200; n++) {
+        std::string input_data;
+        size_t n_chars = gen() % 300;
+        for (size_t i = 0; i < n_chars; i++) {
+            input_data += samples[gen() % 10];
+        }
+        std::vector<char> utf16be, utf32le;
+        size_t consumed;
+        iconv_convert("UTF-16BE", "UTF-8", input_data.data(), input_data.size(), utf16be, &consumed);
+        iconv_convert("UTF-32LE", "UTF-8", input_data.data(), input_data.size(), utf32le, &consumed);
+        std::string str_utf16be(utf16be.begin(), utf16be.end()), str_utf32le(utf32le.begin(), utf32le.end());
+        if (n % 2 == 1) {
+            for (std::string *str : {&input_data, &str_utf16be, &str_utf32le}) {
+                if (!str->empty()) {
+                    (*str)[gen() % str->size()] = char(gen() % 256);
+                }
+            }
+        }
+        if (n % 5 == 0) {
+            for (std::string *str : {&input_data, &str_utf16be, &str_utf32le}) {
+                if (!str->empty()) {
+                    str->resize(str->size() - 1);
+                }
+            }
+        }
+        do_test_parallel("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le_parallel, input_data);
+        do_test_parallel("UTF-8 -> UTF-32BE", UTF::conv_utf8_to_utf32be, UTF::conv_utf8_to_utf32be_parallel, input_data);
+        do_test_parallel("UTF-16BE -> UTF-8", UTF::conv_utf16be_to_utf8, UTF::conv_utf16be_to_utf8_parallel, str_utf16be);
+        do_test_parallel("UTF-16BE -> UTF-32LE", UTF::conv_utf16be_to_utf32le, UTF::conv_utf16be_to_utf32le_parallel, str_utf16be);
+        do_test_parallel("UTF-32LE -> UTF-8", UTF::conv_utf32le_to_utf8, UTF::conv_utf32le_to_utf8_parallel, str_utf32le);
+        do_test_parallel("UTF-32LE -> UTF-16BE", UTF::conv_utf32le_to_utf16be, UTF::conv_utf32le_to_utf16be_parallel, str_utf32le);
+    }
+}
+
+/*
+ * Arena for the allocator tests : the blocks are carved from a fixed buffer and only released with the arena
+ */
+struct TestArena {
+    std::vector<char> memory;
+    size_t used = 0;
+    size_t n_allocations = 0;
+    size_t n_live = 0;
+};
+
+template<typename T>
+struct TestArenaAllocator {
+    typedef T value_type;
+    TestArena *arena;
+
+    explicit TestArenaAllocator(TestArena *a) : arena(a) {
+    }
+    template<typename U>
+    TestArenaAllocator(const TestArenaAllocator<U> &other) : arena(other.arena) {
+    }
+
+    T *allocate(size_t n) {
+        size_t offset = (arena->used + alignof(T) - 1) & ~(alignof(T) - 1);
+        assert(offset + n * sizeof(T) <= arena->memory.size());
+        arena->used = offset + n * sizeof(T);
+        arena->n_allocations++;
+        arena->n_live++;
+        return (T *) (arena->memory.data() + offset);
+    }
+    void deallocate(T *p, size_t n) {
+        assert((char *) p >= arena->memory.data() && (char *) (p + n) <= arena->memory.data() + arena->used);
+        assert(arena->n_live > 0);
+        arena->n_live--;
+    }
+};
+
+template<typename T, typename U>
+static bool operator==(const TestArenaAllocator<T> &a, const TestArenaAllocator<U> &b) {
+    return a.arena == b.arena;
+}
+template<typename T, typename U>
+static bool operator!=(const TestArenaAllocator<T> &a, const TestArenaAllocator<U> &b) {
+    return a.arena != b.arena;
+}
+
+/*
+ * Compare a getline-style function with an allocator with the malloc version (same output, return code, consumed and written),
+ * for each growth policy, with and without shrink_to_fit, from an empty or a small existing buffer
+ */
+template<typename src_type, typename dst_type, typename Allocator>
+static void do_test_allocator(const char *func_name,
+        UTF::RetCode (*conv)(const src_type *, size_t, dst_type **, size_t *, size_t *, size_t *),
+        UTF::RetCode (*conv_alloc)(const src_type *, size_t, dst_type **, size_t *, size_t *, size_t *, const Allocator &, UTF::Growth, bool),
+        const Allocator &alloc, const src_type *src, size_t src_len) {
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<dst_type> DstAlloc;
+    dst_type *ref = NULL;
+    size_t ref_size = 0, ref_consumed = 0, ref_written = 0;
+    UTF::RetCode ref_r = conv(src, src_len, &ref, &ref_size, &ref_consumed, &ref_written);
+    for (UTF::Growth growth : {UTF::Growth::EXACT, UTF::Growth::GEOMETRIC}) {
+        for (int shrink_to_fit = 0; shrink_to_fit < 2; shrink_to_fit++) {
+            for (size_t initial_size : {0, 3}) {
+                DstAlloc dst_alloc(alloc);
+                dst_type *test_conv = initial_size != 0 ? dst_alloc.allocate(initial_size) : NULL;
+                size_t test_conv_size = initial_size, consumed = 0, written = 0;
+                UTF::RetCode r = conv_alloc(src, src_len, &test_conv, &test_conv_size, &consumed, &written, alloc, growth, shrink_to_fit != 0);
+                bool ok = r == ref_r && consumed == ref_consumed && written == ref_written && written <= test_conv_size
+                        && std::equal(test_conv, test_conv + written, ref);
+                if (shrink_to_fit) {
+                    ok = ok && test_conv_size == written && (test_conv == NULL) == (written == 0);
+                }
+                if (!ok) {
+                    printf("[allocator %d %d %zu] %s : KO (%d %d) (%zu %zu | %zu %zu | %zu)\n", (int) growth, shrink_to_fit, initial_size, func_name,
+                            (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written, test_conv_size);
+                    assert(ok);
+                }
+                if (test_conv) {
+                    dst_alloc.deallocate(test_conv, test_conv_size);
+                }
+            }
+        }
+    }
+    free(ref);
+}
+
+/* A mixed text (1 to 4 bytes sequences) of at least size bytes */
+static std::string sample_text(size_t size) {
+    std::string text = "chaîne UTF-8 simple 42€ çàéù \xF0\x9F\x98\xBA";
+    while (text.size() < size) {
+        text += text;
+    }
+    return text;
+}
+
+/*
+ * UTF-8 streams for the variants of the getline-style functions : empty, a single character, sample_text(size),
+ * the text with an invalid byte in the middle and the text with a truncated sequence at the end
+ */
+static std::vector<std::string> sample_streams(size_t size) {
+    std::string text = sample_text(size);
+    return {"", "a", text, text.substr(0, size / 2) + "\xFF" + text, text + "\xF0\x9F"};
+}
+
+/*
+ * Test the getline-style functions with an arena and a standard allocator, on valid and invalid streams
+ */
+static void test_allocators() {
+    std::vector<std::string> inputs = sample_streams(5000);
+
+    TestArena arena;
+    arena.memory.resize(4 << 20);
+    TestArenaAllocator<char> arena_alloc(&arena);
+    std::allocator<char> std_alloc;
+    for (const std::string &utf8 : inputs) {
+        std::vector<char> utf16le;
+        size_t consumed;
+        iconv_convert("UTF-16LE", "UTF-8", utf8.data(), utf8.size(), utf16le, &consumed);
+        std::vector<uint32_t> codepoints;
+        UTF::decode_utf8(utf8.data(), utf8.size(), std::back_inserter(codepoints), &consumed, NULL);
+        codepoints.push_back(0xD800);
+        codepoints.push_back(0x41);
+
+        do_test_allocator<char, char>("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le, arena_alloc, utf8.data(), utf8.size());
+        do_test_allocator<char, char>("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le, std_alloc, utf8.data(), utf8.size());
+        do_test_allocator<char, char>("UTF-16LE -> UTF-8", UTF::conv_utf16le_to_utf8, UTF::conv_utf16le_to_utf8, arena_alloc, utf16le.data(), utf16le.size());
+        do_test_allocator<char, uint32_t>("UTF-8 -> UNICODE", UTF::decode_utf8, UTF::decode_utf8, arena_alloc, utf8.data(), utf8.size());
+        do_test_allocator<char, uint32_t>("UTF-8 -> UNICODE", UTF::decode_utf8, UTF::decode_utf8, std_alloc, utf8.data(), utf8.size());
+        do_test_allocator<uint32_t, char>("UNICODE -> UTF-8", UTF::encode_utf8, UTF::encode_utf8, arena_alloc, codepoints.data(), codepoints.size());
+        do_test_allocator<uint32_t, char>("UNICODE -> UTF-16BE", UTF::encode_utf16be, UTF::encode_utf16be, std_alloc, codepoints.data(), codepoints.size());
+        do_test_allocator<uint32_t, char>("UNICODE -> GB18030", UTF::encode_gb18030, UTF::encode_gb18030, arena_alloc, codepoints.data(), codepoints.size());
+    }
+    // every block was released
+    assert(arena.n_live == 0);
+
+    // the geometric growth starts from half of the largest output (ASCII to UTF-32 : twice the input size) and doubles it
+    std::string ascii(100000, 'a');
+    char *output = NULL;
+    size_t output_size = 0, consumed = 0, written = 0;
+    arena.n_allocations = 0;
+    UTF::RetCode r = UTF::conv_utf8_to_utf32le(ascii.data(), ascii.size(), &output, &output_size, &consumed, &written,
+            arena_alloc, UTF::Growth::GEOMETRIC);
+    assert(r == UTF::RetCode::OK && consumed == ascii.size() && written == 4 * ascii.size());
+    assert(arena.n_allocations == 2 && output_size >= written);
+    arena_alloc.deallocate(output, output_size);
+    assert(arena.n_live == 0);
+
+    // no allocation for an empty input
+    output = NULL;
+    output_size = 0;
+    r = UTF::conv_utf8_to_utf32le(ascii.data(), 0, &output, &output_size, &consumed, &written, arena_alloc, UTF::Growth::EXACT);
+    assert(r == UTF::RetCode::OK && output == NULL && output_size == 0 && arena.n_allocations == 2);
+}
+
+/*
+ * Compare a container function with the getline-style version (same output, return code, consumed),
+ * appending to an empty container and to a container with some content
+ */
+template<typename src_type, typename dst_type, typename Container>
+static void do_test_container(const char *func_name,
+        UTF::RetCode (*conv)(const src_type *, size_t, dst_type **, size_t *, size_t *, size_t *),
+        UTF::RetCode (*conv_container)(const src_type *, size_t, Container &, size_t *, size_t *),
+        const src_type *src, size_t src_len) {
+    typedef typename Container::value_type T;
+    dst_type *ref = NULL;
+    size_t ref_size = 0, ref_consumed = 0, ref_written = 0;
+    UTF::RetCode ref_r = conv(src, src_len, &ref, &ref_size, &ref_consumed, &ref_written);
+    size_t ref_bytes = ref_written * sizeof(dst_type);
+    for (size_t prefix_len : {0, 5}) {
+        Container test_conv(prefix_len, T(7));
+        size_t consumed = 0, written = 0;
+        UTF::RetCode r = conv_container(src, src_len, test_conv, &consumed, &written);
+        bool ok = r == ref_r && consumed == ref_consumed && written * sizeof(T) == ref_bytes
+                && test_conv.size() == prefix_len + written
+                && std::count(test_conv.begin(), test_conv.begin() + prefix_len, T(7)) == (ssize_t) prefix_len
+                && (ref_bytes == 0 || memcmp(&test_conv[prefix_len], ref, ref_bytes) == 0);
+        if (!ok) {
+            printf("[container %zu] %s : KO (%d %d) (%zu %zu | %zu %zu)\n", prefix_len, func_name,
+                    (int) r, (int) ref_r, consumed, ref_consumed, written * sizeof(T), ref_bytes);
+            assert(ok);
+        }
+    }
+    free(ref);
+}
+
+/*
+ * Test the container functions with strings and vectors of bytes or of code units, on valid and invalid streams
+ */
+static void test_containers() {
+    std::vector<std::string> inputs = sample_streams(5000);
+
+    for (const std::string &utf8 : inputs) {
+        std::vector<char> utf16le, utf32be;
+        size_t consumed;
+        iconv_convert("UTF-16LE", "UTF-8", utf8.data(), utf8.size(), utf16le, &consumed);
+        iconv_convert("UTF-32BE", "UTF-8", utf8.data(), utf8.size(), utf32be, &consumed);
+        std::vector<uint32_t> codepoints;
+        UTF::decode_utf8(utf8.data(), utf8.size(), std::back_inserter(codepoints), &consumed, NULL);
+        codepoints.push_back(0xD800);
+        codepoints.push_back(0x41);
+
+        do_test_container<char, char, std::string>("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le, utf8.data(), utf8.size());
+        do_test_container<char, char, std::u16string>("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le, utf8.data(), utf8.size());
+        do_test_container<char, char, std::vector<char16_t> >("UTF-8 -> UTF-16BE", UTF::conv_utf8_to_utf16be, UTF::conv_utf8_to_utf16be, utf8.data(), utf8.size());
+        do_test_container<char, char, std::u32string>("UTF-8 -> UTF-32LE", UTF::conv_utf8_to_utf32le, UTF::conv_utf8_to_utf32le, utf8.data(), utf8.size());
+        do_test_container<char, char, std::vector<unsigned char> >("UTF-16LE -> UTF-8", UTF::conv_utf16le_to_utf8, UTF::conv_utf16le_to_utf8, utf16le.data(), utf16le.size());
+        do_test_container<char, char, std::vector<char32_t> >("UTF-16LE -> UTF-32BE", UTF::conv_utf16le_to_utf32be, UTF::conv_utf16le_to_utf32be, utf16le.data(), utf16le.size());
+        do_test_container<char, char, std::string>("UTF-32BE -> UTF-8", UTF::conv_utf32be_to_utf8, UTF::conv_utf32be_to_utf8, utf32be.data(), utf32be.size());
+        do_test_container<char, char, std::string>("UTF-8 -> GB18030", UTF::conv_utf8_to_gb18030, UTF::conv_utf8_to_gb18030, utf8.data(), utf8.size());
+        do_test_container<char, uint32_t, std::u32string>("UTF-8 -> UNICODE", UTF::decode_utf8, UTF::decode_utf8, utf8.data(), utf8.size());
+        do_test_container<char, uint32_t, std::vector<uint32_t> >("UTF-16LE -> UNICODE", UTF::decode_utf16le, UTF::decode_utf16le, utf16le.data(), utf16le.size());
+        do_test_container<uint32_t, char, std::string>("UNICODE -> UTF-8", UTF::encode_utf8, UTF::encode_utf8, codepoints.data(), codepoints.size());
+        do_test_container<uint32_t, char, std::u16string>("UNICODE -> UTF-16LE", UTF::encode_utf16le, UTF::encode_utf16le, codepoints.data(), codepoints.size());
+        do_test_container<uint32_t, char, std::vector<char> >("UNICODE -> LATIN-1", UTF::encode_latin1, UTF::encode_latin1, codepoints.data(), codepoints.size());
+    }
+
+    // the container is used as is when its capacity is large enough
+    std::string input_data = sample_text(5000);
+    std::u16string output;
+    output.reserve(100000);
+    const char16_t *data = output.data();
+    size_t consumed = 0, written = 0;
+    UTF::RetCode r = UTF::conv_utf8_to_utf16le(input_data.data(), input_data.size(), output, &consumed, &written);
+    assert(r == UTF::RetCode::OK && consumed == input_data.size() && written == output.size() && output.data() == data);
+}
+
+/*
+ * Compare the iterator version of a function with the getline-style version (same output, return code, consumed, written),
+ * for each kind of output : a std::back_inserter of a std::vector appended to, a pointer and a std::back_inserter of a std::deque
+ */
+template<typename src_type, typename dst_type, typename pointer_type>
+static void do_test_output_iterators(const char *func_name,
+        UTF::RetCode (*conv)(const src_type *, size_t, dst_type **, size_t *, size_t *, size_t *),
+        UTF::RetCode (*conv_vector)(const src_type *, size_t, std::back_insert_iterator<std::vector<dst_type> >, size_t *, size_t *),
+        UTF::RetCode (*conv_pointer)(const src_type *, size_t, pointer_type *, size_t *, size_t *),
+        UTF::RetCode (*conv_deque)(const src_type *, size_t, std::back_insert_iterator<std::deque<dst_type> >, size_t *, size_t *),
+        const src_type *src, size_t src_len) {
+    dst_type *ref = NULL;
+    size_t ref_size = 0, ref_consumed = 0, ref_written = 0;
+    UTF::RetCode ref_r = conv(src, src_len, &ref, &ref_size, &ref_consumed, &ref_written);
+
+    std::vector<dst_type> test_vector(3, dst_type(7));
+    size_t consumed = 0, written = 0;
+    UTF::RetCode r = conv_vector(src, src_len, std::back_inserter(test_vector), &consumed, &written);
+    bool ok = r == ref_r && consumed == ref_consumed && written == ref_written && test_vector.size() == 3 + written
+            && std::equal(test_vector.begin() + 3, test_vector.end(), ref);
+    if (!ok) {
+        printf("[output vector] %s : KO (%d %d) (%zu %zu | %zu %zu)\n", func_name, (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written);
+        assert(ok);
+    }
+
+    // exact size, the overflows are caught by the address sanitizer
+    std::vector<pointer_type> test_pointer(ref_written + 1, pointer_type(7));
+    r = conv_pointer(src, src_len, test_pointer.data(), &consumed, &written);
+    ok = r == ref_r && consumed == ref_consumed && written == ref_written && test_pointer[written] == pointer_type(7)
+            && std::equal(test_pointer.begin(), test_pointer.begin() + written, (const pointer_type *) ref);
+    if (!ok) {
+        printf("[output pointer] %s : KO (%d %d) (%zu %zu | %zu %zu)\n", func_name, (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written);
+        assert(ok);
+    }
+
+    std::deque<dst_type> test_deque;
+    r = conv_deque(src, src_len, std::back_inserter(test_deque), &consumed, &written);
+    ok = r == ref_r && consumed == ref_consumed && written == ref_written && std::equal(test_deque.begin(), test_deque.end(), ref);
+    if (!ok) {
+        printf("[output deque] %s : KO (%d %d) (%zu %zu | %zu %zu)\n", func_name, (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written);
+        assert(ok);
+    }
+    free(ref);
+}
+
+/*
+ * Test the contiguous outputs of the iterator functions against the getline-style functions, on valid and invalid streams
+ */
+static void test_output_iterators() {
+    std::vector<std::string> inputs = sample_streams(5000);
+
+    for (const std::string &utf8 : inputs) {
+        std::vector<char> utf16be;
+        size_t consumed;
+        iconv_convert("UTF-16BE", "UTF-8", utf8.data(), utf8.size(), utf16be, &consumed);
+        std::vector<uint32_t> codepoints;
+        UTF::decode_utf8(utf8.data(), utf8.size(), std::back_inserter(codepoints), &consumed, NULL);
+        codepoints.push_back(0x1F600);
+        codepoints.push_back(0x110000);
+        codepoints.push_back(0x41);
+
+        do_test_output_iterators<char, char, char>("UTF-8 -> UTF-16LE", UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le,
+                UTF::conv_utf8_to_utf16le, UTF::conv_utf8_to_utf16le, utf8.data(), utf8.size());
+        do_test_output_iterators<char, char, unsigned char>("UTF-8 -> UTF-32BE", UTF::conv_utf8_to_utf32be, UTF::conv_utf8_to_utf32be,
+                UTF::conv_utf8_to_utf32be, UTF::conv_utf8_to_utf32be, utf8.data(), utf8.size());
+        do_test_output_iterators<char, char, char>("UTF-16BE -> UTF-8", UTF::conv_utf16be_to_utf8, UTF::conv_utf16be_to_utf8,
+                UTF::conv_utf16be_to_utf8, UTF::conv_utf16be_to_utf8, utf16be.data(), utf16be.size());
+        do_test_output_iterators<char, char, char>("UTF-16BE -> UTF-32LE", UTF::conv_utf16be_to_utf32le, UTF::conv_utf16be_to_utf32le,
+                UTF::conv_utf16be_to_utf32le, UTF::conv_utf16be_to_utf32le, utf16be.data(), utf16be.size());
+        do_test_output_iterators<char, uint32_t, uint32_t>("UTF-8 -> UNICODE", UTF::decode_utf8, UTF::decode_utf8,
+                UTF::decode_utf8, UTF::decode_utf8, utf8.data(), utf8.size());
+        do_test_output_iterators<uint32_t, char, char>("UNICODE -> UTF-16BE", UTF::encode_utf16be, UTF::encode_utf16be,
+                UTF::encode_utf16be, UTF::encode_utf16be, codepoints.data(), codepoints.size());
+        do_test_output_iterators<uint32_t, char, unsigned char>("UNICODE -> UTF-8", UTF::encode_utf8, UTF::encode_utf8,
+                UTF::encode_utf8, UTF::encode_utf8, codepoints.data(), codepoints.size());
+    }
+}
+
+/*
+ * Compare an in-place function with the getline-style version. If the in-place conversion stopped because the output
+ * would overwrite the input, the output must be a prefix of the reference and the rest of the input must be untouched
+ */
+static void do_test_inplace(const char *func_name,
+        UTF::RetCode (*conv)(const char *, size_t, char **, size_t *, size_t *, size_t *),
+        UTF::RetCode (*conv_inplace)(char *, size_t, size_t *, size_t *),
+        const char *src, size_t src_len, bool may_stop) {
+    char *ref = NULL;
+    size_t ref_size = 0, ref_consumed = 0, ref_written = 0;
+    UTF::RetCode ref_r = conv(src, src_len, &ref, &ref_size, &ref_consumed, &ref_written);
+
+    std::vector<char> data(src, src + src_len);
+    size_t consumed = 0, written = 0;
+    UTF::RetCode r = conv_inplace(data.data(), data.size(), &consumed, &written);
+    bool ok;
+    if (r == UTF::RetCode::E_OUTPUT_FULL) {
+        ok = may_stop && consumed < ref_consumed && written <= consumed && written < ref_written
+                && std::equal(data.begin(), data.begin() + written, ref)
+                && std::equal(data.begin() + consumed, data.end(), src + consumed);
+    } else {
+        ok = r == ref_r && consumed == ref_consumed && written == ref_written && std::equal(data.begin(), data.begin() + written, ref);
+    }
+    if (!ok) {
+        printf("[inplace] %s : KO (%d %d) (%zu %zu | %zu %zu)\n", func_name, (int) r, (int) ref_r, consumed, ref_consumed, written, ref_written);
+        assert(ok);
+    }
+    free(ref);
+}
+
+/*
+ * Test the in-place functions on valid and invalid streams, and UTF-16 -> UTF-8 on mostly ASCII and on CJK texts
+ */
+static void test_inplace() {
+    std::string input_data = sample_text(20000);
+    std::string cjk;
+    while (cjk.size() < 20000) {
+        cjk += "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E abc ";
+    }
+    std::vector<std::string> inputs = sample_streams(20000);
+    inputs.push_back(cjk);
+    inputs.push_back(input_data + cjk.substr(0, 2800) + input_data);
+
+    for (const std::string &utf8 : inputs) {
+        std::vector<char> utf16le, utf16be, utf32le, utf32be;
+        size_t consumed;
+        iconv_convert("UTF-16LE", "UTF-8", utf8.data(), utf8.size(), utf16le, &consumed);
+        iconv_convert("UTF-16BE", "UTF-8", utf8.data(), utf8.size(), utf16be, &consumed);
+        iconv_convert("UTF-32LE", "UTF-8", utf8.data(), utf8.size(), utf32le, &consumed);
+        iconv_convert("UTF-32BE", "UTF-8", utf8.data(), utf8.size(), utf32be, &consumed);
+        // invalid tails : a lone surrogate and a codepoint out of range
+        utf16le.push_back('\x00');
+        utf16le.push_back('\xD8');
+        utf32be.insert(utf32be.end(), {'\x00', '\x11', '\x00', '\x00'});
+
+        do_test_inplace("UTF-16LE -> UTF-16BE", UTF::conv_utf16le_to_utf16be, UTF::conv_utf16le_to_utf16be_inplace, utf16le.data(), utf16le.size(), false);
+        do_test_inplace("UTF-16BE -> UTF-16LE", UTF::conv_utf16be_to_utf16le, UTF::conv_utf16be_to_utf16le_inplace, utf16be.data(), utf16be.size(), false);
+        do_test_inplace("UTF-32LE -> UTF-32BE", UTF::conv_utf32le_to_utf32be, UTF::conv_utf32le_to_utf32be_inplace, utf32le.data(), utf32le.size(), false);
+        do_test_inplace("UTF-32BE -> UTF-32LE", UTF::conv_utf32be_to_utf32le, UTF::conv_utf32be_to_utf32le_inplace, utf32be.data(), utf32be.size(), false);
+        do_test_inplace("UTF-32LE -> UTF-16LE", UTF::conv_utf32le_to_utf16le, UTF::conv_utf32le_to_utf16le_inplace, utf32le.data(), utf32le.size(), false);
+        do_test_inplace("UTF-32LE -> UTF-16BE", UTF::conv_utf32le_to_utf16be, UTF::conv_utf32le_to_utf16be_inplace, utf32le.data(), utf32le.size(), false);
+        do_test_inplace("UTF-32BE -> UTF-16LE", UTF::conv_utf32be_to_utf16le, UTF::conv_utf32be_to_utf16le_inplace, utf32be.data(), utf32be.size(), false);
+        do_test_inplace("UTF-32BE -> UTF-16BE", UTF::conv_utf32be_to_utf16be, UTF::conv_utf32be_to_utf16be_inplace, utf32be.data(), utf32be.size(), false);
+        do_test_inplace("UTF-32LE -> UTF-8", UTF::conv_utf32le_to_utf8, UTF::conv_utf32le_to_utf8_inplace, utf32le.data(), utf32le.size(), false);
+        do_test_inplace("UTF-32BE -> UTF-8", UTF::conv_utf32be_to_utf8, UTF::conv_utf32be_to_utf8_inplace, utf32be.data(), utf32be.size(), false);
+        do_test_inplace("UTF-16LE -> UTF-8", UTF::conv_utf16le_to_utf8, UTF::conv_utf16le_to_utf8_inplace, utf16le.data(), utf16le.size(), true);
+        do_test_inplace("UTF-16BE -> UTF-8", UTF::conv_utf16be_to_utf8, UTF::conv_utf16be_to_utf8_inplace, utf16be.data(), utf16be.size(), true);
+    }
+
+    // mostly ASCII : the CJK run fits behind the read position
+    std::vector<char> utf16le;
+    size_t consumed = 0, written = 0;
+    std::string utf8 = input_data + cjk.substr(0, 2800) + input_data;
+    iconv_convert("UTF-16LE", "UTF-8", utf8.data(), utf8.size(), utf16le, &consumed);
+    UTF::RetCode r = UTF::conv_utf16le_to_utf8_inplace(utf16le.data(), utf16le.size(), &consumed, &written);
+    assert(r == UTF::RetCode::OK && consumed == utf16le.size() && written == utf8.size() && std::equal(utf8.begin(), utf8.end(), utf16le.begin()));
+
+    // only CJK : the output outruns the input
+    std::string cjk_only;
+    while (cjk_only.size() < 3000) {
+        cjk_only += "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E";
+    }
+    iconv_convert("UTF-16LE", "UTF-8", cjk_only.data(), cjk_only.size(), utf16le, &consumed);
+    r = UTF::conv_utf16le_to_utf8_inplace(utf16le.data(), utf16le.size(), &consumed, &written);
+    assert(r == UTF::RetCode::E_OUTPUT_FULL && consumed < utf16le.size());
+}
+
+/*
+ * Walk a stream with CodepointRange<Read> : the characters must cover the stream, their codepoints must match Read::read
+ * (INVALID and one code unit on errors) and the decode function on valid streams. The backward walk, when the encoding allows it,
+ * must give the same characters.
+ */
+template<typename Range>
+static bool check_codepoints_backward(const Range &range, const std::vector<std::pair<size_t, uint32_t> > &chars, const char *src, std::true_type) {
+    typename Range::iterator it = range.end();
+    for (size_t i = chars.size(); i > 0; i--) {
+        --it;
+        if (it.position() != src + chars[i - 1].first || *it != chars[i - 1].second) {
+            return false;
+        }
+    }
+    return it == range.begin();
+}
+
+// forward only encodings
+template<typename Range>
+static bool check_codepoints_backward(const Range &, const std::vector<std::pair<size_t, uint32_t> > &, const char *, std::false_type) {
+    return true;
+}
+
+template<typename Read>
+static void do_test_codepoints(const char *func_name, const char *src, size_t src_len, size_t unit) {
+    typedef UTF::CodepointRange<Read> Range;
+    Range range(src, src_len);
+    std::vector<std::pair<size_t, uint32_t> > chars;
+    bool ok = true, valid = true;
+    size_t offset = 0;
+    for (typename Range::iterator it = range.begin(); it != range.end(); ++it) {
+        uint32_t cp;
+        int removed = Read::read(src + offset, src_len - offset, cp);
+        if (removed <= 0) {
+            ok = ok && *it == Range::iterator::INVALID && it.length() == std::min(unit, src_len - offset);
+            valid = false;
+        }
+        else {
+            ok = ok && *it == cp && it.length() == (size_t) removed;
+        }
+        ok = ok && it.position() == src + offset;
+        chars.push_back(std::make_pair(offset, *it));
+        offset += it.length();
+    }
+    ok = ok && offset == src_len && range.empty() == (src_len == 0);
+
+    if (valid) {
+        std::vector<uint32_t> ref, codepoints;
+        size_t consumed, written;
+        UTF::impl::unicode_decode<Read>(src, src_len, std::back_inserter(ref), &consumed, &written);
+        for (uint32_t cp : range) {
+            codepoints.push_back(cp);
+        }
+        ok = ok && codepoints == ref && (size_t) std::distance(range.begin(), range.end()) == ref.size();
+    }
+
+    ok = ok && check_codepoints_backward(range, chars, src, std::integral_constant<bool, UTF::impl::CodepointSteps<Read>::bidirectional>());
+
+    if (!ok) {
+        printf("[codepoints] %s : KO\n", func_name);
+        assert(ok);
+    }
+}
+
+/*
+ * Test the codepoint ranges on valid and invalid streams, with long ASCII runs and a reverse walk
+ */
+static void test_codepoints() {
+    std::string input_data = sample_text(5000);
+    std::string ascii(1000, 'a');
+    std::vector<std::string> inputs = sample_streams(5000);
+    inputs.insert(inputs.end(), {"\xC3\xA9", ascii + input_data + ascii, input_data.substr(0, 3000) + "\xFF\x80\xE2\x82" + input_data,
+            "\xE2\x82\xAC\x82"});
+
+    for (const std::string &utf8 : inputs) {
+        std::vector<char> utf16le, utf16be, utf32le, utf32be, latin1, gb18030;
+        size_t consumed;
+        iconv_convert("UTF-16LE", "UTF-8", utf8.data(), utf8.size(), utf16le, &consumed);
+        iconv_convert("UTF-16BE", "UTF-8", utf8.data(), utf8.size(), utf16be, &consumed);
+        iconv_convert("UTF-32LE", "UTF-8", utf8.data(), utf8.size(), utf32le, &consumed);
+        iconv_convert("UTF-32BE", "UTF-8", utf8.data(), utf8.size(), utf32be, &consumed);
+        iconv_convert("GB18030", "UTF-8", utf8.data(), utf8.size(), gb18030, &consumed);
+        // invalid tails : a lone high surrogate, a lone low surrogate, an odd byte and a codepoint out of range
+        utf16le.insert(utf16le.end(), {'\x00', '\xD8', '\x41', '\x00', '\x00', '\xDC', '\x41'});
+        utf16be.insert(utf16be.end(), {'\xD8', '\x00', '\xDC', '\x00', '\xDC', '\x00'});
+        utf32be.insert(utf32be.end(), {'\x00', '\x11', '\x00', '\x00', '\x00', '\x00'});
+        latin1.assign(utf8.begin(), utf8.end());
+
+        do_test_codepoints<UTF::impl::ReadUtf8Cp>("UTF-8", utf8.data(), utf8.size(), 1);
+        do_test_codepoints<UTF::impl::ReadUtf16leCp>("UTF-16LE", utf16le.data(), utf16le.size(), 2);
+        do_test_codepoints<UTF::impl::ReadUtf16beCp>("UTF-16BE", utf16be.data(), utf16be.size(), 2);
+        do_test_codepoints<UTF::impl::ReadUtf32leCp>("UTF-32LE", utf32le.data(), utf32le.size(), 4);
+        do_test_codepoints<UTF::impl::ReadUtf32beCp>("UTF-32BE", utf32be.data(), utf32be.size(), 4);
+        do_test_codepoints<UTF::impl::ReadLatin1Cp>("Latin-1", latin1.data(), latin1.size(), 1);
+        do_test_codepoints<UTF::impl::ReadSingleByteCp<UTF::impl::Windows1252> >("Windows-1252", latin1.data(), latin1.size(), 1);
+        do_test_codepoints<UTF::impl::ReadGbCp<UTF::impl::Gb18030> >("GB18030", gb18030.data(), gb18030.size(), 1);
+    }
+
+    // standard algorithms and reverse iterators
+    std::string utf8 = "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\xBA" + std::string(300, 'b');
+    UTF::CodepointRange<UTF::impl::ReadUtf8Cp> range = UTF::codepoints_utf8(utf8.data(), utf8.size());
+    assert(std::count(range.begin(), range.end(), 'b') == 300);
+    assert(std::find(range.begin(), range.end(), 0x20AC).position() == utf8.data() + 3);
+    std::vector<uint32_t> reversed(range.rbegin(), range.rend());
+    assert(reversed.size() == 304 && reversed[300] == 0x1F63A && reversed[303] == 'a');
+}
+
+/*
+ * Compare the offsets of a CodepointIndex<Read> with the positions of CodepointRange<Read>, for several steps
+ */
+template<typename Read>
+static void do_test_index(const char *func_name, const char *src, size_t src_len) {
+    std::vector<size_t> ref;
+    UTF::CodepointRange<Read> range(src, src_len);
+    for (typename UTF::CodepointRange<Read>::iterator it = range.begin(); it != range.end(); ++it) {
+        ref.push_back(it.position() - src);
+    }
+    ref.push_back(src_len);
+
+    for (size_t step : {1, 3, 64, 256, 1000}) {
+        UTF::CodepointIndex<Read> index;
+        UTF::RetCode r = index.build(src, src_len, step);
+        bool ok = r == UTF::RetCode::OK && index.length() + 1 == ref.size() && index.step() == step;
+        for (size_t k = 0; ok && k < ref.size(); k++) {
+            size_t offset = 0;
+            ok = index.offset(k, &offset) == UTF::RetCode::OK && offset == ref[k];
+        }
+        size_t offset;
+        ok = ok && index.offset(ref.size(), &offset) == UTF::RetCode::E_PARAMS;
+        if (!ok) {
+            printf("[index] %s (step %zu) : KO\n", func_name, step);
+            assert(ok);
+        }
+    }
+}
+
+/*
+ * Test the codepoint indexes on ASCII, mixed and CJK texts, and their errors
+ */
+static void test_index() {
+    std::string input_data = sample_text(5000);
+    std::string cjk;
+    while (cjk.size() < 5000) {
+        cjk += "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xF0\x9F\x98\xBA";
+    }
+    std::vector<std::string> inputs = {"", "a", "\xF0\x9F\x98\xBA", std::string(3000, 'a'), input_data, cjk, std::string(700, 'a') + cjk + input_data};
+
+    for (const std::string &utf8 : inputs) {
+        std::vector<char> utf16le, utf16be;
+        size_t consumed;
+        iconv_convert("UTF-16LE", "UTF-8", utf8.data(), utf8.size(), utf16le, &consumed);
+        iconv_convert("UTF-16BE", "UTF-8", utf8.data(), utf8.size(), utf16be, &consumed);
+        do_test_index<UTF::impl::ReadUtf8Cp>("UTF-8", utf8.data(), utf8.size());
+        do_test_index<UTF::impl::ReadUtf16leCp>("UTF-16LE", utf16le.data(), utf16le.size());
+        do_test_index<UTF::impl::ReadUtf16beCp>("UTF-16BE", utf16be.data(), utf16be.size());
+    }
+
+    UTF::Utf8Index index;
+    std::string invalid = input_data + "\xFF" + input_data;
+    assert(index.build(invalid.data(), invalid.size()) == UTF::RetCode::E_INVALID && index.length() == 0);
+    std::string truncated = input_data + "\xF0\x9F";
+    assert(index.build(truncated.data(), truncated.size()) == UTF::RetCode::E_TRUNCATED);
+    assert(index.build(input_data.data(), input_data.size(), 0) == UTF::RetCode::E_PARAMS);
+    assert(index.build(NULL, 0) == UTF::RetCode::OK && index.length() == 0);
+}
+
+/*
+ * Run all the tests with the active instruction set
+ */
+static void run_tests() {
     /* tests with valid datas */
     do_tests("simple", "chaîne UTF-8 simple 42€ çàéù");
     do_tests("empty", "");
@@ -581,12 +2333,41 @@ int main() {
         break;
     }
 
+    test_ascii_runs();
+    test_stream_converter();
+    test_parallel();
+    test_allocators();
+    test_containers();
+    test_output_iterators();
+    test_inplace();
+    test_codepoints();
+    test_index();
+
     /* test illegal sequences */
 
     test_utf8_decode_errors();
+    test_utf8_validate_random();
+    test_conv_random();
     test_utf16_decode_errors();
     test_utf32_decode_errors();
     test_encode_errors();
+    test_latin1();
+    test_latin1_random();
+    test_code_pages();
+    test_code_pages_random();
+    test_gb18030();
+    test_gb18030_random();
+}
+
+int main() {
+    /* run the tests with each instruction set supported by the CPU */
+    UTF::IsaLevel detected = UTF::detect_isa_level();
+    for (int level = UTF::IsaLevel::ISA_SCALAR; level <= detected; level++) {
+        UTF::IsaLevel selected = UTF::set_isa_level(UTF::IsaLevel(level));
+        assert(selected == level && UTF::get_isa_level() == level);
+        run_tests();
+    }
+    UTF::set_isa_level(detected);
 
     /* test and benchmark on a utf-8 sample file */
 
@@ -597,7 +2378,11 @@ int main() {
             input.clear();
             input.seekg(0);
         }
-        do_tests("test_file_big", input_data.c_str());
+        for (int level = UTF::IsaLevel::ISA_SCALAR; level <= detected; level++) {
+            UTF::set_isa_level(UTF::IsaLevel(level));
+            do_tests("test_file_big", input_data.c_str());
+        }
+        UTF::set_isa_level(detected);
         benchmark_utf8_utf16le(input_data.c_str());
         benchmark_utf16le_utf8(input_data.c_str());
         break;
@@ -19,17 +19,73 @@
 
 #include "utf_conv_impl.h"
 
+#include <string>
+#include <vector>
+
 namespace UTF {
 
 typedef impl::RetCode RetCode;
+typedef impl::IsaLevel IsaLevel;
+
+/*
+ * Output allocation of the getline-style functions
+ * The overloads taking an allocator use it instead of malloc / realloc : MallocAllocator or any standard Allocator
+ * (std::allocator<char>, std::pmr::polymorphic_allocator<char>, an arena allocator...), rebound to the output type.
+ * When the output is at most about twice the size of the input, the first allocation is large enough for any input.
+ * Otherwise Growth::GEOMETRIC (default) allocates half of the largest output and doubles it when it is full,
+ * and Growth::EXACT counts the output in a first pass over the input and allocates once.
+ * With shrink_to_fit, the output is reallocated to the written size at the end.
+ */
+typedef impl::Growth Growth;
+typedef impl::MallocAllocator MallocAllocator;
 
+/*
+ * Instruction set of the vectorized kernels
+ * The best instruction set supported by the CPU is selected on the first call, unless the UTF_CONV_ISA
+ * environment variable forces a lower one ("scalar", "swar", "sse42", "avx2" or "avx512").
+ * set_isa_level caps the requested instruction set to the CPU capabilities and returns the selected one.
+ */
+static inline IsaLevel detect_isa_level() {
+    return impl::simd::detect_isa_level();
+}
+static inline IsaLevel get_isa_level() {
+    return impl::simd::get_isa_level();
+}
+static inline IsaLevel set_isa_level(IsaLevel level) {
+    return impl::simd::set_isa_level(level);
+}
+
+/*
+ * Container overloads
+ * The output is appended to a std::string, std::u16string, std::u32string or std::vector, of bytes or of code units
+ * of the output encoding (char16_t for UTF-16, char32_t or uint32_t for UTF-32 and the codepoints). The container grows
+ * once and the conversion writes through a raw pointer, as with a caller-supplied buffer.
+ * *written is the number of elements appended to the container.
+ */
 #define CHARSET_CONV_FUNC(NAME, READ, CONVERT) \
 template<typename OutputIt> \
 static inline RetCode NAME (const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) { \
     return impl::unicode_conv<READ, CONVERT, OutputIt>(input, input_len, output, consumed, written); \
 } \
+template<typename CharT, typename Traits, typename Alloc> \
+static inline RetCode NAME (const char *input, size_t input_len, std::basic_string<CharT, Traits, Alloc> &output, size_t *consumed, size_t *written) { \
+    return impl::unicode_conv_to_container<READ, CONVERT>(input, input_len, output, consumed, written); \
+} \
+template<typename T, typename Alloc> \
+static inline RetCode NAME (const char *input, size_t input_len, std::vector<T, Alloc> &output, size_t *consumed, size_t *written) { \
+    return impl::unicode_conv_to_container<READ, CONVERT>(input, input_len, output, consumed, written); \
+} \
 static inline RetCode NAME (const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) { \
     return impl::unicode_conv<READ, CONVERT>(input, input_len, output, output_size, consumed, written); \
+} \
+template<typename Allocator> \
+static inline RetCode NAME (const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written, \
+        const Allocator &allocator, Growth growth = Growth::GEOMETRIC, bool shrink_to_fit = false) { \
+    impl::OutputAllocator<Allocator> alloc(allocator); \
+    return impl::unicode_conv<READ, CONVERT, Allocator>(input, input_len, output, output_size, consumed, written, alloc, growth, shrink_to_fit); \
+} \
+static inline RetCode NAME (const char *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written) { \
+    return impl::unicode_conv<READ, CONVERT>(input, input_len, output, output_len, consumed, written); \
 }
 
 #define CHARSET_DECODE_FUNC(NAME, READ) \
@@ -37,8 +93,25 @@ template<typename OutputIt> \
 static inline RetCode NAME (const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) { \
     return impl::unicode_decode<READ, OutputIt>(input, input_len, output, consumed, written); \
 } \
+template<typename CharT, typename Traits, typename Alloc> \
+static inline RetCode NAME (const char *input, size_t input_len, std::basic_string<CharT, Traits, Alloc> &output, size_t *consumed, size_t *written) { \
+    return impl::unicode_decode_to_container<READ>(input, input_len, output, consumed, written); \
+} \
+template<typename T, typename Alloc> \
+static inline RetCode NAME (const char *input, size_t input_len, std::vector<T, Alloc> &output, size_t *consumed, size_t *written) { \
+    return impl::unicode_decode_to_container<READ>(input, input_len, output, consumed, written); \
+} \
 static inline RetCode NAME (const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written) { \
     return impl::unicode_decode<READ>(input, input_len, output, output_size, consumed, written); \
+} \
+template<typename Allocator> \
+static inline RetCode NAME (const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written, \
+        const Allocator &allocator, Growth growth = Growth::GEOMETRIC, bool shrink_to_fit = false) { \
+    impl::OutputAllocator<Allocator> alloc(allocator); \
+    return impl::unicode_decode<READ, Allocator>(input, input_len, output, output_size, consumed, written, alloc, growth, shrink_to_fit); \
+} \
+static inline RetCode NAME (const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *consumed, size_t *written) { \
+    return impl::unicode_decode<READ>(input, input_len, output, output_len, consumed, written); \
 }
 
 #define CHARSET_DECODE_ONE_FUNC(NAME, READ) \
@@ -51,8 +124,36 @@ template<typename OutputIt> \
 static inline RetCode NAME (const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) { \
     return impl::unicode_encode<WRITE, OutputIt>(input, input_len, output, consumed, written); \
 } \
+template<typename CharT, typename Traits, typename Alloc> \
+static inline RetCode NAME (const uint32_t *input, size_t input_len, std::basic_string<CharT, Traits, Alloc> &output, size_t *consumed, size_t *written) { \
+    return impl::unicode_encode_to_container<WRITE>(input, input_len, output, consumed, written); \
+} \
+template<typename T, typename Alloc> \
+static inline RetCode NAME (const uint32_t *input, size_t input_len, std::vector<T, Alloc> &output, size_t *consumed, size_t *written) { \
+    return impl::unicode_encode_to_container<WRITE>(input, input_len, output, consumed, written); \
+} \
 static inline RetCode NAME (const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) { \
     return impl::unicode_encode<WRITE>(input, input_len, output, output_size, consumed, written); \
+} \
+template<typename Allocator> \
+static inline RetCode NAME (const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written, \
+        const Allocator &allocator, Growth growth = Growth::GEOMETRIC, bool shrink_to_fit = false) { \
+    impl::OutputAllocator<Allocator> alloc(allocator); \
+    return impl::unicode_encode<WRITE, Allocator>(input, input_len, output, output_size, consumed, written, alloc, growth, shrink_to_fit); \
+} \
+static inline RetCode NAME (const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written) { \
+    return impl::unicode_encode<WRITE>(input, input_len, output, output_len, consumed, written); \
+}
+
+/*
+ * In-place conversions, for the pairs whose output doesn't outrun the input : the endianness swaps,
+ * UTF-32 -> UTF-16, UTF-32 -> UTF-8 and UTF-16 -> UTF-8. The output overwrites the input from data.
+ * UTF-16 -> UTF-8 stops with E_OUTPUT_FULL if a character would overwrite the unread input
+ * (many characters above 0x7FF), data + *consumed is still the unconverted input.
+ */
+#define CHARSET_CONV_INPLACE_FUNC(NAME, READ, CONVERT) \
+static inline RetCode NAME (char *data, size_t data_len, size_t *consumed, size_t *written) { \
+    return impl::unicode_conv_inplace<READ, CONVERT>(data, data_len, consumed, written); \
 }
 
 #define CHARSET_VALIDATE(NAME, READ) \
@@ -60,6 +161,26 @@ static inline RetCode NAME (const char *input, size_t input_len, size_t *consume
     return impl::unicode_validate<READ>(input, input_len, consumed, length); \
 }
 
+/*
+ * Output size of a conversion, without converting
+ * The result is exact for a valid input (the input is not validated)
+ * X_length_from_Y return a number of bytes, unicode_length_from_Y a number of codepoints
+ */
+#define CHARSET_CONV_LENGTH_FUNC(NAME, READ, CONVERT) \
+static inline size_t NAME (const char *input, size_t input_len) { \
+    return impl::ConvLength<READ, CONVERT>::length(input, input_len); \
+}
+
+#define CHARSET_DECODE_LENGTH_FUNC(NAME, READ) \
+static inline size_t NAME (const char *input, size_t input_len) { \
+    return impl::DecodeLength<READ>::length(input, input_len); \
+}
+
+#define CHARSET_ENCODE_LENGTH_FUNC(NAME, WRITE) \
+static inline size_t NAME (const uint32_t *input, size_t input_len) { \
+    return impl::EncodeLength<WRITE>::length(input, input_len); \
+}
+
 
 CHARSET_CONV_FUNC(conv_utf8_to_utf16le, impl::ReadUtf8Cp, impl::CpToUtf16le)
 CHARSET_CONV_FUNC(conv_utf8_to_utf16be, impl::ReadUtf8Cp, impl::CpToUtf16be)
@@ -69,6 +190,10 @@ CHARSET_DECODE_FUNC(decode_utf8, impl::ReadUtf8Cp)
 CHARSET_DECODE_ONE_FUNC(decode_one_utf8, impl::ReadUtf8Cp)
 CHARSET_ENCODE_FUNC(encode_utf8, impl::CpToUtf8)
 CHARSET_VALIDATE(validate_utf8, impl::ReadUtf8Cp)
+CHARSET_CONV_LENGTH_FUNC(utf16_length_from_utf8, impl::ReadUtf8Cp, impl::CpToUtf16le)
+CHARSET_CONV_LENGTH_FUNC(utf32_length_from_utf8, impl::ReadUtf8Cp, impl::CpToUtf32le)
+CHARSET_DECODE_LENGTH_FUNC(unicode_length_from_utf8, impl::ReadUtf8Cp)
+CHARSET_ENCODE_LENGTH_FUNC(utf8_length_from_unicode, impl::CpToUtf8)
 
 CHARSET_CONV_FUNC(conv_utf16le_to_utf8, impl::ReadUtf16leCp, impl::CpToUtf8)
 CHARSET_CONV_FUNC(conv_utf16le_to_utf16be, impl::ReadUtf16leCp, impl::CpToUtf16be)
@@ -78,6 +203,10 @@ CHARSET_DECODE_FUNC(decode_utf16le, impl::ReadUtf16leCp)
 CHARSET_DECODE_ONE_FUNC(decode_one_utf16le, impl::ReadUtf16leCp)
 CHARSET_ENCODE_FUNC(encode_utf16le, impl::CpToUtf16le)
 CHARSET_VALIDATE(validate_utf16le, impl::ReadUtf16leCp)
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_utf16le, impl::ReadUtf16leCp, impl::CpToUtf8)
+CHARSET_CONV_LENGTH_FUNC(utf32_length_from_utf16le, impl::ReadUtf16leCp, impl::CpToUtf32le)
+CHARSET_DECODE_LENGTH_FUNC(unicode_length_from_utf16le, impl::ReadUtf16leCp)
+CHARSET_ENCODE_LENGTH_FUNC(utf16_length_from_unicode, impl::CpToUtf16le)
 
 CHARSET_CONV_FUNC(conv_utf16be_to_utf16le, impl::ReadUtf16beCp, impl::CpToUtf16le)
 CHARSET_CONV_FUNC(conv_utf16be_to_utf8, impl::ReadUtf16beCp, impl::CpToUtf8)
@@ -87,6 +216,9 @@ CHARSET_DECODE_FUNC(decode_utf16be, impl::ReadUtf16beCp)
 CHARSET_DECODE_ONE_FUNC(decode_one_utf16be, impl::ReadUtf16beCp)
 CHARSET_ENCODE_FUNC(encode_utf16be, impl::CpToUtf16be)
 CHARSET_VALIDATE(validate_utf16be, impl::ReadUtf16beCp)
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_utf16be, impl::ReadUtf16beCp, impl::CpToUtf8)
+CHARSET_CONV_LENGTH_FUNC(utf32_length_from_utf16be, impl::ReadUtf16beCp, impl::CpToUtf32le)
+CHARSET_DECODE_LENGTH_FUNC(unicode_length_from_utf16be, impl::ReadUtf16beCp)
 
 CHARSET_CONV_FUNC(conv_utf32le_to_utf16le, impl::ReadUtf32leCp, impl::CpToUtf16le)
 CHARSET_CONV_FUNC(conv_utf32le_to_utf16be, impl::ReadUtf32leCp, impl::CpToUtf16be)
@@ -96,6 +228,10 @@ CHARSET_DECODE_FUNC(decode_utf32le, impl::ReadUtf32leCp)
 CHARSET_DECODE_ONE_FUNC(decode_one_utf32le, impl::ReadUtf32leCp)
 CHARSET_ENCODE_FUNC(encode_utf32le, impl::CpToUtf32le)
 CHARSET_VALIDATE(validate_utf32le, impl::ReadUtf32leCp)
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_utf32le, impl::ReadUtf32leCp, impl::CpToUtf8)
+CHARSET_CONV_LENGTH_FUNC(utf16_length_from_utf32le, impl::ReadUtf32leCp, impl::CpToUtf16le)
+CHARSET_DECODE_LENGTH_FUNC(unicode_length_from_utf32le, impl::ReadUtf32leCp)
+CHARSET_ENCODE_LENGTH_FUNC(utf32_length_from_unicode, impl::CpToUtf32le)
 
 CHARSET_CONV_FUNC(conv_utf32be_to_utf16le, impl::ReadUtf32beCp, impl::CpToUtf16le)
 CHARSET_CONV_FUNC(conv_utf32be_to_utf16be, impl::ReadUtf32beCp, impl::CpToUtf16be)
@@ -105,8 +241,111 @@ CHARSET_DECODE_FUNC(decode_utf32be, impl::ReadUtf32beCp)
 CHARSET_DECODE_ONE_FUNC(decode_one_utf32be, impl::ReadUtf32beCp)
 CHARSET_ENCODE_FUNC(encode_utf32be, impl::CpToUtf32be)
 CHARSET_VALIDATE(validate_utf32be, impl::ReadUtf32beCp)
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_utf32be, impl::ReadUtf32beCp, impl::CpToUtf8)
+CHARSET_CONV_LENGTH_FUNC(utf16_length_from_utf32be, impl::ReadUtf32beCp, impl::CpToUtf16le)
+CHARSET_DECODE_LENGTH_FUNC(unicode_length_from_utf32be, impl::ReadUtf32beCp)
+
+CHARSET_CONV_INPLACE_FUNC(conv_utf16le_to_utf16be_inplace, impl::ReadUtf16leCp, impl::CpToUtf16be)
+CHARSET_CONV_INPLACE_FUNC(conv_utf16be_to_utf16le_inplace, impl::ReadUtf16beCp, impl::CpToUtf16le)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32le_to_utf32be_inplace, impl::ReadUtf32leCp, impl::CpToUtf32be)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32be_to_utf32le_inplace, impl::ReadUtf32beCp, impl::CpToUtf32le)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32le_to_utf16le_inplace, impl::ReadUtf32leCp, impl::CpToUtf16le)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32le_to_utf16be_inplace, impl::ReadUtf32leCp, impl::CpToUtf16be)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32be_to_utf16le_inplace, impl::ReadUtf32beCp, impl::CpToUtf16le)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32be_to_utf16be_inplace, impl::ReadUtf32beCp, impl::CpToUtf16be)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32le_to_utf8_inplace, impl::ReadUtf32leCp, impl::CpToUtf8)
+CHARSET_CONV_INPLACE_FUNC(conv_utf32be_to_utf8_inplace, impl::ReadUtf32beCp, impl::CpToUtf8)
+CHARSET_CONV_INPLACE_FUNC(conv_utf16le_to_utf8_inplace, impl::ReadUtf16leCp, impl::CpToUtf8)
+CHARSET_CONV_INPLACE_FUNC(conv_utf16be_to_utf8_inplace, impl::ReadUtf16beCp, impl::CpToUtf8)
+
+/*
+ * Latin-1 (ISO-8859-1)
+ * The conversions to Latin-1 fail with E_INVALID on the codepoints above 0xFF
+ */
+CHARSET_CONV_FUNC(conv_latin1_to_utf8, impl::ReadLatin1Cp, impl::CpToUtf8)
+CHARSET_CONV_FUNC(conv_latin1_to_utf16le, impl::ReadLatin1Cp, impl::CpToUtf16le)
+CHARSET_CONV_FUNC(conv_latin1_to_utf16be, impl::ReadLatin1Cp, impl::CpToUtf16be)
+CHARSET_CONV_FUNC(conv_latin1_to_utf32le, impl::ReadLatin1Cp, impl::CpToUtf32le)
+CHARSET_CONV_FUNC(conv_latin1_to_utf32be, impl::ReadLatin1Cp, impl::CpToUtf32be)
+CHARSET_DECODE_FUNC(decode_latin1, impl::ReadLatin1Cp)
+CHARSET_DECODE_ONE_FUNC(decode_one_latin1, impl::ReadLatin1Cp)
+CHARSET_ENCODE_FUNC(encode_latin1, impl::CpToLatin1)
+CHARSET_VALIDATE(validate_latin1, impl::ReadLatin1Cp)
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_latin1, impl::ReadLatin1Cp, impl::CpToUtf8)
+
+CHARSET_CONV_FUNC(conv_utf8_to_latin1, impl::ReadUtf8Cp, impl::CpToLatin1)
+CHARSET_CONV_FUNC(conv_utf16le_to_latin1, impl::ReadUtf16leCp, impl::CpToLatin1)
+CHARSET_CONV_FUNC(conv_utf16be_to_latin1, impl::ReadUtf16beCp, impl::CpToLatin1)
+CHARSET_CONV_FUNC(conv_utf32le_to_latin1, impl::ReadUtf32leCp, impl::CpToLatin1)
+CHARSET_CONV_FUNC(conv_utf32be_to_latin1, impl::ReadUtf32beCp, impl::CpToLatin1)
+CHARSET_CONV_LENGTH_FUNC(latin1_length_from_utf8, impl::ReadUtf8Cp, impl::CpToLatin1)
+
+/*
+ * Single-byte code pages (Windows-125x, ISO-8859-x, KOI8)
+ * The bytes not mapped by the code page are invalid, the conversions to a code page fail with E_INVALID
+ * on the codepoints it can't represent
+ */
+#define CHARSET_SINGLE_BYTE_FUNCS(NAME, PAGE) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf8, impl::ReadSingleByteCp<PAGE>, impl::CpToUtf8) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf16le, impl::ReadSingleByteCp<PAGE>, impl::CpToUtf16le) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf16be, impl::ReadSingleByteCp<PAGE>, impl::CpToUtf16be) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf32le, impl::ReadSingleByteCp<PAGE>, impl::CpToUtf32le) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf32be, impl::ReadSingleByteCp<PAGE>, impl::CpToUtf32be) \
+CHARSET_DECODE_FUNC(decode_ ## NAME, impl::ReadSingleByteCp<PAGE>) \
+CHARSET_DECODE_ONE_FUNC(decode_one_ ## NAME, impl::ReadSingleByteCp<PAGE>) \
+CHARSET_ENCODE_FUNC(encode_ ## NAME, impl::CpToSingleByte<PAGE>) \
+CHARSET_VALIDATE(validate_ ## NAME, impl::ReadSingleByteCp<PAGE>) \
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_ ## NAME, impl::ReadSingleByteCp<PAGE>, impl::CpToUtf8) \
+CHARSET_CONV_FUNC(conv_utf8_to_ ## NAME, impl::ReadUtf8Cp, impl::CpToSingleByte<PAGE>) \
+CHARSET_CONV_FUNC(conv_utf16le_to_ ## NAME, impl::ReadUtf16leCp, impl::CpToSingleByte<PAGE>) \
+CHARSET_CONV_FUNC(conv_utf16be_to_ ## NAME, impl::ReadUtf16beCp, impl::CpToSingleByte<PAGE>) \
+CHARSET_CONV_FUNC(conv_utf32le_to_ ## NAME, impl::ReadUtf32leCp, impl::CpToSingleByte<PAGE>) \
+CHARSET_CONV_FUNC(conv_utf32be_to_ ## NAME, impl::ReadUtf32beCp, impl::CpToSingleByte<PAGE>) \
+CHARSET_CONV_LENGTH_FUNC(NAME ## _length_from_utf8, impl::ReadUtf8Cp, impl::CpToSingleByte<PAGE>)
+
+CHARSET_SINGLE_BYTE_FUNCS(windows1250, impl::Windows1250)
+CHARSET_SINGLE_BYTE_FUNCS(windows1251, impl::Windows1251)
+CHARSET_SINGLE_BYTE_FUNCS(windows1252, impl::Windows1252)
+CHARSET_SINGLE_BYTE_FUNCS(iso8859_2, impl::Iso8859_2)
+CHARSET_SINGLE_BYTE_FUNCS(iso8859_5, impl::Iso8859_5)
+CHARSET_SINGLE_BYTE_FUNCS(iso8859_15, impl::Iso8859_15)
+CHARSET_SINGLE_BYTE_FUNCS(koi8r, impl::Koi8R)
+CHARSET_SINGLE_BYTE_FUNCS(koi8u, impl::Koi8U)
+
+#undef CHARSET_SINGLE_BYTE_FUNCS
+
+/*
+ * GB18030 and GBK (the one and two bytes sequences of GB18030, with 0x80 for the euro sign as in code page 936)
+ * The conversions fail with E_INVALID on the unmapped sequences and on the codepoints without sequence
+ */
+#define CHARSET_GB_FUNCS(NAME, CHARSET) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf8, impl::ReadGbCp<CHARSET>, impl::CpToUtf8) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf16le, impl::ReadGbCp<CHARSET>, impl::CpToUtf16le) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf16be, impl::ReadGbCp<CHARSET>, impl::CpToUtf16be) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf32le, impl::ReadGbCp<CHARSET>, impl::CpToUtf32le) \
+CHARSET_CONV_FUNC(conv_ ## NAME ## _to_utf32be, impl::ReadGbCp<CHARSET>, impl::CpToUtf32be) \
+CHARSET_DECODE_FUNC(decode_ ## NAME, impl::ReadGbCp<CHARSET>) \
+CHARSET_DECODE_ONE_FUNC(decode_one_ ## NAME, impl::ReadGbCp<CHARSET>) \
+CHARSET_ENCODE_FUNC(encode_ ## NAME, impl::CpToGb<CHARSET>) \
+CHARSET_VALIDATE(validate_ ## NAME, impl::ReadGbCp<CHARSET>) \
+CHARSET_CONV_LENGTH_FUNC(utf8_length_from_ ## NAME, impl::ReadGbCp<CHARSET>, impl::CpToUtf8) \
+CHARSET_CONV_FUNC(conv_utf8_to_ ## NAME, impl::ReadUtf8Cp, impl::CpToGb<CHARSET>) \
+CHARSET_CONV_FUNC(conv_utf16le_to_ ## NAME, impl::ReadUtf16leCp, impl::CpToGb<CHARSET>) \
+CHARSET_CONV_FUNC(conv_utf16be_to_ ## NAME, impl::ReadUtf16beCp, impl::CpToGb<CHARSET>) \
+CHARSET_CONV_FUNC(conv_utf32le_to_ ## NAME, impl::ReadUtf32leCp, impl::CpToGb<CHARSET>) \
+CHARSET_CONV_FUNC(conv_utf32be_to_ ## NAME, impl::ReadUtf32beCp, impl::CpToGb<CHARSET>) \
+CHARSET_CONV_LENGTH_FUNC(NAME ## _length_from_utf8, impl::ReadUtf8Cp, impl::CpToGb<CHARSET>)
+
+CHARSET_GB_FUNCS(gb18030, impl::Gb18030)
+CHARSET_GB_FUNCS(gbk, impl::Gbk)
+
+#undef CHARSET_GB_FUNCS
 
+#undef CHARSET_ENCODE_LENGTH_FUNC
+#undef CHARSET_DECODE_LENGTH_FUNC
+#undef CHARSET_CONV_LENGTH_FUNC
 #undef CHARSET_VALIDATE
+#undef CHARSET_CONV_INPLACE_FUNC
 #undef CHARSET_ENCODE_FUNC
 #undef CHARSET_DECODE_FUNC
 #undef CHARSET_DECODE_ONE_FUNC
@@ -0,0 +1,345 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include "utf_conv_simd.h"
+
+#ifndef UTF_CONV_DISPATCH_H_
+#define UTF_CONV_DISPATCH_H_
+
+/*
+ * Runtime selection of the vectorized kernels
+ *
+ * The kernels of utf_conv_simd.h are gathered in one table per instruction set.
+ * The active table is resolved on the first call, from the CPU features (cpuid)
+ * and the UTF_CONV_ISA environment variable ("scalar", "swar", "sse42", "avx2" or "avx512")
+ * which can force a lower instruction set, for benchmarks or tests.
+ * set_isa_level() changes the active table at runtime (it should not be called
+ * while a conversion is running in another thread).
+ */
+
+namespace UTF {
+namespace impl {
+namespace simd {
+
+/* Table of the kernels for one instruction set, indexed by big_endian when relevant */
+struct Kernels {
+    IsaLevel level;
+    size_t (*ascii_to_utf16[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*ascii_to_utf32[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf8_to_utf16[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf8_to_utf32[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf16_to_utf8[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf32_to_utf8[2])(const char *, size_t, char *, size_t, size_t *);
+    // indexed by [big_endian_in][big_endian_out]
+    size_t (*utf32_to_utf16[2][2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf16_to_utf32[2][2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf16_swap[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf32_swap[2])(const char *, size_t, char *, size_t, size_t *);
+    // to the host endianness (the vectorized kernels are only defined for x86, little endian)
+    size_t (*utf32_decode[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*validate_utf8)(const char *, size_t, size_t *);
+    size_t (*validate_utf32[2])(const char *, size_t, size_t *);
+    size_t (*utf8_length)(const char *, size_t, size_t *);
+    size_t (*utf16_length[2])(const char *, size_t, size_t *);
+    size_t (*utf32_length[2])(const char *, size_t, size_t *);
+    size_t (*latin1_to_utf8)(const char *, size_t, char *, size_t, size_t *);
+    size_t (*latin1_to_utf16[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*latin1_to_utf32[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf8_to_latin1)(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf16_to_latin1[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf32_to_latin1[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*single_byte_to_utf8)(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *);
+    size_t (*single_byte_to_utf16[2])(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *);
+    size_t (*single_byte_to_utf32[2])(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf8_to_single_byte)(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf16_to_single_byte[2])(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf32_to_single_byte[2])(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *);
+    size_t (*ascii_copy)(const char *, size_t, char *, size_t, size_t *);
+    size_t (*ascii_length)(const char *, size_t);
+    size_t (*utf16_to_ascii[2])(const char *, size_t, char *, size_t, size_t *);
+    size_t (*utf32_to_ascii[2])(const char *, size_t, char *, size_t, size_t *);
+};
+
+inline const Kernels &kernels_for(IsaLevel level) {
+    static const Kernels scalar_kernels = {
+            ISA_SCALAR,
+            {scalar::ascii_to_utf16<false>, scalar::ascii_to_utf16<true>},
+            {scalar::ascii_to_utf32<false>, scalar::ascii_to_utf32<true>},
+            {scalar::utf8_to_utf16<false>, scalar::utf8_to_utf16<true>},
+            {scalar::utf8_to_utf32<false>, scalar::utf8_to_utf32<true>},
+            {scalar::utf16_to_utf8<false>, scalar::utf16_to_utf8<true>},
+            {scalar::utf32_to_utf8<false>, scalar::utf32_to_utf8<true>},
+            {{scalar::utf32_to_utf16<false, false>, scalar::utf32_to_utf16<false, true>},
+             {scalar::utf32_to_utf16<true, false>, scalar::utf32_to_utf16<true, true>}},
+            {{scalar::utf16_to_utf32<false, false>, scalar::utf16_to_utf32<false, true>},
+             {scalar::utf16_to_utf32<true, false>, scalar::utf16_to_utf32<true, true>}},
+            {scalar::utf16_swap<false>, scalar::utf16_swap<true>},
+            {scalar::utf32_copy<false, true>, scalar::utf32_copy<true, true>},
+            {scalar::utf32_copy<false, false>, scalar::utf32_copy<true, true>},
+            scalar::validate_utf8,
+            {scalar::validate_utf32<false>, scalar::validate_utf32<true>},
+            scalar::utf8_length,
+            {scalar::utf16_length<false>, scalar::utf16_length<true>},
+            {scalar::utf32_length<false>, scalar::utf32_length<true>},
+            scalar::latin1_to_utf8,
+            {scalar::latin1_to_utf16<false>, scalar::latin1_to_utf16<true>},
+            {scalar::latin1_to_utf32<false>, scalar::latin1_to_utf32<true>},
+            scalar::utf8_to_latin1,
+            {scalar::utf16_to_latin1<false>, scalar::utf16_to_latin1<true>},
+            {scalar::utf32_to_latin1<false>, scalar::utf32_to_latin1<true>},
+            scalar::single_byte_to_utf8,
+            {scalar::single_byte_to_utf16<false>, scalar::single_byte_to_utf16<true>},
+            {scalar::single_byte_to_utf32<false>, scalar::single_byte_to_utf32<true>},
+            scalar::utf8_to_single_byte,
+            {scalar::utf16_to_single_byte<false>, scalar::utf16_to_single_byte<true>},
+            {scalar::utf32_to_single_byte<false>, scalar::utf32_to_single_byte<true>},
+            scalar::ascii_copy,
+            scalar::ascii_length,
+            {scalar::utf16_to_ascii<false>, scalar::utf16_to_ascii<true>},
+            {scalar::utf32_to_ascii<false>, scalar::utf32_to_ascii<true>}};
+    static const Kernels swar_kernels = {
+            ISA_SWAR,
+            {swar::ascii_to_utf16<false>, swar::ascii_to_utf16<true>},
+            {swar::ascii_to_utf32<false>, swar::ascii_to_utf32<true>},
+            {swar::utf8_to_utf16<false>, swar::utf8_to_utf16<true>},
+            {swar::utf8_to_utf32<false>, swar::utf8_to_utf32<true>},
+            {swar::utf16_to_utf8<false>, swar::utf16_to_utf8<true>},
+            {scalar::utf32_to_utf8<false>, scalar::utf32_to_utf8<true>},
+            {{scalar::utf32_to_utf16<false, false>, scalar::utf32_to_utf16<false, true>},
+             {scalar::utf32_to_utf16<true, false>, scalar::utf32_to_utf16<true, true>}},
+            {{swar::utf16_to_utf32<false, false>, swar::utf16_to_utf32<false, true>},
+             {swar::utf16_to_utf32<true, false>, swar::utf16_to_utf32<true, true>}},
+            {swar::utf16_swap<false>, swar::utf16_swap<true>},
+            {scalar::utf32_copy<false, true>, scalar::utf32_copy<true, true>},
+            {scalar::utf32_copy<false, false>, scalar::utf32_copy<true, true>},
+            swar::validate_utf8,
+            {scalar::validate_utf32<false>, scalar::validate_utf32<true>},
+            swar::utf8_length,
+            {swar::utf16_length<false>, swar::utf16_length<true>},
+            {scalar::utf32_length<false>, scalar::utf32_length<true>},
+            swar::latin1_to_utf8,
+            {swar::latin1_to_utf16<false>, swar::latin1_to_utf16<true>},
+            {swar::latin1_to_utf32<false>, swar::latin1_to_utf32<true>},
+            swar::utf8_to_latin1,
+            {swar::utf16_to_latin1<false>, swar::utf16_to_latin1<true>},
+            {scalar::utf32_to_latin1<false>, scalar::utf32_to_latin1<true>},
+            swar::single_byte_to_utf8,
+            {swar::single_byte_to_utf16<false>, swar::single_byte_to_utf16<true>},
+            {swar::single_byte_to_utf32<false>, swar::single_byte_to_utf32<true>},
+            swar::utf8_to_single_byte,
+            {swar::utf16_to_single_byte<false>, swar::utf16_to_single_byte<true>},
+            {scalar::utf32_to_single_byte<false>, scalar::utf32_to_single_byte<true>},
+            swar::ascii_copy,
+            swar::ascii_length,
+            {swar::utf16_to_ascii<false>, swar::utf16_to_ascii<true>},
+            {scalar::utf32_to_ascii<false>, scalar::utf32_to_ascii<true>}};
+#if defined(UTF_CONV_X86)
+    static const Kernels sse42_kernels = {
+            ISA_SSE42,
+            {sse42::ascii_to_utf16<false>, sse42::ascii_to_utf16<true>},
+            {sse42::ascii_to_utf32<false>, sse42::ascii_to_utf32<true>},
+            {sse42::utf8_to_utf16<false>, sse42::utf8_to_utf16<true>},
+            {sse42::utf8_to_utf32<false>, sse42::utf8_to_utf32<true>},
+            {sse42::utf16_to_utf8<false>, sse42::utf16_to_utf8<true>},
+            {sse42::utf32_to_utf8<false>, sse42::utf32_to_utf8<true>},
+            {{sse42::utf32_to_utf16<false, false>, sse42::utf32_to_utf16<false, true>},
+             {sse42::utf32_to_utf16<true, false>, sse42::utf32_to_utf16<true, true>}},
+            {{sse42::utf16_to_utf32<false, false>, sse42::utf16_to_utf32<false, true>},
+             {sse42::utf16_to_utf32<true, false>, sse42::utf16_to_utf32<true, true>}},
+            {sse42::utf16_swap<false>, sse42::utf16_swap<true>},
+            {sse42::utf32_copy<false, true>, sse42::utf32_copy<true, true>},
+            {sse42::utf32_copy<false, false>, sse42::utf32_copy<true, true>},
+            sse42::validate_utf8,
+            {sse42::validate_utf32<false>, sse42::validate_utf32<true>},
+            sse42::utf8_length,
+            {sse42::utf16_length<false>, sse42::utf16_length<true>},
+            {sse42::utf32_length<false>, sse42::utf32_length<true>},
+            sse42::latin1_to_utf8,
+            {sse42::latin1_to_utf16<false>, sse42::latin1_to_utf16<true>},
+            {sse42::latin1_to_utf32<false>, sse42::latin1_to_utf32<true>},
+            sse42::utf8_to_latin1,
+            {sse42::utf16_to_latin1<false>, sse42::utf16_to_latin1<true>},
+            {sse42::utf32_to_latin1<false>, sse42::utf32_to_latin1<true>},
+            sse42::single_byte_to_utf8,
+            {sse42::single_byte_to_utf16<false>, sse42::single_byte_to_utf16<true>},
+            {sse42::single_byte_to_utf32<false>, sse42::single_byte_to_utf32<true>},
+            sse42::utf8_to_single_byte,
+            {sse42::utf16_to_single_byte<false>, sse42::utf16_to_single_byte<true>},
+            {sse42::utf32_to_single_byte<false>, sse42::utf32_to_single_byte<true>},
+            sse42::ascii_copy,
+            sse42::ascii_length,
+            {sse42::utf16_to_ascii<false>, sse42::utf16_to_ascii<true>},
+            {sse42::utf32_to_ascii<false>, sse42::utf32_to_ascii<true>}};
+    static const Kernels avx2_kernels = {
+            ISA_AVX2,
+            {avx2::ascii_to_utf16<false>, avx2::ascii_to_utf16<true>},
+            {avx2::ascii_to_utf32<false>, avx2::ascii_to_utf32<true>},
+            {avx2::utf8_to_utf16<false>, avx2::utf8_to_utf16<true>},
+            {avx2::utf8_to_utf32<false>, avx2::utf8_to_utf32<true>},
+            {avx2::utf16_to_utf8<false>, avx2::utf16_to_utf8<true>},
+            {avx2::utf32_to_utf8<false>, avx2::utf32_to_utf8<true>},
+            {{avx2::utf32_to_utf16<false, false>, avx2::utf32_to_utf16<false, true>},
+             {avx2::utf32_to_utf16<true, false>, avx2::utf32_to_utf16<true, true>}},
+            {{avx2::utf16_to_utf32<false, false>, avx2::utf16_to_utf32<false, true>},
+             {avx2::utf16_to_utf32<true, false>, avx2::utf16_to_utf32<true, true>}},
+            {avx2::utf16_swap<false>, avx2::utf16_swap<true>},
+            {avx2::utf32_copy<false, true>, avx2::utf32_copy<true, true>},
+            {avx2::utf32_copy<false, false>, avx2::utf32_copy<true, true>},
+            avx2::validate_utf8,
+            {avx2::validate_utf32<false>, avx2::validate_utf32<true>},
+            avx2::utf8_length,
+            {avx2::utf16_length<false>, avx2::utf16_length<true>},
+            {avx2::utf32_length<false>, avx2::utf32_length<true>},
+            avx2::latin1_to_utf8,
+            {avx2::latin1_to_utf16<false>, avx2::latin1_to_utf16<true>},
+            {avx2::latin1_to_utf32<false>, avx2::latin1_to_utf32<true>},
+            avx2::utf8_to_latin1,
+            {avx2::utf16_to_latin1<false>, avx2::utf16_to_latin1<true>},
+            {avx2::utf32_to_latin1<false>, avx2::utf32_to_latin1<true>},
+            avx2::single_byte_to_utf8,
+            {avx2::single_byte_to_utf16<false>, avx2::single_byte_to_utf16<true>},
+            {avx2::single_byte_to_utf32<false>, avx2::single_byte_to_utf32<true>},
+            sse42::utf8_to_single_byte,
+            {sse42::utf16_to_single_byte<false>, sse42::utf16_to_single_byte<true>},
+            {sse42::utf32_to_single_byte<false>, sse42::utf32_to_single_byte<true>},
+            avx2::ascii_copy,
+            avx2::ascii_length,
+            {sse42::utf16_to_ascii<false>, sse42::utf16_to_ascii<true>},
+            {sse42::utf32_to_ascii<false>, sse42::utf32_to_ascii<true>}};
+    static const Kernels avx512_kernels = {
+            ISA_AVX512,
+            {avx512::ascii_to_utf16<false>, avx512::ascii_to_utf16<true>},
+            {avx512::ascii_to_utf32<false>, avx512::ascii_to_utf32<true>},
+            {avx512::utf8_to_utf16<false>, avx512::utf8_to_utf16<true>},
+            {avx2::utf8_to_utf32<false>, avx2::utf8_to_utf32<true>},
+            {avx2::utf16_to_utf8<false>, avx2::utf16_to_utf8<true>},
+            {avx2::utf32_to_utf8<false>, avx2::utf32_to_utf8<true>},
+            {{avx2::utf32_to_utf16<false, false>, avx2::utf32_to_utf16<false, true>},
+             {avx2::utf32_to_utf16<true, false>, avx2::utf32_to_utf16<true, true>}},
+            {{avx2::utf16_to_utf32<false, false>, avx2::utf16_to_utf32<false, true>},
+             {avx2::utf16_to_utf32<true, false>, avx2::utf16_to_utf32<true, true>}},
+            {avx512::utf16_swap<false>, avx512::utf16_swap<true>},
+            {avx512::utf32_copy<false, true>, avx512::utf32_copy<true, true>},
+            {avx512::utf32_copy<false, false>, avx512::utf32_copy<true, true>},
+            avx2::validate_utf8,
+            {avx512::validate_utf32<false>, avx512::validate_utf32<true>},
+            avx2::utf8_length,
+            {avx2::utf16_length<false>, avx2::utf16_length<true>},
+            {avx2::utf32_length<false>, avx2::utf32_length<true>},
+            avx2::latin1_to_utf8,
+            {avx2::latin1_to_utf16<false>, avx2::latin1_to_utf16<true>},
+            {avx2::latin1_to_utf32<false>, avx2::latin1_to_utf32<true>},
+            avx2::utf8_to_latin1,
+            {avx2::utf16_to_latin1<false>, avx2::utf16_to_latin1<true>},
+            {avx2::utf32_to_latin1<false>, avx2::utf32_to_latin1<true>},
+            avx2::single_byte_to_utf8,
+            {avx2::single_byte_to_utf16<false>, avx2::single_byte_to_utf16<true>},
+            {avx2::single_byte_to_utf32<false>, avx2::single_byte_to_utf32<true>},
+            sse42::utf8_to_single_byte,
+            {sse42::utf16_to_single_byte<false>, sse42::utf16_to_single_byte<true>},
+            {sse42::utf32_to_single_byte<false>, sse42::utf32_to_single_byte<true>},
+            avx2::ascii_copy,
+            avx2::ascii_length,
+            {sse42::utf16_to_ascii<false>, sse42::utf16_to_ascii<true>},
+            {sse42::utf32_to_ascii<false>, sse42::utf32_to_ascii<true>}};
+    switch (level) {
+    case ISA_AVX512:
+        return avx512_kernels;
+    case ISA_AVX2:
+        return avx2_kernels;
+    case ISA_SSE42:
+        return sse42_kernels;
+    default:
+        break;
+    }
+#endif
+    // the SWAR kernels are the best ones without vector instructions
+    return level >= ISA_SWAR ? swar_kernels : scalar_kernels;
+}
+
+/* Best instruction set supported by the CPU */
+inline IsaLevel detect_isa_level() {
+#if defined(UTF_CONV_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")
+            && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+        return ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt")) {
+        return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return ISA_SSE42;
+    }
+#endif
+    return ISA_SWAR;
+}
+
+/* Instruction set requested by the UTF_CONV_ISA environment variable, or the best supported one */
+inline IsaLevel requested_isa_level() {
+    IsaLevel detected = detect_isa_level();
+    const char *env = getenv("UTF_CONV_ISA");
+    if (env == NULL) {
+        return detected;
+    }
+    IsaLevel requested = detected;
+    if (strcmp(env, "scalar") == 0) {
+        requested = ISA_SCALAR;
+    } else if (strcmp(env, "swar") == 0) {
+        requested = ISA_SWAR;
+    } else if (strcmp(env, "sse42") == 0) {
+        requested = ISA_SSE42;
+    } else if (strcmp(env, "avx2") == 0) {
+        requested = ISA_AVX2;
+    } else if (strcmp(env, "avx512") == 0) {
+        requested = ISA_AVX512;
+    }
+    return requested < detected ? requested : detected;
+}
+
+inline std::atomic<const Kernels *> &active_kernels() {
+    static std::atomic<const Kernels *> active(&kernels_for(requested_isa_level()));
+    return active;
+}
+
+/* The kernels of the active instruction set */
+static inline __attribute__((always_inline))
+const Kernels &kernels() {
+    return *active_kernels().load(std::memory_order_relaxed);
+}
+
+/* Select the instruction set, capped to the one supported by the CPU. Return the selected instruction set */
+inline IsaLevel set_isa_level(IsaLevel level) {
+    IsaLevel detected = detect_isa_level();
+    if (level > detected) {
+        level = detected;
+    }
+    active_kernels().store(&kernels_for(level), std::memory_order_relaxed);
+    return level;
+}
+
+inline IsaLevel get_isa_level() {
+    return kernels().level;
+}
+
+}
+}
+}
+
+#endif /* UTF_CONV_DISPATCH_H_ */
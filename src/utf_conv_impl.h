@@ -16,8 +16,18 @@
 
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <iterator>
+#include <vector>
+#include <type_traits>
 #include <endian.h>
 #include "utf_conv.h"
+#include "utf_conv_dispatch.h"
+#include "utf_conv_codepages.h"
+#include "utf_conv_gb18030.h"
 
 #ifndef UTF_CONV_IMPL_H_
 #define UTF_CONV_IMPL_H_
@@ -27,29 +37,67 @@
  * - ReadUTf8Cp : read 1 codepoint from an UTF-8 stream
  * - ReadUTf16leCp / ReadUTf16beCp : read 1 codepoint from an UTF-16 stream
  * - ReadUTf32leCp / ReadUTf32beCp : read 1 codepoint from an UTF-32 stream
+ * - ReadLatin1Cp : read 1 codepoint from a Latin-1 (ISO-8859-1) stream
+ * - ReadSingleByteCp<Page> : read 1 codepoint from a stream in a single-byte code page (see utf_conv_codepages.h)
+ * - ReadGbCp<Charset> : read 1 codepoint from a GB18030 or GBK stream (see utf_conv_gb18030.h)
  * - CpToUtf8 : write 1 codepoint to an UTF-8 stream
  * - CpToUtf16le / CpToUtf16be : write 1 codepoint to an UTF-16 stream
  * - CpToUtf32le / CpToUtf32be : write 1 codepoint to an UTF-32 stream
+ * - CpToLatin1 : write 1 codepoint to a Latin-1 stream
+ * - CpToSingleByte<Page> : write 1 codepoint to a stream in a single-byte code page
+ * - CpToGb<Charset> : write 1 codepoint to a GB18030 or GBK stream
  *
  * The Read* classes return the number of bytes read (1 to 4) or -1 on error
  * The CpTo* classes return the number of bytes written (1 to 4) or -1 on error
+ * CpTo*::length(cp) returns the number of bytes written by CpTo*::write(cp)
+ * Read*::boundary(input, input_len, pos) returns the first character boundary at or after pos (or input_len),
+ * assuming input begins on a boundary. It is used to split the streams
  *
  * The Read* classes validate the input data (illegal codepoints, overlong encoding)
- * The CpTo* classes do not validate the input
+ * The CpTo* classes do not validate the input, except CpToLatin1, CpToSingleByte and CpToGb which fail on the codepoints
+ * they can't represent
+ *
+ * BulkConv<Read, Encode> is an optional vectorized kernel used by the conversion functions
+ * to process the easy parts of the stream (ASCII runs...) before falling back on Read and Encode
+ * BulkDecode<Read> is an optional vectorized kernel used by the decoding functions
+ * BulkEncode<Encode> is an optional vectorized kernel used by the encoding functions
+ * BulkValidate<Read> is an optional vectorized kernel used by the validation functions
+ * The vectorized kernels are selected at runtime (see utf_conv_dispatch.h)
+ *
+ * ConvLength<Read, Encode>, DecodeLength<Read> and EncodeLength<Encode> compute the output size of
+ * the conversions without converting (exact for valid inputs). The getline-style functions use them
+ * to allocate their output once.
+ *
+ * OutputAllocator<Allocator> allocates the output of the getline-style functions : malloc / realloc for
+ * MallocAllocator, or a standard Allocator (std::allocator, std::pmr::polymorphic_allocator, an arena...)
  *
  * Based on these classes, the following templated functions are defined :
  * - stream conversion :
  *   (1) template<typename Read, typename Encode, typename OutputIt> RetCode unicode_conv(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written)
  *   (2) template<typename Read, typename Encode> RetCode unicode_conv(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written)
+ *   (7) template<typename Read, typename Encode, typename Allocator> RetCode unicode_conv(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written, OutputAllocator<Allocator> &alloc, Growth growth, bool shrink_to_fit)
+ *   (6) template<typename Read, typename Encode> RetCode unicode_conv(const char *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written)
+ *   (8) template<typename Read, typename Encode, typename Container> RetCode unicode_conv_to_container(const char *input, size_t input_len, Container &output, size_t *consumed, size_t *written)
+ *   (9) template<typename Read, typename Encode> RetCode unicode_conv_inplace(char *data, size_t data_len, size_t *consumed, size_t *written)
  * - stream decoding :
  *   (1) template<typename Read, typename OutputIt> RetCode unicode_decode(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written)
  *   (2) template<typename Read> RetCode unicode_decode(const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written)
+ *   (7) template<typename Read, typename Allocator> RetCode unicode_decode(const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written, OutputAllocator<Allocator> &alloc, Growth growth, bool shrink_to_fit)
+ *   (6) template<typename Read> RetCode unicode_decode(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *consumed, size_t *written)
+ *   (8) template<typename Read, typename Container> RetCode unicode_decode_to_container(const char *input, size_t input_len, Container &output, size_t *consumed, size_t *written)
  *   (3) template<typename Read> RetCode unicode_decode_one(const char *input, size_t input_len, uint32_t *output, size_t *consumed)
  * - stream encoding :
  *   (1) template<typename Encode, typename OutputIt> RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written)
  *   (2) template<typename Encode> RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written)
+ *   (7) template<typename Encode, typename Allocator> RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written, OutputAllocator<Allocator> &alloc, Growth growth, bool shrink_to_fit)
+ *   (6) template<typename Encode> RetCode unicode_encode(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written)
+ *   (8) template<typename Encode, typename Container> RetCode unicode_encode_to_container(const uint32_t *input, size_t input_len, Container &output, size_t *consumed, size_t *written)
  * - stream validation and length counting :
  *   (4) template<typename Read> RetCode unicode_validate(const char *input, size_t input_len, size_t *consumed, size_t *length)
+ * - output size :
+ *   (5) ConvLength<Read, Encode>::length(const char *input, size_t input_len)
+ *       DecodeLength<Read>::length(const char *input, size_t input_len)
+ *       EncodeLength<Encode>::length(const uint32_t *input, size_t input_len)
  *
  * template parameters :
  * - Read : a Read* class
@@ -88,6 +136,35 @@
  *       consumed : store the number of elements read from input. If *consumed == input_len, there was no error
  *       length : store the number of unicode characters read from the input stream
  *       return : error code (OK, E_INVALID, E_TRUNCATED, E_PARAMS)
+ * (5) : the input is not validated
+ *       input : beginning of the input stream
+ *       input_len : number of elements in the input stream (!= byte size)
+ *       return : number of elements written by the conversion of a valid input (bytes, or codepoints for the decoders)
+ * (6) : the output is a caller-supplied buffer, nothing is allocated
+ *       input : beginning of the input stream
+ *       input_len : number of elements in the input stream (!= byte size)
+ *       output : beginning of the output buffer
+ *       output_len : number of elements available in output
+ *       consumed : store the number of elements read from input. If *consumed == input_len, there was no error
+ *       written : store the number of elements written into output
+ *       return : error code (OK, E_INVALID, E_TRUNCATED, E_PARAMS, E_OUTPUT_FULL)
+ *         E_OUTPUT_FULL : the next character doesn't fit in output, the conversion stopped on a character boundary
+ *         and can be resumed at input + *consumed with another buffer
+ * (7) : same as (2), the output is allocated by alloc (*output must come from the same allocator, with *output_size elements)
+ *       growth : EXACT computes the output size before converting and allocates once (as (2)),
+ *         GEOMETRIC skips this pass and doubles the output when it is full (starting from half of the largest output)
+ *       shrink_to_fit : reallocate the output to the written size at the end (*output is NULL if nothing was written)
+ * (8) : same as (1), the output is appended to output, a std::basic_string or a std::vector
+ *       (of bytes or of code units for conv and encode, of 32 bits integers for decode)
+ *       written : store the number of elements appended to output
+ * (9) : the output overwrites the input in data, for the conversions whose output doesn't outrun their input
+ *       data : beginning of the input stream, and of the output stream
+ *       data_len : number of bytes in the input stream
+ *       consumed : store the number of bytes read from data
+ *       written : store the number of bytes written at data
+ *       return : error code (OK, E_INVALID, E_TRUNCATED, E_PARAMS, E_OUTPUT_FULL)
+ *         E_OUTPUT_FULL : the next character would overwrite the unread input, the conversion stopped on a character
+ *         boundary and data + *consumed is still the unconverted input
  */
 
 namespace UTF {
@@ -95,6 +172,7 @@ namespace impl {
 
 /* Used to specialize the UTF-16 and UTF-32 encoders and decoders */
 struct BigEndian {
+    static const bool big_endian = true;
     static inline __attribute__((always_inline)) uint16_t from(uint16_t v) {
         return be16toh(v);
     }
@@ -109,6 +187,7 @@ struct BigEndian {
     }
 };
 struct LittleEndian {
+    static const bool big_endian = false;
     static inline __attribute__((always_inline)) uint16_t from(uint16_t v) {
         return le16toh(v);
     }
@@ -127,7 +206,14 @@ enum RetCode {
     OK = 0,
     E_INVALID = 1,
     E_TRUNCATED = 2,
-    E_PARAMS = 3
+    E_PARAMS = 3,
+    E_OUTPUT_FULL = 4
+};
+
+/* Output allocation of the getline-style functions (7) */
+enum Growth {
+    EXACT = 0,
+    GEOMETRIC = 1
 };
 
 /*
@@ -220,6 +306,15 @@ struct ReadUtf8Cp {
 
         return -1;
     }
+
+    static inline __attribute__((always_inline))
+    size_t boundary(const char *input, size_t input_len, size_t pos) {
+        // skip at most 3 continuation bytes
+        for (size_t i = 0; i < 3 && pos < input_len && (((uint8_t *) input)[pos] & 0b11000000) == 0b10000000; i++) {
+            pos++;
+        }
+        return pos < input_len ? pos : input_len;
+    }
 };
 
 /*
@@ -236,7 +331,10 @@ struct ReadUtf16Cp {
             return 0;
         }
 
-        uint16_t high = endianness::from(*(uint16_t*) input);
+        // memcpy : the input may be unaligned (e.g. chunks of a stream)
+        uint16_t high;
+        memcpy(&high, input, 2);
+        high = endianness::from(high);
 
         if (high <= 0xD7FF || high >= 0xE000) {
             cp_out = high;
@@ -245,7 +343,9 @@ struct ReadUtf16Cp {
             if (input_len < 4) {
                 return 0;
             }
-            uint16_t low = endianness::from(*(uint16_t*) (input + 2));
+            uint16_t low;
+            memcpy(&low, input + 2, 2);
+            low = endianness::from(low);
 
             if (low >= 0xDC00 && low <= 0xDFFF) {
                 cp_out = 0x10000 + (((high - 0xD800) << 10) | (low - 0xDC00));
@@ -255,6 +355,21 @@ struct ReadUtf16Cp {
 
         return -1;
     }
+
+    static inline __attribute__((always_inline))
+    size_t boundary(const char *input, size_t input_len, size_t pos) {
+        pos = (pos + 1) & ~size_t(1);
+        if (pos + 2 <= input_len) {
+            // don't split a surrogate pair
+            uint16_t unit;
+            memcpy(&unit, input + pos, 2);
+            unit = endianness::from(unit);
+            if (unit >= 0xDC00 && unit <= 0xDFFF) {
+                pos += 2;
+            }
+        }
+        return pos < input_len ? pos : input_len;
+    }
 };
 typedef ReadUtf16Cp<LittleEndian> ReadUtf16leCp;
 typedef ReadUtf16Cp<BigEndian> ReadUtf16beCp;
@@ -270,7 +385,9 @@ struct ReadUtf32Cp {
             return 0;
         }
 
-        uint32_t v = endianness::from(*(uint32_t*) input);
+        uint32_t v;
+        memcpy(&v, input, 4);
+        v = endianness::from(v);
 
         if (v <= 0xD7FF || (v >= 0xE000 && v <= 0x10FFFF)) {
             cp_out = v;
@@ -279,14 +396,42 @@ struct ReadUtf32Cp {
 
         return -1;
     }
+
+    static inline __attribute__((always_inline))
+    size_t boundary(const char *, size_t input_len, size_t pos) {
+        pos = (pos + 3) & ~size_t(3);
+        return pos < input_len ? pos : input_len;
+    }
 };
 typedef ReadUtf32Cp<LittleEndian> ReadUtf32leCp;
 typedef ReadUtf32Cp<BigEndian> ReadUtf32beCp;
 
+/*
+ * Latin-1 decoder, each byte is a codepoint
+ */
+struct ReadLatin1Cp {
+    static inline __attribute__((always_inline))
+    int read(const char *input, size_t input_len, uint32_t &cp_out) {
+        if (input_len == 0) {
+            return 0;
+        }
+        cp_out = *(uint8_t*) input;
+        return 1;
+    }
+
+    static inline __attribute__((always_inline))
+    size_t boundary(const char *, size_t input_len, size_t pos) {
+        return pos < input_len ? pos : input_len;
+    }
+};
+
 /*
  * UTF-8 encoder
  */
 struct CpToUtf8 {
+    /* size of a code unit, the container versions accept containers of bytes or of code units */
+    static const int unit_size = 1;
+
     template<typename OutputIt>
     static inline __attribute__((always_inline))
     int write(uint32_t cp, OutputIt output) {
@@ -310,6 +455,11 @@ struct CpToUtf8 {
             return 4;
         }
     }
+
+    static inline __attribute__((always_inline))
+    int length(uint32_t cp) {
+        return 1 + (cp > 0x7F) + (cp > 0x7FF) + (cp > 0xFFFF);
+    }
 };
 
 /*
@@ -317,6 +467,8 @@ struct CpToUtf8 {
  */
 template<typename endianness>
 struct CpToUtf16 {
+    static const int unit_size = 2;
+
     template<typename OutputIt>
     static inline __attribute__((always_inline))
     int write(uint32_t cp, OutputIt output) {
@@ -337,6 +489,25 @@ struct CpToUtf16 {
             return 4;
         }
     }
+
+    /* contiguous output : word-sized stores */
+    static inline __attribute__((always_inline))
+    int write(uint32_t cp, char *output) {
+        if (cp <= 0xD7FF || (cp >= 0xE000 && cp <= 0xFFFF)) {
+            uint16_t v = endianness::to(uint16_t(cp));
+            memcpy(output, &v, 2);
+            return 2;
+        }
+        cp -= 0x10000;
+        uint16_t v[2] = {endianness::to(uint16_t(0xD800 + (cp >> 10))), endianness::to(uint16_t(0xDC00 + (cp & 0x3FF)))};
+        memcpy(output, v, 4);
+        return 4;
+    }
+
+    static inline __attribute__((always_inline))
+    int length(uint32_t cp) {
+        return cp > 0xFFFF ? 4 : 2;
+    }
 };
 typedef CpToUtf16<LittleEndian> CpToUtf16le;
 typedef CpToUtf16<BigEndian> CpToUtf16be;
@@ -346,6 +517,8 @@ typedef CpToUtf16<BigEndian> CpToUtf16be;
  */
 template<typename endianness>
 struct CpToUtf32 {
+    static const int unit_size = 4;
+
     template<typename OutputIt>
     static inline __attribute__((always_inline))
     int write(uint32_t cp, OutputIt output) {
@@ -356,220 +529,2293 @@ struct CpToUtf32 {
         *output++ = (v >> 24) & 0xFF;
         return 4;
     }
+
+    /* contiguous output : word-sized store */
+    static inline __attribute__((always_inline))
+    int write(uint32_t cp, char *output) {
+        uint32_t v = endianness::to(uint32_t(cp));
+        memcpy(output, &v, 4);
+        return 4;
+    }
+
+    static inline __attribute__((always_inline))
+    int length(uint32_t) {
+        return 4;
+    }
 };
 typedef CpToUtf32<LittleEndian> CpToUtf32le;
 typedef CpToUtf32<BigEndian> CpToUtf32be;
 
 /*
- * Generic UTF conversion function, iterator version
- * output must accept char or unsigned char data
+ * Single-byte code page decoder, the unmapped bytes are invalid
  */
-template<typename Read, typename Encode, typename OutputIt>
-static inline __attribute__((always_inline))
-RetCode unicode_conv(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
-    RetCode ret = RetCode::OK;
-    size_t w = 0;
-    if (!input) {
-        return RetCode::E_PARAMS;
-    }
-    if (consumed) {
-        *consumed = 0;
-    }
-    while (input_len != 0) {
-        uint32_t cp;
-        int removed = Read::read(input, input_len, cp);
-        if (removed < 0) {
-            ret = RetCode::E_INVALID;
-            break;
+template<typename Page>
+struct ReadSingleByteCp {
+    static inline __attribute__((always_inline))
+    int read(const char *input, size_t input_len, uint32_t &cp_out) {
+        if (input_len == 0) {
+            return 0;
         }
-        if (removed == 0) {
-            ret = RetCode::E_TRUNCATED;
-            break;
+        uint8_t b = *(uint8_t*) input;
+        if (b < 0x80) {
+            cp_out = b;
+            return 1;
         }
-        input += removed;
-        input_len -= removed;
-
-        int encoded = Encode::write(cp, output);
-
-        if (consumed) {
-            *consumed += removed;
+        uint16_t cp = Page::upper()[b - 0x80];
+        if (cp == 0) {
+            return -1;
         }
-
-        w += encoded;
+        cp_out = cp;
+        return 1;
     }
 
-    if (written) {
-        *written = w;
+    static inline __attribute__((always_inline))
+    size_t boundary(const char *, size_t input_len, size_t pos) {
+        return pos < input_len ? pos : input_len;
     }
-    return ret;
-}
+};
 
 /*
- * Generic UTF conversion function, getline-style version
+ * Latin-1 encoder, nothing is written for the codepoints above 0xFF
  */
-template<typename Read, typename Encode>
-static inline __attribute__((always_inline))
-RetCode unicode_conv(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) {
-    RetCode ret = RetCode::OK;
-    size_t w = 0;
-    if (!input || !output || !output_size) {
-        return RetCode::E_PARAMS;
-    }
-    if (*output_size == 0) {
-        *output = NULL;
-    }
-    if (consumed) {
-        *consumed = 0;
-    }
-    while (input_len != 0) {
-        uint32_t cp;
-        int removed = Read::read(input, input_len, cp);
-        if (removed < 0) {
-            ret = RetCode::E_INVALID;
-            break;
-        }
-        if (removed == 0) {
-            ret = RetCode::E_TRUNCATED;
-            break;
-        }
-        input += removed;
-        input_len -= removed;
-
-        // more efficient than the iterator version because the avalaible size is checked less often
-        if (w + 4 > *output_size) {
-            *output_size += input_len * 2 + 8;
-            *output = (char *) realloc(*output, *output_size);
-        }
-
-        int encoded = Encode::write(cp, *output + w);
+struct CpToLatin1 {
+    static const int unit_size = 1;
 
-        if (consumed) {
-            *consumed += removed;
+    template<typename OutputIt>
+    static inline __attribute__((always_inline))
+    int write(uint32_t cp, OutputIt output) {
+        if (cp > 0xFF) {
+            return -1;
         }
-
-        w += encoded;
+        *output++ = cp & 0xFF;
+        return 1;
     }
 
-    if (written) {
-        *written = w;
+    static inline __attribute__((always_inline))
+    int length(uint32_t) {
+        return 1;
     }
-    return ret;
-}
+};
 
 /*
- * Generic UTF decoder, iterator version
- * output must accept uint32_t data for the codepoints
+ * Single-byte code page encoder, nothing is written for the unmapped codepoints
+ * The reverse lookup tables are computed on first use (see simd::SingleByteTables)
  */
-template<typename Read, typename OutputIt>
-static inline __attribute__((always_inline))
-RetCode unicode_decode(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
-    RetCode ret = RetCode::OK;
-    size_t w = 0;
-    if (!input) {
-        return RetCode::E_PARAMS;
-    }
-    if (consumed) {
-        *consumed = 0;
-    }
-    while (input_len != 0) {
-        uint32_t cp;
-        int removed = Read::read(input, input_len, cp);
-        if (removed < 0) {
-            ret = RetCode::E_INVALID;
-            break;
-        }
-        if (removed == 0) {
-            ret = RetCode::E_TRUNCATED;
-            break;
-        }
-        input += removed;
-        input_len -= removed;
-
-        *output++ = cp;
+template<typename Page>
+struct CpToSingleByte {
+    static const int unit_size = 1;
 
-        if (consumed) {
-            *consumed += removed;
+    template<typename OutputIt>
+    static inline __attribute__((always_inline))
+    int write(uint32_t cp, OutputIt output) {
+        int b = simd::single_byte_tables<Page>().encode(cp);
+        if (b < 0) {
+            return -1;
         }
-
-        w += 1;
+        *output++ = char(b);
+        return 1;
     }
 
-    if (written) {
-        *written = w;
+    static inline __attribute__((always_inline))
+    int length(uint32_t) {
+        return 1;
     }
-    return ret;
-}
+};
 
 /*
- * Generic UTF decoder, getline-style version
+ * Lookup tables of GB18030 computed on first use, in addition to the tables of utf_conv_gb18030.h
+ * - encode_block[encode_page[cp >> 8]][cp & 0xFF] is the sequence of the BMP codepoint cp : 1 + its index in two_bytes(),
+ *   FOUR_BYTES_BASE + the linear index of its four bytes sequence, or 0 if it has none. Only the pages with two bytes
+ *   sequences have a block, the others (encode_page 0) are made of consecutive four bytes sequences from page_linear
+ *   (0xFFFF for the surrogates)
+ * - decode_bucket[linear / 64] is the range of four_bytes_ranges() containing the linear index
+ * With the decoding tables, about 120 KB : the whole codec stays in L2
  */
-template<typename Read>
-static inline __attribute__((always_inline))
-RetCode unicode_decode(const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written) {
-    RetCode ret = RetCode::OK;
-    size_t w = 0;
-    if (!input || !output || !output_size) {
-        return RetCode::E_PARAMS;
-    }
-    if (*output_size == 0) {
-        *output = NULL;
-    }
-    if (consumed) {
-        *consumed = 0;
-    }
-    while (input_len != 0) {
-        uint32_t cp;
-        int removed = Read::read(input, input_len, cp);
-        if (removed < 0) {
-            ret = RetCode::E_INVALID;
-            break;
+struct Gb18030Tables {
+    static const uint32_t FOUR_BYTES_BASE = Gb18030::N_TWO_BYTES + 1;
+
+    uint8_t encode_page[256];
+    uint16_t page_linear[256];
+    uint16_t encode_block[Gb18030::N_PAGES + 1][256];
+    uint8_t decode_bucket[39420 / 64 + 1];
+
+    Gb18030Tables() {
+        memset(encode_page, 0, sizeof(encode_page));
+        memset(encode_block, 0, sizeof(encode_block));
+        for (size_t page = 0; page < 256; page++) {
+            page_linear[page] = 0xFFFF;
         }
-        if (removed == 0) {
-            ret = RetCode::E_TRUNCATED;
-            break;
+        const uint16_t *two_bytes = Gb18030::two_bytes();
+        size_t n_blocks = 1;
+        for (size_t i = 0; i < Gb18030::N_TWO_BYTES; i++) {
+            uint16_t cp = two_bytes[i];
+            if (cp == 0) {
+                continue;
+            }
+            if (encode_page[cp >> 8] == 0) {
+                encode_page[cp >> 8] = uint8_t(n_blocks++);
+            }
+            encode_block[encode_page[cp >> 8]][cp & 0xFF] = uint16_t(1 + i);
         }
-        input += removed;
-        input_len -= removed;
-
-        if (w + 1 > *output_size) {
-            *output_size += input_len  + 8;
-            *output = (uint32_t *) realloc(*output, (*output_size) * 4);
+        const Gb18030::Range *ranges = Gb18030::four_bytes_ranges();
+        for (size_t r = 0; r < Gb18030::N_RANGES; r++) {
+            for (uint32_t linear = ranges[r].linear; linear < ranges[r + 1].linear; linear++) {
+                if (linear % 64 == 0) {
+                    decode_bucket[linear / 64] = uint8_t(r);
+                }
+                if (ranges[r].cp == 0) {
+                    continue;
+                }
+                uint32_t cp = ranges[r].cp + (linear - ranges[r].linear);
+                if (encode_page[cp >> 8] != 0) {
+                    encode_block[encode_page[cp >> 8]][cp & 0xFF] = uint16_t(FOUR_BYTES_BASE + linear);
+                } else if ((cp & 0xFF) == 0) {
+                    page_linear[cp >> 8] = uint16_t(linear);
+                }
+            }
         }
-        (*output)[w] = cp;
+    }
 
-        if (consumed) {
-            *consumed += removed;
+    /* Sequence of a BMP codepoint (see encode_block) */
+    inline __attribute__((always_inline))
+    uint32_t encode(uint32_t cp) const {
+        uint8_t block = encode_page[cp >> 8];
+        if (block != 0) {
+            return encode_block[block][cp & 0xFF];
         }
+        uint16_t linear = page_linear[cp >> 8];
+        return linear != 0xFFFF ? FOUR_BYTES_BASE + linear + (cp & 0xFF) : 0;
+    }
 
-        w += 1;
+    /* Codepoint of a BMP four bytes sequence, 0 if it is unmapped */
+    inline __attribute__((always_inline))
+    uint32_t decode(uint32_t linear) const {
+        const Gb18030::Range *ranges = Gb18030::four_bytes_ranges();
+        size_t r = decode_bucket[linear / 64];
+        while (ranges[r + 1].linear <= linear) {
+            r++;
+        }
+        return ranges[r].cp != 0 ? ranges[r].cp + (linear - ranges[r].linear) : 0;
     }
 
-    if (written) {
-        *written = w;
+    /* Two bytes sequence of a codepoint above 0xFFFF, 0 if it has none */
+    static inline __attribute__((always_inline))
+    uint16_t two_bytes_supplementary(uint32_t cp) {
+        const Gb18030::Supplementary *table = Gb18030::two_bytes_supplementary();
+        if (cp < table[0].cp || cp > table[Gb18030::N_SUPPLEMENTARY - 1].cp) {
+            return 0;
+        }
+        for (size_t i = 0; i < Gb18030::N_SUPPLEMENTARY; i++) {
+            if (table[i].cp == cp) {
+                return table[i].code;
+            }
+        }
+        return 0;
     }
-    return ret;
+};
+
+inline const Gb18030Tables &gb18030_tables() {
+    static const Gb18030Tables tables;
+    return tables;
 }
 
 /*
- * UTF decoder, read only one sequence
+ * GB18030 decoder (Charset is Gb18030) or GBK decoder (Charset is Gbk, the four bytes sequences are invalid)
  */
-template<typename Read>
-static inline __attribute__((always_inline))
-RetCode unicode_decode_one(const char *input, size_t input_len, uint32_t *output, size_t *consumed) {
-    RetCode ret = RetCode::OK;
-    if (!input || input_len == 0) {
-        return RetCode::E_PARAMS;
-    }
-    if (consumed) {
-        *consumed = 0;
-    }
-
-    uint32_t cp;
-    int removed = Read::read(input, input_len, cp);
-    if (removed < 0) {
-        return RetCode::E_INVALID;
-    }
-    if (removed == 0) {
+template<typename Charset>
+struct ReadGbCp {
+    static inline __attribute__((always_inline))
+    int read(const char *input, size_t input_len, uint32_t &cp_out) {
+        if (input_len == 0) {
+            return 0;
+        }
+        const uint8_t *p = (const uint8_t *) input;
+        if (p[0] < 0x80) {
+            cp_out = p[0];
+            return 1;
+        }
+        if (p[0] == 0x80 || p[0] == 0xFF) {
+            if (p[0] == 0x80 && !Charset::FOUR_BYTES) {
+                cp_out = 0x20AC;
+                return 1;
+            }
+            return -1;
+        }
+        if (input_len < 2) {
+            return 0;
+        }
+        if (p[1] >= 0x40 && p[1] <= 0xFE && p[1] != 0x7F) {
+            size_t index = (p[0] - 0x81) * 190 + (p[1] < 0x7F ? p[1] - 0x40 : p[1] - 0x41);
+            uint32_t cp = Charset::two_bytes()[index];
+            cp_out = cp != 0 ? cp : supplementary(uint16_t(p[0] << 8 | p[1]));
+            return 2;
+        }
+        if (!Charset::FOUR_BYTES || p[1] < 0x30 || p[1] > 0x39) {
+            return -1;
+        }
+        if (input_len < 3) {
+            return 0;
+        }
+        if (p[2] < 0x81 || p[2] > 0xFE) {
+            return -1;
+        }
+        if (input_len < 4) {
+            return 0;
+        }
+        if (p[3] < 0x30 || p[3] > 0x39) {
+            return -1;
+        }
+        uint32_t linear = (((p[0] - 0x81) * 10 + p[1] - 0x30) * 126 + p[2] - 0x81) * 10 + p[3] - 0x30;
+        uint32_t cp;
+        if (linear < 39420) {
+            cp = gb18030_tables().decode(linear);
+        } else if (linear >= 189000 && linear <= 1237575) {
+            cp = linear - 189000 + 0x10000;
+        } else {
+            return -1;
+        }
+        if (cp == 0) {
+            return -1;
+        }
+        cp_out = cp;
+        return 4;
+    }
+
+    /*
+     * The trail bytes of the sequences are also valid lead bytes : go back to the last byte which can't be a trail byte
+     * (linear in the distance to this byte) and parse the sequence lengths up to pos
+     */
+    static inline __attribute__((always_inline))
+    size_t boundary(const char *input, size_t input_len, size_t pos) {
+        if (pos >= input_len) {
+            return input_len;
+        }
+        const uint8_t *p = (const uint8_t *) input;
+        size_t i = pos;
+        while (i > 0 && !anchor(p[i - 1])) {
+            i--;
+        }
+        while (i < pos) {
+            if (p[i] <= 0x80 || p[i] == 0xFF || i + 1 >= input_len) {
+                i += 1;
+            } else if (Charset::FOUR_BYTES && p[i + 1] >= 0x30 && p[i + 1] <= 0x39) {
+                i += 4;
+            } else {
+                i += 2;
+            }
+        }
+        return i < input_len ? i : input_len;
+    }
+
+private:
+    /* Bytes which are never the trail byte of a sequence */
+    static inline __attribute__((always_inline))
+    bool anchor(uint8_t b) {
+        return b < 0x30 || (b > 0x39 && b < 0x40) || b == 0x7F || b == 0x80 || b == 0xFF;
+    }
+
+    static inline uint32_t supplementary(uint16_t code) {
+        const Gb18030::Supplementary *table = Gb18030::two_bytes_supplementary();
+        for (size_t i = 0; i < Gb18030::N_SUPPLEMENTARY; i++) {
+            if (table[i].code == code) {
+                return table[i].cp;
+            }
+        }
+        return 0;
+    }
+};
+
+/*
+ * GB18030 or GBK encoder, nothing is written for the codepoints without sequence
+ * The two bytes sequences are preferred, the reverse lookup tables are computed on first use (see Gb18030Tables)
+ */
+template<typename Charset>
+struct CpToGb {
+    static const int unit_size = 1;
+
+    template<typename OutputIt>
+    static inline __attribute__((always_inline))
+    int write(uint32_t cp, OutputIt output) {
+        if (cp < 0x80) {
+            *output++ = char(cp);
+            return 1;
+        }
+        if (cp == 0x20AC && !Charset::FOUR_BYTES) {
+            *output++ = char(0x80);
+            return 1;
+        }
+        uint32_t sequence;
+        if (cp <= 0xFFFF) {
+            sequence = gb18030_tables().encode(cp);
+        } else {
+            uint16_t code = Gb18030Tables::two_bytes_supplementary(cp);
+            if (code != 0) {
+                *output++ = char(code >> 8);
+                *output++ = char(code & 0xFF);
+                return 2;
+            }
+            sequence = cp <= 0x10FFFF ? Gb18030Tables::FOUR_BYTES_BASE + 189000 + (cp - 0x10000) : 0;
+        }
+        if (sequence == 0) {
+            return -1;
+        }
+        if (sequence < Gb18030Tables::FOUR_BYTES_BASE) {
+            uint32_t index = sequence - 1;
+            uint32_t b2 = index % 190 + 0x40;
+            *output++ = char(0x81 + index / 190);
+            *output++ = char(b2 + (b2 >= 0x7F));
+            return 2;
+        }
+        if (!Charset::FOUR_BYTES) {
+            return -1;
+        }
+        uint32_t linear = sequence - Gb18030Tables::FOUR_BYTES_BASE;
+        *output++ = char(0x81 + linear / 12600);
+        *output++ = char(0x30 + linear / 1260 % 10);
+        *output++ = char(0x81 + linear / 10 % 126);
+        *output++ = char(0x30 + linear % 10);
+        return 4;
+    }
+
+    static inline __attribute__((always_inline))
+    int length(uint32_t cp) {
+        if (cp < 0x80 || (cp == 0x20AC && !Charset::FOUR_BYTES)) {
+            return 1;
+        }
+        if (cp <= 0xFFFF) {
+            uint32_t sequence = gb18030_tables().encode(cp);
+            return sequence < Gb18030Tables::FOUR_BYTES_BASE || !Charset::FOUR_BYTES ? 2 : 4;
+        }
+        return Gb18030Tables::two_bytes_supplementary(cp) != 0 || !Charset::FOUR_BYTES ? 2 : 4;
+    }
+};
+
+/*
+ * Bulk conversion kernels
+ * run() converts a prefix of input into output (at most output_len bytes are written)
+ * and returns the number of bytes read from input. The number of bytes written is stored in *written.
+ * The default implementation doesn't convert anything.
+ */
+template<typename Read, typename Encode>
+struct BulkConv {
+    static const bool enabled = false;
+    static inline __attribute__((always_inline))
+    size_t run(const char *, size_t, char *, size_t, size_t *written) {
+        *written = 0;
+        return 0;
+    }
+};
+
+/* UTF-8 to UTF-16 : direct transcoding of the validated blocks */
+template<typename endianness>
+struct BulkConv<ReadUtf8Cp, CpToUtf16<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf8_to_utf16[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-8 to UTF-32 : block decoding of the validated blocks */
+template<typename endianness>
+struct BulkConv<ReadUtf8Cp, CpToUtf32<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf8_to_utf32[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16 to UTF-8 : direct transcoding, the surrogate pairs are decoded one at a time */
+template<typename endianness>
+struct BulkConv<ReadUtf16Cp<endianness>, CpToUtf8> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf16_to_utf8[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32 to UTF-8 : the ASCII and BMP blocks are encoded with packs and shuffles */
+template<typename endianness>
+struct BulkConv<ReadUtf32Cp<endianness>, CpToUtf8> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_utf8[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32 to UTF-16 : narrow the BMP blocks, the surrogate pairs are only generated for the blocks above 0xFFFF */
+template<typename endianness_in, typename endianness_out>
+struct BulkConv<ReadUtf32Cp<endianness_in>, CpToUtf16<endianness_out> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_utf16[endianness_in::big_endian][endianness_out::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16 to UTF-32 : widen the blocks without surrogates */
+template<typename endianness_in, typename endianness_out>
+struct BulkConv<ReadUtf16Cp<endianness_in>, CpToUtf32<endianness_out> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf16_to_utf32[endianness_in::big_endian][endianness_out::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16LE to UTF-16BE : byte swap, the surrogate pairs are checked by blocks */
+template<>
+struct BulkConv<ReadUtf16Cp<LittleEndian>, CpToUtf16<BigEndian> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf16_swap[false](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16BE to UTF-16LE */
+template<>
+struct BulkConv<ReadUtf16Cp<BigEndian>, CpToUtf16<LittleEndian> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf16_swap[true](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32LE to UTF-32BE : byte swap and range check */
+template<>
+struct BulkConv<ReadUtf32Cp<LittleEndian>, CpToUtf32<BigEndian> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_swap[false](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32BE to UTF-32LE */
+template<>
+struct BulkConv<ReadUtf32Cp<BigEndian>, CpToUtf32<LittleEndian> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_swap[true](input, input_len, output, output_len, written);
+    }
+};
+
+/* Latin-1 to UTF-8 : the ASCII blocks are copied, the others are encoded with a shuffle table */
+template<>
+struct BulkConv<ReadLatin1Cp, CpToUtf8> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().latin1_to_utf8(input, input_len, output, output_len, written);
+    }
+};
+
+/* Latin-1 to UTF-16 : zero extension */
+template<typename endianness>
+struct BulkConv<ReadLatin1Cp, CpToUtf16<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().latin1_to_utf16[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* Latin-1 to UTF-32 : zero extension */
+template<typename endianness>
+struct BulkConv<ReadLatin1Cp, CpToUtf32<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().latin1_to_utf32[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-8 to Latin-1 : the continuation bytes of the 2 bytes sequences are removed with a shuffle table */
+template<>
+struct BulkConv<ReadUtf8Cp, CpToLatin1> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf8_to_latin1(input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16 to Latin-1 : narrow the blocks of code units below 0x100 */
+template<typename endianness>
+struct BulkConv<ReadUtf16Cp<endianness>, CpToLatin1> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf16_to_latin1[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32 to Latin-1 : narrow the blocks of codepoints below 0x100 */
+template<typename endianness>
+struct BulkConv<ReadUtf32Cp<endianness>, CpToLatin1> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_latin1[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* Single-byte code page to UTF-8 : the ASCII blocks are copied, the others are looked up with byte shuffles */
+template<typename Page>
+struct BulkConv<ReadSingleByteCp<Page>, CpToUtf8> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().single_byte_to_utf8(simd::single_byte_tables<Page>(), input, input_len, output, output_len, written);
+    }
+};
+
+/* Single-byte code page to UTF-16 : the ASCII blocks are widened, the others are looked up with byte shuffles */
+template<typename Page, typename endianness>
+struct BulkConv<ReadSingleByteCp<Page>, CpToUtf16<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().single_byte_to_utf16[endianness::big_endian](
+                simd::single_byte_tables<Page>(), input, input_len, output, output_len, written);
+    }
+};
+
+/* Single-byte code page to UTF-32 : the ASCII blocks are widened, the others are looked up with byte shuffles */
+template<typename Page, typename endianness>
+struct BulkConv<ReadSingleByteCp<Page>, CpToUtf32<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().single_byte_to_utf32[endianness::big_endian](
+                simd::single_byte_tables<Page>(), input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-8 to single-byte code page : the ASCII blocks are copied, the others use the reverse lookup tables */
+template<typename Page>
+struct BulkConv<ReadUtf8Cp, CpToSingleByte<Page> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf8_to_single_byte(simd::single_byte_tables<Page>(), input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16 to single-byte code page : the ASCII blocks are narrowed, the others use the reverse lookup tables */
+template<typename endianness, typename Page>
+struct BulkConv<ReadUtf16Cp<endianness>, CpToSingleByte<Page> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf16_to_single_byte[endianness::big_endian](
+                simd::single_byte_tables<Page>(), input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32 to single-byte code page : the ASCII blocks are narrowed, the others use the reverse lookup tables */
+template<typename endianness, typename Page>
+struct BulkConv<ReadUtf32Cp<endianness>, CpToSingleByte<Page> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_single_byte[endianness::big_endian](
+                simd::single_byte_tables<Page>(), input, input_len, output, output_len, written);
+    }
+};
+
+/* GB18030 and GBK to UTF-8 : copy the ASCII runs */
+template<typename Charset>
+struct BulkConv<ReadGbCp<Charset>, CpToUtf8> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        // called before each character : skip the dispatch inside the runs of double-byte characters
+        if ((uint8_t) input[0] >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().ascii_copy(input, input_len, output, output_len, written);
+    }
+};
+
+/* GB18030 and GBK to UTF-16 : widen the ASCII runs */
+template<typename Charset, typename endianness>
+struct BulkConv<ReadGbCp<Charset>, CpToUtf16<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        if ((uint8_t) input[0] >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().ascii_to_utf16[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* GB18030 and GBK to UTF-32 : widen the ASCII runs */
+template<typename Charset, typename endianness>
+struct BulkConv<ReadGbCp<Charset>, CpToUtf32<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        if ((uint8_t) input[0] >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().ascii_to_utf32[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-8 to GB18030 and GBK : copy the ASCII runs */
+template<typename Charset>
+struct BulkConv<ReadUtf8Cp, CpToGb<Charset> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        if ((uint8_t) input[0] >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().ascii_copy(input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-16 to GB18030 and GBK : narrow the ASCII runs */
+template<typename endianness, typename Charset>
+struct BulkConv<ReadUtf16Cp<endianness>, CpToGb<Charset> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        uint16_t unit = 0;
+        if (input_len >= 2) {
+            memcpy(&unit, input, 2);
+        }
+        if (endianness::from(unit) >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().utf16_to_ascii[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/* UTF-32 to GB18030 and GBK : narrow the ASCII runs */
+template<typename endianness, typename Charset>
+struct BulkConv<ReadUtf32Cp<endianness>, CpToGb<Charset> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        uint32_t cp = 0;
+        if (input_len >= 4) {
+            memcpy(&cp, input, 4);
+        }
+        if (endianness::from(cp) >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().utf32_to_ascii[endianness::big_endian](input, input_len, output, output_len, written);
+    }
+};
+
+/*
+ * Bulk decoding kernels
+ * run() decodes a prefix of input into output (at most output_len codepoints are written)
+ * and returns the number of bytes read from input. The number of codepoints written is stored in *written.
+ * The default implementation doesn't decode anything.
+ */
+template<typename Read>
+struct BulkDecode {
+    static const bool enabled = false;
+    static inline __attribute__((always_inline))
+    size_t run(const char *, size_t, uint32_t *, size_t, size_t *written) {
+        *written = 0;
+        return 0;
+    }
+};
+
+/* UTF-8 : block decoding of the validated blocks, to the host endianness (see utf32_decode) */
+template<>
+struct BulkDecode<ReadUtf8Cp> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *written) {
+        size_t read = simd::kernels().utf8_to_utf32[false](input, input_len, (char *) output, output_len * 4, written);
+        *written /= 4;
+        return read;
+    }
+};
+
+/* UTF-32 : copy or byte swap, and range check */
+template<typename endianness>
+struct BulkDecode<ReadUtf32Cp<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *written) {
+        size_t read = simd::kernels().utf32_decode[endianness::big_endian](input, input_len, (char *) output, output_len * 4, written);
+        *written /= 4;
+        return read;
+    }
+};
+
+/* Latin-1 : zero extension, to the host endianness */
+template<>
+struct BulkDecode<ReadLatin1Cp> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *written) {
+        size_t read = simd::kernels().latin1_to_utf32[false](input, input_len, (char *) output, output_len * 4, written);
+        *written /= 4;
+        return read;
+    }
+};
+
+/* Single-byte code page : lookup with byte shuffles, to the host endianness */
+template<typename Page>
+struct BulkDecode<ReadSingleByteCp<Page> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *written) {
+        size_t read = simd::kernels().single_byte_to_utf32[false](
+                simd::single_byte_tables<Page>(), input, input_len, (char *) output, output_len * 4, written);
+        *written /= 4;
+        return read;
+    }
+};
+
+/* GB18030 and GBK : widen the ASCII runs, to the host endianness */
+template<typename Charset>
+struct BulkDecode<ReadGbCp<Charset> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *written) {
+        if ((uint8_t) input[0] >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        size_t read = simd::kernels().ascii_to_utf32[false](input, input_len, (char *) output, output_len * 4, written);
+        *written /= 4;
+        return read;
+    }
+};
+
+/*
+ * Bulk encoding kernels
+ * run() encodes a prefix of input into output (at most output_len bytes are written)
+ * and returns the number of codepoints read from input. The number of bytes written is stored in *written.
+ * The input codepoints are in the host endianness (see utf32_decode). The default implementation doesn't encode anything.
+ */
+template<typename Encode>
+struct BulkEncode {
+    static const bool enabled = false;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *, size_t, char *, size_t, size_t *written) {
+        *written = 0;
+        return 0;
+    }
+};
+
+/* UTF-8 : range check, the ASCII and BMP blocks are encoded with packs and shuffles */
+template<>
+struct BulkEncode<CpToUtf8> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_utf8[false]((const char *) input, input_len * 4, output, output_len, written) / 4;
+    }
+};
+
+/* UTF-16 : range check, the BMP blocks are narrowed */
+template<typename endianness>
+struct BulkEncode<CpToUtf16<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_utf16[false][endianness::big_endian]((const char *) input, input_len * 4, output, output_len, written) / 4;
+    }
+};
+
+/* UTF-32 : range check, copy or byte swap */
+template<typename endianness>
+struct BulkEncode<CpToUtf32<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        const simd::Kernels &kernels = simd::kernels();
+        return (endianness::big_endian ? kernels.utf32_swap[false] : kernels.utf32_decode[false])(
+                (const char *) input, input_len * 4, output, output_len, written) / 4;
+    }
+};
+
+/* Latin-1 : narrow the blocks of codepoints below 0x100 */
+template<>
+struct BulkEncode<CpToLatin1> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_latin1[false]((const char *) input, input_len * 4, output, output_len, written) / 4;
+    }
+};
+
+/* Single-byte code page : the ASCII blocks are narrowed, the others use the reverse lookup tables */
+template<typename Page>
+struct BulkEncode<CpToSingleByte<Page> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        return simd::kernels().utf32_to_single_byte[false](
+                simd::single_byte_tables<Page>(), (const char *) input, input_len * 4, output, output_len, written) / 4;
+    }
+};
+
+/* GB18030 and GBK : narrow the ASCII runs */
+template<typename Charset>
+struct BulkEncode<CpToGb<Charset> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+        if (input[0] >= 0x80) {
+            *written = 0;
+            return 0;
+        }
+        return simd::kernels().utf32_to_ascii[false]((const char *) input, input_len * 4, output, output_len, written) / 4;
+    }
+};
+
+/*
+ * Calls of the bulk kernels from the generic loops
+ * The kernels are never called with the scalar instruction set, they don't process anything.
+ * Once a kernel has stopped on a character it can't process, the loop converts the next RETRY characters
+ * one at a time before calling it again : a run of such characters doesn't pay a kernel call for each one.
+ */
+class BulkGate {
+    enum { RETRY = 8 };
+    size_t m_skip; // characters to convert before the next call
+
+public:
+    explicit BulkGate(bool enabled) :
+            m_skip(enabled && simd::kernels().level != ISA_SCALAR ? 0 : std::numeric_limits<size_t>::max()) {
+    }
+
+    bool ready() {
+        if (m_skip != 0) {
+            m_skip--;
+            return false;
+        }
+        return true;
+    }
+
+    void stopped() {
+        m_skip = RETRY;
+    }
+};
+
+/*
+ * Bulk validation kernels
+ * run() validates a prefix of input and returns its size. The number of characters of the prefix is stored in *length.
+ * The prefix must end on a character boundary. The default implementation doesn't validate anything.
+ */
+template<typename Read>
+struct BulkValidate {
+    static const bool enabled = false;
+    static inline __attribute__((always_inline))
+    size_t run(const char *, size_t, size_t *length) {
+        *length = 0;
+        return 0;
+    }
+};
+
+/* UTF-8 : Keiser-Lemire validation */
+template<>
+struct BulkValidate<ReadUtf8Cp> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, size_t *length) {
+        return simd::kernels().validate_utf8(input, input_len, length);
+    }
+};
+
+/* UTF-32 : range check */
+template<typename endianness>
+struct BulkValidate<ReadUtf32Cp<endianness> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, size_t *length) {
+        return simd::kernels().validate_utf32[endianness::big_endian](input, input_len, length);
+    }
+};
+
+/* Latin-1 : every byte is a character */
+template<>
+struct BulkValidate<ReadLatin1Cp> {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *, size_t input_len, size_t *length) {
+        *length = input_len;
+        return input_len;
+    }
+};
+
+/* Single-byte code page : look for the first unmapped byte */
+template<typename Page>
+struct BulkValidate<ReadSingleByteCp<Page> > {
+    static const bool enabled = true;
+    static inline __attribute__((always_inline))
+    size_t run(const char *input, size_t input_len, size_t *length) {
+        const uint16_t *upper = Page::upper();
+        size_t i = 0;
+        for (; i < input_len; i++) {
+            uint8_t b = ((const uint8_t *) input)[i];
+            if (b >= 0x80 && upper[b - 0x80] == 0) {
+                break;
+            }
+        }
+        *length = i;
+        return i;
+    }
+};
+
+/*
+ * Output size of the conversions
+ * length() returns the number of bytes written by the conversion of input, exact if input is valid.
+ * max_length() returns an upper bound of this size for any input of input_len bytes.
+ * The default implementation reads the input one codepoint at a time.
+ */
+template<typename Read, typename Encode>
+struct ConvLength {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t len = 0;
+        while (input_len != 0) {
+            uint32_t cp;
+            int removed = Read::read(input, input_len, cp);
+            if (removed <= 0) {
+                break;
+            }
+            input += removed;
+            input_len -= removed;
+            len += Encode::length(cp);
+        }
+        return len;
+    }
+};
+
+/* UTF-8 to UTF-16 : 2 bytes per character, 4 for the 4 bytes sequences */
+template<typename endianness>
+struct ConvLength<ReadUtf8Cp, CpToUtf16<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t four_bytes;
+        size_t chars = simd::kernels().utf8_length(input, input_len, &four_bytes);
+        return (chars + four_bytes) * 2;
+    }
+};
+
+/* UTF-8 to UTF-32 : 4 bytes per character */
+template<typename endianness>
+struct ConvLength<ReadUtf8Cp, CpToUtf32<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t four_bytes;
+        return simd::kernels().utf8_length(input, input_len, &four_bytes) * 4;
+    }
+};
+
+/* UTF-16 to UTF-8 : 1 to 3 bytes per code unit */
+template<typename endianness>
+struct ConvLength<ReadUtf16Cp<endianness>, CpToUtf8> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len / 2 * 3;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t low_surrogates;
+        return simd::kernels().utf16_length[endianness::big_endian](input, input_len, &low_surrogates);
+    }
+};
+
+/* UTF-16 to UTF-16 : same size */
+template<typename endianness_in, typename endianness_out>
+struct ConvLength<ReadUtf16Cp<endianness_in>, CpToUtf16<endianness_out> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len & ~size_t(1);
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len & ~size_t(1);
+    }
+};
+
+/* UTF-16 to UTF-32 : 4 bytes per code unit, except for the low surrogates */
+template<typename endianness_in, typename endianness_out>
+struct ConvLength<ReadUtf16Cp<endianness_in>, CpToUtf32<endianness_out> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len / 2 * 4;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t low_surrogates;
+        simd::kernels().utf16_length[endianness_in::big_endian](input, input_len, &low_surrogates);
+        return (input_len / 2 - low_surrogates) * 4;
+    }
+};
+
+/* UTF-32 to UTF-8 : 1 to 4 bytes per codepoint */
+template<typename endianness>
+struct ConvLength<ReadUtf32Cp<endianness>, CpToUtf8> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len & ~size_t(3);
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t supplementary;
+        return simd::kernels().utf32_length[endianness::big_endian](input, input_len, &supplementary);
+    }
+};
+
+/* UTF-32 to UTF-16 : 2 bytes per codepoint, 4 for the supplementary planes */
+template<typename endianness_in, typename endianness_out>
+struct ConvLength<ReadUtf32Cp<endianness_in>, CpToUtf16<endianness_out> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len & ~size_t(3);
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t supplementary;
+        simd::kernels().utf32_length[endianness_in::big_endian](input, input_len, &supplementary);
+        return (input_len / 4 + supplementary) * 2;
+    }
+};
+
+/* UTF-32 to UTF-32 : same size */
+template<typename endianness_in, typename endianness_out>
+struct ConvLength<ReadUtf32Cp<endianness_in>, CpToUtf32<endianness_out> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len & ~size_t(3);
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len & ~size_t(3);
+    }
+};
+
+/* Latin-1 to UTF-8 : 2 bytes for the characters above 0x7F */
+template<>
+struct ConvLength<ReadLatin1Cp, CpToUtf8> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t len = input_len;
+        for (size_t i = 0; i < input_len; i++) {
+            len += ((const uint8_t *) input)[i] >> 7;
+        }
+        return len;
+    }
+};
+
+/* Latin-1 to UTF-16 : 2 bytes per character */
+template<typename endianness>
+struct ConvLength<ReadLatin1Cp, CpToUtf16<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len * 2;
+    }
+};
+
+/* Latin-1 to UTF-32 : 4 bytes per character */
+template<typename endianness>
+struct ConvLength<ReadLatin1Cp, CpToUtf32<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len * 4;
+    }
+};
+
+/* Single-byte code page to UTF-8 : 2 or 3 bytes for the bytes above 0x7F */
+template<typename Page>
+struct ConvLength<ReadSingleByteCp<Page>, CpToUtf8> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 3;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        const uint8_t *utf8_length = simd::single_byte_tables<Page>().utf8_length;
+        size_t len = 0, i = 0;
+        for (; i + 8 <= input_len; i += 8) {
+            // skip the ASCII words
+            uint64_t word;
+            memcpy(&word, input + i, 8);
+            if ((word & simd::swar::HIGH_BITS_8) == 0) {
+                len += 8;
+                continue;
+            }
+            for (size_t j = i; j < i + 8; j++) {
+                len += utf8_length[((const uint8_t *) input)[j]];
+            }
+        }
+        for (; i < input_len; i++) {
+            len += utf8_length[((const uint8_t *) input)[i]];
+        }
+        return len;
+    }
+};
+
+/* Single-byte code page to UTF-16 : 2 bytes per character (the code pages are in the BMP) */
+template<typename Page, typename endianness>
+struct ConvLength<ReadSingleByteCp<Page>, CpToUtf16<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len * 2;
+    }
+};
+
+/* Single-byte code page to UTF-32 : 4 bytes per character */
+template<typename Page, typename endianness>
+struct ConvLength<ReadSingleByteCp<Page>, CpToUtf32<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len * 4;
+    }
+};
+
+/*
+ * Output size of a conversion from an ASCII compatible encoding (UTF-8 or a multi-byte legacy encoding) :
+ * the ASCII words are counted at once, the other characters are decoded one at a time
+ */
+template<typename Read, typename Encode>
+static inline size_t legacy_conv_length(const char *input, size_t input_len) {
+    size_t len = 0, i = 0;
+    while (i < input_len) {
+        if (i + 8 <= input_len) {
+            uint64_t word;
+            memcpy(&word, input + i, 8);
+            if ((word & simd::swar::HIGH_BITS_8) == 0) {
+                len += 8 * Encode::length(0);
+                i += 8;
+                continue;
+            }
+        }
+        uint32_t cp;
+        int removed = Read::read(input + i, input_len - i, cp);
+        if (removed <= 0) {
+            break;
+        }
+        i += removed;
+        len += Encode::length(cp);
+    }
+    return len;
+}
+
+/* GB18030 and GBK to UTF-8 : at most 3 bytes per byte (the euro sign of GBK) */
+template<typename Charset>
+struct ConvLength<ReadGbCp<Charset>, CpToUtf8> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 3;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        return legacy_conv_length<ReadGbCp<Charset>, CpToUtf8>(input, input_len);
+    }
+};
+
+/* GB18030 and GBK to UTF-16 : at most 2 bytes per byte (the two bytes sequences above 0xFFFF) */
+template<typename Charset, typename endianness>
+struct ConvLength<ReadGbCp<Charset>, CpToUtf16<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        return legacy_conv_length<ReadGbCp<Charset>, CpToUtf16<endianness> >(input, input_len);
+    }
+};
+
+/* GB18030 and GBK to UTF-32 : 4 bytes per character */
+template<typename Charset, typename endianness>
+struct ConvLength<ReadGbCp<Charset>, CpToUtf32<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        return legacy_conv_length<ReadGbCp<Charset>, CpToUtf32<endianness> >(input, input_len);
+    }
+};
+
+/*
+ * Number of codepoints of the decoders
+ * Same semantics as ConvLength, the sizes are numbers of codepoints
+ */
+template<typename Read>
+struct DecodeLength {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t len = 0;
+        while (input_len != 0) {
+            uint32_t cp;
+            int removed = Read::read(input, input_len, cp);
+            if (removed <= 0) {
+                break;
+            }
+            input += removed;
+            input_len -= removed;
+            len += 1;
+        }
+        return len;
+    }
+};
+
+template<>
+struct DecodeLength<ReadUtf8Cp> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t four_bytes;
+        return simd::kernels().utf8_length(input, input_len, &four_bytes);
+    }
+};
+
+template<typename endianness>
+struct DecodeLength<ReadUtf16Cp<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len / 2;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t low_surrogates;
+        simd::kernels().utf16_length[endianness::big_endian](input, input_len, &low_surrogates);
+        return input_len / 2 - low_surrogates;
+    }
+};
+
+template<typename endianness>
+struct DecodeLength<ReadUtf32Cp<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len / 4;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len / 4;
+    }
+};
+
+template<>
+struct DecodeLength<ReadLatin1Cp> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len;
+    }
+};
+
+template<typename Page>
+struct DecodeLength<ReadSingleByteCp<Page> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const char *, size_t input_len) {
+        return input_len;
+    }
+};
+
+template<typename Charset>
+struct DecodeLength<ReadGbCp<Charset> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        // 1 UTF-32 code unit per codepoint
+        return legacy_conv_length<ReadGbCp<Charset>, CpToUtf32<LittleEndian> >(input, input_len) / 4;
+    }
+};
+
+/* UTF to Latin-1 : 1 byte per character, exact if there is no codepoint above 0xFF */
+template<typename Read>
+struct ConvLength<Read, CpToLatin1> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return DecodeLength<Read>::max_length(input_len);
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        return DecodeLength<Read>::length(input, input_len);
+    }
+};
+
+/* UTF to single-byte code page : 1 byte per character, exact if every character is mapped */
+template<typename Read, typename Page>
+struct ConvLength<Read, CpToSingleByte<Page> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return DecodeLength<Read>::max_length(input_len);
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        return DecodeLength<Read>::length(input, input_len);
+    }
+};
+
+/* UTF to GB18030 and GBK : at most 2 bytes per byte (the 2 bytes UTF-8 sequences are encoded on 4 bytes) */
+template<typename Read, typename Charset>
+struct ConvLength<Read, CpToGb<Charset> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        size_t len = 0;
+        while (input_len != 0) {
+            uint32_t cp;
+            int removed = Read::read(input, input_len, cp);
+            if (removed <= 0) {
+                break;
+            }
+            input += removed;
+            input_len -= removed;
+            len += CpToGb<Charset>::length(cp);
+        }
+        return len;
+    }
+};
+
+template<typename Charset>
+struct ConvLength<ReadUtf8Cp, CpToGb<Charset> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 2;
+    }
+    static inline size_t length(const char *input, size_t input_len) {
+        return legacy_conv_length<ReadUtf8Cp, CpToGb<Charset> >(input, input_len);
+    }
+};
+
+/*
+ * Output size of the encoders
+ * Same semantics as ConvLength, input_len is a number of codepoints
+ */
+template<typename Encode>
+struct EncodeLength {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const uint32_t *input, size_t input_len) {
+        size_t len = 0;
+        for (size_t i = 0; i < input_len; i++) {
+            len += Encode::length(input[i]);
+        }
+        return len;
+    }
+};
+
+template<>
+struct EncodeLength<CpToUtf8> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const uint32_t *input, size_t input_len) {
+        size_t supplementary;
+        return simd::kernels().utf32_length[__BYTE_ORDER == __BIG_ENDIAN]((const char *) input, input_len * 4, &supplementary);
+    }
+};
+
+template<typename endianness>
+struct EncodeLength<CpToUtf16<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const uint32_t *input, size_t input_len) {
+        size_t supplementary;
+        simd::kernels().utf32_length[__BYTE_ORDER == __BIG_ENDIAN]((const char *) input, input_len * 4, &supplementary);
+        return (input_len + supplementary) * 2;
+    }
+};
+
+template<typename endianness>
+struct EncodeLength<CpToUtf32<endianness> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len * 4;
+    }
+    static inline size_t length(const uint32_t *, size_t input_len) {
+        return input_len * 4;
+    }
+};
+
+template<>
+struct EncodeLength<CpToLatin1> {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const uint32_t *, size_t input_len) {
+        return input_len;
+    }
+};
+
+template<typename Page>
+struct EncodeLength<CpToSingleByte<Page> > {
+    static inline __attribute__((always_inline))
+    size_t max_length(size_t input_len) {
+        return input_len;
+    }
+    static inline size_t length(const uint32_t *, size_t input_len) {
+        return input_len;
+    }
+};
+
+/* Tag of the default allocator of the getline-style functions */
+struct MallocAllocator {
+};
+
+/*
+ * Output allocator of the getline-style functions, Allocator is a standard Allocator (rebound to the output type)
+ * reallocate returns a buffer of new_size elements beginning with the first used elements of ptr, and releases ptr
+ * (size elements, ptr is NULL if size is 0)
+ */
+template<typename Allocator>
+struct OutputAllocator {
+    Allocator alloc;
+
+    explicit OutputAllocator(const Allocator &a) : alloc(a) {
+    }
+
+    template<typename T>
+    inline T *reallocate(T *ptr, size_t size, size_t used, size_t new_size) {
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<T> TAlloc;
+        typedef std::allocator_traits<TAlloc> Traits;
+        TAlloc a(alloc);
+        T *new_ptr = new_size != 0 ? Traits::allocate(a, new_size) : NULL;
+        if (used != 0) {
+            memcpy(new_ptr, ptr, std::min(used, new_size) * sizeof(T));
+        }
+        if (ptr) {
+            Traits::deallocate(a, ptr, size);
+        }
+        return new_ptr;
+    }
+};
+
+/* malloc / realloc, as the getline-style functions (2) : the output can be grown in place */
+template<>
+struct OutputAllocator<MallocAllocator> {
+    explicit OutputAllocator(const MallocAllocator &) {
+    }
+
+    template<typename T>
+    inline T *reallocate(T *ptr, size_t, size_t, size_t new_size) {
+        if (new_size == 0) {
+            free(ptr);
+            return NULL;
+        }
+        return (T *) realloc(ptr, new_size * sizeof(T));
+    }
+};
+
+/*
+ * Size of the output of a getline-style function when it is full : w elements are written, the next character
+ * needs at most min_free elements and the rest of the input at most max_rest elements
+ */
+static inline __attribute__((always_inline))
+size_t grown_size(Growth growth, size_t size, size_t w, size_t min_free, size_t max_rest) {
+    if (growth == Growth::EXACT) {
+        // only on invalid inputs, the precomputed size was exact
+        return size + max_rest + 8;
+    }
+    return std::max(w + min_free, std::min(size * 2, w + min_free + max_rest));
+}
+
+/*
+ * First allocation of a getline-style function, in elements of unit bytes : the output of input_bytes bytes of input
+ * is at most max_size elements. The whole max_size when it is close to the input size (no counting pass),
+ * otherwise half of it with the geometric growth, and 0 with the exact growth : the output must be counted
+ */
+static inline __attribute__((always_inline))
+size_t first_size(Growth growth, size_t input_bytes, size_t max_size, size_t unit) {
+    if (max_size * unit <= input_bytes * 2 + 16) {
+        return max_size;
+    }
+    return growth == Growth::EXACT ? 0 : max_size / 2;
+}
+
+/*
+ * Outputs of the iterator versions, detected at compile time for elements of element_size bytes
+ * - PointerOutput : a pointer, the characters are written with word-sized stores
+ * - VectorOutput : a std::back_inserter of a std::vector, appended to as with the container versions
+ *   (the vector grows once and the conversion writes through a raw pointer)
+ * - GenericOutput : any other LegacyOutputIterator, written one element at a time
+ */
+struct GenericOutput {
+};
+struct PointerOutput {
+};
+struct VectorOutput {
+};
+
+template<typename OutputIt, size_t element_size>
+struct OutputKind {
+    typedef GenericOutput type;
+};
+template<typename T, size_t element_size>
+struct OutputKind<T *, element_size> {
+    typedef typename std::conditional<sizeof(T) == element_size, PointerOutput, GenericOutput>::type type;
+};
+template<typename T, typename Alloc, size_t element_size>
+struct OutputKind<std::back_insert_iterator<std::vector<T, Alloc> >, element_size> {
+    typedef typename std::conditional<sizeof(T) == element_size, VectorOutput, GenericOutput>::type type;
+};
+
+/* Container of a std::back_insert_iterator (its protected member) */
+template<typename Container>
+static inline Container &back_inserter_container(const std::back_insert_iterator<Container> &it) {
+    struct Access : std::back_insert_iterator<Container> {
+        static Container &get(const std::back_insert_iterator<Container> &it) {
+            return *(it.*&Access::container);
+        }
+    };
+    return Access::get(it);
+}
+
+/* Write a character with Encode and advance the output iterator */
+template<typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+int write_output(uint32_t cp, OutputIt &output) {
+    return Encode::template write<OutputIt &>(cp, output);
+}
+template<typename Encode>
+static inline __attribute__((always_inline))
+int write_output(uint32_t cp, char *&output) {
+    int encoded = Encode::write(cp, output);
+    if (encoded > 0) {
+        output += encoded;
+    }
+    return encoded;
+}
+
+/*
+ * Generic UTF conversion function, iterator version for the generic outputs and the pointers (as char *)
+ * output must accept char or unsigned char data
+ */
+template<typename Read, typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_conv_iterator(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input) {
+        return RetCode::E_PARAMS;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    BulkGate bulk(BulkConv<Read, Encode>::enabled);
+    while (input_len != 0) {
+        if (BulkConv<Read, Encode>::enabled && bulk.ready()) {
+            // convert into a small local buffer, still cheaper than Read + Encode for each character
+            char buffer[256];
+            size_t bulk_written;
+            size_t bulk_read = BulkConv<Read, Encode>::run(input, input_len, buffer, sizeof(buffer), &bulk_written);
+            if (bulk_read != 0) {
+                output = std::copy(buffer, buffer + bulk_written, output);
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp;
+        int removed = Read::read(input, input_len, cp);
+        if (removed < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (removed == 0) {
+            ret = RetCode::E_TRUNCATED;
+            break;
+        }
+        input += removed;
+        input_len -= removed;
+
+        int encoded = write_output<Encode>(cp, output);
+        if (encoded < 0) {
+            // not representable in the output charset
+            ret = RetCode::E_INVALID;
+            break;
+        }
+
+        if (consumed) {
+            *consumed += removed;
+        }
+
+        w += encoded;
+    }
+
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF conversion function, getline-style version with an allocator
+ */
+template<typename Read, typename Encode, typename Allocator>
+static inline __attribute__((always_inline))
+RetCode unicode_conv(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written,
+        OutputAllocator<Allocator> &alloc, Growth growth, bool shrink_to_fit) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input || !output || !output_size) {
+        return RetCode::E_PARAMS;
+    }
+    if (*output_size == 0) {
+        *output = NULL;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    // first allocation (see first_size), unless the buffer is already large enough for any input
+    // (4 more bytes : the size check below expects room for a whole character)
+    size_t max_length = ConvLength<Read, Encode>::max_length(input_len);
+    if (input_len != 0 && *output_size < max_length + 4) {
+        size_t needed = first_size(growth, input_len, max_length, 1);
+        if (needed == 0) {
+            needed = ConvLength<Read, Encode>::length(input, input_len);
+        }
+        needed += 4;
+        if (*output_size < needed) {
+            *output = alloc.reallocate(*output, *output_size, 0, needed);
+            *output_size = needed;
+        }
+    }
+    BulkGate bulk(BulkConv<Read, Encode>::enabled);
+    while (input_len != 0) {
+        if (BulkConv<Read, Encode>::enabled && bulk.ready()) {
+            size_t bulk_written;
+            size_t bulk_read = BulkConv<Read, Encode>::run(input, input_len, *output + w, *output_size - w, &bulk_written);
+            if (bulk_read != 0) {
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp;
+        int removed = Read::read(input, input_len, cp);
+        if (removed < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (removed == 0) {
+            ret = RetCode::E_TRUNCATED;
+            break;
+        }
+        input += removed;
+        input_len -= removed;
+
+        // more efficient than the iterator version because the avalaible size is checked less often
+        // with the exact growth, the buffer only grows here if the input was invalid
+        if (w + 4 > *output_size) {
+            size_t new_size = grown_size(growth, *output_size, w, 4, ConvLength<Read, Encode>::max_length(input_len));
+            *output = alloc.reallocate(*output, *output_size, w, new_size);
+            *output_size = new_size;
+        }
+
+        int encoded = Encode::write(cp, *output + w);
+        if (encoded < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+
+        if (consumed) {
+            *consumed += removed;
+        }
+
+        w += encoded;
+    }
+
+    if (shrink_to_fit && w != *output_size) {
+        *output = alloc.reallocate(*output, *output_size, w, w);
+        *output_size = w;
+    }
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF conversion function, getline-style version
+ */
+template<typename Read, typename Encode>
+static inline __attribute__((always_inline))
+RetCode unicode_conv(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) {
+    OutputAllocator<MallocAllocator> alloc((MallocAllocator()));
+    return unicode_conv<Read, Encode, MallocAllocator>(input, input_len, output, output_size, consumed, written, alloc, Growth::GEOMETRIC, false);
+}
+
+/*
+ * Generic UTF conversion function, fixed output buffer version
+ */
+template<typename Read, typename Encode>
+static inline __attribute__((always_inline))
+RetCode unicode_conv(const char *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input || (!output && output_len != 0)) {
+        return RetCode::E_PARAMS;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    BulkGate bulk(BulkConv<Read, Encode>::enabled);
+    while (input_len != 0) {
+        if (BulkConv<Read, Encode>::enabled && bulk.ready()) {
+            size_t bulk_written;
+            size_t bulk_read = BulkConv<Read, Encode>::run(input, input_len, output + w, output_len - w, &bulk_written);
+            if (bulk_read != 0) {
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp;
+        int removed = Read::read(input, input_len, cp);
+        if (removed < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (removed == 0) {
+            ret = RetCode::E_TRUNCATED;
+            break;
+        }
+
+        // the exact size is only needed near the end of the buffer
+        if (output_len - w < 4 && output_len - w < (size_t) Encode::length(cp)) {
+            ret = RetCode::E_OUTPUT_FULL;
+            break;
+        }
+        input += removed;
+        input_len -= removed;
+
+        int encoded = Encode::write(cp, output + w);
+        if (encoded < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+
+        if (consumed) {
+            *consumed += removed;
+        }
+
+        w += encoded;
+    }
+
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF conversion function, in-place version
+ * The input is converted by chunks into a small local buffer (the fixed output buffer version), copied back behind
+ * the read position : the bulk kernels never write over the unread input.
+ * A chunk whose output outruns its input is converted again one character at a time, until a character would
+ * overwrite the unread input (E_OUTPUT_FULL).
+ */
+template<typename Read, typename Encode>
+static inline
+RetCode unicode_conv_inplace(char *data, size_t data_len, size_t *consumed, size_t *written) {
+    RetCode ret = RetCode::OK;
+    size_t r = 0, w = 0;
+    if (!data && data_len != 0) {
+        return RetCode::E_PARAMS;
+    }
+    char buffer[4096];
+    while (r != data_len) {
+        size_t c = 0, n = 0;
+        ret = unicode_conv<Read, Encode>(data + r, data_len - r, buffer, sizeof(buffer), &c, &n);
+        if (w + n <= r + c) {
+            memcpy(data + w, buffer, n);
+            r += c;
+            w += n;
+            if (ret != RetCode::E_OUTPUT_FULL) {
+                break;
+            }
+            continue;
+        }
+
+        // the chunk was valid up to r + c, the errors after it are found by the next chunk
+        size_t chunk_end = r + c;
+        ret = RetCode::OK;
+        while (r != chunk_end) {
+            uint32_t cp;
+            int removed = Read::read(data + r, chunk_end - r, cp);
+            if (removed < 0) {
+                ret = RetCode::E_INVALID;
+                break;
+            }
+            if (removed == 0) {
+                ret = RetCode::E_TRUNCATED;
+                break;
+            }
+            int encoded = Encode::write(cp, buffer);
+            if (encoded < 0) {
+                ret = RetCode::E_INVALID;
+                break;
+            }
+            if (w + encoded > r + removed) {
+                ret = RetCode::E_OUTPUT_FULL;
+                break;
+            }
+            memcpy(data + w, buffer, encoded);
+            r += removed;
+            w += encoded;
+        }
+        if (ret != RetCode::OK) {
+            break;
+        }
+    }
+
+    if (consumed) {
+        *consumed = r;
+    }
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Raw output of the container versions : the bytes of output from the element start (NULL if there is none)
+ */
+template<typename Container>
+static inline __attribute__((always_inline))
+char *container_bytes(Container &output, size_t start) {
+    return output.size() != start ? (char *) &output[start] : NULL;
+}
+
+/*
+ * Generic UTF conversion function, container version
+ * The output is appended to a std::basic_string or a std::vector of bytes or of code units : the container grows once
+ * to the precomputed size (unless its capacity is large enough for any input), the fixed output buffer version writes
+ * through a raw pointer, and the container is resized to the written size
+ */
+template<typename Read, typename Encode, typename Container>
+static inline
+RetCode unicode_conv_to_container(const char *input, size_t input_len, Container &output, size_t *consumed, size_t *written) {
+    typedef typename Container::value_type T;
+    static_assert(sizeof(T) == 1 || sizeof(T) == Encode::unit_size, "the container must hold bytes or code units");
+    RetCode ret = RetCode::OK;
+    size_t start = output.size(), c = 0, w = 0;
+    if (!input) {
+        return RetCode::E_PARAMS;
+    }
+    size_t needed = ConvLength<Read, Encode>::max_length(input_len);
+    if ((output.capacity() - start) * sizeof(T) < needed) {
+        needed = ConvLength<Read, Encode>::length(input, input_len);
+    }
+    do {
+        output.resize(start + (w + needed + sizeof(T) - 1) / sizeof(T));
+        size_t step_consumed = 0, step_written = 0;
+        ret = unicode_conv<Read, Encode>(input + c, input_len - c, container_bytes(output, start) + w,
+                (output.size() - start) * sizeof(T) - w, &step_consumed, &step_written);
+        c += step_consumed;
+        w += step_written;
+        // only on invalid inputs, the precomputed size was exact (4 more bytes for a whole character)
+        needed = ConvLength<Read, Encode>::max_length(input_len - c) + 4;
+    } while (ret == RetCode::E_OUTPUT_FULL);
+    output.resize(start + (w + sizeof(T) - 1) / sizeof(T));
+
+    if (consumed) {
+        *consumed = c;
+    }
+    if (written) {
+        *written = output.size() - start;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF conversion function, iterator version
+ * output must accept char or unsigned char data
+ */
+template<typename Read, typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_conv(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, GenericOutput) {
+    return unicode_conv_iterator<Read, Encode>(input, input_len, output, consumed, written);
+}
+template<typename Read, typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_conv(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, PointerOutput) {
+    return unicode_conv_iterator<Read, Encode>(input, input_len, (char *) output, consumed, written);
+}
+template<typename Read, typename Encode, typename OutputIt>
+static inline
+RetCode unicode_conv(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, VectorOutput) {
+    return unicode_conv_to_container<Read, Encode>(input, input_len, back_inserter_container(output), consumed, written);
+}
+template<typename Read, typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_conv(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+    return unicode_conv<Read, Encode>(input, input_len, output, consumed, written, typename OutputKind<OutputIt, 1>::type());
+}
+
+/*
+ * Generic UTF decoder, iterator version for the generic outputs and the pointers
+ * output must accept uint32_t data for the codepoints
+ */
+template<typename Read, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_decode_iterator(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input) {
+        return RetCode::E_PARAMS;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    BulkGate bulk(BulkDecode<Read>::enabled);
+    while (input_len != 0) {
+        if (BulkDecode<Read>::enabled && bulk.ready()) {
+            uint32_t buffer[64];
+            size_t bulk_written;
+            size_t bulk_read = BulkDecode<Read>::run(input, input_len, buffer, 64, &bulk_written);
+            if (bulk_read != 0) {
+                output = std::copy(buffer, buffer + bulk_written, output);
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp;
+        int removed = Read::read(input, input_len, cp);
+        if (removed < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (removed == 0) {
+            ret = RetCode::E_TRUNCATED;
+            break;
+        }
+        input += removed;
+        input_len -= removed;
+
+        *output++ = cp;
+
+        if (consumed) {
+            *consumed += removed;
+        }
+
+        w += 1;
+    }
+
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF decoder, getline-style version with an allocator
+ */
+template<typename Read, typename Allocator>
+static inline __attribute__((always_inline))
+RetCode unicode_decode(const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written,
+        OutputAllocator<Allocator> &alloc, Growth growth, bool shrink_to_fit) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input || !output || !output_size) {
+        return RetCode::E_PARAMS;
+    }
+    if (*output_size == 0) {
+        *output = NULL;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    // first allocation (see first_size), unless the buffer is already large enough for any input
+    size_t max_length = DecodeLength<Read>::max_length(input_len);
+    if (input_len != 0 && *output_size < max_length) {
+        size_t needed = first_size(growth, input_len, max_length, sizeof(uint32_t));
+        if (needed == 0) {
+            needed = DecodeLength<Read>::length(input, input_len);
+        }
+        if (*output_size < needed) {
+            *output = alloc.reallocate(*output, *output_size, 0, needed);
+            *output_size = needed;
+        }
+    }
+    BulkGate bulk(BulkDecode<Read>::enabled);
+    while (input_len != 0) {
+        if (BulkDecode<Read>::enabled && bulk.ready()) {
+            size_t bulk_written;
+            size_t bulk_read = BulkDecode<Read>::run(input, input_len, *output + w, *output_size - w, &bulk_written);
+            if (bulk_read != 0) {
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp;
+        int removed = Read::read(input, input_len, cp);
+        if (removed < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (removed == 0) {
+            ret = RetCode::E_TRUNCATED;
+            break;
+        }
+        input += removed;
+        input_len -= removed;
+
+        if (w + 1 > *output_size) {
+            size_t new_size = grown_size(growth, *output_size, w, 1, DecodeLength<Read>::max_length(input_len));
+            *output = alloc.reallocate(*output, *output_size, w, new_size);
+            *output_size = new_size;
+        }
+        (*output)[w] = cp;
+
+        if (consumed) {
+            *consumed += removed;
+        }
+
+        w += 1;
+    }
+
+    if (shrink_to_fit && w != *output_size) {
+        *output = alloc.reallocate(*output, *output_size, w, w);
+        *output_size = w;
+    }
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF decoder, getline-style version
+ */
+template<typename Read>
+static inline __attribute__((always_inline))
+RetCode unicode_decode(const char *input, size_t input_len, uint32_t **output, size_t *output_size, size_t *consumed, size_t *written) {
+    OutputAllocator<MallocAllocator> alloc((MallocAllocator()));
+    return unicode_decode<Read, MallocAllocator>(input, input_len, output, output_size, consumed, written, alloc, Growth::GEOMETRIC, false);
+}
+
+/*
+ * Generic UTF decoder, fixed output buffer version
+ */
+template<typename Read>
+static inline __attribute__((always_inline))
+RetCode unicode_decode(const char *input, size_t input_len, uint32_t *output, size_t output_len, size_t *consumed, size_t *written) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input || (!output && output_len != 0)) {
+        return RetCode::E_PARAMS;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    BulkGate bulk(BulkDecode<Read>::enabled);
+    while (input_len != 0) {
+        if (BulkDecode<Read>::enabled && bulk.ready()) {
+            size_t bulk_written;
+            size_t bulk_read = BulkDecode<Read>::run(input, input_len, output + w, output_len - w, &bulk_written);
+            if (bulk_read != 0) {
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp;
+        int removed = Read::read(input, input_len, cp);
+        if (removed < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (removed == 0) {
+            ret = RetCode::E_TRUNCATED;
+            break;
+        }
+        if (w == output_len) {
+            ret = RetCode::E_OUTPUT_FULL;
+            break;
+        }
+        input += removed;
+        input_len -= removed;
+
+        output[w] = cp;
+
+        if (consumed) {
+            *consumed += removed;
+        }
+
+        w += 1;
+    }
+
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF decoder, container version
+ * The codepoints are appended to a std::basic_string or a std::vector of 32 bits integers (see unicode_conv)
+ */
+template<typename Read, typename Container>
+static inline
+RetCode unicode_decode_to_container(const char *input, size_t input_len, Container &output, size_t *consumed, size_t *written) {
+    typedef typename Container::value_type T;
+    static_assert(sizeof(T) == 4, "the container must hold 32 bits codepoints");
+    RetCode ret = RetCode::OK;
+    size_t start = output.size(), c = 0, w = 0;
+    if (!input) {
+        return RetCode::E_PARAMS;
+    }
+    size_t needed = DecodeLength<Read>::max_length(input_len);
+    if (output.capacity() - start < needed) {
+        needed = DecodeLength<Read>::length(input, input_len);
+    }
+    do {
+        output.resize(start + w + needed);
+        size_t step_consumed = 0, step_written = 0;
+        ret = unicode_decode<Read>(input + c, input_len - c, (uint32_t *) container_bytes(output, start) + w,
+                output.size() - start - w, &step_consumed, &step_written);
+        c += step_consumed;
+        w += step_written;
+        needed = DecodeLength<Read>::max_length(input_len - c) + 1;
+    } while (ret == RetCode::E_OUTPUT_FULL);
+    output.resize(start + w);
+
+    if (consumed) {
+        *consumed = c;
+    }
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF decoder, iterator version
+ * output must accept uint32_t data for the codepoints
+ */
+template<typename Read, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_decode(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, GenericOutput) {
+    return unicode_decode_iterator<Read>(input, input_len, output, consumed, written);
+}
+template<typename Read, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_decode(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, PointerOutput) {
+    return unicode_decode_iterator<Read>(input, input_len, output, consumed, written);
+}
+template<typename Read, typename OutputIt>
+static inline
+RetCode unicode_decode(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, VectorOutput) {
+    return unicode_decode_to_container<Read>(input, input_len, back_inserter_container(output), consumed, written);
+}
+template<typename Read, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_decode(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+    return unicode_decode<Read>(input, input_len, output, consumed, written, typename OutputKind<OutputIt, 4>::type());
+}
+
+/*
+ * UTF decoder, read only one sequence
+ */
+template<typename Read>
+static inline __attribute__((always_inline))
+RetCode unicode_decode_one(const char *input, size_t input_len, uint32_t *output, size_t *consumed) {
+    RetCode ret = RetCode::OK;
+    if (!input || input_len == 0) {
+        return RetCode::E_PARAMS;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+
+    uint32_t cp;
+    int removed = Read::read(input, input_len, cp);
+    if (removed < 0) {
+        return RetCode::E_INVALID;
+    }
+    if (removed == 0) {
         return RetCode::E_TRUNCATED;
     }
     *output = cp;
@@ -595,6 +2841,15 @@ RetCode unicode_validate(const char *input, size_t input_len, size_t *consumed,
     if (consumed) {
         *consumed = 0;
     }
+    if (BulkValidate<Read>::enabled) {
+        // the kernel stops before the first error, the loop below finds its exact position
+        size_t validated = BulkValidate<Read>::run(input, input_len, &w);
+        input += validated;
+        input_len -= validated;
+        if (consumed) {
+            *consumed += validated;
+        }
+    }
     while (input_len != 0) {
         uint32_t cp;
         int removed = Read::read(input, input_len, cp);
@@ -623,13 +2878,13 @@ RetCode unicode_validate(const char *input, size_t input_len, size_t *consumed,
 }
 
 /*
- * Generic UTF encoder, iterator version
+ * Generic UTF encoder, iterator version for the generic outputs and the pointers (as char *)
  * output must accept char or unsigned char data
  * The input is checked for validity
  */
 template<typename Encode, typename OutputIt>
 static inline __attribute__((always_inline))
-RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+RetCode unicode_encode_iterator(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
     RetCode ret = RetCode::OK;
     size_t w = 0;
     if (!input) {
@@ -638,7 +2893,25 @@ RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output,
     if (consumed) {
         *consumed = 0;
     }
+    BulkGate bulk(BulkEncode<Encode>::enabled);
     while (input_len != 0) {
+        if (BulkEncode<Encode>::enabled && bulk.ready()) {
+            char buffer[256];
+            size_t bulk_written;
+            size_t bulk_read = BulkEncode<Encode>::run(input, input_len, buffer, sizeof(buffer), &bulk_written);
+            if (bulk_read != 0) {
+                output = std::copy(buffer, buffer + bulk_written, output);
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
         uint32_t cp = *input;
         if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
             ret = RetCode::E_INVALID;
@@ -647,7 +2920,11 @@ RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output,
         input++;
         input_len--;
 
-        int encoded = Encode::write(cp, output);
+        int encoded = write_output<Encode>(cp, output);
+        if (encoded < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
 
         if (consumed) {
             *consumed += 1;
@@ -663,12 +2940,13 @@ RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output,
 }
 
 /*
- * Generic UTF encoder, getline-style version
+ * Generic UTF encoder, getline-style version with an allocator
  * The input is checked for validity
  */
-template<typename Encode>
+template<typename Encode, typename Allocator>
 static inline __attribute__((always_inline))
-RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) {
+RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written,
+        OutputAllocator<Allocator> &alloc, Growth growth, bool shrink_to_fit) {
     RetCode ret = RetCode::OK;
     size_t w = 0;
     if (!input || !output || !output_size) {
@@ -680,7 +2958,37 @@ RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, s
     if (consumed) {
         *consumed = 0;
     }
+    // first allocation (see first_size), unless the buffer is already large enough for any input
+    // (4 more bytes : the size check below expects room for a whole character)
+    size_t max_length = EncodeLength<Encode>::max_length(input_len);
+    if (input_len != 0 && *output_size < max_length + 4) {
+        size_t needed = first_size(growth, input_len * sizeof(uint32_t), max_length, 1);
+        if (needed == 0) {
+            needed = EncodeLength<Encode>::length(input, input_len);
+        }
+        needed += 4;
+        if (*output_size < needed) {
+            *output = alloc.reallocate(*output, *output_size, 0, needed);
+            *output_size = needed;
+        }
+    }
+    BulkGate bulk(BulkEncode<Encode>::enabled);
     while (input_len != 0) {
+        if (BulkEncode<Encode>::enabled && bulk.ready()) {
+            size_t bulk_written;
+            size_t bulk_read = BulkEncode<Encode>::run(input, input_len, *output + w, *output_size - w, &bulk_written);
+            if (bulk_read != 0) {
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
         uint32_t cp = *input;
         if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
             ret = RetCode::E_INVALID;
@@ -690,11 +2998,94 @@ RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, s
         input_len--;
 
         if (w + 4 > *output_size) {
-            *output_size += input_len + 8;
-            *output = (char *) realloc(*output, *output_size);
+            size_t new_size = grown_size(growth, *output_size, w, 4, EncodeLength<Encode>::max_length(input_len));
+            *output = alloc.reallocate(*output, *output_size, w, new_size);
+            *output_size = new_size;
         }
 
         int encoded = Encode::write(cp, *output + w);
+        if (encoded < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+
+        if (consumed) {
+            *consumed += 1;
+        }
+
+        w += encoded;
+    }
+
+    if (shrink_to_fit && w != *output_size) {
+        *output = alloc.reallocate(*output, *output_size, w, w);
+        *output_size = w;
+    }
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF encoder, getline-style version
+ * The input is checked for validity
+ */
+template<typename Encode>
+static inline __attribute__((always_inline))
+RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) {
+    OutputAllocator<MallocAllocator> alloc((MallocAllocator()));
+    return unicode_encode<Encode, MallocAllocator>(input, input_len, output, output_size, consumed, written, alloc, Growth::GEOMETRIC, false);
+}
+
+/*
+ * Generic UTF encoder, fixed output buffer version
+ * The input is checked for validity
+ */
+template<typename Encode>
+static inline __attribute__((always_inline))
+RetCode unicode_encode(const uint32_t *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written) {
+    RetCode ret = RetCode::OK;
+    size_t w = 0;
+    if (!input || (!output && output_len != 0)) {
+        return RetCode::E_PARAMS;
+    }
+    if (consumed) {
+        *consumed = 0;
+    }
+    BulkGate bulk(BulkEncode<Encode>::enabled);
+    while (input_len != 0) {
+        if (BulkEncode<Encode>::enabled && bulk.ready()) {
+            size_t bulk_written;
+            size_t bulk_read = BulkEncode<Encode>::run(input, input_len, output + w, output_len - w, &bulk_written);
+            if (bulk_read != 0) {
+                input += bulk_read;
+                input_len -= bulk_read;
+                if (consumed) {
+                    *consumed += bulk_read;
+                }
+                w += bulk_written;
+                continue;
+            }
+            bulk.stopped();
+        }
+
+        uint32_t cp = *input;
+        if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
+        if (output_len - w < 4 && output_len - w < (size_t) Encode::length(cp)) {
+            ret = RetCode::E_OUTPUT_FULL;
+            break;
+        }
+        input++;
+        input_len--;
+
+        int encoded = Encode::write(cp, output + w);
+        if (encoded < 0) {
+            ret = RetCode::E_INVALID;
+            break;
+        }
 
         if (consumed) {
             *consumed += 1;
@@ -709,6 +3100,72 @@ RetCode unicode_encode(const uint32_t *input, size_t input_len, char **output, s
     return ret;
 }
 
+
+/*
+ * Generic UTF encoder, container version
+ * The output is appended to a std::basic_string or a std::vector of bytes or of code units (see unicode_conv)
+ * The input is checked for validity
+ */
+template<typename Encode, typename Container>
+static inline
+RetCode unicode_encode_to_container(const uint32_t *input, size_t input_len, Container &output, size_t *consumed, size_t *written) {
+    typedef typename Container::value_type T;
+    static_assert(sizeof(T) == 1 || sizeof(T) == Encode::unit_size, "the container must hold bytes or code units");
+    RetCode ret = RetCode::OK;
+    size_t start = output.size(), c = 0, w = 0;
+    if (!input) {
+        return RetCode::E_PARAMS;
+    }
+    size_t needed = EncodeLength<Encode>::max_length(input_len);
+    if ((output.capacity() - start) * sizeof(T) < needed) {
+        needed = EncodeLength<Encode>::length(input, input_len);
+    }
+    do {
+        output.resize(start + (w + needed + sizeof(T) - 1) / sizeof(T));
+        size_t step_consumed = 0, step_written = 0;
+        ret = unicode_encode<Encode>(input + c, input_len - c, container_bytes(output, start) + w,
+                (output.size() - start) * sizeof(T) - w, &step_consumed, &step_written);
+        c += step_consumed;
+        w += step_written;
+        needed = EncodeLength<Encode>::max_length(input_len - c) + 4;
+    } while (ret == RetCode::E_OUTPUT_FULL);
+    output.resize(start + (w + sizeof(T) - 1) / sizeof(T));
+
+    if (consumed) {
+        *consumed = c;
+    }
+    if (written) {
+        *written = output.size() - start;
+    }
+    return ret;
+}
+
+/*
+ * Generic UTF encoder, iterator version
+ * output must accept char or unsigned char data
+ * The input is checked for validity
+ */
+template<typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, GenericOutput) {
+    return unicode_encode_iterator<Encode>(input, input_len, output, consumed, written);
+}
+template<typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, PointerOutput) {
+    return unicode_encode_iterator<Encode>(input, input_len, (char *) output, consumed, written);
+}
+template<typename Encode, typename OutputIt>
+static inline
+RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written, VectorOutput) {
+    return unicode_encode_to_container<Encode>(input, input_len, back_inserter_container(output), consumed, written);
+}
+template<typename Encode, typename OutputIt>
+static inline __attribute__((always_inline))
+RetCode unicode_encode(const uint32_t *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+    return unicode_encode<Encode>(input, input_len, output, consumed, written, typename OutputKind<OutputIt, 1>::type());
+}
+
 }
 }
 
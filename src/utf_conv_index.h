@@ -0,0 +1,181 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "utf_conv.h"
+
+#ifndef UTF_CONV_INDEX_H_
+#define UTF_CONV_INDEX_H_
+
+namespace UTF {
+namespace impl {
+
+/*
+ * Character starts of the indexed encodings for CodepointIndex
+ * - unit : size of a code unit, a block of n bytes holds at most n / unit characters
+ * - is_start(p) : the code unit at p begins a character (not a UTF-8 continuation byte or a UTF-16 low surrogate)
+ */
+template<typename Read>
+struct IndexSteps;
+
+template<>
+struct IndexSteps<ReadUtf8Cp> {
+    static const size_t unit = 1;
+
+    static inline __attribute__((always_inline))
+    bool is_start(const char *p) {
+        return (*(const uint8_t *) p & 0b11000000) != 0b10000000;
+    }
+};
+
+template<typename endianness>
+struct IndexSteps<ReadUtf16Cp<endianness> > {
+    static const size_t unit = 2;
+
+    static inline __attribute__((always_inline))
+    bool is_start(const char *p) {
+        uint16_t u;
+        memcpy(&u, p, 2);
+        u = endianness::from(u);
+        return u < 0xDC00 || u > 0xDFFF;
+    }
+};
+
+}
+
+/*
+ * Sparse index of the codepoints of a UTF-8 or UTF-16 stream (Read is ReadUtf8Cp, ReadUtf16leCp or ReadUtf16beCp)
+ * build() stores the byte offset of every step-th codepoint, offset() jumps to the checkpoint before a codepoint
+ * and counts at most step - 1 codepoints from there. The index takes sizeof(size_t) bytes per step codepoints.
+ *
+ * The stream is validated first and the characters are counted by blocks with the length kernels,
+ * the scalar loop only finds the exact offset in the last block. The stream is not copied,
+ * it must outlive the index and stay unchanged.
+ */
+template<typename Read>
+class CodepointIndex {
+    typedef impl::IndexSteps<Read> Steps;
+    enum { BLOCK = 64 };
+
+    const char *m_input;
+    size_t m_input_len;
+    size_t m_length;
+    size_t m_step;
+    std::vector<size_t> m_checkpoints; // offsets of the codepoints 0, step, 2 * step...
+
+    /* Offset of the n-th character start from offset (0 for offset itself), m_input_len if there is none */
+    size_t advance(size_t offset, size_t n) const {
+        size_t unit = Steps::unit;
+        // a block of n * unit bytes holds at most n characters, it can be skipped whole
+        while (n * unit >= (size_t) BLOCK) {
+            size_t block = (n * unit) & ~size_t(BLOCK - 1);
+            size_t left = (m_input_len - offset) & ~size_t(BLOCK - 1);
+            if (block > left) {
+                block = left;
+            }
+            if (block == 0) {
+                break;
+            }
+            // a block may end in the middle of a character, only the starts are counted
+            n -= impl::DecodeLength<Read>::length(m_input + offset, block);
+            offset += block;
+        }
+        for (; offset < m_input_len; offset += unit) {
+            if (Steps::is_start(m_input + offset)) {
+                if (n == 0) {
+                    break;
+                }
+                n--;
+            }
+        }
+        return offset < m_input_len ? offset : m_input_len;
+    }
+
+public:
+    CodepointIndex() : m_input(NULL), m_input_len(0), m_length(0), m_step(256) {
+    }
+
+    /*
+     * Index a stream, with a checkpoint every step codepoints
+     * return : OK, E_PARAMS, or the error of the validation (E_INVALID, E_TRUNCATED), the index is then empty
+     */
+    RetCode build(const char *input, size_t input_len, size_t step = 256) {
+        m_input = NULL;
+        m_input_len = 0;
+        m_length = 0;
+        m_checkpoints.clear();
+        if ((!input && input_len != 0) || step == 0) {
+            return RetCode::E_PARAMS;
+        }
+
+        size_t consumed = 0, length = 0;
+        if (input_len != 0) {
+            RetCode ret = impl::unicode_validate<Read>(input, input_len, &consumed, &length);
+            if (ret != RetCode::OK) {
+                return ret;
+            }
+        }
+
+        m_input = input;
+        m_input_len = input_len;
+        m_length = length;
+        m_step = step;
+        m_checkpoints.reserve(length / step + 1);
+        size_t offset = 0;
+        m_checkpoints.push_back(offset);
+        for (size_t k = step; k < length; k += step) {
+            offset = advance(offset, step);
+            m_checkpoints.push_back(offset);
+        }
+        return RetCode::OK;
+    }
+
+    /*
+     * Byte offset of the codepoint at index (input_len for index == length())
+     * return : OK, or E_PARAMS if index > length()
+     */
+    RetCode offset(size_t index, size_t *offset) const {
+        if (!offset || index > m_length) {
+            return RetCode::E_PARAMS;
+        }
+        if (index == m_length) {
+            *offset = m_input_len;
+        }
+        else {
+            *offset = advance(m_checkpoints[index / m_step], index % m_step);
+        }
+        return RetCode::OK;
+    }
+
+    /* Number of codepoints of the indexed stream */
+    size_t length() const {
+        return m_length;
+    }
+
+    size_t step() const {
+        return m_step;
+    }
+};
+
+typedef CodepointIndex<impl::ReadUtf8Cp> Utf8Index;
+typedef CodepointIndex<impl::ReadUtf16leCp> Utf16leIndex;
+typedef CodepointIndex<impl::ReadUtf16beCp> Utf16beIndex;
+
+}
+
+#endif /* UTF_CONV_INDEX_H_ */
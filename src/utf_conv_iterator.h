@@ -0,0 +1,309 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include "utf_conv.h"
+
+#ifndef UTF_CONV_ITERATOR_H_
+#define UTF_CONV_ITERATOR_H_
+
+namespace UTF {
+namespace impl {
+
+/*
+ * Stepping rules of the Read* classes for CodepointIterator
+ * - unit : size of a code unit, an invalid or truncated sequence is skipped one code unit at a time
+ * - ascii_runs : the ASCII bytes are single characters (byte encodings), their runs are scanned with the ascii_length kernel
+ * - bidirectional : previous(begin, pos) returns the beginning of the character ending at pos
+ * The default rules only step forward, one byte at a time on errors.
+ */
+template<typename Read>
+struct CodepointSteps {
+    static const size_t unit = 1;
+    static const bool ascii_runs = false;
+    static const bool bidirectional = false;
+};
+
+template<>
+struct CodepointSteps<ReadUtf8Cp> {
+    static const size_t unit = 1;
+    static const bool ascii_runs = true;
+    static const bool bidirectional = true;
+
+    static inline const char *previous(const char *begin, const char *pos) {
+        // back over the continuation bytes, then check that the sequence ends exactly at pos
+        const char *s = pos - 1;
+        while (s > begin && pos - s < 4 && (*(const uint8_t *) s & 0b11000000) == 0b10000000) {
+            s--;
+        }
+        uint32_t cp;
+        if (s != pos - 1 && ReadUtf8Cp::read(s, pos - s, cp) == pos - s) {
+            return s;
+        }
+        return pos - 1;
+    }
+};
+
+template<typename endianness>
+struct CodepointSteps<ReadUtf16Cp<endianness> > {
+    static const size_t unit = 2;
+    static const bool ascii_runs = false;
+    static const bool bidirectional = true;
+
+    static inline const char *previous(const char *begin, const char *pos) {
+        size_t partial = (pos - begin) % 2;
+        if (partial) {
+            return pos - partial;
+        }
+        if (pos - begin >= 4) {
+            uint16_t high, low;
+            memcpy(&high, pos - 4, 2);
+            memcpy(&low, pos - 2, 2);
+            high = endianness::from(high);
+            low = endianness::from(low);
+            if (high >= 0xD800 && high <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF) {
+                return pos - 4;
+            }
+        }
+        return pos - 2;
+    }
+};
+
+template<typename endianness>
+struct CodepointSteps<ReadUtf32Cp<endianness> > {
+    static const size_t unit = 4;
+    static const bool ascii_runs = false;
+    static const bool bidirectional = true;
+
+    static inline const char *previous(const char *begin, const char *pos) {
+        size_t partial = (pos - begin) % 4;
+        return pos - (partial ? partial : 4);
+    }
+};
+
+template<>
+struct CodepointSteps<ReadLatin1Cp> {
+    static const size_t unit = 1;
+    static const bool ascii_runs = true;
+    static const bool bidirectional = true;
+
+    static inline const char *previous(const char *, const char *pos) {
+        return pos - 1;
+    }
+};
+
+template<typename Page>
+struct CodepointSteps<ReadSingleByteCp<Page> > {
+    static const size_t unit = 1;
+    static const bool ascii_runs = true;
+    static const bool bidirectional = true;
+
+    static inline const char *previous(const char *, const char *pos) {
+        return pos - 1;
+    }
+};
+
+// the second byte of a GB18030 sequence may be ASCII, the characters can't be found backward
+template<typename Charset>
+struct CodepointSteps<ReadGbCp<Charset> > {
+    static const size_t unit = 1;
+    static const bool ascii_runs = true;
+    static const bool bidirectional = false;
+};
+
+}
+
+/*
+ * Lazy decoding of a stream
+ * CodepointIterator<Read> iterates over the codepoints of a stream (Read is a Read* class), decoding one character per step.
+ * It is a bidirectional iterator for UTF-8, UTF-16, UTF-32, Latin-1 and the single-byte code pages,
+ * and a forward iterator for GB18030 and GBK.
+ *
+ * On the byte encodings, the end of each ASCII run is found by the ascii_length kernel,
+ * stepping inside the run is a comparison and a load.
+ *
+ * An invalid or truncated sequence is not an error : it is skipped one code unit at a time and
+ * each skipped code unit is decoded as INVALID (not a codepoint). position() is the offset of the current character,
+ * use unicode_validate first to reject the invalid streams at once.
+ */
+template<typename Read>
+class CodepointIterator {
+    typedef impl::CodepointSteps<Read> Steps;
+    enum { ASCII_WINDOW = 256 };
+
+    const char *m_begin;
+    const char *m_end;
+    const char *m_pos;
+    const char *m_ascii_end; // end of the ASCII run containing m_pos, if m_pos < m_ascii_end
+    uint32_t m_cp;
+    size_t m_len; // length of the current character, 0 at the end
+
+    void decode(bool scan) {
+        size_t left = m_end - m_pos;
+        if (left == 0) {
+            m_len = 0;
+            return;
+        }
+        if (Steps::ascii_runs && *(const uint8_t *) m_pos < 0x80) {
+            m_cp = *(const uint8_t *) m_pos;
+            m_len = 1;
+            if (scan) {
+                // a bounded window, begin() doesn't scan a whole ASCII stream
+                size_t window = ASCII_WINDOW;
+                if (left - 1 < window) {
+                    window = left - 1;
+                }
+                m_ascii_end = m_pos + 1 + impl::simd::kernels().ascii_length(m_pos + 1, window);
+            }
+            return;
+        }
+        int removed = Read::read(m_pos, left, m_cp);
+        if (removed <= 0) {
+            size_t unit = Steps::unit;
+            m_cp = INVALID;
+            m_len = left < unit ? left : unit;
+        }
+        else {
+            m_len = removed;
+        }
+    }
+
+public:
+    static const uint32_t INVALID = 0xFFFFFFFF;
+
+    typedef typename std::conditional<Steps::bidirectional,
+            std::bidirectional_iterator_tag, std::forward_iterator_tag>::type iterator_category;
+    typedef uint32_t value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const uint32_t *pointer;
+    // the codepoints are decoded on the fly, they are returned by value
+    typedef uint32_t reference;
+
+    CodepointIterator() : m_begin(NULL), m_end(NULL), m_pos(NULL), m_ascii_end(NULL), m_cp(0), m_len(0) {
+    }
+
+    /* Iterator on the character at pos, which must be a character boundary of [begin, end) */
+    CodepointIterator(const char *begin, const char *end, const char *pos) :
+            m_begin(begin), m_end(end), m_pos(pos), m_ascii_end(pos), m_cp(0), m_len(0) {
+        decode(true);
+    }
+
+    uint32_t operator*() const {
+        return m_cp;
+    }
+
+    /* Beginning of the current character and its length in bytes */
+    const char *position() const {
+        return m_pos;
+    }
+    size_t length() const {
+        return m_len;
+    }
+
+    CodepointIterator &operator++() {
+        m_pos += m_len;
+        if (Steps::ascii_runs && m_pos < m_ascii_end) {
+            m_cp = *(const uint8_t *) m_pos;
+            return *this;
+        }
+        decode(true);
+        return *this;
+    }
+
+    CodepointIterator operator++(int) {
+        CodepointIterator tmp(*this);
+        ++*this;
+        return tmp;
+    }
+
+    CodepointIterator &operator--() {
+        static_assert(Steps::bidirectional, "this encoding can only be decoded forward");
+        m_pos = Steps::previous(m_begin, m_pos);
+        // the run was scanned forward from a later position
+        m_ascii_end = m_pos;
+        decode(false);
+        return *this;
+    }
+
+    CodepointIterator operator--(int) {
+        CodepointIterator tmp(*this);
+        --*this;
+        return tmp;
+    }
+
+    bool operator==(const CodepointIterator &other) const {
+        return m_pos == other.m_pos;
+    }
+    bool operator!=(const CodepointIterator &other) const {
+        return m_pos != other.m_pos;
+    }
+};
+
+/*
+ * Range of the codepoints of a stream, for the range-based for loops and the standard algorithms
+ * The stream is not copied, it must outlive the range and its iterators.
+ */
+template<typename Read>
+class CodepointRange {
+    const char *m_begin;
+    const char *m_end;
+
+public:
+    typedef CodepointIterator<Read> iterator;
+    typedef CodepointIterator<Read> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    CodepointRange(const char *input, size_t input_len) : m_begin(input), m_end(input + input_len) {
+    }
+
+    iterator begin() const {
+        return iterator(m_begin, m_end, m_begin);
+    }
+    iterator end() const {
+        return iterator(m_begin, m_end, m_end);
+    }
+    reverse_iterator rbegin() const {
+        return reverse_iterator(end());
+    }
+    reverse_iterator rend() const {
+        return reverse_iterator(begin());
+    }
+
+    bool empty() const {
+        return m_begin == m_end;
+    }
+};
+
+#define CHARSET_CODEPOINTS_FUNC(NAME, READ) \
+static inline CodepointRange<READ> NAME (const char *input, size_t input_len) { \
+    return CodepointRange<READ>(input, input_len); \
+}
+
+CHARSET_CODEPOINTS_FUNC(codepoints_utf8, impl::ReadUtf8Cp)
+CHARSET_CODEPOINTS_FUNC(codepoints_utf16le, impl::ReadUtf16leCp)
+CHARSET_CODEPOINTS_FUNC(codepoints_utf16be, impl::ReadUtf16beCp)
+CHARSET_CODEPOINTS_FUNC(codepoints_utf32le, impl::ReadUtf32leCp)
+CHARSET_CODEPOINTS_FUNC(codepoints_utf32be, impl::ReadUtf32beCp)
+CHARSET_CODEPOINTS_FUNC(codepoints_latin1, impl::ReadLatin1Cp)
+
+#undef CHARSET_CODEPOINTS_FUNC
+
+}
+
+#endif /* UTF_CONV_ITERATOR_H_ */
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <system_error>
+#include "utf_conv.h"
+
+#ifndef UTF_CONV_PARALLEL_H_
+#define UTF_CONV_PARALLEL_H_
+
+/*
+ * Multi-threaded stream conversions (link with the threads library)
+ *
+ * The input is split on character boundaries (Read*::boundary) into one chunk per thread.
+ * A first pass computes the output size of each chunk (ConvLength), the prefix sums give the
+ * output offset of each chunk, then the chunks are converted concurrently into a single output buffer.
+ * If a chunk fails (invalid input), the conversion is resumed serially from the beginning of this chunk,
+ * so *consumed and *written are the same as with the serial conversion.
+ * If the output can't be allocated, the old buffer is kept : E_PARAMS before the conversion,
+ * E_OUTPUT_FULL with the converted prefix if the serial conversion can't grow it.
+ *
+ * conv_XXX_to_YYY_parallel have the same arguments as the getline-style conv_XXX_to_YYY, and :
+ *   n_threads : number of threads, 0 for std::thread::hardware_concurrency()
+ *   min_chunk_len : minimum size of a chunk, the small inputs are converted serially
+ */
+
+namespace UTF {
+namespace impl {
+
+/* Run f(0) ... f(n - 1), f(0) in the calling thread. A chunk whose thread can't be started runs in the calling thread */
+template<typename Function>
+static inline void parallel_for(size_t n, Function f) {
+    std::vector<std::thread> threads;
+    threads.reserve(n);
+    for (size_t i = 1; i < n; i++) {
+        try {
+            threads.emplace_back(f, i);
+        } catch (const std::system_error &) {
+            f(i);
+        }
+    }
+    f(0);
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+/*
+ * Generic UTF conversion function, multi-threaded getline-style version
+ */
+template<typename Read, typename Encode>
+static inline
+RetCode unicode_conv_parallel(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written,
+        unsigned n_threads, size_t min_chunk_len) {
+    if (!input || !output || !output_size) {
+        return RetCode::E_PARAMS;
+    }
+    if (n_threads == 0) {
+        n_threads = std::thread::hardware_concurrency();
+    }
+    if (min_chunk_len == 0) {
+        min_chunk_len = 1;
+    }
+    size_t n_chunks = input_len / min_chunk_len < n_threads ? input_len / min_chunk_len : n_threads;
+    if (n_chunks <= 1) {
+        return unicode_conv<Read, Encode>(input, input_len, output, output_size, consumed, written);
+    }
+    if (*output_size == 0) {
+        *output = NULL;
+    }
+
+    // chunk i is [bounds[i], bounds[i + 1])
+    std::vector<size_t> bounds(n_chunks + 1);
+    bounds[0] = 0;
+    for (size_t i = 1; i < n_chunks; i++) {
+        bounds[i] = Read::boundary(input, input_len, input_len / n_chunks * i);
+        if (bounds[i] < bounds[i - 1]) {
+            bounds[i] = bounds[i - 1];
+        }
+    }
+    bounds[n_chunks] = input_len;
+
+    // first pass : output size of each chunk, then output offsets
+    std::vector<size_t> offsets(n_chunks + 1);
+    parallel_for(n_chunks, [&](size_t i) {
+        offsets[i + 1] = ConvLength<Read, Encode>::length(input + bounds[i], bounds[i + 1] - bounds[i]);
+    });
+    offsets[0] = 0;
+    for (size_t i = 0; i < n_chunks; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    if (*output_size < offsets[n_chunks] + 4) {
+        // the chunks are converted at their offsets : nothing is converted without the whole buffer
+        char *resized = (char *) realloc(*output, offsets[n_chunks] + 4);
+        if (!resized) {
+            if (consumed) {
+                *consumed = 0;
+            }
+            if (written) {
+                *written = 0;
+            }
+            return RetCode::E_PARAMS;
+        }
+        *output = resized;
+        *output_size = offsets[n_chunks] + 4;
+    }
+
+    // second pass : conversion of each chunk into its own part of the output
+    std::vector<RetCode> chunk_ret(n_chunks);
+    std::vector<size_t> chunk_consumed(n_chunks), chunk_written(n_chunks);
+    char *out = *output;
+    parallel_for(n_chunks, [&](size_t i) {
+        chunk_ret[i] = unicode_conv<Read, Encode>(input + bounds[i], bounds[i + 1] - bounds[i],
+                out + offsets[i], offsets[i + 1] - offsets[i], &chunk_consumed[i], &chunk_written[i]);
+    });
+
+    size_t first_error = 0;
+    while (first_error < n_chunks && chunk_ret[first_error] == RetCode::OK
+            && chunk_consumed[first_error] == bounds[first_error + 1] - bounds[first_error]
+            && chunk_written[first_error] == offsets[first_error + 1] - offsets[first_error]) {
+        first_error++;
+    }
+
+    RetCode ret = RetCode::OK;
+    size_t c = input_len, w = offsets[n_chunks];
+    if (first_error < n_chunks) {
+        // the chunks before first_error end on character boundaries : resume serially from this chunk
+        c = bounds[first_error];
+        w = offsets[first_error];
+        for (;;) {
+            size_t serial_consumed = 0, serial_written = 0;
+            ret = unicode_conv<Read, Encode>(input + c, input_len - c, *output + w, *output_size - w, &serial_consumed, &serial_written);
+            c += serial_consumed;
+            w += serial_written;
+            if (ret != RetCode::E_OUTPUT_FULL) {
+                break;
+            }
+            size_t new_size = grown_size(Growth::GEOMETRIC, *output_size, w, 4, ConvLength<Read, Encode>::max_length(input_len - c));
+            char *resized = (char *) realloc(*output, new_size);
+            if (!resized) {
+                break;
+            }
+            *output = resized;
+            *output_size = new_size;
+        }
+    }
+
+    if (consumed) {
+        *consumed = c;
+    }
+    if (written) {
+        *written = w;
+    }
+    return ret;
+}
+
+}
+
+#define CHARSET_CONV_PARALLEL_FUNC(NAME, READ, CONVERT) \
+static inline RetCode NAME (const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written, \
+        unsigned n_threads = 0, size_t min_chunk_len = 1 << 20) { \
+    return impl::unicode_conv_parallel<READ, CONVERT>(input, input_len, output, output_size, consumed, written, n_threads, min_chunk_len); \
+}
+
+CHARSET_CONV_PARALLEL_FUNC(conv_utf8_to_utf16le_parallel, impl::ReadUtf8Cp, impl::CpToUtf16le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf8_to_utf16be_parallel, impl::ReadUtf8Cp, impl::CpToUtf16be)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf8_to_utf32le_parallel, impl::ReadUtf8Cp, impl::CpToUtf32le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf8_to_utf32be_parallel, impl::ReadUtf8Cp, impl::CpToUtf32be)
+
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16le_to_utf8_parallel, impl::ReadUtf16leCp, impl::CpToUtf8)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16le_to_utf16be_parallel, impl::ReadUtf16leCp, impl::CpToUtf16be)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16le_to_utf32le_parallel, impl::ReadUtf16leCp, impl::CpToUtf32le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16le_to_utf32be_parallel, impl::ReadUtf16leCp, impl::CpToUtf32be)
+
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16be_to_utf16le_parallel, impl::ReadUtf16beCp, impl::CpToUtf16le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16be_to_utf8_parallel, impl::ReadUtf16beCp, impl::CpToUtf8)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16be_to_utf32le_parallel, impl::ReadUtf16beCp, impl::CpToUtf32le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf16be_to_utf32be_parallel, impl::ReadUtf16beCp, impl::CpToUtf32be)
+
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32le_to_utf16le_parallel, impl::ReadUtf32leCp, impl::CpToUtf16le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32le_to_utf16be_parallel, impl::ReadUtf32leCp, impl::CpToUtf16be)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32le_to_utf8_parallel, impl::ReadUtf32leCp, impl::CpToUtf8)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32le_to_utf32be_parallel, impl::ReadUtf32leCp, impl::CpToUtf32be)
+
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32be_to_utf16le_parallel, impl::ReadUtf32beCp, impl::CpToUtf16le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32be_to_utf16be_parallel, impl::ReadUtf32beCp, impl::CpToUtf16be)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32be_to_utf32le_parallel, impl::ReadUtf32beCp, impl::CpToUtf32le)
+CHARSET_CONV_PARALLEL_FUNC(conv_utf32be_to_utf8_parallel, impl::ReadUtf32beCp, impl::CpToUtf8)
+
+#undef CHARSET_CONV_PARALLEL_FUNC
+
+}
+
+#endif /* UTF_CONV_PARALLEL_H_ */
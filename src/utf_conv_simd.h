@@ -0,0 +1,4082 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+// define UTF_CONV_NO_SIMD to build without any intrinsic (e.g. with -mgeneral-regs-only), the SWAR kernels remain
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(UTF_CONV_NO_SIMD)
+#define UTF_CONV_X86 1
+#include <immintrin.h>
+#endif
+
+#ifndef UTF_CONV_SIMD_H_
+#define UTF_CONV_SIMD_H_
+
+/*
+ * This file defines the vectorized kernels used by the generic functions of utf_conv_impl.h
+ *
+ * The kernels only handle the "easy" blocks of a stream (ASCII runs, ...) and stop at the first
+ * block they can't process. The generic functions then fall back on the Read* and CpTo* classes.
+ *
+ * The kernels are defined once per instruction set, in the namespaces scalar, swar, sse42, avx2 and avx512.
+ * They are compiled with the target attribute of their instruction set, whatever the flags of the includer,
+ * and selected at runtime by utf_conv_dispatch.h. The scalar kernels don't process anything.
+ * The swar kernels only use 64 bits integer operations, they are available on every target.
+ *
+ * - ascii_to_utf16<big_endian>(input, input_len, output, output_len, written) :
+ *       widen the ASCII prefix of input into UTF-16 code units
+ * - ascii_to_utf32<big_endian>(input, input_len, output, output_len, written) :
+ *       widen the ASCII prefix of input into UTF-32 code units
+ * - validate_utf8(input, input_len, length) :
+ *       validate a prefix of input with the lookup tables algorithm of Keiser and Lemire
+ *       ("Validating UTF-8 In Less Than One Instruction Per Byte", 2021).
+ *       The returned prefix ends on a character boundary, *length stores its number of characters.
+ *       The prefix stops before the block containing the first error, the exact error is left to ReadUtf8Cp.
+ * - utf8_to_utf16<big_endian>(input, input_len, output, output_len, written) :
+ *       convert the validated prefix of a UTF-8 stream into UTF-16, without the codepoint intermediate
+ * - utf8_to_utf32<big_endian>(input, input_len, output, output_len, written) :
+ *       convert the validated prefix of a UTF-8 stream into UTF-32
+ * - utf16_to_utf8<big_endian>(input, input_len, output, output_len, written) :
+ *       convert a prefix of a UTF-16 stream into UTF-8, up to the first invalid or truncated surrogate pair
+ * - utf32_to_utf8<big_endian>(input, input_len, output, output_len, written) :
+ *       convert a prefix of a UTF-32 stream into UTF-8, up to the first invalid codepoint
+ * - utf16_swap<big_endian>(input, input_len, output, output_len, written) :
+ *       byte swap a prefix of a UTF-16 stream, up to the block containing the first unpaired surrogate
+ * - utf32_to_utf16<big_endian_in, big_endian_out>(input, input_len, output, output_len, written) :
+ *       convert a prefix of a UTF-32 stream into UTF-16, up to the first invalid codepoint
+ * - utf16_to_utf32<big_endian_in, big_endian_out>(input, input_len, output, output_len, written) :
+ *       convert a prefix of a UTF-16 stream into UTF-32, up to the first invalid or truncated surrogate pair
+ * - utf32_copy<big_endian, swap>(input, input_len, output, output_len, written) :
+ *       copy a prefix of a UTF-32 stream, byte swapped if swap, up to the first invalid codepoint
+ * - validate_utf32<big_endian>(input, input_len, length) :
+ *       validate a prefix of a UTF-32 stream, up to the first invalid codepoint
+ * - latin1_to_utf8(input, input_len, output, output_len, written) :
+ *       convert a prefix of a Latin-1 stream into UTF-8 (1 or 2 bytes per character)
+ * - latin1_to_utf16<big_endian>(input, input_len, output, output_len, written) :
+ * - latin1_to_utf32<big_endian>(input, input_len, output, output_len, written) :
+ *       widen a prefix of a Latin-1 stream into UTF-16 or UTF-32 code units, every byte is valid
+ * - utf8_to_latin1(input, input_len, output, output_len, written) :
+ *       convert a prefix of a UTF-8 stream into Latin-1, up to the first window containing an invalid sequence
+ *       or a codepoint above 0xFF
+ * - utf16_to_latin1<big_endian>(input, input_len, output, output_len, written) :
+ * - utf32_to_latin1<big_endian>(input, input_len, output, output_len, written) :
+ *       narrow a prefix of a UTF-16 or UTF-32 stream into Latin-1, up to the first block containing a code unit above 0xFF
+ * - single_byte_to_utf8(tables, input, input_len, output, output_len, written) :
+ * - single_byte_to_utf16<big_endian>(tables, input, input_len, output, output_len, written) :
+ * - single_byte_to_utf32<big_endian>(tables, input, input_len, output, output_len, written) :
+ *       convert a prefix of a stream in the single-byte code page of tables (see SingleByteTables),
+ *       up to the first block containing an unmapped byte
+ * - utf8_to_single_byte(tables, input, input_len, output, output_len, written) :
+ * - utf16_to_single_byte<big_endian>(tables, input, input_len, output, output_len, written) :
+ * - utf32_to_single_byte<big_endian>(tables, input, input_len, output, output_len, written) :
+ *       convert a prefix of a UTF stream into the single-byte code page of tables, up to the first invalid or unmapped character
+ * - ascii_copy(input, input_len, output, output_len, written) :
+ *       copy the ASCII prefix of input (the ASCII runs of the multi-byte legacy encodings)
+ * - ascii_length(input, input_len) :
+ *       return the length of the ASCII prefix of input, by whole blocks (the tail shorter than a block is not scanned)
+ * - utf16_to_ascii<big_endian>(input, input_len, output, output_len, written) :
+ * - utf32_to_ascii<big_endian>(input, input_len, output, output_len, written) :
+ *       narrow the ASCII prefix of a UTF-16 or UTF-32 stream
+ *
+ * The counting kernels process the whole input, the scalar versions do the actual counting.
+ * Their results are exact for valid inputs only.
+ * - utf8_length(input, input_len, four_bytes) :
+ *       return the number of characters of a UTF-8 stream, store the number of 4 bytes sequences in *four_bytes
+ * - utf16_length<big_endian>(input, input_len, low_surrogates) :
+ *       return the UTF-8 size of a UTF-16 stream, store its number of low surrogates in *low_surrogates
+ * - utf32_length<big_endian>(input, input_len, supplementary) :
+ *       return the UTF-8 size of a UTF-32 stream, store its number of codepoints above 0xFFFF in *supplementary
+ *
+ * The conversion kernels return the number of bytes read from input and store the number of bytes written in *written.
+ * They may write up to one full block past *written (but never past output + output_len).
+ */
+
+#define UTF_TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+#define UTF_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define UTF_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,bmi,bmi2,popcnt")))
+
+namespace UTF {
+namespace impl {
+
+/* Instruction sets of the vectorized kernels */
+enum IsaLevel {
+    ISA_SCALAR = 0,
+    ISA_SWAR = 1,
+    ISA_SSE42 = 2,
+    ISA_AVX2 = 3,
+    ISA_AVX512 = 4
+};
+
+namespace simd {
+
+/*
+ * Given a validated UTF-8 prefix of r bytes whose last sequence may be incomplete,
+ * return the position of the beginning of this incomplete sequence (or r)
+ */
+static inline __attribute__((always_inline))
+size_t utf8_last_boundary(const char *input, size_t r) {
+    for (size_t k = 1; k <= 3 && k <= r; k++) {
+        uint8_t b = ((const uint8_t *) input)[r - k];
+        if (b < 0x80) {
+            break;
+        }
+        if (b >= 0xC0) {
+            size_t seq_len = b >= 0xF0 ? 4 : (b >= 0xE0 ? 3 : 2);
+            if (seq_len > k) {
+                return r - k;
+            }
+            break;
+        }
+    }
+    return r;
+}
+
+/*
+ * Error flags for the Keiser-Lemire UTF-8 validation
+ * Each flag is set by 3 lookup tables indexed by the high nibble of the first byte,
+ * the low nibble of the first byte and the high nibble of the second byte of each pair of bytes.
+ */
+enum Utf8ErrorFlags {
+    U8_TOO_SHORT = 1 << 0,      // 11______ 0_______ or 11______ 11______
+    U8_TOO_LONG = 1 << 1,       // 0_______ 10______
+    U8_OVERLONG_3 = 1 << 2,     // 11100000 100_____
+    U8_TOO_LARGE = 1 << 3,      // 11110100 1001____, 11110100 101_____, 11110101+ 1001____...
+    U8_SURROGATE = 1 << 4,      // 11101101 101_____
+    U8_OVERLONG_2 = 1 << 5,     // 1100000_ 10______
+    U8_TOO_LARGE_1000 = 1 << 6, // 11110101+ 1000____
+    U8_OVERLONG_4 = 1 << 6,     // 11110000 1000____
+    U8_TWO_CONTS = 1 << 7,      // 10______ 10______
+    U8_CARRY = U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS
+};
+
+#define UTF8_BYTE_1_HIGH_TABLE \
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, \
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, \
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, \
+        U8_TOO_SHORT | U8_OVERLONG_2, \
+        U8_TOO_SHORT, \
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE, \
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+#define UTF8_BYTE_1_LOW_TABLE \
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4, \
+        U8_CARRY | U8_OVERLONG_2, \
+        U8_CARRY, \
+        U8_CARRY, \
+        U8_CARRY | U8_TOO_LARGE, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000, \
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000
+#define UTF8_BYTE_2_HIGH_TABLE \
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, \
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, \
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4, \
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE, \
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE, \
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE, \
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+
+/*
+ * Shuffle tables of the UTF-8 <-> UTF-16 kernels, computed on first use
+ * - utf16_pack[mask] moves the 16 bits lanes selected by mask (8 bits) to the beginning of a vector
+ * - utf8_pack[ge_80 | ge_800 << 4] moves the UTF-8 bytes of 4 BMP codepoints, held in 32 bits lanes, to the beginning
+ *   of a vector. ge_80 and ge_800 are the masks of the codepoints >= 0x80 and >= 0x800, utf8_pack_len[] is the number of bytes
+ * - utf32_pack[mask] moves the 32 bits lanes selected by mask (4 bits) to the beginning of a vector
+ * - utf16_pair_pack[mask] moves the UTF-16 code units of 4 codepoints, held in 32 bits lanes (a code unit or a surrogate pair),
+ *   to the beginning of a vector. mask (4 bits) selects the surrogate pairs
+ * - latin1_pack[mask] moves the UTF-8 bytes of 8 codepoints below 0x800, held in 16 bits lanes (1 or 2 bytes),
+ *   to the beginning of a vector. mask (8 bits) selects the codepoints >= 0x80
+ */
+struct ShuffleTables {
+    alignas(16) uint8_t utf16_pack[256][16];
+    alignas(16) uint8_t utf8_pack[256][16];
+    alignas(16) uint8_t utf32_pack[16][16];
+    alignas(16) uint8_t utf16_pair_pack[16][16];
+    alignas(16) uint8_t latin1_pack[256][16];
+    uint8_t utf8_pack_len[256];
+
+    ShuffleTables() {
+        for (int mask = 0; mask < 256; mask++) {
+            int k = 0;
+            for (int i = 0; i < 8; i++) {
+                if (mask & (1 << i)) {
+                    utf16_pack[mask][k++] = 2 * i;
+                    utf16_pack[mask][k++] = 2 * i + 1;
+                }
+            }
+            while (k < 16) {
+                utf16_pack[mask][k++] = 0x80;
+            }
+
+            k = 0;
+            for (int i = 0; i < 4; i++) {
+                int len = 1 + ((mask >> i) & 1) + ((mask >> (i + 4)) & 1);
+                for (int j = 0; j < len; j++) {
+                    utf8_pack[mask][k++] = 4 * i + j;
+                }
+            }
+            utf8_pack_len[mask] = k;
+            while (k < 16) {
+                utf8_pack[mask][k++] = 0x80;
+            }
+
+            k = 0;
+            for (int i = 0; i < 8; i++) {
+                latin1_pack[mask][k++] = 2 * i;
+                if (mask & (1 << i)) {
+                    latin1_pack[mask][k++] = 2 * i + 1;
+                }
+            }
+            while (k < 16) {
+                latin1_pack[mask][k++] = 0x80;
+            }
+        }
+        for (int mask = 0; mask < 16; mask++) {
+            int k = 0;
+            for (int i = 0; i < 4; i++) {
+                if (mask & (1 << i)) {
+                    for (int j = 0; j < 4; j++) {
+                        utf32_pack[mask][k++] = 4 * i + j;
+                    }
+                }
+            }
+            while (k < 16) {
+                utf32_pack[mask][k++] = 0x80;
+            }
+
+            k = 0;
+            for (int i = 0; i < 4; i++) {
+                int len = mask & (1 << i) ? 4 : 2;
+                for (int j = 0; j < len; j++) {
+                    utf16_pair_pack[mask][k++] = 4 * i + j;
+                }
+            }
+            while (k < 16) {
+                utf16_pair_pack[mask][k++] = 0x80;
+            }
+        }
+    }
+};
+
+inline const ShuffleTables &shuffle_tables() {
+    static const ShuffleTables tables;
+    return tables;
+}
+
+/*
+ * Lookup tables of a single-byte code page (see utf_conv_codepages.h), computed on first use
+ * - decode[b - 0x80] is the codepoint of the byte b >= 0x80, 0 if it is unmapped
+ * - decode_low[g][i] and decode_high[g][i] are the low and high bytes of decode[16 * g + i], for the byte shuffles
+ * - encode_block[encode_page[cp >> 8]][cp & 0xFF] is the byte of the BMP codepoint cp, 0 if it is unmapped.
+ *   Block 0 is empty, block 1 holds the first 256 codepoints (ASCII included), a code page only spans a few blocks
+ * - utf8_length[b] is the size of the byte b in UTF-8
+ */
+struct SingleByteTables {
+    alignas(16) uint8_t decode_low[8][16];
+    alignas(16) uint8_t decode_high[8][16];
+    uint16_t decode[128];
+    uint8_t encode_page[256];
+    uint8_t encode_block[8][256];
+    uint8_t utf8_length[256];
+
+    explicit SingleByteTables(const uint16_t *upper) {
+        memset(encode_page, 0, sizeof(encode_page));
+        memset(encode_block, 0, sizeof(encode_block));
+        encode_page[0] = 1;
+        for (int i = 0; i < 0x80; i++) {
+            encode_block[1][i] = uint8_t(i);
+            utf8_length[i] = 1;
+        }
+        int n_blocks = 2;
+        for (int i = 0; i < 128; i++) {
+            uint16_t cp = upper[i];
+            decode[i] = cp;
+            decode_low[i / 16][i % 16] = uint8_t(cp & 0xFF);
+            decode_high[i / 16][i % 16] = uint8_t(cp >> 8);
+            utf8_length[0x80 + i] = cp < 0x800 ? 2 : 3;
+            if (cp < 0x80) {
+                continue;
+            }
+            if (encode_page[cp >> 8] == 0) {
+                encode_page[cp >> 8] = uint8_t(n_blocks++);
+            }
+            encode_block[encode_page[cp >> 8]][cp & 0xFF] = uint8_t(0x80 + i);
+        }
+    }
+
+    /* Byte of a codepoint without branch, 0 if it is unmapped (or if cp is 0) */
+    inline __attribute__((always_inline))
+    uint8_t lookup(uint32_t cp) const {
+        uint32_t page = cp >> 8;
+        return encode_block[page < 256 ? encode_page[page] : 0][cp & 0xFF];
+    }
+
+    /* Byte of a codepoint, -1 if it is unmapped */
+    inline __attribute__((always_inline))
+    int encode(uint32_t cp) const {
+        uint8_t b = lookup(cp);
+        return b != 0 || cp == 0 ? b : -1;
+    }
+};
+
+template<typename Page>
+inline const SingleByteTables &single_byte_tables() {
+    static const SingleByteTables tables(Page::upper());
+    return tables;
+}
+
+/*
+ * Decode the UTF-8 character at the beginning of input and encode it in a single-byte code page
+ * Return the number of bytes read, 0 if the character is invalid, truncated or unmapped
+ * (the code pages only map ASCII and codepoints of 2 and 3 bytes sequences)
+ */
+static inline __attribute__((always_inline))
+size_t utf8_to_single_byte_one(const SingleByteTables &tables, const uint8_t *p, size_t input_len, char *output) {
+    uint32_t cp;
+    size_t len;
+    if (p[0] < 0x80) {
+        *output = char(p[0]);
+        return 1;
+    } else if (p[0] >= 0xC2 && p[0] < 0xE0 && input_len >= 2 && (p[1] & 0xC0) == 0x80) {
+        cp = uint32_t(p[0] & 0x1F) << 6 | (p[1] & 0x3F);
+        len = 2;
+    } else if ((p[0] & 0xF0) == 0xE0 && input_len >= 3 && (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80) {
+        cp = uint32_t(p[0] & 0x0F) << 12 | uint32_t(p[1] & 0x3F) << 6 | (p[2] & 0x3F);
+        len = 3;
+        if (cp < 0x800) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+    // the surrogates are never mapped
+    int b = tables.encode(cp);
+    if (b < 0) {
+        return 0;
+    }
+    *output = char(b);
+    return len;
+}
+
+template<bool big_endian>
+static inline __attribute__((always_inline))
+void store_utf16(uint16_t unit, char *output) {
+    output[big_endian ? 1 : 0] = char(unit & 0xFF);
+    output[big_endian ? 0 : 1] = char(unit >> 8);
+}
+
+/* Write a valid codepoint in UTF-8, return the number of bytes written */
+static inline __attribute__((always_inline))
+size_t store_utf8(uint32_t cp, char *output) {
+    if (cp < 0x80) {
+        output[0] = char(cp);
+        return 1;
+    }
+    if (cp < 0x800) {
+        output[0] = char(0xC0 | cp >> 6);
+        output[1] = char(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        output[0] = char(0xE0 | cp >> 12);
+        output[1] = char(0x80 | ((cp >> 6) & 0x3F));
+        output[2] = char(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    output[0] = char(0xF0 | cp >> 18);
+    output[1] = char(0x80 | ((cp >> 12) & 0x3F));
+    output[2] = char(0x80 | ((cp >> 6) & 0x3F));
+    output[3] = char(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+template<bool big_endian>
+static inline __attribute__((always_inline))
+uint32_t load_utf32(const char *input) {
+    const uint8_t *p = (const uint8_t *) input;
+    return big_endian ? (uint32_t(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3])
+                      : (uint32_t(p[3]) << 24 | p[2] << 16 | p[1] << 8 | p[0]);
+}
+
+/*
+ * Convert the first character of a validated UTF-8 stream into UTF-16
+ * Return the number of bytes read, store the number of bytes written in *written
+ */
+template<bool big_endian>
+static inline __attribute__((always_inline))
+size_t utf8_to_utf16_one(const char *input, char *output, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    if (p[0] < 0x80) {
+        store_utf16<big_endian>(p[0], output);
+        *written = 2;
+        return 1;
+    }
+    if (p[0] < 0xE0) {
+        store_utf16<big_endian>((p[0] & 0x1F) << 6 | (p[1] & 0x3F), output);
+        *written = 2;
+        return 2;
+    }
+    if (p[0] < 0xF0) {
+        store_utf16<big_endian>((p[0] & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F), output);
+        *written = 2;
+        return 3;
+    }
+    uint32_t cp = (p[0] & 0x07) << 18 | (p[1] & 0x3F) << 12 | (p[2] & 0x3F) << 6 | (p[3] & 0x3F);
+    store_utf16<big_endian>(0xD800 + ((cp - 0x10000) >> 10), output);
+    store_utf16<big_endian>(0xDC00 + (cp & 0x3FF), output + 2);
+    *written = 4;
+    return 4;
+}
+
+/*
+ * Convert the first character of a validated UTF-8 stream into UTF-32
+ * Return the number of bytes read (4 bytes are written)
+ */
+template<bool big_endian>
+static inline __attribute__((always_inline))
+size_t utf8_to_utf32_one(const char *input, char *output) {
+    const uint8_t *p = (const uint8_t *) input;
+    uint32_t cp;
+    size_t len;
+    if (p[0] < 0x80) {
+        cp = p[0];
+        len = 1;
+    } else if (p[0] < 0xE0) {
+        cp = (p[0] & 0x1F) << 6 | (p[1] & 0x3F);
+        len = 2;
+    } else if (p[0] < 0xF0) {
+        cp = (p[0] & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F);
+        len = 3;
+    } else {
+        cp = (p[0] & 0x07) << 18 | (p[1] & 0x3F) << 12 | (p[2] & 0x3F) << 6 | (p[3] & 0x3F);
+        len = 4;
+    }
+    for (int i = 0; i < 4; i++) {
+        output[big_endian ? 3 - i : i] = char(cp >> (8 * i));
+    }
+    return len;
+}
+
+/*
+ * Read the first character of a UTF-16 stream
+ * Return the number of bytes read, 0 if the character is invalid or truncated
+ */
+template<bool big_endian>
+static inline __attribute__((always_inline))
+size_t read_utf16_one(const char *input, size_t input_len, uint32_t *cp) {
+    const uint8_t *p = (const uint8_t *) input;
+    uint32_t unit = big_endian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+    if (unit < 0xD800 || unit > 0xDFFF) {
+        *cp = unit;
+        return 2;
+    }
+    if (unit >= 0xDC00 || input_len < 4) {
+        return 0;
+    }
+    uint32_t low = big_endian ? (p[2] << 8 | p[3]) : (p[3] << 8 | p[2]);
+    if (low < 0xDC00 || low > 0xDFFF) {
+        return 0;
+    }
+    *cp = 0x10000 + ((unit - 0xD800) << 10 | (low - 0xDC00));
+    return 4;
+}
+
+/*
+ * Convert the first character of a UTF-16 stream into UTF-8 (at most 4 bytes)
+ * Return the number of bytes read, 0 if the character is invalid or truncated. Store the number of bytes written in *written
+ */
+template<bool big_endian>
+static inline __attribute__((always_inline))
+size_t utf16_to_utf8_one(const char *input, size_t input_len, char *output, size_t *written) {
+    uint32_t cp;
+    size_t read = read_utf16_one<big_endian>(input, input_len, &cp);
+    if (read == 0) {
+        return 0;
+    }
+    *written = store_utf8(cp, output);
+    return read;
+}
+
+/*
+ * Convert the first character of a UTF-16 stream into UTF-32
+ * Return the number of bytes read, 0 if the character is invalid or truncated
+ */
+template<bool big_endian_in, bool big_endian_out>
+static inline __attribute__((always_inline))
+size_t utf16_to_utf32_one(const char *input, size_t input_len, char *output) {
+    uint32_t cp;
+    size_t read = read_utf16_one<big_endian_in>(input, input_len, &cp);
+    if (read != 0) {
+        for (int i = 0; i < 4; i++) {
+            output[big_endian_out ? 3 - i : i] = char(cp >> (8 * i));
+        }
+    }
+    return read;
+}
+
+/*
+ * Convert the first codepoint of a UTF-32 stream into UTF-16
+ * Return the number of bytes written, 0 if the codepoint is invalid
+ */
+template<bool big_endian_in, bool big_endian_out>
+static inline __attribute__((always_inline))
+size_t utf32_to_utf16_one(const char *input, char *output) {
+    uint32_t cp = load_utf32<big_endian_in>(input);
+    if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+        return 0;
+    }
+    if (cp < 0x10000) {
+        store_utf16<big_endian_out>(cp, output);
+        return 2;
+    }
+    store_utf16<big_endian_out>(0xD800 + ((cp - 0x10000) >> 10), output);
+    store_utf16<big_endian_out>(0xDC00 + (cp & 0x3FF), output + 2);
+    return 4;
+}
+
+/*
+ * Convert the UTF-32 codepoints of input[r, block_end) into UTF-8, one at a time
+ * Return false if an invalid codepoint is found, r and w are updated up to this codepoint
+ */
+template<bool big_endian>
+static inline __attribute__((always_inline))
+bool utf32_to_utf8_block(const char *input, size_t &r, size_t block_end, char *output, size_t &w) {
+    for (; r < block_end; r += 4) {
+        uint32_t cp = load_utf32<big_endian>(input + r);
+        if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+            return false;
+        }
+        w += store_utf8(cp, output + w);
+    }
+    return true;
+}
+
+/*
+ * Scalar kernels: nothing is processed, everything is left to the Read* and CpTo* classes
+ */
+namespace scalar {
+
+template<bool big_endian>
+inline size_t ascii_to_utf16(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t ascii_to_utf32(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf8_to_utf16(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf8_to_utf32(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf16_to_utf8(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf16_swap(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf32_to_utf8(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian_in, bool big_endian_out>
+inline size_t utf32_to_utf16(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian_in, bool big_endian_out>
+inline size_t utf16_to_utf32(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian, bool swap>
+inline size_t utf32_copy(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t validate_utf32(const char *, size_t, size_t *length) {
+    *length = 0;
+    return 0;
+}
+
+inline size_t validate_utf8(const char *, size_t, size_t *length) {
+    *length = 0;
+    return 0;
+}
+
+inline size_t latin1_to_utf8(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t latin1_to_utf16(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t latin1_to_utf32(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+inline size_t utf8_to_latin1(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf16_to_latin1(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf32_to_latin1(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+inline size_t single_byte_to_utf8(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t single_byte_to_utf16(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t single_byte_to_utf32(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+inline size_t utf8_to_single_byte(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf16_to_single_byte(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf32_to_single_byte(const SingleByteTables &, const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+inline size_t ascii_copy(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+inline size_t ascii_length(const char *, size_t) {
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf16_to_ascii(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+template<bool big_endian>
+inline size_t utf32_to_ascii(const char *, size_t, char *, size_t, size_t *written) {
+    *written = 0;
+    return 0;
+}
+
+inline size_t utf8_length(const char *input, size_t input_len, size_t *four_bytes) {
+    size_t chars = 0, four = 0;
+    for (size_t i = 0; i < input_len; i++) {
+        uint8_t b = ((const uint8_t *) input)[i];
+        chars += (b & 0b11000000) != 0b10000000;
+        four += b >= 0b11110000;
+    }
+    *four_bytes = four;
+    return chars;
+}
+
+template<bool big_endian>
+inline size_t utf16_length(const char *input, size_t input_len, size_t *low_surrogates) {
+    size_t utf8_len = 0, lows = 0;
+    for (size_t i = 0; i + 2 <= input_len; i += 2) {
+        const uint8_t *p = (const uint8_t *) input + i;
+        uint16_t u = big_endian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+        if (u <= 0x7F) {
+            utf8_len += 1;
+        } else if (u <= 0x7FF) {
+            utf8_len += 2;
+        } else if (u >= 0xD800 && u <= 0xDFFF) {
+            // each half of a surrogate pair accounts for 2 of the 4 UTF-8 bytes
+            utf8_len += 2;
+            lows += u >= 0xDC00;
+        } else {
+            utf8_len += 3;
+        }
+    }
+    *low_surrogates = lows;
+    return utf8_len;
+}
+
+template<bool big_endian>
+inline size_t utf32_length(const char *input, size_t input_len, size_t *supplementary) {
+    size_t utf8_len = 0, sup = 0;
+    for (size_t i = 0; i + 4 <= input_len; i += 4) {
+        const uint8_t *p = (const uint8_t *) input + i;
+        uint32_t cp = big_endian ? (uint32_t(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3])
+                                 : (uint32_t(p[3]) << 24 | p[2] << 16 | p[1] << 8 | p[0]);
+        utf8_len += 1 + (cp > 0x7F) + (cp > 0x7FF) + (cp > 0xFFFF);
+        sup += cp > 0xFFFF;
+    }
+    *supplementary = sup;
+    return utf8_len;
+}
+
+}
+
+/*
+ * SWAR kernels : 8 bytes (or 4 UTF-16 code units) per 64 bits word, without any intrinsic
+ * Only the ASCII runs of the UTF-8 streams and the UTF-16 words without surrogates are processed,
+ * the UTF-32 kernels are the scalar ones.
+ */
+namespace swar {
+
+static const uint64_t HIGH_BITS_8 = 0x8080808080808080ULL;
+static const uint64_t HIGH_BITS_16 = 0x8000800080008000ULL;
+static const uint64_t LOW_BITS_16 = 0x7FFF7FFF7FFF7FFFULL;
+
+/* Load and store 64 bits words in little endian order, whatever the host */
+static inline __attribute__((always_inline))
+uint64_t load_le64(const char *input) {
+    uint64_t x;
+    memcpy(&x, input, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+static inline __attribute__((always_inline))
+void store_le64(char *output, uint64_t x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    memcpy(output, &x, 8);
+}
+
+static inline __attribute__((always_inline))
+void store_le32(char *output, uint32_t x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap32(x);
+#endif
+    memcpy(output, &x, 4);
+}
+
+/* Byte swap each 16 bits lane */
+static inline __attribute__((always_inline))
+uint64_t bswap_16(uint64_t x) {
+    return ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+}
+
+/* Byte swap each 32 bits lane */
+static inline __attribute__((always_inline))
+uint64_t bswap_32(uint64_t x) {
+    x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+    return ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+}
+
+/* Bit 15 of each 16 bits lane is set if the lane is zero (exact, no carry between the lanes) */
+static inline __attribute__((always_inline))
+uint64_t zero_16(uint64_t x) {
+    return ~(((x & LOW_BITS_16) + LOW_BITS_16) | x) & HIGH_BITS_16;
+}
+
+/* Bit 15 of each 16 bits lane is set if the code unit is a surrogate */
+static inline __attribute__((always_inline))
+uint64_t surrogates_16(uint64_t units) {
+    return zero_16((units & 0xF800F800F800F800ULL) ^ 0xD800D800D800D800ULL);
+}
+
+/* Widen the 4 low bytes of x into 16 bits lanes */
+static inline __attribute__((always_inline))
+uint64_t widen_8_16(uint64_t x) {
+    x &= 0xFFFFFFFFULL;
+    x = (x | x << 16) & 0x0000FFFF0000FFFFULL;
+    return (x | x << 8) & 0x00FF00FF00FF00FFULL;
+}
+
+/* Widen the 2 low 16 bits lanes of x into 32 bits lanes */
+static inline __attribute__((always_inline))
+uint64_t widen_16_32(uint64_t x) {
+    x &= 0xFFFFFFFFULL;
+    return (x | x << 16) & 0x0000FFFF0000FFFFULL;
+}
+
+/* Number of ASCII bytes at the beginning of a word containing a non-ASCII byte */
+static inline __attribute__((always_inline))
+size_t ascii_prefix(uint64_t x) {
+    return __builtin_ctzll(x & HIGH_BITS_8) / 8;
+}
+
+/* Same as sse42::ascii_to_utf16, by words of 8 bytes */
+template<bool big_endian>
+inline size_t ascii_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && 2 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        store_le64(output + 2 * r, widen_8_16(x) << (big_endian ? 8 : 0));
+        store_le64(output + 2 * r + 8, widen_8_16(x >> 32) << (big_endian ? 8 : 0));
+        if ((x & HIGH_BITS_8) != 0) {
+            r += ascii_prefix(x);
+            break;
+        }
+        r += 8;
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/* Same as sse42::ascii_to_utf32, by words of 8 bytes */
+template<bool big_endian>
+inline size_t ascii_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && 4 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        for (int i = 0; i < 4; i++) {
+            uint64_t cp = widen_16_32(widen_8_16(x >> (16 * i)));
+            store_le64(output + 4 * r + 8 * i, big_endian ? bswap_32(cp) : cp);
+        }
+        if ((x & HIGH_BITS_8) != 0) {
+            r += ascii_prefix(x);
+            break;
+        }
+        r += 8;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/* Decode the valid UTF-8 character at the beginning of input, return its length, 0 if it is invalid or truncated */
+static inline __attribute__((always_inline))
+size_t utf8_decode_one(const uint8_t *p, size_t input_len, uint32_t *cp) {
+    if (p[0] < 0x80) {
+        *cp = p[0];
+        return 1;
+    }
+    if (p[0] < 0xC2 || p[0] > 0xF4) {
+        return 0;
+    }
+    if (p[0] < 0xE0) {
+        if (input_len < 2 || (p[1] & 0xC0) != 0x80) {
+            return 0;
+        }
+        *cp = (p[0] & 0x1F) << 6 | (p[1] & 0x3F);
+        return 2;
+    }
+    if (p[0] < 0xF0) {
+        if (input_len < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80) {
+            return 0;
+        }
+        // overlong and surrogates
+        uint32_t c = (p[0] & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F);
+        if (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF)) {
+            return 0;
+        }
+        *cp = c;
+        return 3;
+    }
+    if (input_len < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80) {
+        return 0;
+    }
+    // overlong and > 0x10FFFF
+    uint32_t c = (p[0] & 0x07) << 18 | (p[1] & 0x3F) << 12 | (p[2] & 0x3F) << 6 | (p[3] & 0x3F);
+    if (c < 0x10000 || c > 0x10FFFF) {
+        return 0;
+    }
+    *cp = c;
+    return 4;
+}
+
+/* Length of the valid UTF-8 character at the beginning of input, 0 if it is invalid or truncated */
+static inline __attribute__((always_inline))
+size_t utf8_valid_length(const uint8_t *p, size_t input_len) {
+    uint32_t cp;
+    return utf8_decode_one(p, input_len, &cp);
+}
+
+/* Validate a prefix of a UTF-8 stream, the ASCII words are skipped. Stop on the first invalid or truncated character */
+inline size_t validate_utf8(const char *input, size_t input_len, size_t *length) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0, chars = 0;
+    while (r < input_len) {
+        if (p[r] < 0x80) {
+            // only look for an ASCII word after an ASCII byte
+            if (r + 8 <= input_len && (load_le64(input + r) & HIGH_BITS_8) == 0) {
+                r += 8;
+                chars += 8;
+            } else {
+                r += 1;
+                chars += 1;
+            }
+            continue;
+        }
+        size_t len = utf8_valid_length(p + r, input_len - r);
+        if (len == 0) {
+            break;
+        }
+        r += len;
+        chars += 1;
+    }
+    *length = chars;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into UTF-16, stop on the first invalid or truncated character
+ * The ASCII words are widened, the other characters are decoded one at a time and written with a single store
+ * (the output often has the same offset in its page as the input : byte stores would delay the next loads).
+ */
+template<bool big_endian>
+inline size_t utf8_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0, w = 0;
+    while (r < input_len && w + 16 <= output_len) {
+        // only look for an ASCII word after an ASCII byte
+        if (p[r] < 0x80 && r + 8 <= input_len) {
+            uint64_t x = load_le64(input + r);
+            if ((x & HIGH_BITS_8) == 0) {
+                store_le64(output + w, widen_8_16(x) << (big_endian ? 8 : 0));
+                store_le64(output + w + 8, widen_8_16(x >> 32) << (big_endian ? 8 : 0));
+                r += 8;
+                w += 16;
+                continue;
+            }
+        }
+        uint32_t cp;
+        size_t len = utf8_decode_one(p + r, input_len - r, &cp);
+        if (len == 0) {
+            break;
+        }
+        // 4 bytes are stored, the next character overwrites the 2 last ones after a BMP character
+        bool pair = cp >= 0x10000;
+        uint32_t units = pair ? (0xD800 + ((cp - 0x10000) >> 10)) | (0xDC00 + (cp & 0x3FF)) << 16 : cp;
+        store_le32(output + w, big_endian ? uint32_t(bswap_16(units)) : units);
+        r += len;
+        w += pair ? 4 : 2;
+    }
+    *written = w;
+    return r;
+}
+
+/* Same as utf8_to_utf16, into UTF-32 */
+template<bool big_endian>
+inline size_t utf8_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0, w = 0;
+    while (r < input_len && w + 32 <= output_len) {
+        if (p[r] < 0x80 && r + 8 <= input_len) {
+            uint64_t x = load_le64(input + r);
+            if ((x & HIGH_BITS_8) == 0) {
+                for (int i = 0; i < 4; i++) {
+                    uint64_t cp = widen_16_32(widen_8_16(x >> (16 * i)));
+                    store_le64(output + w + 8 * i, big_endian ? bswap_32(cp) : cp);
+                }
+                r += 8;
+                w += 32;
+                continue;
+            }
+        }
+        uint32_t cp;
+        size_t len = utf8_decode_one(p + r, input_len - r, &cp);
+        if (len == 0) {
+            break;
+        }
+        store_le32(output + w, big_endian ? __builtin_bswap32(cp) : cp);
+        r += len;
+        w += 4;
+    }
+    *written = w;
+    return r;
+}
+
+inline size_t utf8_length(const char *input, size_t input_len, size_t *four_bytes) {
+    size_t chars = 0, four = 0;
+    size_t r = 0;
+    for (; r + 8 <= input_len; r += 8) {
+        uint64_t x = load_le64(input + r);
+        // continuation bytes : 10xxxxxx, 4 bytes leads : 11110xxx (the shifted bits of the next byte don't reach bit 7)
+        chars += 8 - __builtin_popcountll(x & ~(x << 1) & HIGH_BITS_8);
+        four += __builtin_popcountll(x & (x << 1) & (x << 2) & (x << 3) & HIGH_BITS_8);
+    }
+    size_t tail_four;
+    chars += scalar::utf8_length(input + r, input_len - r, &tail_four);
+    *four_bytes = four + tail_four;
+    return chars;
+}
+
+template<bool big_endian>
+inline size_t utf16_length(const char *input, size_t input_len, size_t *low_surrogates) {
+    size_t utf8_len = 0, lows = 0;
+    size_t r = 0;
+    for (; r + 8 <= input_len; r += 8) {
+        uint64_t x = load_le64(input + r);
+        uint64_t units = big_endian ? bswap_16(x) : x;
+        uint64_t lt_80 = zero_16(units & 0xFF80FF80FF80FF80ULL);
+        uint64_t lt_800 = zero_16(units & 0xF800F800F800F800ULL);
+        // 3 bytes, minus 1 for each unit < 0x800 or surrogate, minus 1 for each unit < 0x80
+        utf8_len += 12 - __builtin_popcountll(lt_800 | surrogates_16(units)) - __builtin_popcountll(lt_80);
+        lows += __builtin_popcountll(zero_16((units & 0xFC00FC00FC00FC00ULL) ^ 0xDC00DC00DC00DC00ULL));
+    }
+    size_t tail_lows;
+    utf8_len += scalar::utf16_length<big_endian>(input + r, input_len - r, &tail_lows);
+    *low_surrogates = lows + tail_lows;
+    return utf8_len;
+}
+
+/* Convert a prefix of a UTF-16 stream into UTF-8, by words of 4 code units. Stop on the first word containing a surrogate */
+template<bool big_endian>
+inline size_t utf16_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0, w = 0;
+    while (r + 8 <= input_len && w + 12 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        uint64_t units = big_endian ? bswap_16(x) : x;
+        if ((units & 0xFF80FF80FF80FF80ULL) == 0) {
+            units = (units | units >> 8) & 0x0000FFFF0000FFFFULL;
+            units = (units | units >> 16) & 0xFFFFFFFFULL;
+            for (int i = 0; i < 4; i++) {
+                output[w + i] = char(units >> (8 * i));
+            }
+            r += 8;
+            w += 4;
+            continue;
+        }
+        if (surrogates_16(units) != 0) {
+            break;
+        }
+        for (int i = 0; i < 4; i++) {
+            w += store_utf8(uint16_t(units >> (16 * i)), output + w);
+        }
+        r += 8;
+    }
+    *written = w;
+    return r;
+}
+
+/* Convert a prefix of a UTF-16 stream into UTF-32, by words of 4 code units. Stop on the first word containing a surrogate */
+template<bool big_endian_in, bool big_endian_out>
+inline size_t utf16_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && 2 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        uint64_t units = big_endian_in ? bswap_16(x) : x;
+        if (surrogates_16(units) != 0) {
+            break;
+        }
+        uint64_t lo = widen_16_32(units), hi = widen_16_32(units >> 32);
+        store_le64(output + 2 * r, big_endian_out ? bswap_32(lo) : lo);
+        store_le64(output + 2 * r + 8, big_endian_out ? bswap_32(hi) : hi);
+        r += 8;
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/* Byte swap a prefix of a UTF-16 stream, by words of 4 code units. Stop on the first word containing a surrogate */
+template<bool big_endian>
+inline size_t utf16_swap(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && r + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if (surrogates_16(big_endian ? bswap_16(x) : x) != 0) {
+            break;
+        }
+        store_le64(output + r, bswap_16(x));
+        r += 8;
+    }
+    *written = r;
+    return r;
+}
+
+/* Convert a prefix of a Latin-1 stream into UTF-8, by words of 8 bytes. The ASCII words are copied */
+inline size_t latin1_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0, w = 0;
+    while (r + 8 <= input_len && w + 16 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) == 0) {
+            store_le64(output + w, x);
+            w += 8;
+        } else {
+            for (int i = 0; i < 8; i++) {
+                w += store_utf8(uint8_t(x >> (8 * i)), output + w);
+            }
+        }
+        r += 8;
+    }
+    *written = w;
+    return r;
+}
+
+/* Widen a prefix of a Latin-1 stream into UTF-16, by words of 8 bytes */
+template<bool big_endian>
+inline size_t latin1_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && 2 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        store_le64(output + 2 * r, widen_8_16(x) << (big_endian ? 8 : 0));
+        store_le64(output + 2 * r + 8, widen_8_16(x >> 32) << (big_endian ? 8 : 0));
+        r += 8;
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/* Widen a prefix of a Latin-1 stream into UTF-32, by words of 8 bytes */
+template<bool big_endian>
+inline size_t latin1_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && 4 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        for (int i = 0; i < 4; i++) {
+            uint64_t cp = widen_16_32(widen_8_16(x >> (16 * i)));
+            store_le64(output + 4 * r + 8 * i, big_endian ? bswap_32(cp) : cp);
+        }
+        r += 8;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into Latin-1, by words of 8 bytes. The ASCII words are copied,
+ * the others are converted one character at a time. Stop on the first character which is not ASCII or a valid
+ * 2 bytes sequence of U+0080..U+00FF
+ */
+inline size_t utf8_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0, w = 0;
+    while (r + 8 <= input_len && w + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) == 0) {
+            store_le64(output + w, x);
+            r += 8;
+            w += 8;
+            continue;
+        }
+        // the last sequence may end in the next word
+        for (size_t word_end = r + 8; r < word_end;) {
+            if (p[r] < 0x80) {
+                output[w++] = char(p[r]);
+                r += 1;
+            } else if ((p[r] & 0xFE) == 0xC2 && r + 1 < input_len && (p[r + 1] & 0xC0) == 0x80) {
+                output[w++] = char((p[r] & 0x03) << 6 | (p[r + 1] & 0x3F));
+                r += 2;
+            } else {
+                *written = w;
+                return r;
+            }
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Narrow a prefix of a UTF-16 stream into Latin-1, by words of 4 code units. Stop on the first word containing a code unit above 0xFF */
+template<bool big_endian>
+inline size_t utf16_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && r / 2 + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        uint64_t units = big_endian ? bswap_16(x) : x;
+        if ((units & 0xFF00FF00FF00FF00ULL) != 0) {
+            break;
+        }
+        units = (units | units >> 8) & 0x0000FFFF0000FFFFULL;
+        units = (units | units >> 16) & 0xFFFFFFFFULL;
+        store_le64(output + r / 2, units);
+        r += 8;
+    }
+    *written = r / 2;
+    return r;
+}
+
+/*
+ * Convert a prefix of a single-byte stream into UTF-8, by words of 8 bytes. The ASCII words are copied,
+ * the others are looked up one byte at a time. Stop on the first unmapped byte
+ */
+inline size_t single_byte_to_utf8(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0, w = 0;
+    while (r + 8 <= input_len && w + 24 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) == 0) {
+            store_le64(output + w, x);
+            r += 8;
+            w += 8;
+            continue;
+        }
+        for (size_t word_end = r + 8; r < word_end; r++) {
+            uint32_t cp = p[r] < 0x80 ? p[r] : tables.decode[p[r] - 0x80];
+            if (cp == 0 && p[r] != 0) {
+                *written = w;
+                return r;
+            }
+            w += store_utf8(cp, output + w);
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Same as single_byte_to_utf8 into UTF-16, the ASCII words are widened */
+template<bool big_endian>
+inline size_t single_byte_to_utf16(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0;
+    while (r + 8 <= input_len && 2 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) == 0) {
+            store_le64(output + 2 * r, widen_8_16(x) << (big_endian ? 8 : 0));
+            store_le64(output + 2 * r + 8, widen_8_16(x >> 32) << (big_endian ? 8 : 0));
+            r += 8;
+            continue;
+        }
+        for (size_t word_end = r + 8; r < word_end; r++) {
+            uint16_t unit = p[r] < 0x80 ? p[r] : tables.decode[p[r] - 0x80];
+            if (unit == 0 && p[r] != 0) {
+                *written = 2 * r;
+                return r;
+            }
+            store_utf16<big_endian>(unit, output + 2 * r);
+        }
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/* Same as single_byte_to_utf8 into UTF-32, the ASCII words are widened */
+template<bool big_endian>
+inline size_t single_byte_to_utf32(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0;
+    while (r + 8 <= input_len && 4 * (r + 8) <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) == 0) {
+            for (int i = 0; i < 4; i++) {
+                uint64_t cp = widen_16_32(widen_8_16(x >> (16 * i)));
+                store_le64(output + 4 * r + 8 * i, big_endian ? bswap_32(cp) : cp);
+            }
+            r += 8;
+            continue;
+        }
+        for (size_t word_end = r + 8; r < word_end; r++) {
+            uint16_t unit = p[r] < 0x80 ? p[r] : tables.decode[p[r] - 0x80];
+            if (unit == 0 && p[r] != 0) {
+                *written = 4 * r;
+                return r;
+            }
+            // the codepoints are in the BMP, the high code unit is zero
+            store_utf16<big_endian>(0, output + 4 * r + (big_endian ? 0 : 2));
+            store_utf16<big_endian>(unit, output + 4 * r + (big_endian ? 2 : 0));
+        }
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into a single-byte code page, by words of 8 bytes. The ASCII words are copied,
+ * the others are converted one character at a time. Stop on the first invalid or unmapped character
+ */
+inline size_t utf8_to_single_byte(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    size_t r = 0, w = 0;
+    while (r + 8 <= input_len && w + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) == 0) {
+            store_le64(output + w, x);
+            r += 8;
+            w += 8;
+            continue;
+        }
+        // the last sequence may end in the next word
+        for (size_t word_end = r + 8; r < word_end; w++) {
+            size_t char_read = utf8_to_single_byte_one(tables, p + r, input_len - r, output + w);
+            if (char_read == 0) {
+                *written = w;
+                return r;
+            }
+            r += char_read;
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-16 stream into a single-byte code page, by words of 4 code units looked up without branch.
+ * Stop on the first unmapped code unit
+ */
+template<bool big_endian>
+inline size_t utf16_to_single_byte(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && r / 2 + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        uint64_t units = big_endian ? bswap_16(x) : x;
+        if ((units & 0xFF80FF80FF80FF80ULL) == 0) {
+            units = (units | units >> 8) & 0x0000FFFF0000FFFFULL;
+            units = (units | units >> 16) & 0xFFFFFFFFULL;
+            store_le64(output + r / 2, units);
+            r += 8;
+            continue;
+        }
+        // the surrogates are never mapped
+        uint32_t unmapped = 0;
+        for (int i = 0; i < 4; i++) {
+            uint16_t unit = uint16_t(units >> (16 * i));
+            uint8_t b = tables.lookup(unit);
+            output[r / 2 + i] = char(b);
+            unmapped |= uint32_t(b == 0 && unit != 0) << i;
+        }
+        if (unmapped != 0) {
+            r += 2 * __builtin_ctz(unmapped);
+            break;
+        }
+        r += 8;
+    }
+    *written = r / 2;
+    return r;
+}
+
+/* Same as sse42::ascii_copy, by words of 8 bytes */
+inline size_t ascii_copy(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && r + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        store_le64(output + r, x);
+        if ((x & HIGH_BITS_8) != 0) {
+            r += ascii_prefix(x);
+            break;
+        }
+        r += 8;
+    }
+    *written = r;
+    return r;
+}
+
+/* Same as sse42::ascii_length, by words of 8 bytes */
+inline size_t ascii_length(const char *input, size_t input_len) {
+    size_t r = 0;
+    while (r + 8 <= input_len) {
+        uint64_t x = load_le64(input + r);
+        if ((x & HIGH_BITS_8) != 0)
+            return r + ascii_prefix(x);
+        r += 8;
+    }
+    return r;
+}
+
+/* Same as sse42::utf16_to_ascii, by words of 4 code units */
+template<bool big_endian>
+inline size_t utf16_to_ascii(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 8 <= input_len && r / 2 + 8 <= output_len) {
+        uint64_t x = load_le64(input + r);
+        uint64_t units = big_endian ? bswap_16(x) : x;
+        uint64_t non_ascii = units & 0xFF80FF80FF80FF80ULL;
+        uint64_t bytes = (units | units >> 8) & 0x0000FFFF0000FFFFULL;
+        store_le64(output + r / 2, (bytes | bytes >> 16) & 0xFFFFFFFFULL);
+        if (non_ascii != 0) {
+            r += __builtin_ctzll(non_ascii) / 16 * 2;
+            break;
+        }
+        r += 8;
+    }
+    *written = r / 2;
+    return r;
+}
+}
+
+#if defined(UTF_CONV_X86)
+
+/*
+ * SSE4.2 kernels (the UTF-8 validation only needs SSSE3)
+ */
+namespace sse42 {
+
+/*
+ * Widen the ASCII prefix of input into UTF-16 (2 output bytes per input byte), by blocks of 16 bytes.
+ * A block containing a non-ASCII byte is still stored but only its ASCII prefix is accounted for.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t ascii_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t r = 0;
+    while (r + 16 <= input_len && 2 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+        if (big_endian) {
+            _mm_storeu_si128((__m128i *) (output + 2 * r), _mm_unpacklo_epi8(zero, v));
+            _mm_storeu_si128((__m128i *) (output + 2 * r + 16), _mm_unpackhi_epi8(zero, v));
+        } else {
+            _mm_storeu_si128((__m128i *) (output + 2 * r), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *) (output + 2 * r + 16), _mm_unpackhi_epi8(v, zero));
+        }
+        if (mask != 0) {
+            r += __builtin_ctz(mask);
+            break;
+        }
+        r += 16;
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/*
+ * Widen the ASCII prefix of input into UTF-32 (4 output bytes per input byte)
+ * Same block semantics as ascii_to_utf16
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t ascii_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t r = 0;
+    while (r + 16 <= input_len && 4 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i out[4] = {
+                _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+        for (int i = 0; i < 4; i++) {
+            if (big_endian) {
+                out[i] = _mm_slli_epi32(out[i], 24);
+            }
+            _mm_storeu_si128((__m128i *) (output + 4 * r + 16 * i), out[i]);
+        }
+        if (mask != 0) {
+            r += __builtin_ctz(mask);
+            break;
+        }
+        r += 16;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/* Error mask of the 16 bytes of input, prev_input holds the previous 16 bytes */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf8_check_block(__m128i input, __m128i prev_input) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 16 - 1);
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 16 - 2);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 16 - 3);
+
+    // special cases: bad continuation, overlong encoding, surrogates, too large codepoints
+    __m128i byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(UTF8_BYTE_1_HIGH_TABLE),
+            _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte_1_low = _mm_shuffle_epi8(_mm_setr_epi8(UTF8_BYTE_1_LOW_TABLE),
+            _mm_and_si128(prev1, nibble));
+    __m128i byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(UTF8_BYTE_2_HIGH_TABLE),
+            _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special_cases = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+    // the third and fourth bytes of the 3 and 4 bytes sequences must be continuations
+    __m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80)));
+    __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80)));
+    __m128i must_be_2_3_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8(char(0x80)));
+    return _mm_xor_si128(must_be_2_3_continuation, special_cases);
+}
+
+/* Non zero if the block ends with an incomplete sequence */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf8_is_incomplete(__m128i input) {
+    const __m128i max_value = _mm_setr_epi8(
+            char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF),
+            char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+    return _mm_subs_epu8(input, max_value);
+}
+
+/* Number of non continuation bytes in the block */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+size_t utf8_count_chars(__m128i input) {
+    return __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(input, _mm_set1_epi8(char(0xBF)))));
+}
+
+/*
+ * Validate a prefix of a UTF-8 stream by blocks of 64 bytes
+ * Return the length of the validated prefix (on a character boundary) and store its number of characters in *length
+ */
+UTF_TARGET_SSE42
+inline size_t validate_utf8(const char *input, size_t input_len, size_t *length) {
+    size_t r = 0;
+    size_t count = 0;
+    __m128i prev_input = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+    while (r + 64 <= input_len) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *) (input + r + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *) (input + r + 48));
+        __m128i error;
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3))) == 0) {
+            // ASCII block, only check that the previous block was complete
+            error = prev_incomplete;
+            prev_input = _mm_setzero_si128();
+            prev_incomplete = _mm_setzero_si128();
+            if (!_mm_testz_si128(error, error)) {
+                break;
+            }
+            count += 64;
+        } else {
+            error = _mm_or_si128(
+                    _mm_or_si128(utf8_check_block(v0, prev_input), utf8_check_block(v1, v0)),
+                    _mm_or_si128(utf8_check_block(v2, v1), utf8_check_block(v3, v2)));
+            prev_input = v3;
+            prev_incomplete = utf8_is_incomplete(v3);
+            if (!_mm_testz_si128(error, error)) {
+                break;
+            }
+            count += utf8_count_chars(v0) + utf8_count_chars(v1) + utf8_count_chars(v2) + utf8_count_chars(v3);
+        }
+        r += 64;
+    }
+    size_t boundary = utf8_last_boundary(input, r);
+    if (boundary != r) {
+        // the lead byte of the incomplete sequence was counted
+        count--;
+    }
+    *length = count;
+    return boundary;
+}
+
+/* Number of characters and of 4 bytes sequences, by blocks of 16 bytes */
+UTF_TARGET_SSE42
+inline size_t utf8_length(const char *input, size_t input_len, size_t *four_bytes) {
+    size_t chars = 0, four = 0;
+    size_t r = 0;
+    for (; r + 16 <= input_len; r += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        chars += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(0xBF)))));
+        four += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(char(0xF0))), v)));
+    }
+    size_t tail_four;
+    chars += scalar::utf8_length(input + r, input_len - r, &tail_four);
+    *four_bytes = four + tail_four;
+    return chars;
+}
+
+/* Masks of the code units >= 0x80, >= 0x800, surrogates and low surrogates of 8 code units */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+void utf16_classify(__m128i v, __m128i &ge_80, __m128i &ge_800, __m128i &surrogates, __m128i &lows) {
+    const __m128i zero = _mm_setzero_si128();
+    ge_80 = _mm_xor_si128(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xFF80))), zero), _mm_set1_epi8(-1));
+    ge_800 = _mm_xor_si128(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xF800))), zero), _mm_set1_epi8(-1));
+    surrogates = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xF800))), _mm_set1_epi16(short(0xD800)));
+    lows = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xFC00))), _mm_set1_epi16(short(0xDC00)));
+}
+
+/* UTF-8 size and number of low surrogates, by blocks of 16 code units */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf16_length(const char *input, size_t input_len, size_t *low_surrogates) {
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t utf8_len = 0, lows = 0;
+    size_t r = 0;
+    for (; r + 32 <= input_len; r += 32) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        if (big_endian) {
+            v0 = _mm_shuffle_epi8(v0, bswap);
+            v1 = _mm_shuffle_epi8(v1, bswap);
+        }
+        __m128i ge_80_0, ge_800_0, sur_0, lows_0, ge_80_1, ge_800_1, sur_1, lows_1;
+        utf16_classify(v0, ge_80_0, ge_800_0, sur_0, lows_0);
+        utf16_classify(v1, ge_80_1, ge_800_1, sur_1, lows_1);
+        utf8_len += 16
+                + __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(ge_80_0, ge_80_1)))
+                + __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(ge_800_0, ge_800_1)))
+                - __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(sur_0, sur_1)));
+        lows += __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(lows_0, lows_1)));
+    }
+    size_t tail_lows;
+    utf8_len += scalar::utf16_length<big_endian>(input + r, input_len - r, &tail_lows);
+    *low_surrogates = lows + tail_lows;
+    return utf8_len;
+}
+
+/* UTF-8 size and number of supplementary codepoints, by blocks of 4 codepoints */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf32_length(const char *input, size_t input_len, size_t *supplementary) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t utf8_len = 0, sup = 0;
+    size_t r = 0;
+    for (; r + 16 <= input_len; r += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (big_endian) {
+            v = _mm_shuffle_epi8(v, bswap);
+        }
+        int ge_80 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, _mm_set1_epi32(0x7F))));
+        int ge_800 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, _mm_set1_epi32(0x7FF))));
+        int ge_10000 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, _mm_set1_epi32(0xFFFF))));
+        utf8_len += 4 + __builtin_popcount(ge_80) + __builtin_popcount(ge_800) + __builtin_popcount(ge_10000);
+        sup += __builtin_popcount(ge_10000);
+    }
+    size_t tail_sup;
+    utf8_len += scalar::utf32_length<big_endian>(input + r, input_len - r, &tail_sup);
+    *supplementary = sup + tail_sup;
+    return utf8_len;
+}
+
+
+/* Codepoints of the characters beginning in the 8 first bytes of input (BMP only), in 16 bits lanes */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf8_decode_8(__m128i b0, __m128i b1, __m128i b2) {
+    const __m128i cont_bits = _mm_set1_epi16(0x3F);
+    __m128i c1 = _mm_and_si128(b1, cont_bits);
+    __m128i c2 = _mm_and_si128(b2, cont_bits);
+    __m128i two = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b0, _mm_set1_epi16(0x1F)), 6), c1);
+    __m128i three = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(b0, 12), _mm_slli_epi16(c1, 6)), c2);
+    __m128i cp = _mm_blendv_epi8(b0, two, _mm_cmpgt_epi16(b0, _mm_set1_epi16(0xBF)));
+    return _mm_blendv_epi8(cp, three, _mm_cmpgt_epi16(b0, _mm_set1_epi16(0xDF)));
+}
+
+/*
+ * Same as utf8_decode_8 with the 4 bytes sequences : the lane of the lead byte holds the high surrogate
+ * and the lane of the first continuation byte (prev is the previous byte) holds the low surrogate
+ */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf8_decode_8_pairs(__m128i prev, __m128i b0, __m128i b1, __m128i b2) {
+    const __m128i cont_bits = _mm_set1_epi16(0x3F);
+    __m128i c2 = _mm_and_si128(b2, cont_bits);
+    // 0xD800 + ((cp - 0x10000) >> 10) == 0xD7C0 + (cp >> 10)
+    __m128i highs = _mm_add_epi16(_mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(b0, _mm_set1_epi16(0x07)), 8),
+            _mm_slli_epi16(_mm_and_si128(b1, cont_bits), 2)), _mm_srli_epi16(c2, 4)), _mm_set1_epi16(short(0xD7C0)));
+    __m128i lows = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(b1, _mm_set1_epi16(0x0F)), 6), c2), _mm_set1_epi16(short(0xDC00)));
+    __m128i units = _mm_blendv_epi8(utf8_decode_8(b0, b1, b2), highs, _mm_cmpgt_epi16(b0, _mm_set1_epi16(0xEF)));
+    return _mm_blendv_epi8(units, lows, _mm_cmpgt_epi16(prev, _mm_set1_epi16(0xEF)));
+}
+
+/* Surrogate pairs of 4 sequences of 4 bytes, each one in a 32 bits lane of v */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf8_four_to_utf16(__m128i v) {
+    __m128i cp = _mm_or_si128(
+            _mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x07)), 18), _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x3F00)), 4)),
+            _mm_or_si128(_mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x3F0000)), 10), _mm_and_si128(_mm_srli_epi32(v, 24), _mm_set1_epi32(0x3F))));
+    __m128i highs = _mm_add_epi32(_mm_srli_epi32(cp, 10), _mm_set1_epi32(0xD7C0));
+    __m128i lows = _mm_or_si128(_mm_and_si128(cp, _mm_set1_epi32(0x3FF)), _mm_set1_epi32(0xDC00));
+    return _mm_or_si128(highs, _mm_slli_epi32(lows, 16));
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into UTF-16
+ * The input is validated by chunks (validate_utf8), then each validated chunk is converted by windows of 16 bytes :
+ * the characters beginning in the 8 first bytes of the window are decoded in 16 bits lanes and packed
+ * with a shuffle table, the surrogate pairs of the 4 bytes sequences take the lanes of their 2 first bytes.
+ * The runs of 4 bytes sequences are converted 16 bytes at a time.
+ * Stop before the chunk containing the first error, the exact error is left to ReadUtf8Cp.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf8_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0, w = 0;
+    for (;;) {
+        size_t ascii_written;
+        r += ascii_to_utf16<big_endian>(input + r, input_len - r, output + w, output_len - w, &ascii_written);
+        w += ascii_written;
+
+        // at most 2 output bytes per input byte
+        size_t chunk_len = input_len - r < 4096 ? input_len - r : 4096;
+        if (chunk_len > (output_len - w) / 2) {
+            chunk_len = (output_len - w) / 2;
+        }
+        size_t length;
+        size_t end = r + validate_utf8(input + r, chunk_len, &length);
+        if (end == r) {
+            break;
+        }
+
+        while (r + 16 <= end && w + 32 <= output_len) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+            uint32_t leads = _mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(0xBF))));
+            uint32_t four_leads = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(char(0xF0))), v));
+            // 4 sequences of 4 bytes, converted in place
+            if ((four_leads & 0x1111) == 0x1111) {
+                __m128i units = utf8_four_to_utf16(v);
+                if (big_endian) {
+                    units = _mm_shuffle_epi8(units, bswap);
+                }
+                _mm_storeu_si128((__m128i *) (output + w), units);
+                w += 16;
+                r += 16;
+                continue;
+            }
+            // the window ends at the first character beginning after its 8 first bytes
+            size_t window = 8 + __builtin_ctz(leads >> 8);
+            leads &= 0xFF;
+            four_leads &= 0xFF;
+
+            __m128i b0 = _mm_cvtepu8_epi16(v);
+            __m128i b1 = _mm_cvtepu8_epi16(_mm_srli_si128(v, 1));
+            __m128i b2 = _mm_cvtepu8_epi16(_mm_srli_si128(v, 2));
+            __m128i units;
+            if (four_leads == 0) {
+                units = utf8_decode_8(b0, b1, b2);
+            } else {
+                // the low surrogate of a 4 bytes sequence beginning on the last lane is left to the next window
+                if (four_leads & 0x80) {
+                    window = 7;
+                    leads &= 0x7F;
+                    four_leads &= 0x7F;
+                }
+                units = utf8_decode_8_pairs(_mm_cvtepu8_epi16(_mm_slli_si128(v, 1)), b0, b1, b2);
+                leads |= four_leads << 1;
+            }
+            units = _mm_shuffle_epi8(units, _mm_load_si128((const __m128i *) tables.utf16_pack[leads]));
+            if (big_endian) {
+                units = _mm_shuffle_epi8(units, bswap);
+            }
+            _mm_storeu_si128((__m128i *) (output + w), units);
+            w += 2 * __builtin_popcount(leads);
+            r += window;
+        }
+        while (r < end && w + 4 <= output_len) {
+            size_t char_written;
+            r += utf8_to_utf16_one<big_endian>(input + r, output + w, &char_written);
+            w += char_written;
+        }
+        if (r < end) {
+            break;
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Codepoints of the characters beginning in the 4 first bytes of input, in 32 bits lanes */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf8_decode_4(__m128i b0, __m128i b1, __m128i b2, __m128i b3) {
+    const __m128i cont_bits = _mm_set1_epi32(0x3F);
+    __m128i c1 = _mm_and_si128(b1, cont_bits);
+    __m128i c2 = _mm_and_si128(b2, cont_bits);
+    __m128i c3 = _mm_and_si128(b3, cont_bits);
+    __m128i two = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x1F)), 6), c1);
+    __m128i three = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x0F)), 12), _mm_slli_epi32(c1, 6)), c2);
+    __m128i four = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x07)), 18), _mm_slli_epi32(c1, 12)),
+            _mm_or_si128(_mm_slli_epi32(c2, 6), c3));
+    __m128i cp = _mm_blendv_epi8(b0, two, _mm_cmpgt_epi32(b0, _mm_set1_epi32(0xBF)));
+    cp = _mm_blendv_epi8(cp, three, _mm_cmpgt_epi32(b0, _mm_set1_epi32(0xDF)));
+    return _mm_blendv_epi8(cp, four, _mm_cmpgt_epi32(b0, _mm_set1_epi32(0xEF)));
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into UTF-32
+ * The input is validated by chunks (validate_utf8), then each validated chunk is converted by windows of 16 bytes :
+ * the characters beginning in the 8 first bytes of the window are decoded and packed with a shuffle table.
+ * The windows without 4 bytes sequences are decoded in 16 bits lanes and widened, the others in 32 bits lanes.
+ * Stop before the chunk containing the first error, the exact error is left to ReadUtf8Cp.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf8_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    for (;;) {
+        size_t ascii_written;
+        r += ascii_to_utf32<big_endian>(input + r, input_len - r, output + w, output_len - w, &ascii_written);
+        w += ascii_written;
+
+        // at most 4 output bytes per input byte
+        size_t chunk_len = input_len - r < 4096 ? input_len - r : 4096;
+        if (chunk_len > (output_len - w) / 4) {
+            chunk_len = (output_len - w) / 4;
+        }
+        size_t length;
+        size_t end = r + validate_utf8(input + r, chunk_len, &length);
+        if (end == r) {
+            break;
+        }
+
+        while (r + 16 <= end && w + 32 <= output_len) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+            // the window ends at the first character beginning after its 8 first bytes
+            uint32_t leads = _mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(0xBF))));
+            uint32_t four_leads = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(char(0xF0))), v)) & 0xFF;
+            size_t window = 8 + __builtin_ctz(leads >> 8);
+            leads &= 0xFF;
+
+            __m128i lo, hi;
+            size_t low_written;
+            if (four_leads == 0) {
+                __m128i b0 = _mm_cvtepu8_epi16(v);
+                __m128i b1 = _mm_cvtepu8_epi16(_mm_srli_si128(v, 1));
+                __m128i b2 = _mm_cvtepu8_epi16(_mm_srli_si128(v, 2));
+                __m128i units = _mm_shuffle_epi8(utf8_decode_8(b0, b1, b2),
+                        _mm_load_si128((const __m128i *) tables.utf16_pack[leads]));
+                lo = _mm_cvtepu16_epi32(units);
+                hi = _mm_cvtepu16_epi32(_mm_srli_si128(units, 8));
+                low_written = 16;
+            } else {
+                lo = _mm_shuffle_epi8(utf8_decode_4(_mm_cvtepu8_epi32(v), _mm_cvtepu8_epi32(_mm_srli_si128(v, 1)),
+                        _mm_cvtepu8_epi32(_mm_srli_si128(v, 2)), _mm_cvtepu8_epi32(_mm_srli_si128(v, 3))),
+                        _mm_load_si128((const __m128i *) tables.utf32_pack[leads & 0xF]));
+                hi = _mm_shuffle_epi8(utf8_decode_4(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4)), _mm_cvtepu8_epi32(_mm_srli_si128(v, 5)),
+                        _mm_cvtepu8_epi32(_mm_srli_si128(v, 6)), _mm_cvtepu8_epi32(_mm_srli_si128(v, 7))),
+                        _mm_load_si128((const __m128i *) tables.utf32_pack[leads >> 4]));
+                low_written = 4 * __builtin_popcount(leads & 0xF);
+            }
+            if (big_endian) {
+                lo = _mm_shuffle_epi8(lo, bswap);
+                hi = _mm_shuffle_epi8(hi, bswap);
+            }
+            _mm_storeu_si128((__m128i *) (output + w), lo);
+            _mm_storeu_si128((__m128i *) (output + w + low_written), hi);
+            w += 4 * __builtin_popcount(leads);
+            r += window;
+        }
+        while (r < end && w + 4 <= output_len) {
+            r += utf8_to_utf32_one<big_endian>(input + r, output + w);
+            w += 4;
+        }
+        if (r < end) {
+            break;
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Convert 4 BMP codepoints (not surrogates) held in 32 bits lanes into UTF-8, return the number of bytes written (16 bytes are stored) */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+size_t utf16_to_utf8_4(__m128i cp, const ShuffleTables &tables, char *output) {
+    const __m128i cont_bits = _mm_set1_epi32(0x3F);
+    const __m128i cont_tag = _mm_set1_epi32(0x80);
+    __m128i ge_80 = _mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7F));
+    __m128i ge_800 = _mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7FF));
+    __m128i last = _mm_or_si128(_mm_and_si128(cp, cont_bits), cont_tag);
+    __m128i middle = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(cp, 6), cont_bits), cont_tag);
+    __m128i two = _mm_or_si128(_mm_or_si128(_mm_srli_epi32(cp, 6), _mm_set1_epi32(0xC0)), _mm_slli_epi32(last, 8));
+    __m128i three = _mm_or_si128(_mm_or_si128(_mm_srli_epi32(cp, 12), _mm_set1_epi32(0xE0)),
+            _mm_or_si128(_mm_slli_epi32(middle, 8), _mm_slli_epi32(last, 16)));
+    __m128i bytes = _mm_blendv_epi8(_mm_blendv_epi8(cp, two, ge_80), three, ge_800);
+    int index = _mm_movemask_ps(_mm_castsi128_ps(ge_80)) | _mm_movemask_ps(_mm_castsi128_ps(ge_800)) << 4;
+    _mm_storeu_si128((__m128i *) output, _mm_shuffle_epi8(bytes, _mm_load_si128((const __m128i *) tables.utf8_pack[index])));
+    return tables.utf8_pack_len[index];
+}
+
+/*
+ * Convert a prefix of a UTF-16 stream into UTF-8, by blocks of 8 code units
+ * The blocks containing surrogates are converted one character at a time, stop on the first invalid or truncated pair.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf16_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0, w = 0;
+    while (r + 16 <= input_len && w + 32 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (big_endian) {
+            v = _mm_shuffle_epi8(v, bswap);
+        }
+        if (_mm_testz_si128(v, _mm_set1_epi16(short(0xFF80)))) {
+            _mm_storel_epi64((__m128i *) (output + w), _mm_packus_epi16(v, v));
+            r += 16;
+            w += 8;
+            continue;
+        }
+        __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xF800))), _mm_set1_epi16(short(0xD800)));
+        if (_mm_movemask_epi8(surrogates) != 0) {
+            size_t block_end = r + 16;
+            while (r < block_end) {
+                size_t char_written;
+                size_t char_read = utf16_to_utf8_one<big_endian>(input + r, input_len - r, output + w, &char_written);
+                if (char_read == 0) {
+                    *written = w;
+                    return r;
+                }
+                r += char_read;
+                w += char_written;
+            }
+            continue;
+        }
+        w += utf16_to_utf8_4(_mm_cvtepu16_epi32(v), tables, output + w);
+        w += utf16_to_utf8_4(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8)), tables, output + w);
+        r += 16;
+    }
+    *written = w;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-32 stream into UTF-8, by blocks of 8 codepoints
+ * The ASCII blocks are narrowed with two packs, the BMP blocks are encoded with the utf8_pack shuffle table.
+ * The blocks containing supplementary codepoints are converted one codepoint at a time, stop on the first invalid codepoint.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf32_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 32 <= output_len) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        if (big_endian) {
+            v0 = _mm_shuffle_epi8(v0, bswap);
+            v1 = _mm_shuffle_epi8(v1, bswap);
+        }
+        __m128i any = _mm_or_si128(v0, v1);
+        if (_mm_testz_si128(any, _mm_set1_epi32(int(0xFFFFFF80)))) {
+            __m128i units = _mm_packus_epi32(v0, v1);
+            _mm_storel_epi64((__m128i *) (output + w), _mm_packus_epi16(units, units));
+            r += 32;
+            w += 8;
+            continue;
+        }
+        __m128i surrogates = _mm_or_si128(
+                _mm_cmpeq_epi32(_mm_and_si128(v0, _mm_set1_epi32(int(0xFFFFF800))), _mm_set1_epi32(0xD800)),
+                _mm_cmpeq_epi32(_mm_and_si128(v1, _mm_set1_epi32(int(0xFFFFF800))), _mm_set1_epi32(0xD800)));
+        if (!_mm_testz_si128(any, _mm_set1_epi32(int(0xFFFF0000))) || !_mm_testz_si128(surrogates, surrogates)) {
+            if (!utf32_to_utf8_block<big_endian>(input, r, r + 32, output, w)) {
+                break;
+            }
+            continue;
+        }
+        w += utf16_to_utf8_4(v0, tables, output + w);
+        w += utf16_to_utf8_4(v1, tables, output + w);
+        r += 32;
+    }
+    *written = w;
+    return r;
+}
+
+/*
+ * Byte swap a prefix of a UTF-16 stream (big_endian is the endianness of input), by blocks of 8 code units
+ * In each block, the low surrogates must follow the high surrogates. A block ending with a high surrogate
+ * is only swapped up to this high surrogate, which begins the next block. Stop before the first invalid block.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf16_swap(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i surrogate_bits = _mm_set1_epi16(short(0xFC00));
+    size_t r = 0;
+    while (r + 16 <= input_len && r + 16 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i swapped = _mm_shuffle_epi8(v, bswap);
+        __m128i units = big_endian ? swapped : v;
+        _mm_storeu_si128((__m128i *) (output + r), swapped);
+        uint32_t mask = _mm_movemask_epi8(_mm_packs_epi16(
+                _mm_cmpeq_epi16(_mm_and_si128(units, surrogate_bits), _mm_set1_epi16(short(0xD800))),
+                _mm_cmpeq_epi16(_mm_and_si128(units, surrogate_bits), _mm_set1_epi16(short(0xDC00)))));
+        if (mask != 0) {
+            uint32_t highs = mask & 0xFF, lows = mask >> 8;
+            if (lows != ((highs << 1) & 0xFF)) {
+                break;
+            }
+            if (highs & 0x80) {
+                r += 14;
+                continue;
+            }
+        }
+        r += 16;
+    }
+    *written = r;
+    return r;
+}
+
+/* Mask of the invalid codepoints (surrogates or > 0x10FFFF) */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+__m128i utf32_invalid(__m128i cp) {
+    // unsigned comparison
+    __m128i too_large = _mm_cmpgt_epi32(_mm_xor_si128(cp, _mm_set1_epi32(int(0x80000000))), _mm_set1_epi32(int(0x8010FFFF)));
+    __m128i surrogate = _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(int(0xFFFFF800))), _mm_set1_epi32(0xD800));
+    return _mm_or_si128(too_large, surrogate);
+}
+
+/*
+ * Copy a prefix of a UTF-32 stream (big_endian is the endianness of input), byte swapped if swap, by blocks of 4 codepoints
+ * Stop on the first invalid codepoint
+ */
+template<bool big_endian, bool swap>
+UTF_TARGET_SSE42
+inline size_t utf32_copy(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 16 <= input_len && r + 16 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i swapped = _mm_shuffle_epi8(v, bswap);
+        _mm_storeu_si128((__m128i *) (output + r), swap ? swapped : v);
+        int invalid = _mm_movemask_ps(_mm_castsi128_ps(utf32_invalid(big_endian ? swapped : v)));
+        if (invalid != 0) {
+            r += 4 * __builtin_ctz(invalid);
+            break;
+        }
+        r += 16;
+    }
+    *written = r;
+    return r;
+}
+
+/* Validate a prefix of a UTF-32 stream by blocks of 4 codepoints, stop on the first invalid codepoint */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t validate_utf32(const char *input, size_t input_len, size_t *length) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 16 <= input_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (big_endian) {
+            v = _mm_shuffle_epi8(v, bswap);
+        }
+        int invalid = _mm_movemask_ps(_mm_castsi128_ps(utf32_invalid(v)));
+        if (invalid != 0) {
+            r += 4 * __builtin_ctz(invalid);
+            break;
+        }
+        r += 16;
+    }
+    *length = r / 4;
+    return r;
+}
+
+/*
+ * Convert 4 valid codepoints into UTF-16 (at most 16 bytes), the codepoints above 0xFFFF become surrogate pairs
+ * Return the number of bytes written
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+size_t utf32_to_utf16_4(__m128i cp, const ShuffleTables &tables, char *output) {
+    __m128i supplementary = _mm_cmpgt_epi32(cp, _mm_set1_epi32(0xFFFF));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(supplementary));
+    __m128i offset = _mm_sub_epi32(cp, _mm_set1_epi32(0x10000));
+    __m128i highs = _mm_add_epi32(_mm_srli_epi32(offset, 10), _mm_set1_epi32(0xD800));
+    __m128i lows = _mm_or_si128(_mm_and_si128(offset, _mm_set1_epi32(0x3FF)), _mm_set1_epi32(0xDC00));
+    __m128i units = _mm_blendv_epi8(cp, _mm_or_si128(highs, _mm_slli_epi32(lows, 16)), supplementary);
+    units = _mm_shuffle_epi8(units, _mm_load_si128((const __m128i *) tables.utf16_pair_pack[mask]));
+    if (big_endian) {
+        units = _mm_shuffle_epi8(units, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+    }
+    _mm_storeu_si128((__m128i *) output, units);
+    return 8 + 2 * __builtin_popcount(mask);
+}
+
+/*
+ * Convert a prefix of a UTF-32 stream into UTF-16, by blocks of 8 codepoints
+ * The blocks of BMP codepoints are narrowed with a single pack. Stop on the first invalid codepoint.
+ */
+template<bool big_endian_in, bool big_endian_out>
+UTF_TARGET_SSE42
+inline size_t utf32_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m128i bswap16 = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i bswap32 = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 32 <= output_len) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        if (big_endian_in) {
+            v0 = _mm_shuffle_epi8(v0, bswap32);
+            v1 = _mm_shuffle_epi8(v1, bswap32);
+        }
+        __m128i invalid = _mm_or_si128(utf32_invalid(v0), utf32_invalid(v1));
+        if (!_mm_testz_si128(invalid, invalid)) {
+            size_t char_written;
+            while ((char_written = utf32_to_utf16_one<big_endian_in, big_endian_out>(input + r, output + w)) != 0) {
+                r += 4;
+                w += char_written;
+            }
+            break;
+        }
+        if (_mm_testz_si128(_mm_or_si128(v0, v1), _mm_set1_epi32(int(0xFFFF0000)))) {
+            __m128i units = _mm_packus_epi32(v0, v1);
+            if (big_endian_out) {
+                units = _mm_shuffle_epi8(units, bswap16);
+            }
+            _mm_storeu_si128((__m128i *) (output + w), units);
+            r += 32;
+            w += 16;
+            continue;
+        }
+        w += utf32_to_utf16_4<big_endian_out>(v0, tables, output + w);
+        w += utf32_to_utf16_4<big_endian_out>(v1, tables, output + w);
+        r += 32;
+    }
+    *written = w;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-16 stream into UTF-32, by blocks of 8 code units
+ * The blocks without surrogates are widened with a single unpack, the others are converted one character at a time.
+ * Stop on the first invalid or truncated pair.
+ */
+template<bool big_endian_in, bool big_endian_out>
+UTF_TARGET_SSE42
+inline size_t utf16_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap16 = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i bswap32 = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    while (r + 16 <= input_len && w + 32 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (big_endian_in) {
+            v = _mm_shuffle_epi8(v, bswap16);
+        }
+        __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xF800))), _mm_set1_epi16(short(0xD800)));
+        if (_mm_movemask_epi8(surrogates) != 0) {
+            size_t block_end = r + 16;
+            while (r < block_end) {
+                size_t char_read = utf16_to_utf32_one<big_endian_in, big_endian_out>(input + r, input_len - r, output + w);
+                if (char_read == 0) {
+                    *written = w;
+                    return r;
+                }
+                r += char_read;
+                w += 4;
+            }
+            continue;
+        }
+        __m128i lo = _mm_cvtepu16_epi32(v);
+        __m128i hi = _mm_cvtepu16_epi32(_mm_srli_si128(v, 8));
+        if (big_endian_out) {
+            lo = _mm_shuffle_epi8(lo, bswap32);
+            hi = _mm_shuffle_epi8(hi, bswap32);
+        }
+        _mm_storeu_si128((__m128i *) (output + w), lo);
+        _mm_storeu_si128((__m128i *) (output + w + 16), hi);
+        r += 16;
+        w += 32;
+    }
+    *written = w;
+    return r;
+}
+
+/*
+ * Convert 8 Latin-1 characters held in 16 bits lanes into UTF-8, mask selects the characters >= 0x80
+ * Return the number of bytes written (16 bytes are stored)
+ */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+size_t latin1_to_utf8_8(__m128i cp, uint32_t mask, const ShuffleTables &tables, char *output) {
+    __m128i last = _mm_or_si128(_mm_and_si128(cp, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+    __m128i two = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(cp, 6), _mm_set1_epi16(0xC0)), _mm_slli_epi16(last, 8));
+    __m128i bytes = _mm_blendv_epi8(cp, two, _mm_cmpgt_epi16(cp, _mm_set1_epi16(0x7F)));
+    _mm_storeu_si128((__m128i *) output, _mm_shuffle_epi8(bytes, _mm_load_si128((const __m128i *) tables.latin1_pack[mask])));
+    return 8 + __builtin_popcount(mask);
+}
+
+/*
+ * Convert a prefix of a Latin-1 stream into UTF-8, by blocks of 16 bytes
+ * The ASCII blocks are copied, the others are widened to 16 bits lanes and encoded with the latin1_pack shuffle table.
+ */
+UTF_TARGET_SSE42
+inline size_t latin1_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    size_t r = 0, w = 0;
+    while (r + 16 <= input_len && w + 32 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *) (output + w), v);
+            r += 16;
+            w += 16;
+            continue;
+        }
+        w += latin1_to_utf8_8(_mm_cvtepu8_epi16(v), mask & 0xFF, tables, output + w);
+        w += latin1_to_utf8_8(_mm_cvtepu8_epi16(_mm_srli_si128(v, 8)), mask >> 8, tables, output + w);
+        r += 16;
+    }
+    *written = w;
+    return r;
+}
+
+/* Widen a prefix of a Latin-1 stream into UTF-16, by blocks of 16 bytes */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t latin1_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t r = 0;
+    while (r + 16 <= input_len && 2 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (big_endian) {
+            _mm_storeu_si128((__m128i *) (output + 2 * r), _mm_unpacklo_epi8(zero, v));
+            _mm_storeu_si128((__m128i *) (output + 2 * r + 16), _mm_unpackhi_epi8(zero, v));
+        } else {
+            _mm_storeu_si128((__m128i *) (output + 2 * r), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *) (output + 2 * r + 16), _mm_unpackhi_epi8(v, zero));
+        }
+        r += 16;
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/* Widen a prefix of a Latin-1 stream into UTF-32, by blocks of 16 bytes */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t latin1_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 16 <= input_len && 4 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i cp[4] = {
+            _mm_cvtepu8_epi32(v), _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)),
+            _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)), _mm_cvtepu8_epi32(_mm_srli_si128(v, 12))
+        };
+        for (int i = 0; i < 4; i++) {
+            if (big_endian) {
+                cp[i] = _mm_slli_epi32(cp[i], 24);
+            }
+            _mm_storeu_si128((__m128i *) (output + 4 * r + 16 * i), cp[i]);
+        }
+        r += 16;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/*
+ * Convert a window of 16 bytes of a UTF-8 stream into Latin-1 (at most 16 bytes are stored)
+ * The window must only contain ASCII bytes and the 2 bytes sequences of U+0080..U+00FF (C2 or C3 followed by a continuation),
+ * it stops before a lead byte in its last position. The codepoints are computed at the positions of the lead bytes
+ * and the continuation bytes are removed with the utf16_pack shuffle table.
+ * Return the number of bytes read (0 if the window contains anything else), store the number of bytes written in *written
+ */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+size_t utf8_to_latin1_16(__m128i v, const ShuffleTables &tables, char *output, size_t *written) {
+    __m128i is_lead = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xFE))), _mm_set1_epi8(char(0xC2)));
+    uint32_t ascii = ~(uint32_t) _mm_movemask_epi8(v) & 0xFFFF;
+    uint32_t leads = (uint32_t) _mm_movemask_epi8(is_lead);
+    uint32_t conts = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xC0))), _mm_set1_epi8(char(0x80))));
+    size_t window = leads & 0x8000 ? 15 : 16;
+    uint32_t window_mask = (1u << window) - 1;
+    leads &= window_mask;
+    if ((ascii | leads | conts) != window_mask || conts != leads << 1) {
+        return 0;
+    }
+    // (lead & 0x03) << 6 | (continuation & 0x3F), the shift doesn't cross the bytes
+    __m128i cp = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi8(0x03)), 6),
+            _mm_and_si128(_mm_srli_si128(v, 1), _mm_set1_epi8(0x3F)));
+    __m128i bytes = _mm_blendv_epi8(v, cp, is_lead);
+    uint32_t keep = ascii | leads;
+    __m128i lo = _mm_shuffle_epi8(_mm_cvtepu8_epi16(bytes), _mm_load_si128((const __m128i *) tables.utf16_pack[keep & 0xFF]));
+    __m128i hi = _mm_shuffle_epi8(_mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8)), _mm_load_si128((const __m128i *) tables.utf16_pack[keep >> 8]));
+    size_t lo_len = __builtin_popcount(keep & 0xFF);
+    _mm_storel_epi64((__m128i *) output, _mm_packus_epi16(lo, lo));
+    _mm_storel_epi64((__m128i *) (output + lo_len), _mm_packus_epi16(hi, hi));
+    *written = lo_len + __builtin_popcount(keep >> 8);
+    return window;
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into Latin-1, by windows of 16 bytes (see utf8_to_latin1_16)
+ * Stop before the first window containing an invalid sequence or a codepoint above 0xFF, the exact error is left to ReadUtf8Cp
+ * and CpToLatin1.
+ */
+UTF_TARGET_SSE42
+inline size_t utf8_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    size_t r = 0, w = 0;
+    while (r + 16 <= input_len && w + 16 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (_mm_movemask_epi8(v) == 0) {
+            _mm_storeu_si128((__m128i *) (output + w), v);
+            r += 16;
+            w += 16;
+            continue;
+        }
+        size_t window_written;
+        size_t window = utf8_to_latin1_16(v, tables, output + w, &window_written);
+        if (window == 0) {
+            break;
+        }
+        r += window;
+        w += window_written;
+    }
+    *written = w;
+    return r;
+}
+
+/* Narrow a prefix of a UTF-16 stream into Latin-1, by blocks of 16 code units. Stop on the first block containing a code unit above 0xFF */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf16_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0;
+    while (r + 32 <= input_len && r / 2 + 16 <= output_len) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        if (big_endian) {
+            v0 = _mm_shuffle_epi8(v0, bswap);
+            v1 = _mm_shuffle_epi8(v1, bswap);
+        }
+        if (!_mm_testz_si128(_mm_or_si128(v0, v1), _mm_set1_epi16(short(0xFF00)))) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) (output + r / 2), _mm_packus_epi16(v0, v1));
+        r += 32;
+    }
+    *written = r / 2;
+    return r;
+}
+
+/* Narrow a prefix of a UTF-32 stream into Latin-1, by blocks of 16 codepoints. Stop on the first block containing a codepoint above 0xFF */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf32_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 64 <= input_len && r / 4 + 16 <= output_len) {
+        __m128i v[4];
+        for (int i = 0; i < 4; i++) {
+            v[i] = _mm_loadu_si128((const __m128i *) (input + r + 16 * i));
+            if (big_endian) {
+                v[i] = _mm_shuffle_epi8(v[i], bswap);
+            }
+        }
+        if (!_mm_testz_si128(_mm_or_si128(_mm_or_si128(v[0], v[1]), _mm_or_si128(v[2], v[3])), _mm_set1_epi32(int(0xFFFFFF00)))) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) (output + r / 4),
+                _mm_packus_epi16(_mm_packus_epi32(v[0], v[1]), _mm_packus_epi32(v[2], v[3])));
+        r += 64;
+    }
+    *written = r / 4;
+    return r;
+}
+
+/*
+ * Copy the ASCII prefix of input, by blocks of 16 bytes.
+ * A block containing a non-ASCII byte is still stored but only its ASCII prefix is accounted for.
+ */
+UTF_TARGET_SSE42
+inline size_t ascii_copy(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 16 <= input_len && r + 16 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        _mm_storeu_si128((__m128i *) (output + r), v);
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+        if (mask != 0) {
+            r += __builtin_ctz(mask);
+            break;
+        }
+        r += 16;
+    }
+    *written = r;
+    return r;
+}
+
+/* Length of the ASCII prefix of input, by blocks of 16 bytes */
+UTF_TARGET_SSE42
+inline size_t ascii_length(const char *input, size_t input_len) {
+    size_t r = 0;
+    while (r + 16 <= input_len) {
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (input + r)));
+        if (mask != 0)
+            return r + __builtin_ctz(mask);
+        r += 16;
+    }
+    return r;
+}
+
+/*
+ * Narrow the ASCII prefix of a UTF-16 stream, by blocks of 16 code units.
+ * Same block semantics as ascii_copy, the saturated code units of the last block are not accounted for.
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf16_to_ascii(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi16(short(0xFF80));
+    size_t r = 0;
+    while (r + 32 <= input_len && r / 2 + 16 <= output_len) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        if (big_endian) {
+            v0 = _mm_shuffle_epi8(v0, bswap);
+            v1 = _mm_shuffle_epi8(v1, bswap);
+        }
+        _mm_storeu_si128((__m128i *) (output + r / 2), _mm_packus_epi16(v0, v1));
+        // packus is signed, the code units above 0x7FFF would become 0 : look for the non-ASCII ones separately
+        __m128i ascii = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(v0, high), zero), _mm_cmpeq_epi16(_mm_and_si128(v1, high), zero));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(ascii) ^ 0xFFFF;
+        if (mask != 0) {
+            r += 2 * __builtin_ctz(mask);
+            break;
+        }
+        r += 32;
+    }
+    *written = r / 2;
+    return r;
+}
+
+/* Narrow the ASCII prefix of a UTF-32 stream, by blocks of 16 codepoints. Same block semantics as utf16_to_ascii */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf32_to_ascii(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi32(int(0xFFFFFF80));
+    size_t r = 0;
+    while (r + 64 <= input_len && r / 4 + 16 <= output_len) {
+        __m128i v[4], ascii[4];
+        for (int i = 0; i < 4; i++) {
+            v[i] = _mm_loadu_si128((const __m128i *) (input + r + 16 * i));
+            if (big_endian) {
+                v[i] = _mm_shuffle_epi8(v[i], bswap);
+            }
+            ascii[i] = _mm_cmpeq_epi32(_mm_and_si128(v[i], high), zero);
+        }
+        _mm_storeu_si128((__m128i *) (output + r / 4),
+                _mm_packus_epi16(_mm_packus_epi32(v[0], v[1]), _mm_packus_epi32(v[2], v[3])));
+        __m128i packed = _mm_packs_epi16(_mm_packs_epi32(ascii[0], ascii[1]), _mm_packs_epi32(ascii[2], ascii[3]));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(packed) ^ 0xFFFF;
+        if (mask != 0) {
+            r += 4 * __builtin_ctz(mask);
+            break;
+        }
+        r += 64;
+    }
+    *written = r / 4;
+    return r;
+}
+
+/*
+ * Look up the codepoints of 16 bytes of a single-byte code page with 2 byte shuffles per group of 16 bytes
+ * of the upper half. Store the low and high bytes of the codepoints, return the mask of the unmapped bytes
+ */
+UTF_TARGET_SSE42
+static inline __attribute__((always_inline))
+uint32_t single_byte_lookup_16(__m128i v, const SingleByteTables &tables, __m128i *low, __m128i *high) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i non_ascii = _mm_cmplt_epi8(v, zero);
+    __m128i lo = _mm_andnot_si128(non_ascii, v);
+    __m128i hi = zero;
+    for (int g = 0; g < 8; g++) {
+        // the bytes of the group become 0x70..0x7F, the others get their bit 7 set and are zeroed by the shuffles
+        __m128i index = _mm_adds_epu8(_mm_xor_si128(v, _mm_set1_epi8(char(0x80 + 16 * g))), _mm_set1_epi8(0x70));
+        lo = _mm_or_si128(lo, _mm_shuffle_epi8(_mm_load_si128((const __m128i *) tables.decode_low[g]), index));
+        hi = _mm_or_si128(hi, _mm_shuffle_epi8(_mm_load_si128((const __m128i *) tables.decode_high[g]), index));
+    }
+    *low = lo;
+    *high = hi;
+    return (uint32_t) _mm_movemask_epi8(_mm_and_si128(non_ascii, _mm_cmpeq_epi8(_mm_or_si128(lo, hi), zero)));
+}
+
+/*
+ * Convert a prefix of a single-byte stream into UTF-8, by blocks of 16 bytes. The ASCII blocks are copied, the others
+ * are looked up (see single_byte_lookup_16) and encoded as BMP codepoints. Stop on the first block containing an unmapped byte
+ */
+UTF_TARGET_SSE42
+inline size_t single_byte_to_utf8(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &shuffles = shuffle_tables();
+    size_t r = 0, w = 0;
+    while (r + 16 <= input_len && w + 64 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (_mm_movemask_epi8(v) == 0) {
+            _mm_storeu_si128((__m128i *) (output + w), v);
+            r += 16;
+            w += 16;
+            continue;
+        }
+        __m128i lo, hi;
+        if (single_byte_lookup_16(v, tables, &lo, &hi) != 0) {
+            break;
+        }
+        __m128i units0 = _mm_unpacklo_epi8(lo, hi);
+        __m128i units1 = _mm_unpackhi_epi8(lo, hi);
+        w += utf16_to_utf8_4(_mm_cvtepu16_epi32(units0), shuffles, output + w);
+        w += utf16_to_utf8_4(_mm_cvtepu16_epi32(_mm_srli_si128(units0, 8)), shuffles, output + w);
+        w += utf16_to_utf8_4(_mm_cvtepu16_epi32(units1), shuffles, output + w);
+        w += utf16_to_utf8_4(_mm_cvtepu16_epi32(_mm_srli_si128(units1, 8)), shuffles, output + w);
+        r += 16;
+    }
+    *written = w;
+    return r;
+}
+
+/* Same as single_byte_to_utf8 into UTF-16 */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t single_byte_to_utf16(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 16 <= input_len && 2 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i lo = v, hi = _mm_setzero_si128();
+        if (_mm_movemask_epi8(v) != 0 && single_byte_lookup_16(v, tables, &lo, &hi) != 0) {
+            break;
+        }
+        if (big_endian) {
+            _mm_storeu_si128((__m128i *) (output + 2 * r), _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128((__m128i *) (output + 2 * r + 16), _mm_unpackhi_epi8(hi, lo));
+        } else {
+            _mm_storeu_si128((__m128i *) (output + 2 * r), _mm_unpacklo_epi8(lo, hi));
+            _mm_storeu_si128((__m128i *) (output + 2 * r + 16), _mm_unpackhi_epi8(lo, hi));
+        }
+        r += 16;
+    }
+    *written = 2 * r;
+    return r;
+}
+
+/* Same as single_byte_to_utf8 into UTF-32 */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t single_byte_to_utf32(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 16 <= input_len && 4 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i lo = v, hi = zero;
+        if (_mm_movemask_epi8(v) != 0 && single_byte_lookup_16(v, tables, &lo, &hi) != 0) {
+            break;
+        }
+        __m128i units0 = _mm_unpacklo_epi8(lo, hi);
+        __m128i units1 = _mm_unpackhi_epi8(lo, hi);
+        __m128i cp[4] = {
+            _mm_unpacklo_epi16(units0, zero), _mm_unpackhi_epi16(units0, zero),
+            _mm_unpacklo_epi16(units1, zero), _mm_unpackhi_epi16(units1, zero)
+        };
+        for (int i = 0; i < 4; i++) {
+            if (big_endian) {
+                cp[i] = _mm_shuffle_epi8(cp[i], bswap);
+            }
+            _mm_storeu_si128((__m128i *) (output + 4 * r + 16 * i), cp[i]);
+        }
+        r += 16;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-8 stream into a single-byte code page. The ASCII blocks of 16 bytes are copied, the others
+ * are transcoded by chunks of up to 256 bytes into UTF-16 (see utf8_to_utf16), then the code units are looked up
+ * without branch. Stop on the first invalid or unmapped character
+ */
+UTF_TARGET_SSE42
+inline size_t utf8_to_single_byte(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const uint8_t *p = (const uint8_t *) input;
+    alignas(16) uint16_t units[256];
+    size_t r = 0, w = 0;
+    while (r + 16 <= input_len && w + 16 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (_mm_movemask_epi8(v) == 0) {
+            _mm_storeu_si128((__m128i *) (output + w), v);
+            r += 16;
+            w += 16;
+            continue;
+        }
+        // at most 1 code unit per byte, but the chunk must end on a character boundary
+        size_t chunk = input_len - r < output_len - w ? input_len - r : output_len - w;
+        if (chunk > 256) {
+            chunk = 256;
+        }
+        size_t units_written;
+        size_t chunk_read = utf8_to_utf16<false>(input + r, chunk, (char *) units, sizeof(units), &units_written);
+        if (chunk_read == 0) {
+            break;
+        }
+        size_t n_units = units_written / 2;
+        bool unmapped = false;
+        for (size_t i = 0; i < n_units; i++) {
+            uint8_t b = tables.lookup(units[i]);
+            output[w + i] = char(b);
+            unmapped |= b == 0 && units[i] != 0;
+        }
+        if (unmapped) {
+            // skip the characters before the first unmapped one (the surrogates are never mapped)
+            for (size_t i = 0; tables.lookup(units[i]) != 0 || units[i] == 0; i++, w++) {
+                r++;
+                while ((p[r] & 0xC0) == 0x80) {
+                    r++;
+                }
+            }
+            break;
+        }
+        r += chunk_read;
+        w += n_units;
+    }
+    *written = w;
+    return r;
+}
+
+/*
+ * Convert a prefix of a UTF-16 stream into a single-byte code page, by blocks of 8 code units. The ASCII blocks are narrowed,
+ * the others are looked up without branch (see SingleByteTables::lookup). Stop on the first unmapped code unit
+ */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf16_to_single_byte(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0;
+    while (r + 16 <= input_len && r / 2 + 8 <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        if (big_endian) {
+            v = _mm_shuffle_epi8(v, bswap);
+        }
+        if (_mm_testz_si128(v, _mm_set1_epi16(short(0xFF80)))) {
+            _mm_storel_epi64((__m128i *) (output + r / 2), _mm_packus_epi16(v, v));
+            r += 16;
+            continue;
+        }
+        // the surrogates are never mapped
+        alignas(16) uint16_t units[8];
+        _mm_store_si128((__m128i *) units, v);
+        uint32_t unmapped = 0;
+        for (int i = 0; i < 8; i++) {
+            uint8_t b = tables.lookup(units[i]);
+            output[r / 2 + i] = char(b);
+            unmapped |= uint32_t(b == 0 && units[i] != 0) << i;
+        }
+        if (unmapped != 0) {
+            r += 2 * __builtin_ctz(unmapped);
+            break;
+        }
+        r += 16;
+    }
+    *written = r / 2;
+    return r;
+}
+
+/* Same as utf16_to_single_byte for UTF-32, by blocks of 8 codepoints */
+template<bool big_endian>
+UTF_TARGET_SSE42
+inline size_t utf32_to_single_byte(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 32 <= input_len && r / 4 + 8 <= output_len) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (input + r));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (input + r + 16));
+        if (big_endian) {
+            v0 = _mm_shuffle_epi8(v0, bswap);
+            v1 = _mm_shuffle_epi8(v1, bswap);
+        }
+        if (_mm_testz_si128(_mm_or_si128(v0, v1), _mm_set1_epi32(int(0xFFFFFF80)))) {
+            __m128i units = _mm_packus_epi32(v0, v1);
+            _mm_storel_epi64((__m128i *) (output + r / 4), _mm_packus_epi16(units, units));
+            r += 32;
+            continue;
+        }
+        alignas(16) uint32_t cp[8];
+        _mm_store_si128((__m128i *) cp, v0);
+        _mm_store_si128((__m128i *) (cp + 4), v1);
+        uint32_t unmapped = 0;
+        for (int i = 0; i < 8; i++) {
+            uint8_t b = tables.lookup(cp[i]);
+            output[r / 4 + i] = char(b);
+            unmapped |= uint32_t(b == 0 && cp[i] != 0) << i;
+        }
+        if (unmapped != 0) {
+            r += 4 * __builtin_ctz(unmapped);
+            break;
+        }
+        r += 32;
+    }
+    *written = r / 4;
+    return r;
+}
+}
+
+/*
+ * AVX2 kernels
+ * The tails of the streams are left to the SSE4.2 kernels
+ */
+namespace avx2 {
+
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t ascii_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 32 <= input_len && 2 * (r + 32) <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+        __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        if (big_endian) {
+            lo = _mm256_slli_epi16(lo, 8);
+            hi = _mm256_slli_epi16(hi, 8);
+        }
+        _mm256_storeu_si256((__m256i *) (output + 2 * r), lo);
+        _mm256_storeu_si256((__m256i *) (output + 2 * r + 32), hi);
+        if (mask != 0) {
+            r += __builtin_ctz(mask);
+            *written = 2 * r;
+            return r;
+        }
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::ascii_to_utf16<big_endian>(input + r, input_len - r, output + 2 * r, output_len - 2 * r, &tail_written);
+    *written = 2 * r;
+    return r;
+}
+
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t ascii_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 16 <= input_len && 4 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+        __m256i lo = _mm256_cvtepu8_epi32(v);
+        __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8));
+        if (big_endian) {
+            lo = _mm256_slli_epi32(lo, 24);
+            hi = _mm256_slli_epi32(hi, 24);
+        }
+        _mm256_storeu_si256((__m256i *) (output + 4 * r), lo);
+        _mm256_storeu_si256((__m256i *) (output + 4 * r + 32), hi);
+        if (mask != 0) {
+            r += __builtin_ctz(mask);
+            break;
+        }
+        r += 16;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/* Error mask of the 32 bytes of input, prev_input holds the previous 32 bytes */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf8_check_block(__m256i input, __m256i prev_input) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    // bytes 16..31 of prev_input followed by the bytes 0..15 of input
+    __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 16 - 1);
+    __m256i prev2 = _mm256_alignr_epi8(input, shifted, 16 - 2);
+    __m256i prev3 = _mm256_alignr_epi8(input, shifted, 16 - 3);
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(_mm256_setr_epi8(UTF8_BYTE_1_HIGH_TABLE, UTF8_BYTE_1_HIGH_TABLE),
+            _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte_1_low = _mm256_shuffle_epi8(_mm256_setr_epi8(UTF8_BYTE_1_LOW_TABLE, UTF8_BYTE_1_LOW_TABLE),
+            _mm256_and_si256(prev1, nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(_mm256_setr_epi8(UTF8_BYTE_2_HIGH_TABLE, UTF8_BYTE_2_HIGH_TABLE),
+            _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    __m256i is_third_byte = _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xE0 - 0x80)));
+    __m256i is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xF0 - 0x80)));
+    __m256i must_be_2_3_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8(char(0x80)));
+    return _mm256_xor_si256(must_be_2_3_continuation, special_cases);
+}
+
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf8_is_incomplete(__m256i input) {
+    const __m256i max_value = _mm256_setr_epi8(
+            char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF),
+            char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF),
+            char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF),
+            char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+    return _mm256_subs_epu8(input, max_value);
+}
+
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+size_t utf8_count_chars(__m256i input) {
+    return __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(input, _mm256_set1_epi8(char(0xBF)))));
+}
+
+UTF_TARGET_AVX2
+inline size_t validate_utf8(const char *input, size_t input_len, size_t *length) {
+    size_t r = 0;
+    size_t count = 0;
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    while (r + 64 <= input_len) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (input + r + 32));
+        __m256i error;
+        if (_mm256_movemask_epi8(_mm256_or_si256(v0, v1)) == 0) {
+            error = prev_incomplete;
+            prev_input = _mm256_setzero_si256();
+            prev_incomplete = _mm256_setzero_si256();
+            if (!_mm256_testz_si256(error, error)) {
+                break;
+            }
+            count += 64;
+        } else {
+            error = _mm256_or_si256(utf8_check_block(v0, prev_input), utf8_check_block(v1, v0));
+            prev_input = v1;
+            prev_incomplete = utf8_is_incomplete(v1);
+            if (!_mm256_testz_si256(error, error)) {
+                break;
+            }
+            count += utf8_count_chars(v0) + utf8_count_chars(v1);
+        }
+        r += 64;
+    }
+    size_t boundary = utf8_last_boundary(input, r);
+    if (boundary != r) {
+        count--;
+    }
+    *length = count;
+    return boundary;
+}
+
+UTF_TARGET_AVX2
+inline size_t utf8_length(const char *input, size_t input_len, size_t *four_bytes) {
+    size_t chars = 0, four = 0;
+    size_t r = 0;
+    for (; r + 32 <= input_len; r += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        chars += __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(0xBF)))));
+        four += __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(char(0xF0))), v)));
+    }
+    size_t tail_four;
+    chars += sse42::utf8_length(input + r, input_len - r, &tail_four);
+    *four_bytes = four + tail_four;
+    return chars;
+}
+
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf16_length(const char *input, size_t input_len, size_t *low_surrogates) {
+    const __m256i bswap = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t utf8_len = 0, lows = 0;
+    size_t r = 0;
+    for (; r + 32 <= input_len; r += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (big_endian) {
+            v = _mm256_shuffle_epi8(v, bswap);
+        }
+        // 2 bits per code unit in the movemasks
+        uint32_t lt_80 = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(short(0xFF80))), zero));
+        uint32_t lt_800 = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(short(0xF800))), zero));
+        uint32_t sur = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(short(0xF800))), _mm256_set1_epi16(short(0xD800))));
+        uint32_t low = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(short(0xFC00))), _mm256_set1_epi16(short(0xDC00))));
+        utf8_len += 48 - (__builtin_popcount(lt_80) + __builtin_popcount(lt_800) + __builtin_popcount(sur)) / 2;
+        lows += __builtin_popcount(low) / 2;
+    }
+    size_t tail_lows;
+    utf8_len += sse42::utf16_length<big_endian>(input + r, input_len - r, &tail_lows);
+    *low_surrogates = lows + tail_lows;
+    return utf8_len;
+}
+
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf32_length(const char *input, size_t input_len, size_t *supplementary) {
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t utf8_len = 0, sup = 0;
+    size_t r = 0;
+    for (; r + 32 <= input_len; r += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (big_endian) {
+            v = _mm256_shuffle_epi8(v, bswap);
+        }
+        int ge_80 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, _mm256_set1_epi32(0x7F))));
+        int ge_800 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, _mm256_set1_epi32(0x7FF))));
+        int ge_10000 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, _mm256_set1_epi32(0xFFFF))));
+        utf8_len += 8 + __builtin_popcount(ge_80) + __builtin_popcount(ge_800) + __builtin_popcount(ge_10000);
+        sup += __builtin_popcount(ge_10000);
+    }
+    size_t tail_sup;
+    utf8_len += sse42::utf32_length<big_endian>(input + r, input_len - r, &tail_sup);
+    *supplementary = sup + tail_sup;
+    return utf8_len;
+}
+
+
+/* Codepoints of the characters beginning in the 16 first bytes of input (BMP only), in 16 bits lanes */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf8_decode_16(__m256i b0, __m256i b1, __m256i b2) {
+    const __m256i cont_bits = _mm256_set1_epi16(0x3F);
+    __m256i c1 = _mm256_and_si256(b1, cont_bits);
+    __m256i c2 = _mm256_and_si256(b2, cont_bits);
+    __m256i two = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b0, _mm256_set1_epi16(0x1F)), 6), c1);
+    __m256i three = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(b0, 12), _mm256_slli_epi16(c1, 6)), c2);
+    __m256i cp = _mm256_blendv_epi8(b0, two, _mm256_cmpgt_epi16(b0, _mm256_set1_epi16(0xBF)));
+    return _mm256_blendv_epi8(cp, three, _mm256_cmpgt_epi16(b0, _mm256_set1_epi16(0xDF)));
+}
+
+/* Same as sse42::utf8_decode_8_pairs, with 16 lanes */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf8_decode_16_pairs(__m256i prev, __m256i b0, __m256i b1, __m256i b2) {
+    const __m256i cont_bits = _mm256_set1_epi16(0x3F);
+    __m256i c2 = _mm256_and_si256(b2, cont_bits);
+    __m256i highs = _mm256_add_epi16(_mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b0, _mm256_set1_epi16(0x07)), 8),
+            _mm256_slli_epi16(_mm256_and_si256(b1, cont_bits), 2)), _mm256_srli_epi16(c2, 4)), _mm256_set1_epi16(short(0xD7C0)));
+    __m256i lows = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b1, _mm256_set1_epi16(0x0F)), 6), c2),
+            _mm256_set1_epi16(short(0xDC00)));
+    __m256i units = _mm256_blendv_epi8(utf8_decode_16(b0, b1, b2), highs, _mm256_cmpgt_epi16(b0, _mm256_set1_epi16(0xEF)));
+    return _mm256_blendv_epi8(units, lows, _mm256_cmpgt_epi16(prev, _mm256_set1_epi16(0xEF)));
+}
+
+/* Same as sse42::utf8_four_to_utf16, with 8 sequences */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf8_four_to_utf16(__m256i v) {
+    __m256i cp = _mm256_or_si256(
+            _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x07)), 18), _mm256_slli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x3F00)), 4)),
+            _mm256_or_si256(_mm256_srli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x3F0000)), 10), _mm256_and_si256(_mm256_srli_epi32(v, 24), _mm256_set1_epi32(0x3F))));
+    __m256i highs = _mm256_add_epi32(_mm256_srli_epi32(cp, 10), _mm256_set1_epi32(0xD7C0));
+    __m256i lows = _mm256_or_si256(_mm256_and_si256(cp, _mm256_set1_epi32(0x3FF)), _mm256_set1_epi32(0xDC00));
+    return _mm256_or_si256(highs, _mm256_slli_epi32(lows, 16));
+}
+
+/* Same as sse42::utf8_to_utf16, with windows of 32 bytes (16 characters) */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf8_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m256i bswap = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0, w = 0;
+    for (;;) {
+        size_t ascii_written;
+        r += ascii_to_utf16<big_endian>(input + r, input_len - r, output + w, output_len - w, &ascii_written);
+        w += ascii_written;
+
+        size_t chunk_len = input_len - r < 4096 ? input_len - r : 4096;
+        if (chunk_len > (output_len - w) / 2) {
+            chunk_len = (output_len - w) / 2;
+        }
+        size_t length;
+        size_t end = r + validate_utf8(input + r, chunk_len, &length);
+        if (end == r) {
+            break;
+        }
+
+        while (r + 32 <= end && w + 64 <= output_len) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+            uint32_t all_leads = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(0xBF))));
+            uint32_t four_leads = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(char(0xF0))), v));
+            if ((four_leads & 0x11111111) == 0x11111111) {
+                __m256i units = utf8_four_to_utf16(v);
+                if (big_endian) {
+                    units = _mm256_shuffle_epi8(units, bswap);
+                }
+                _mm256_storeu_si256((__m256i *) (output + w), units);
+                w += 32;
+                r += 32;
+                continue;
+            }
+            size_t window = 16 + __builtin_ctz(all_leads >> 16);
+            uint32_t leads = all_leads & 0xFFFF;
+            four_leads &= 0xFFFF;
+
+            __m256i b0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+            __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + r + 1)));
+            __m256i b2 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + r + 2)));
+            __m256i units;
+            if (four_leads == 0) {
+                units = utf8_decode_16(b0, b1, b2);
+            } else {
+                if (four_leads & 0x8000) {
+                    window = 15;
+                    leads &= 0x7FFF;
+                    four_leads &= 0x7FFF;
+                }
+                units = utf8_decode_16_pairs(_mm256_cvtepu8_epi16(_mm_slli_si128(_mm256_castsi256_si128(v), 1)), b0, b1, b2);
+                leads |= four_leads << 1;
+            }
+            __m256i pack = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(_mm_load_si128((const __m128i *) tables.utf16_pack[leads & 0xFF])),
+                    _mm_load_si128((const __m128i *) tables.utf16_pack[leads >> 8]), 1);
+            units = _mm256_shuffle_epi8(units, pack);
+            if (big_endian) {
+                units = _mm256_shuffle_epi8(units, bswap);
+            }
+            size_t low_written = 2 * __builtin_popcount(leads & 0xFF);
+            _mm_storeu_si128((__m128i *) (output + w), _mm256_castsi256_si128(units));
+            _mm_storeu_si128((__m128i *) (output + w + low_written), _mm256_extracti128_si256(units, 1));
+            w += 2 * __builtin_popcount(leads);
+            r += window;
+        }
+        while (r < end && w + 4 <= output_len) {
+            size_t char_written;
+            r += utf8_to_utf16_one<big_endian>(input + r, output + w, &char_written);
+            w += char_written;
+        }
+        if (r < end) {
+            break;
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Codepoints of the characters beginning in the 8 first bytes of input, in 32 bits lanes */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf8_decode_8x32(__m256i b0, __m256i b1, __m256i b2, __m256i b3) {
+    const __m256i cont_bits = _mm256_set1_epi32(0x3F);
+    __m256i c1 = _mm256_and_si256(b1, cont_bits);
+    __m256i c2 = _mm256_and_si256(b2, cont_bits);
+    __m256i c3 = _mm256_and_si256(b3, cont_bits);
+    __m256i two = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b0, _mm256_set1_epi32(0x1F)), 6), c1);
+    __m256i three = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b0, _mm256_set1_epi32(0x0F)), 12),
+            _mm256_slli_epi32(c1, 6)), c2);
+    __m256i four = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b0, _mm256_set1_epi32(0x07)), 18),
+            _mm256_slli_epi32(c1, 12)), _mm256_or_si256(_mm256_slli_epi32(c2, 6), c3));
+    __m256i cp = _mm256_blendv_epi8(b0, two, _mm256_cmpgt_epi32(b0, _mm256_set1_epi32(0xBF)));
+    cp = _mm256_blendv_epi8(cp, three, _mm256_cmpgt_epi32(b0, _mm256_set1_epi32(0xDF)));
+    return _mm256_blendv_epi8(cp, four, _mm256_cmpgt_epi32(b0, _mm256_set1_epi32(0xEF)));
+}
+
+/* Decode the characters beginning at input[0..7] (selected by leads) into 32 bits lanes, store them in output. Return the number of bytes written */
+template<bool big_endian>
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+size_t utf8_to_utf32_8(const char *input, uint32_t leads, const ShuffleTables &tables, char *output) {
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i cp = utf8_decode_8x32(
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) input)),
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (input + 1))),
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (input + 2))),
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (input + 3))));
+    __m256i pack = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_load_si128((const __m128i *) tables.utf32_pack[leads & 0xF])),
+            _mm_load_si128((const __m128i *) tables.utf32_pack[leads >> 4]), 1);
+    cp = _mm256_shuffle_epi8(cp, pack);
+    if (big_endian) {
+        cp = _mm256_shuffle_epi8(cp, bswap);
+    }
+    size_t low_written = 4 * __builtin_popcount(leads & 0xF);
+    _mm_storeu_si128((__m128i *) output, _mm256_castsi256_si128(cp));
+    _mm_storeu_si128((__m128i *) (output + low_written), _mm256_extracti128_si256(cp, 1));
+    return 4 * __builtin_popcount(leads);
+}
+
+/* Same as sse42::utf8_to_utf32, with windows of 32 bytes (16 characters) */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf8_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    for (;;) {
+        size_t ascii_written;
+        r += ascii_to_utf32<big_endian>(input + r, input_len - r, output + w, output_len - w, &ascii_written);
+        w += ascii_written;
+
+        size_t chunk_len = input_len - r < 4096 ? input_len - r : 4096;
+        if (chunk_len > (output_len - w) / 4) {
+            chunk_len = (output_len - w) / 4;
+        }
+        size_t length;
+        size_t end = r + validate_utf8(input + r, chunk_len, &length);
+        if (end == r) {
+            break;
+        }
+
+        while (r + 32 <= end && w + 64 <= output_len) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+            uint32_t leads = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(0xBF))));
+            uint32_t four_leads = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(char(0xF0))), v)) & 0xFFFF;
+            size_t window = 16 + __builtin_ctz(leads >> 16);
+            leads &= 0xFFFF;
+
+            if (four_leads == 0) {
+                __m256i b0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+                __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + r + 1)));
+                __m256i b2 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + r + 2)));
+                __m256i pack = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm_load_si128((const __m128i *) tables.utf16_pack[leads & 0xFF])),
+                        _mm_load_si128((const __m128i *) tables.utf16_pack[leads >> 8]), 1);
+                __m256i units = _mm256_shuffle_epi8(utf8_decode_16(b0, b1, b2), pack);
+                __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(units));
+                __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(units, 1));
+                if (big_endian) {
+                    lo = _mm256_shuffle_epi8(lo, bswap);
+                    hi = _mm256_shuffle_epi8(hi, bswap);
+                }
+                _mm256_storeu_si256((__m256i *) (output + w), lo);
+                _mm256_storeu_si256((__m256i *) (output + w + 4 * __builtin_popcount(leads & 0xFF)), hi);
+                w += 4 * __builtin_popcount(leads);
+            } else {
+                w += utf8_to_utf32_8<big_endian>(input + r, leads & 0xFF, tables, output + w);
+                w += utf8_to_utf32_8<big_endian>(input + r + 8, leads >> 8, tables, output + w);
+            }
+            r += window;
+        }
+        while (r < end && w + 4 <= output_len) {
+            r += utf8_to_utf32_one<big_endian>(input + r, output + w);
+            w += 4;
+        }
+        if (r < end) {
+            break;
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Convert 8 BMP codepoints (not surrogates) held in 32 bits lanes into UTF-8, return the number of bytes written (28 bytes at most are stored) */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+size_t utf16_to_utf8_8(__m256i cp, const ShuffleTables &tables, char *output) {
+    const __m256i cont_bits = _mm256_set1_epi32(0x3F);
+    const __m256i cont_tag = _mm256_set1_epi32(0x80);
+    __m256i ge_80 = _mm256_cmpgt_epi32(cp, _mm256_set1_epi32(0x7F));
+    __m256i ge_800 = _mm256_cmpgt_epi32(cp, _mm256_set1_epi32(0x7FF));
+    __m256i last = _mm256_or_si256(_mm256_and_si256(cp, cont_bits), cont_tag);
+    __m256i middle = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(cp, 6), cont_bits), cont_tag);
+    __m256i two = _mm256_or_si256(_mm256_or_si256(_mm256_srli_epi32(cp, 6), _mm256_set1_epi32(0xC0)), _mm256_slli_epi32(last, 8));
+    __m256i three = _mm256_or_si256(_mm256_or_si256(_mm256_srli_epi32(cp, 12), _mm256_set1_epi32(0xE0)),
+            _mm256_or_si256(_mm256_slli_epi32(middle, 8), _mm256_slli_epi32(last, 16)));
+    __m256i bytes = _mm256_blendv_epi8(_mm256_blendv_epi8(cp, two, ge_80), three, ge_800);
+    int m_80 = _mm256_movemask_ps(_mm256_castsi256_ps(ge_80));
+    int m_800 = _mm256_movemask_ps(_mm256_castsi256_ps(ge_800));
+    int index_low = (m_80 & 0x0F) | (m_800 & 0x0F) << 4;
+    int index_high = m_80 >> 4 | (m_800 & 0xF0);
+    __m256i pack = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_load_si128((const __m128i *) tables.utf8_pack[index_low])),
+            _mm_load_si128((const __m128i *) tables.utf8_pack[index_high]), 1);
+    bytes = _mm256_shuffle_epi8(bytes, pack);
+    _mm_storeu_si128((__m128i *) output, _mm256_castsi256_si128(bytes));
+    _mm_storeu_si128((__m128i *) (output + tables.utf8_pack_len[index_low]), _mm256_extracti128_si256(bytes, 1));
+    return tables.utf8_pack_len[index_low] + tables.utf8_pack_len[index_high];
+}
+
+/* Same as sse42::utf16_to_utf8, by blocks of 16 code units */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf16_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m256i bswap = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 64 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (big_endian) {
+            v = _mm256_shuffle_epi8(v, bswap);
+        }
+        if (_mm256_testz_si256(v, _mm256_set1_epi16(short(0xFF80)))) {
+            _mm_storeu_si128((__m128i *) (output + w), _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+            r += 32;
+            w += 16;
+            continue;
+        }
+        __m256i surrogates = _mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(short(0xF800))), _mm256_set1_epi16(short(0xD800)));
+        if (_mm256_movemask_epi8(surrogates) != 0) {
+            size_t block_end = r + 32;
+            while (r < block_end) {
+                size_t char_written;
+                size_t char_read = utf16_to_utf8_one<big_endian>(input + r, input_len - r, output + w, &char_written);
+                if (char_read == 0) {
+                    *written = w;
+                    return r;
+                }
+                r += char_read;
+                w += char_written;
+            }
+            continue;
+        }
+        w += utf16_to_utf8_8(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), tables, output + w);
+        w += utf16_to_utf8_8(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), tables, output + w);
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::utf16_to_utf8<big_endian>(input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::utf32_to_utf8, by blocks of 16 codepoints */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf32_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    while (r + 64 <= input_len && w + 64 <= output_len) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (input + r + 32));
+        if (big_endian) {
+            v0 = _mm256_shuffle_epi8(v0, bswap);
+            v1 = _mm256_shuffle_epi8(v1, bswap);
+        }
+        __m256i any = _mm256_or_si256(v0, v1);
+        if (_mm256_testz_si256(any, _mm256_set1_epi32(int(0xFFFFFF80)))) {
+            // packus works on 128 bits lanes
+            __m256i units = _mm256_permute4x64_epi64(_mm256_packus_epi32(v0, v1), 0xD8);
+            _mm_storeu_si128((__m128i *) (output + w), _mm_packus_epi16(_mm256_castsi256_si128(units), _mm256_extracti128_si256(units, 1)));
+            r += 64;
+            w += 16;
+            continue;
+        }
+        __m256i surrogates = _mm256_or_si256(
+                _mm256_cmpeq_epi32(_mm256_and_si256(v0, _mm256_set1_epi32(int(0xFFFFF800))), _mm256_set1_epi32(0xD800)),
+                _mm256_cmpeq_epi32(_mm256_and_si256(v1, _mm256_set1_epi32(int(0xFFFFF800))), _mm256_set1_epi32(0xD800)));
+        if (!_mm256_testz_si256(any, _mm256_set1_epi32(int(0xFFFF0000))) || !_mm256_testz_si256(surrogates, surrogates)) {
+            if (!utf32_to_utf8_block<big_endian>(input, r, r + 64, output, w)) {
+                *written = w;
+                return r;
+            }
+            continue;
+        }
+        w += utf16_to_utf8_8(v0, tables, output + w);
+        w += utf16_to_utf8_8(v1, tables, output + w);
+        r += 64;
+    }
+    size_t tail_written;
+    r += sse42::utf32_to_utf8<big_endian>(input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::utf16_swap, by blocks of 16 code units */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf16_swap(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i surrogate_bits = _mm256_set1_epi16(short(0xFC00));
+    size_t r = 0;
+    while (r + 32 <= input_len && r + 32 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i swapped = _mm256_shuffle_epi8(v, bswap);
+        __m256i units = big_endian ? swapped : v;
+        _mm256_storeu_si256((__m256i *) (output + r), swapped);
+        uint32_t highs = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(units, surrogate_bits), _mm256_set1_epi16(short(0xD800))));
+        uint32_t lows = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(units, surrogate_bits), _mm256_set1_epi16(short(0xDC00))));
+        if ((highs | lows) != 0) {
+            // 2 bits per code unit
+            if (lows != highs << 2) {
+                break;
+            }
+            if (highs & 0x80000000) {
+                r += 30;
+                continue;
+            }
+        }
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::utf16_swap<big_endian>(input + r, input_len - r, output + r, output_len - r, &tail_written);
+    *written = r;
+    return r;
+}
+
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+__m256i utf32_invalid(__m256i cp) {
+    __m256i too_large = _mm256_cmpgt_epi32(_mm256_xor_si256(cp, _mm256_set1_epi32(int(0x80000000))), _mm256_set1_epi32(int(0x8010FFFF)));
+    __m256i surrogate = _mm256_cmpeq_epi32(_mm256_and_si256(cp, _mm256_set1_epi32(int(0xFFFFF800))), _mm256_set1_epi32(0xD800));
+    return _mm256_or_si256(too_large, surrogate);
+}
+
+/* Same as sse42::utf32_copy, by blocks of 8 codepoints */
+template<bool big_endian, bool swap>
+UTF_TARGET_AVX2
+inline size_t utf32_copy(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 32 <= input_len && r + 32 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i swapped = _mm256_shuffle_epi8(v, bswap);
+        _mm256_storeu_si256((__m256i *) (output + r), swap ? swapped : v);
+        int invalid = _mm256_movemask_ps(_mm256_castsi256_ps(utf32_invalid(big_endian ? swapped : v)));
+        if (invalid != 0) {
+            r += 4 * __builtin_ctz(invalid);
+            *written = r;
+            return r;
+        }
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::utf32_copy<big_endian, swap>(input + r, input_len - r, output + r, output_len - r, &tail_written);
+    *written = r;
+    return r;
+}
+
+/* Same as sse42::validate_utf32, by blocks of 8 codepoints */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t validate_utf32(const char *input, size_t input_len, size_t *length) {
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 32 <= input_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (big_endian) {
+            v = _mm256_shuffle_epi8(v, bswap);
+        }
+        int invalid = _mm256_movemask_ps(_mm256_castsi256_ps(utf32_invalid(v)));
+        if (invalid != 0) {
+            r += 4 * __builtin_ctz(invalid);
+            *length = r / 4;
+            return r;
+        }
+        r += 32;
+    }
+    size_t tail_length;
+    r += sse42::validate_utf32<big_endian>(input + r, input_len - r, &tail_length);
+    *length = r / 4;
+    return r;
+}
+
+/* Same as sse42::utf32_to_utf16, by blocks of 16 codepoints */
+template<bool big_endian_in, bool big_endian_out>
+UTF_TARGET_AVX2
+inline size_t utf32_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    const __m256i bswap16 = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i bswap32 = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    while (r + 64 <= input_len && w + 64 <= output_len) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (input + r + 32));
+        if (big_endian_in) {
+            v0 = _mm256_shuffle_epi8(v0, bswap32);
+            v1 = _mm256_shuffle_epi8(v1, bswap32);
+        }
+        __m256i invalid = _mm256_or_si256(utf32_invalid(v0), utf32_invalid(v1));
+        if (!_mm256_testz_si256(invalid, invalid)) {
+            size_t char_written;
+            while ((char_written = utf32_to_utf16_one<big_endian_in, big_endian_out>(input + r, output + w)) != 0) {
+                r += 4;
+                w += char_written;
+            }
+            *written = w;
+            return r;
+        }
+        if (_mm256_testz_si256(_mm256_or_si256(v0, v1), _mm256_set1_epi32(int(0xFFFF0000)))) {
+            // packus works on 128 bits lanes
+            __m256i units = _mm256_permute4x64_epi64(_mm256_packus_epi32(v0, v1), 0xD8);
+            if (big_endian_out) {
+                units = _mm256_shuffle_epi8(units, bswap16);
+            }
+            _mm256_storeu_si256((__m256i *) (output + w), units);
+            r += 64;
+            w += 32;
+            continue;
+        }
+        w += sse42::utf32_to_utf16_4<big_endian_out>(_mm256_castsi256_si128(v0), tables, output + w);
+        w += sse42::utf32_to_utf16_4<big_endian_out>(_mm256_extracti128_si256(v0, 1), tables, output + w);
+        w += sse42::utf32_to_utf16_4<big_endian_out>(_mm256_castsi256_si128(v1), tables, output + w);
+        w += sse42::utf32_to_utf16_4<big_endian_out>(_mm256_extracti128_si256(v1, 1), tables, output + w);
+        r += 64;
+    }
+    size_t tail_written;
+    r += sse42::utf32_to_utf16<big_endian_in, big_endian_out>(input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::utf16_to_utf32, by blocks of 16 code units */
+template<bool big_endian_in, bool big_endian_out>
+UTF_TARGET_AVX2
+inline size_t utf16_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap16 = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i bswap32 = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 64 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (big_endian_in) {
+            v = _mm256_shuffle_epi8(v, bswap16);
+        }
+        __m256i surrogates = _mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(short(0xF800))), _mm256_set1_epi16(short(0xD800)));
+        if (_mm256_movemask_epi8(surrogates) != 0) {
+            size_t block_end = r + 32;
+            while (r < block_end) {
+                size_t char_read = utf16_to_utf32_one<big_endian_in, big_endian_out>(input + r, input_len - r, output + w);
+                if (char_read == 0) {
+                    *written = w;
+                    return r;
+                }
+                r += char_read;
+                w += 4;
+            }
+            continue;
+        }
+        __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+        if (big_endian_out) {
+            lo = _mm256_shuffle_epi8(lo, bswap32);
+            hi = _mm256_shuffle_epi8(hi, bswap32);
+        }
+        _mm256_storeu_si256((__m256i *) (output + w), lo);
+        _mm256_storeu_si256((__m256i *) (output + w + 32), hi);
+        r += 32;
+        w += 64;
+    }
+    size_t tail_written;
+    r += sse42::utf16_to_utf32<big_endian_in, big_endian_out>(input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::latin1_to_utf8, by blocks of 32 bytes */
+UTF_TARGET_AVX2
+inline size_t latin1_to_utf8(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 64 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *) (output + w), v);
+            r += 32;
+            w += 32;
+            continue;
+        }
+        __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        w += sse42::latin1_to_utf8_8(_mm256_castsi256_si128(lo), mask & 0xFF, tables, output + w);
+        w += sse42::latin1_to_utf8_8(_mm256_extracti128_si256(lo, 1), (mask >> 8) & 0xFF, tables, output + w);
+        w += sse42::latin1_to_utf8_8(_mm256_castsi256_si128(hi), (mask >> 16) & 0xFF, tables, output + w);
+        w += sse42::latin1_to_utf8_8(_mm256_extracti128_si256(hi, 1), mask >> 24, tables, output + w);
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::latin1_to_utf8(input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::latin1_to_utf16, by blocks of 32 bytes */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t latin1_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 32 <= input_len && 2 * (r + 32) <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        if (big_endian) {
+            lo = _mm256_slli_epi16(lo, 8);
+            hi = _mm256_slli_epi16(hi, 8);
+        }
+        _mm256_storeu_si256((__m256i *) (output + 2 * r), lo);
+        _mm256_storeu_si256((__m256i *) (output + 2 * r + 32), hi);
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::latin1_to_utf16<big_endian>(input + r, input_len - r, output + 2 * r, output_len - 2 * r, &tail_written);
+    *written = 2 * r;
+    return r;
+}
+
+/* Same as sse42::latin1_to_utf32, by blocks of 16 bytes */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t latin1_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 16 <= input_len && 4 * (r + 16) <= output_len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (input + r));
+        __m256i lo = _mm256_cvtepu8_epi32(v);
+        __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8));
+        if (big_endian) {
+            lo = _mm256_slli_epi32(lo, 24);
+            hi = _mm256_slli_epi32(hi, 24);
+        }
+        _mm256_storeu_si256((__m256i *) (output + 4 * r), lo);
+        _mm256_storeu_si256((__m256i *) (output + 4 * r + 32), hi);
+        r += 16;
+    }
+    *written = 4 * r;
+    return r;
+}
+
+/* Same as sse42::utf8_to_latin1, the ASCII blocks are copied by 32 bytes */
+UTF_TARGET_AVX2
+inline size_t utf8_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &tables = shuffle_tables();
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 32 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (_mm256_movemask_epi8(v) == 0) {
+            _mm256_storeu_si256((__m256i *) (output + w), v);
+            r += 32;
+            w += 32;
+            continue;
+        }
+        size_t window_written;
+        size_t window = sse42::utf8_to_latin1_16(_mm256_castsi256_si128(v), tables, output + w, &window_written);
+        if (window == 0) {
+            *written = w;
+            return r;
+        }
+        r += window;
+        w += window_written;
+    }
+    size_t tail_written;
+    r += sse42::utf8_to_latin1(input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::utf16_to_latin1, by blocks of 32 code units */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf16_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0;
+    while (r + 64 <= input_len && r / 2 + 32 <= output_len) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (input + r + 32));
+        if (big_endian) {
+            v0 = _mm256_shuffle_epi8(v0, bswap);
+            v1 = _mm256_shuffle_epi8(v1, bswap);
+        }
+        if (!_mm256_testz_si256(_mm256_or_si256(v0, v1), _mm256_set1_epi16(short(0xFF00)))) {
+            *written = r / 2;
+            return r;
+        }
+        // packus works on 128 bits lanes
+        _mm256_storeu_si256((__m256i *) (output + r / 2), _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), 0xD8));
+        r += 64;
+    }
+    size_t tail_written;
+    r += sse42::utf16_to_latin1<big_endian>(input + r, input_len - r, output + r / 2, output_len - r / 2, &tail_written);
+    *written = r / 2;
+    return r;
+}
+
+/* Same as sse42::utf32_to_latin1, by blocks of 32 codepoints */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t utf32_to_latin1(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 128 <= input_len && r / 4 + 32 <= output_len) {
+        __m256i v[4];
+        for (int i = 0; i < 4; i++) {
+            v[i] = _mm256_loadu_si256((const __m256i *) (input + r + 32 * i));
+            if (big_endian) {
+                v[i] = _mm256_shuffle_epi8(v[i], bswap);
+            }
+        }
+        if (!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(v[0], v[1]), _mm256_or_si256(v[2], v[3])), _mm256_set1_epi32(int(0xFFFFFF00)))) {
+            *written = r / 4;
+            return r;
+        }
+        // packus works on 128 bits lanes
+        __m256i units0 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v[0], v[1]), 0xD8);
+        __m256i units1 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v[2], v[3]), 0xD8);
+        _mm256_storeu_si256((__m256i *) (output + r / 4), _mm256_permute4x64_epi64(_mm256_packus_epi16(units0, units1), 0xD8));
+        r += 128;
+    }
+    size_t tail_written;
+    r += sse42::utf32_to_latin1<big_endian>(input + r, input_len - r, output + r / 4, output_len - r / 4, &tail_written);
+    *written = r / 4;
+    return r;
+}
+
+/* Same as sse42::ascii_copy, by blocks of 32 bytes */
+UTF_TARGET_AVX2
+inline size_t ascii_copy(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 32 <= input_len && r + 32 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        _mm256_storeu_si256((__m256i *) (output + r), v);
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+        if (mask != 0) {
+            r += __builtin_ctz(mask);
+            *written = r;
+            return r;
+        }
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::ascii_copy(input + r, input_len - r, output + r, output_len - r, &tail_written);
+    *written = r;
+    return r;
+}
+
+/* Same as sse42::ascii_length, by blocks of 32 bytes */
+UTF_TARGET_AVX2
+inline size_t ascii_length(const char *input, size_t input_len) {
+    size_t r = 0;
+    while (r + 32 <= input_len) {
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (input + r)));
+        if (mask != 0)
+            return r + __builtin_ctz(mask);
+        r += 32;
+    }
+    return r + sse42::ascii_length(input + r, input_len - r);
+}
+
+/* Same as sse42::single_byte_lookup_16 for 32 bytes, the lookup tables are broadcast to both lanes */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+uint32_t single_byte_lookup_32(__m256i v, const SingleByteTables &tables, __m256i *low, __m256i *high) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i non_ascii = _mm256_cmpgt_epi8(zero, v);
+    __m256i lo = _mm256_andnot_si256(non_ascii, v);
+    __m256i hi = zero;
+    for (int g = 0; g < 8; g++) {
+        __m256i index = _mm256_adds_epu8(_mm256_xor_si256(v, _mm256_set1_epi8(char(0x80 + 16 * g))), _mm256_set1_epi8(0x70));
+        __m256i table_low = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) tables.decode_low[g]));
+        __m256i table_high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) tables.decode_high[g]));
+        lo = _mm256_or_si256(lo, _mm256_shuffle_epi8(table_low, index));
+        hi = _mm256_or_si256(hi, _mm256_shuffle_epi8(table_high, index));
+    }
+    *low = lo;
+    *high = hi;
+    return (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(non_ascii, _mm256_cmpeq_epi8(_mm256_or_si256(lo, hi), zero)));
+}
+
+/* Interleave the low and high bytes of 32 codepoints into 2 vectors of 16 code units, in the order of the stream */
+UTF_TARGET_AVX2
+static inline __attribute__((always_inline))
+void single_byte_units_32(__m256i lo, __m256i hi, __m256i *units0, __m256i *units1) {
+    // unpack works on 128 bits lanes
+    __m256i a = _mm256_unpacklo_epi8(lo, hi);
+    __m256i b = _mm256_unpackhi_epi8(lo, hi);
+    *units0 = _mm256_permute2x128_si256(a, b, 0x20);
+    *units1 = _mm256_permute2x128_si256(a, b, 0x31);
+}
+
+/* Same as sse42::single_byte_to_utf8, by blocks of 32 bytes */
+UTF_TARGET_AVX2
+inline size_t single_byte_to_utf8(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const ShuffleTables &shuffles = shuffle_tables();
+    size_t r = 0, w = 0;
+    while (r + 32 <= input_len && w + 128 <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        if (_mm256_movemask_epi8(v) == 0) {
+            _mm256_storeu_si256((__m256i *) (output + w), v);
+            r += 32;
+            w += 32;
+            continue;
+        }
+        __m256i lo, hi, units[2];
+        if (single_byte_lookup_32(v, tables, &lo, &hi) != 0) {
+            break;
+        }
+        single_byte_units_32(lo, hi, &units[0], &units[1]);
+        for (int i = 0; i < 2; i++) {
+            __m128i half0 = _mm256_castsi256_si128(units[i]);
+            __m128i half1 = _mm256_extracti128_si256(units[i], 1);
+            w += sse42::utf16_to_utf8_4(_mm_cvtepu16_epi32(half0), shuffles, output + w);
+            w += sse42::utf16_to_utf8_4(_mm_cvtepu16_epi32(_mm_srli_si128(half0, 8)), shuffles, output + w);
+            w += sse42::utf16_to_utf8_4(_mm_cvtepu16_epi32(half1), shuffles, output + w);
+            w += sse42::utf16_to_utf8_4(_mm_cvtepu16_epi32(_mm_srli_si128(half1, 8)), shuffles, output + w);
+        }
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::single_byte_to_utf8(tables, input + r, input_len - r, output + w, output_len - w, &tail_written);
+    *written = w + tail_written;
+    return r;
+}
+
+/* Same as sse42::single_byte_to_utf16, by blocks of 32 bytes */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t single_byte_to_utf16(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t r = 0;
+    while (r + 32 <= input_len && 2 * (r + 32) <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i units0, units1;
+        if (_mm256_movemask_epi8(v) == 0) {
+            units0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+            units1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        } else {
+            __m256i lo, hi;
+            if (single_byte_lookup_32(v, tables, &lo, &hi) != 0) {
+                break;
+            }
+            single_byte_units_32(lo, hi, &units0, &units1);
+        }
+        if (big_endian) {
+            units0 = _mm256_shuffle_epi8(units0, bswap);
+            units1 = _mm256_shuffle_epi8(units1, bswap);
+        }
+        _mm256_storeu_si256((__m256i *) (output + 2 * r), units0);
+        _mm256_storeu_si256((__m256i *) (output + 2 * r + 32), units1);
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::single_byte_to_utf16<big_endian>(tables, input + r, input_len - r, output + 2 * r, output_len - 2 * r, &tail_written);
+    *written = 2 * r;
+    return r;
+}
+
+/* Same as sse42::single_byte_to_utf32, by blocks of 32 bytes */
+template<bool big_endian>
+UTF_TARGET_AVX2
+inline size_t single_byte_to_utf32(const SingleByteTables &tables, const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t r = 0;
+    while (r + 32 <= input_len && 4 * (r + 32) <= output_len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+        __m256i lo = v, hi = _mm256_setzero_si256(), units[2];
+        if (_mm256_movemask_epi8(v) != 0 && single_byte_lookup_32(v, tables, &lo, &hi) != 0) {
+            break;
+        }
+        single_byte_units_32(lo, hi, &units[0], &units[1]);
+        for (int i = 0; i < 2; i++) {
+            __m256i cp0 = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(units[i]));
+            __m256i cp1 = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(units[i], 1));
+            if (big_endian) {
+                cp0 = _mm256_shuffle_epi8(cp0, bswap);
+                cp1 = _mm256_shuffle_epi8(cp1, bswap);
+            }
+            _mm256_storeu_si256((__m256i *) (output + 4 * r + 64 * i), cp0);
+            _mm256_storeu_si256((__m256i *) (output + 4 * r + 64 * i + 32), cp1);
+        }
+        r += 32;
+    }
+    size_t tail_written;
+    r += sse42::single_byte_to_utf32<big_endian>(tables, input + r, input_len - r, output + 4 * r, output_len - 4 * r, &tail_written);
+    *written = 4 * r;
+    return r;
+}
+}
+
+/*
+ * AVX-512 kernels (AVX512BW)
+ * Only the kernels gaining from the 64 bytes registers are defined, the others are taken from the AVX2 set
+ */
+namespace avx512 {
+
+template<bool big_endian>
+UTF_TARGET_AVX512
+inline size_t ascii_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 64 <= input_len && 2 * (r + 64) <= output_len) {
+        __m512i v = _mm512_loadu_si512((const void *) (input + r));
+        uint64_t mask = _mm512_movepi8_mask(v);
+        // load the halves again rather than extracting them (cheaper than a cross-lane shuffle)
+        __m512i lo = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (input + r)));
+        __m512i hi = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (input + r + 32)));
+        if (big_endian) {
+            lo = _mm512_slli_epi16(lo, 8);
+            hi = _mm512_slli_epi16(hi, 8);
+        }
+        _mm512_storeu_si512((void *) (output + 2 * r), lo);
+        _mm512_storeu_si512((void *) (output + 2 * r + 64), hi);
+        if (mask != 0) {
+            r += __builtin_ctzll(mask);
+            *written = 2 * r;
+            return r;
+        }
+        r += 64;
+    }
+    size_t tail_written;
+    r += avx2::ascii_to_utf16<big_endian>(input + r, input_len - r, output + 2 * r, output_len - 2 * r, &tail_written);
+    *written = 2 * r;
+    return r;
+}
+
+template<bool big_endian>
+UTF_TARGET_AVX512
+inline size_t ascii_to_utf32(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    size_t r = 0;
+    while (r + 64 <= input_len && 4 * (r + 64) <= output_len) {
+        __m512i v = _mm512_loadu_si512((const void *) (input + r));
+        uint64_t mask = _mm512_movepi8_mask(v);
+        __m512i out[4];
+        for (int i = 0; i < 4; i++) {
+            // the maskz forms avoid a spurious -Wmaybe-uninitialized of GCC 12 in the unmasked intrinsics
+            out[i] = _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i *) (input + r + 16 * i)));
+            if (big_endian) {
+                out[i] = _mm512_maskz_slli_epi32(0xFFFF, out[i], 24);
+            }
+            _mm512_storeu_si512((void *) (output + 4 * r + 64 * i), out[i]);
+        }
+        if (mask != 0) {
+            r += __builtin_ctzll(mask);
+            *written = 4 * r;
+            return r;
+        }
+        r += 64;
+    }
+    size_t tail_written;
+    r += avx2::ascii_to_utf32<big_endian>(input + r, input_len - r, output + 4 * r, output_len - 4 * r, &tail_written);
+    *written = 4 * r;
+    return r;
+}
+
+
+/*
+ * Same as sse42::utf8_to_utf16, with windows of 32 bytes (16 characters) decoded in 32 bits lanes
+ * and packed with vpcompressd instead of a shuffle table
+ */
+template<bool big_endian>
+UTF_TARGET_AVX512
+inline size_t utf8_to_utf16(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m256i bswap = _mm256_setr_epi8(
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m512i cont_bits = _mm512_set1_epi32(0x3F);
+    size_t r = 0, w = 0;
+    for (;;) {
+        size_t ascii_written;
+        r += ascii_to_utf16<big_endian>(input + r, input_len - r, output + w, output_len - w, &ascii_written);
+        w += ascii_written;
+
+        size_t chunk_len = input_len - r < 4096 ? input_len - r : 4096;
+        if (chunk_len > (output_len - w) / 2) {
+            chunk_len = (output_len - w) / 2;
+        }
+        size_t length;
+        size_t end = r + avx2::validate_utf8(input + r, chunk_len, &length);
+        if (end == r) {
+            break;
+        }
+
+        while (r + 32 <= end && w + 64 <= output_len) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (input + r));
+            uint32_t all_leads = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(0xBF))));
+            uint32_t four_leads = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(char(0xF0))), v));
+            if ((four_leads & 0x11111111) == 0x11111111) {
+                __m256i units = avx2::utf8_four_to_utf16(v);
+                if (big_endian) {
+                    units = _mm256_shuffle_epi8(units, bswap);
+                }
+                _mm256_storeu_si256((__m256i *) (output + w), units);
+                w += 32;
+                r += 32;
+                continue;
+            }
+            size_t window = 16 + __builtin_ctz(all_leads >> 16);
+            __mmask16 leads = all_leads & 0xFFFF;
+            four_leads &= 0xFFFF;
+
+            __m512i b0 = _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm256_castsi256_si128(v));
+            __m512i c1 = _mm512_and_si512(_mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i *) (input + r + 1))), cont_bits);
+            __m512i c2 = _mm512_and_si512(_mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i *) (input + r + 2))), cont_bits);
+            __m512i two = _mm512_or_si512(_mm512_maskz_slli_epi32(0xFFFF, _mm512_and_si512(b0, _mm512_set1_epi32(0x1F)), 6), c1);
+            __m512i three = _mm512_or_si512(_mm512_or_si512(_mm512_maskz_slli_epi32(0xFFFF, _mm512_and_si512(b0, _mm512_set1_epi32(0x0F)), 12),
+                    _mm512_maskz_slli_epi32(0xFFFF, c1, 6)), c2);
+            __m512i cp = _mm512_mask_blend_epi32(_mm512_cmpgt_epu32_mask(b0, _mm512_set1_epi32(0xBF)), b0, two);
+            cp = _mm512_mask_blend_epi32(_mm512_cmpgt_epu32_mask(b0, _mm512_set1_epi32(0xDF)), cp, three);
+            if (four_leads != 0) {
+                if (four_leads & 0x8000) {
+                    window = 15;
+                    leads &= 0x7FFF;
+                    four_leads &= 0x7FFF;
+                }
+                __m512i highs = _mm512_add_epi32(_mm512_or_si512(_mm512_or_si512(_mm512_maskz_slli_epi32(0xFFFF, _mm512_and_si512(b0, _mm512_set1_epi32(0x07)), 8),
+                        _mm512_maskz_slli_epi32(0xFFFF, c1, 2)), _mm512_maskz_srli_epi32(0xFFFF, c2, 4)), _mm512_set1_epi32(0xD7C0));
+                __m512i lows = _mm512_or_si512(_mm512_or_si512(_mm512_maskz_slli_epi32(0xFFFF, _mm512_and_si512(c1, _mm512_set1_epi32(0x0F)), 6), c2),
+                        _mm512_set1_epi32(0xDC00));
+                cp = _mm512_mask_blend_epi32(four_leads, cp, highs);
+                cp = _mm512_mask_blend_epi32(four_leads << 1, cp, lows);
+                leads |= four_leads << 1;
+            }
+
+            __m256i units = _mm512_maskz_cvtepi32_epi16(0xFFFF, _mm512_maskz_compress_epi32(leads, cp));
+            if (big_endian) {
+                units = _mm256_shuffle_epi8(units, bswap);
+            }
+            _mm256_storeu_si256((__m256i *) (output + w), units);
+            w += 2 * __builtin_popcount(leads);
+            r += window;
+        }
+        while (r < end && w + 4 <= output_len) {
+            size_t char_written;
+            r += utf8_to_utf16_one<big_endian>(input + r, output + w, &char_written);
+            w += char_written;
+        }
+        if (r < end) {
+            break;
+        }
+    }
+    *written = w;
+    return r;
+}
+
+/* Same as sse42::utf16_swap, by blocks of 32 code units */
+template<bool big_endian>
+UTF_TARGET_AVX512
+inline size_t utf16_swap(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m512i bswap = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+    const __m512i surrogate_bits = _mm512_set1_epi16(short(0xFC00));
+    size_t r = 0;
+    while (r + 64 <= input_len && r + 64 <= output_len) {
+        __m512i v = _mm512_loadu_si512((const void *) (input + r));
+        __m512i swapped = _mm512_shuffle_epi8(v, bswap);
+        __m512i units = big_endian ? swapped : v;
+        _mm512_storeu_si512((void *) (output + r), swapped);
+        uint32_t highs = _mm512_cmpeq_epi16_mask(_mm512_and_si512(units, surrogate_bits), _mm512_set1_epi16(short(0xD800)));
+        uint32_t lows = _mm512_cmpeq_epi16_mask(_mm512_and_si512(units, surrogate_bits), _mm512_set1_epi16(short(0xDC00)));
+        if ((highs | lows) != 0) {
+            if (lows != highs << 1) {
+                break;
+            }
+            if (highs & 0x80000000) {
+                r += 62;
+                continue;
+            }
+        }
+        r += 64;
+    }
+    size_t tail_written;
+    r += avx2::utf16_swap<big_endian>(input + r, input_len - r, output + r, output_len - r, &tail_written);
+    *written = r;
+    return r;
+}
+
+UTF_TARGET_AVX512
+static inline __attribute__((always_inline))
+__mmask16 utf32_invalid(__m512i cp) {
+    return _mm512_cmpgt_epu32_mask(cp, _mm512_set1_epi32(0x10FFFF))
+            | _mm512_cmpeq_epi32_mask(_mm512_and_si512(cp, _mm512_set1_epi32(int(0xFFFFF800))), _mm512_set1_epi32(0xD800));
+}
+
+/* Same as sse42::utf32_copy, by blocks of 16 codepoints */
+template<bool big_endian, bool swap>
+UTF_TARGET_AVX512
+inline size_t utf32_copy(const char *input, size_t input_len, char *output, size_t output_len, size_t *written) {
+    const __m512i bswap = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    size_t r = 0;
+    while (r + 64 <= input_len && r + 64 <= output_len) {
+        __m512i v = _mm512_loadu_si512((const void *) (input + r));
+        __m512i swapped = _mm512_shuffle_epi8(v, bswap);
+        _mm512_storeu_si512((void *) (output + r), swap ? swapped : v);
+        uint32_t invalid = utf32_invalid(big_endian ? swapped : v);
+        if (invalid != 0) {
+            r += 4 * __builtin_ctz(invalid);
+            *written = r;
+            return r;
+        }
+        r += 64;
+    }
+    size_t tail_written;
+    r += avx2::utf32_copy<big_endian, swap>(input + r, input_len - r, output + r, output_len - r, &tail_written);
+    *written = r;
+    return r;
+}
+
+/* Same as sse42::validate_utf32, by blocks of 16 codepoints */
+template<bool big_endian>
+UTF_TARGET_AVX512
+inline size_t validate_utf32(const char *input, size_t input_len, size_t *length) {
+    const __m512i bswap = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    size_t r = 0;
+    while (r + 64 <= input_len) {
+        __m512i v = _mm512_loadu_si512((const void *) (input + r));
+        if (big_endian) {
+            v = _mm512_shuffle_epi8(v, bswap);
+        }
+        uint32_t invalid = utf32_invalid(v);
+        if (invalid != 0) {
+            r += 4 * __builtin_ctz(invalid);
+            *length = r / 4;
+            return r;
+        }
+        r += 64;
+    }
+    size_t tail_length;
+    r += avx2::validate_utf32<big_endian>(input + r, input_len - r, &tail_length);
+    *length = r / 4;
+    return r;
+}
+}
+
+#endif /* UTF_CONV_X86 */
+
+#undef UTF8_BYTE_1_HIGH_TABLE
+#undef UTF8_BYTE_1_LOW_TABLE
+#undef UTF8_BYTE_2_HIGH_TABLE
+
+}
+}
+}
+
+#endif /* UTF_CONV_SIMD_H_ */
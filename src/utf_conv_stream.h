@@ -0,0 +1,223 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include "utf_conv.h"
+
+#ifndef UTF_CONV_STREAM_H_
+#define UTF_CONV_STREAM_H_
+
+namespace UTF {
+
+/*
+ * Stateful stream conversion
+ * StreamConverter<Read, Encode> converts a stream received in successive chunks (Read is a Read* class, Encode a CpTo* class).
+ * A character split between two chunks is kept in the converter (at most 3 bytes) and emitted with the next chunk,
+ * the chunks themselves are never copied.
+ *
+ * The convert() functions have the same arguments as the conv_XXX_to_YYY functions, except that
+ * a truncated sequence at the end of input is not an error : its bytes are counted in *consumed and kept for the next chunk.
+ * On error, *consumed is the offset of the invalid sequence in this chunk (0 if the invalid sequence began in a previous chunk)
+ * and the pending bytes are kept, reset() drops them.
+ * finish() ends the stream and returns E_TRUNCATED if a sequence was left incomplete.
+ */
+template<typename Read, typename Encode>
+class StreamConverter {
+    char m_pending[4];
+    size_t m_pending_len;
+
+    /*
+     * Complete the pending sequence with the beginning of input
+     * Store the encoded character in buffer (*encoded bytes, 0 if there is nothing to emit yet)
+     * and the number of bytes taken from input in *used. The pending bytes are dropped by the caller once emitted.
+     */
+    RetCode complete_pending(const char *input, size_t input_len, char *buffer, size_t *encoded, size_t *used) {
+        *encoded = 0;
+        *used = 0;
+        if (m_pending_len == 0) {
+            return RetCode::OK;
+        }
+        char sequence[4];
+        size_t taken = input_len < 4 - m_pending_len ? input_len : 4 - m_pending_len;
+        memcpy(sequence, m_pending, m_pending_len);
+        memcpy(sequence + m_pending_len, input, taken);
+
+        uint32_t cp;
+        int removed = Read::read(sequence, m_pending_len + taken, cp);
+        if (removed < 0) {
+            return RetCode::E_INVALID;
+        }
+        if (removed == 0) {
+            // still incomplete, the whole input is pending
+            memcpy(m_pending + m_pending_len, input, taken);
+            m_pending_len += taken;
+            *used = taken;
+            return RetCode::OK;
+        }
+        int written = Encode::write(cp, buffer);
+        if (written < 0) {
+            return RetCode::E_INVALID;
+        }
+        *encoded = written;
+        *used = removed - m_pending_len;
+        return RetCode::OK;
+    }
+
+    /* Keep the truncated sequence at the end of input */
+    RetCode keep_truncated(RetCode ret, const char *input, size_t input_len, size_t *consumed) {
+        if (ret == RetCode::E_TRUNCATED) {
+            memcpy(m_pending, input + *consumed, input_len - *consumed);
+            m_pending_len = input_len - *consumed;
+            *consumed = input_len;
+            return RetCode::OK;
+        }
+        return ret;
+    }
+
+public:
+    StreamConverter() : m_pending_len(0) {
+    }
+
+    /* Number of bytes of an incomplete sequence kept from the previous chunks */
+    size_t pending() const {
+        return m_pending_len;
+    }
+
+    void reset() {
+        m_pending_len = 0;
+    }
+
+    RetCode finish() {
+        RetCode ret = m_pending_len != 0 ? RetCode::E_TRUNCATED : RetCode::OK;
+        m_pending_len = 0;
+        return ret;
+    }
+
+    /*
+     * Iterator version
+     */
+    template<typename OutputIt>
+    RetCode convert(const char *input, size_t input_len, OutputIt output, size_t *consumed, size_t *written) {
+        if (!input) {
+            return RetCode::E_PARAMS;
+        }
+        char buffer[4];
+        size_t encoded, used, c = 0, w = 0;
+        RetCode ret = complete_pending(input, input_len, buffer, &encoded, &used);
+        if (ret == RetCode::OK && encoded != 0) {
+            for (size_t i = 0; i < encoded; i++) {
+                *output++ = buffer[i];
+            }
+            m_pending_len = 0;
+        }
+        if (ret == RetCode::OK && m_pending_len == 0) {
+            ret = impl::unicode_conv<Read, Encode, OutputIt>(input + used, input_len - used, output, &c, &w);
+            ret = keep_truncated(ret, input + used, input_len - used, &c);
+        }
+
+        if (consumed) {
+            *consumed = used + c;
+        }
+        if (written) {
+            *written = encoded + w;
+        }
+        return ret;
+    }
+
+    /*
+     * Fixed output buffer version
+     */
+    RetCode convert(const char *input, size_t input_len, char *output, size_t output_len, size_t *consumed, size_t *written) {
+        if (!input || (!output && output_len != 0)) {
+            return RetCode::E_PARAMS;
+        }
+        char buffer[4];
+        size_t encoded, used, c = 0, w = 0;
+        RetCode ret = complete_pending(input, input_len, buffer, &encoded, &used);
+        if (ret == RetCode::OK && encoded != 0) {
+            if (encoded > output_len) {
+                ret = RetCode::E_OUTPUT_FULL;
+                encoded = 0;
+                used = 0;
+            } else {
+                memcpy(output, buffer, encoded);
+                m_pending_len = 0;
+            }
+        }
+        if (ret == RetCode::OK && m_pending_len == 0) {
+            ret = impl::unicode_conv<Read, Encode>(input + used, input_len - used, output + encoded, output_len - encoded, &c, &w);
+            ret = keep_truncated(ret, input + used, input_len - used, &c);
+        }
+
+        if (consumed) {
+            *consumed = used + c;
+        }
+        if (written) {
+            *written = encoded + w;
+        }
+        return ret;
+    }
+
+    /*
+     * getline-style version
+     */
+    RetCode convert(const char *input, size_t input_len, char **output, size_t *output_size, size_t *consumed, size_t *written) {
+        if (!input || !output || !output_size) {
+            return RetCode::E_PARAMS;
+        }
+        if (*output_size == 0) {
+            *output = NULL;
+        }
+        // 4 more bytes for the pending character
+        size_t max_length = impl::ConvLength<Read, Encode>::max_length(input_len);
+        if (input_len != 0 && *output_size < max_length + 4) {
+            size_t needed = impl::first_size(impl::Growth::GEOMETRIC, input_len, max_length, 1) + 4;
+            if (*output_size < needed) {
+                *output_size = needed;
+                *output = (char *) realloc(*output, *output_size);
+            }
+        }
+
+        RetCode ret;
+        size_t c = 0, w = 0;
+        for (;;) {
+            // convert() returns E_PARAMS without setting the counts (no output buffer after a failed realloc)
+            size_t chunk_consumed = 0, chunk_written = 0;
+            ret = convert(input + c, input_len - c, *output + w, *output_size - w, &chunk_consumed, &chunk_written);
+            c += chunk_consumed;
+            w += chunk_written;
+            if (ret != RetCode::E_OUTPUT_FULL) {
+                break;
+            }
+            *output_size = impl::grown_size(impl::Growth::GEOMETRIC, *output_size, w, 4,
+                    impl::ConvLength<Read, Encode>::max_length(input_len - c));
+            *output = (char *) realloc(*output, *output_size);
+        }
+
+        if (consumed) {
+            *consumed = c;
+        }
+        if (written) {
+            *written = w;
+        }
+        return ret;
+    }
+};
+
+}
+
+#endif /* UTF_CONV_STREAM_H_ */
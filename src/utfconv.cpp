@@ -0,0 +1,400 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * utfconv : convert a file between UTF-8, UTF-16, UTF-32 and Latin-1
+ *
+ * usage: utfconv -f FROM -t TO [-v] [INPUT [OUTPUT]]
+ *
+ * A regular input file is memory-mapped and converted in a single call.
+ * A regular output file is sized from the precomputed output length (ftruncate) and memory-mapped,
+ * other outputs (pipes, terminals) are written by large batches.
+ * Other inputs (pipes) are read by chunks with a StreamConverter.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <string>
+#include <chrono>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utf_conv.h"
+#include "utf_conv_stream.h"
+
+/* size of the batches for the non-mappable inputs and outputs */
+static const size_t BATCH_SIZE = 1 << 20;
+
+struct Stats {
+    size_t bytes_in;
+    size_t bytes_out;
+};
+
+/* Write the whole buffer, return false on error */
+static bool write_all(int fd, const char *buffer, size_t len) {
+    while (len != 0) {
+        ssize_t n = write(fd, buffer, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("utfconv: write");
+            return false;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int report_error(UTF::RetCode r, size_t offset) {
+    if (r == UTF::RetCode::E_INVALID) {
+        fprintf(stderr, "utfconv: invalid sequence at offset %zu\n", offset);
+    } else if (r == UTF::RetCode::E_TRUNCATED) {
+        fprintf(stderr, "utfconv: truncated sequence at offset %zu\n", offset);
+    } else {
+        fprintf(stderr, "utfconv: conversion error %d at offset %zu\n", (int) r, offset);
+    }
+    return 1;
+}
+
+/*
+ * Convert a memory-mapped input into a memory-mapped regular file
+ */
+template<typename Read, typename Encode>
+static int transcode_mapped_to_file(const char *input, size_t input_len, int out_fd, Stats *stats) {
+    size_t output_size = UTF::impl::ConvLength<Read, Encode>::length(input, input_len);
+    size_t consumed = 0, written = 0;
+    UTF::RetCode r = UTF::RetCode::OK;
+    for (;;) {
+        if (output_size != 0 && ftruncate(out_fd, output_size) != 0) {
+            perror("utfconv: ftruncate");
+            return 1;
+        }
+        char *output = NULL;
+        if (output_size != 0) {
+            output = (char *) mmap(NULL, output_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+            if (output == MAP_FAILED) {
+                perror("utfconv: mmap");
+                return 1;
+            }
+        }
+        size_t c = 0, w = 0;
+        r = UTF::impl::unicode_conv<Read, Encode>(input + consumed, input_len - consumed, output + written, output_size - written, &c, &w);
+        consumed += c;
+        written += w;
+        if (output) {
+            munmap(output, output_size);
+        }
+        if (r != UTF::RetCode::E_OUTPUT_FULL) {
+            break;
+        }
+        // the precomputed length is exact for valid inputs only
+        output_size += (input_len - consumed) * 4 + 16;
+    }
+    if (ftruncate(out_fd, written) != 0) {
+        perror("utfconv: ftruncate");
+        return 1;
+    }
+    stats->bytes_in = consumed;
+    stats->bytes_out = written;
+    return r == UTF::RetCode::OK ? 0 : report_error(r, consumed);
+}
+
+/*
+ * Convert a memory-mapped input into any file descriptor, by batches
+ */
+template<typename Read, typename Encode>
+static int transcode_mapped_to_fd(const char *input, size_t input_len, int out_fd, Stats *stats) {
+    char *output = (char *) malloc(BATCH_SIZE);
+    size_t consumed = 0;
+    UTF::RetCode r;
+    stats->bytes_out = 0;
+    do {
+        size_t c = 0, w = 0;
+        r = UTF::impl::unicode_conv<Read, Encode>(input + consumed, input_len - consumed, output, BATCH_SIZE, &c, &w);
+        consumed += c;
+        stats->bytes_out += w;
+        if (!write_all(out_fd, output, w)) {
+            free(output);
+            return 1;
+        }
+    } while (r == UTF::RetCode::E_OUTPUT_FULL);
+    free(output);
+    stats->bytes_in = consumed;
+    return r == UTF::RetCode::OK ? 0 : report_error(r, consumed);
+}
+
+/*
+ * Convert a non-mappable input (pipe...) read by chunks
+ */
+template<typename Read, typename Encode>
+static int transcode_stream(int in_fd, int out_fd, Stats *stats) {
+    UTF::StreamConverter<Read, Encode> conv;
+    char *input = (char *) malloc(BATCH_SIZE);
+    char *output = (char *) malloc(BATCH_SIZE);
+    int ret = 0;
+    stats->bytes_in = 0;
+    stats->bytes_out = 0;
+    for (;;) {
+        ssize_t n = read(in_fd, input, BATCH_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("utfconv: read");
+            ret = 1;
+            break;
+        }
+        if (n == 0) {
+            size_t pending = conv.pending();
+            if (conv.finish() != UTF::RetCode::OK) {
+                ret = report_error(UTF::RetCode::E_TRUNCATED, stats->bytes_in - pending);
+            }
+            break;
+        }
+        size_t consumed = 0;
+        UTF::RetCode r;
+        do {
+            size_t c = 0, w = 0;
+            r = conv.convert(input + consumed, n - consumed, output, BATCH_SIZE, &c, &w);
+            consumed += c;
+            stats->bytes_out += w;
+            if (!write_all(out_fd, output, w)) {
+                ret = 1;
+                break;
+            }
+        } while (r == UTF::RetCode::E_OUTPUT_FULL);
+        if (ret != 0) {
+            break;
+        }
+        if (r != UTF::RetCode::OK) {
+            // the invalid sequence may begin in the pending bytes of the previous chunk
+            ret = report_error(r, stats->bytes_in + consumed - (consumed == 0 ? conv.pending() : 0));
+            break;
+        }
+        stats->bytes_in += n;
+    }
+    free(input);
+    free(output);
+    return ret;
+}
+
+template<typename Read, typename Encode>
+static int transcode(int in_fd, int out_fd, Stats *stats) {
+    struct stat in_stat, out_stat;
+    if (fstat(in_fd, &in_stat) != 0 || fstat(out_fd, &out_stat) != 0) {
+        perror("utfconv: fstat");
+        return 1;
+    }
+    if (!S_ISREG(in_stat.st_mode) || in_stat.st_size == 0) {
+        return transcode_stream<Read, Encode>(in_fd, out_fd, stats);
+    }
+
+    size_t input_len = in_stat.st_size;
+    const char *input = (const char *) mmap(NULL, input_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (input == MAP_FAILED) {
+        return transcode_stream<Read, Encode>(in_fd, out_fd, stats);
+    }
+    madvise((void *) input, input_len, MADV_SEQUENTIAL);
+
+    // the output is mapped only if it's a regular file opened read-write at its beginning (not a redirected stdout)
+    int ret;
+    if (S_ISREG(out_stat.st_mode) && (fcntl(out_fd, F_GETFL) & O_ACCMODE) == O_RDWR && lseek(out_fd, 0, SEEK_CUR) == 0) {
+        ret = transcode_mapped_to_file<Read, Encode>(input, input_len, out_fd, stats);
+    } else {
+        ret = transcode_mapped_to_fd<Read, Encode>(input, input_len, out_fd, stats);
+    }
+    munmap((void *) input, input_len);
+    return ret;
+}
+
+typedef int (*TranscodeFunc)(int, int, Stats *);
+
+/* "UTF-16LE", "utf16le"... -> "utf16le" */
+static std::string normalize_name(const char *name) {
+    std::string normalized;
+    for (; *name; name++) {
+        if (*name != '-' && *name != '_') {
+            normalized.push_back(tolower((unsigned char) *name));
+        }
+    }
+    return normalized;
+}
+
+template<typename Read>
+static TranscodeFunc transcoder_to(const std::string &to) {
+    if (to == "utf8") {
+        return transcode<Read, UTF::impl::CpToUtf8>;
+    } else if (to == "utf16le") {
+        return transcode<Read, UTF::impl::CpToUtf16le>;
+    } else if (to == "utf16be") {
+        return transcode<Read, UTF::impl::CpToUtf16be>;
+    } else if (to == "utf32le") {
+        return transcode<Read, UTF::impl::CpToUtf32le>;
+    } else if (to == "utf32be") {
+        return transcode<Read, UTF::impl::CpToUtf32be>;
+    } else if (to == "latin1" || to == "iso88591") {
+        return transcode<Read, UTF::impl::CpToLatin1>;
+    } else if (to == "windows1250" || to == "cp1250") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Windows1250> >;
+    } else if (to == "windows1251" || to == "cp1251") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Windows1251> >;
+    } else if (to == "windows1252" || to == "cp1252") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Windows1252> >;
+    } else if (to == "iso88592") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Iso8859_2> >;
+    } else if (to == "iso88595") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Iso8859_5> >;
+    } else if (to == "iso885915") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Iso8859_15> >;
+    } else if (to == "koi8r") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Koi8R> >;
+    } else if (to == "koi8u") {
+        return transcode<Read, UTF::impl::CpToSingleByte<UTF::impl::Koi8U> >;
+    } else if (to == "gb18030") {
+        return transcode<Read, UTF::impl::CpToGb<UTF::impl::Gb18030> >;
+    } else if (to == "gbk" || to == "cp936") {
+        return transcode<Read, UTF::impl::CpToGb<UTF::impl::Gbk> >;
+    }
+    return NULL;
+}
+
+static TranscodeFunc transcoder(const std::string &from, const std::string &to) {
+    if (from == "utf8") {
+        return transcoder_to<UTF::impl::ReadUtf8Cp>(to);
+    } else if (from == "utf16le") {
+        return transcoder_to<UTF::impl::ReadUtf16leCp>(to);
+    } else if (from == "utf16be") {
+        return transcoder_to<UTF::impl::ReadUtf16beCp>(to);
+    } else if (from == "utf32le") {
+        return transcoder_to<UTF::impl::ReadUtf32leCp>(to);
+    } else if (from == "utf32be") {
+        return transcoder_to<UTF::impl::ReadUtf32beCp>(to);
+    } else if (from == "latin1" || from == "iso88591") {
+        return transcoder_to<UTF::impl::ReadLatin1Cp>(to);
+    } else if (from == "windows1250" || from == "cp1250") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Windows1250> >(to);
+    } else if (from == "windows1251" || from == "cp1251") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Windows1251> >(to);
+    } else if (from == "windows1252" || from == "cp1252") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Windows1252> >(to);
+    } else if (from == "iso88592") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Iso8859_2> >(to);
+    } else if (from == "iso88595") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Iso8859_5> >(to);
+    } else if (from == "iso885915") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Iso8859_15> >(to);
+    } else if (from == "koi8r") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Koi8R> >(to);
+    } else if (from == "koi8u") {
+        return transcoder_to<UTF::impl::ReadSingleByteCp<UTF::impl::Koi8U> >(to);
+    } else if (from == "gb18030") {
+        return transcoder_to<UTF::impl::ReadGbCp<UTF::impl::Gb18030> >(to);
+    } else if (from == "gbk" || from == "cp936") {
+        return transcoder_to<UTF::impl::ReadGbCp<UTF::impl::Gbk> >(to);
+    }
+    return NULL;
+}
+
+static void usage(FILE *out) {
+    fprintf(out,
+            "usage: utfconv -f FROM -t TO [-v] [INPUT [OUTPUT]]\n"
+            "  FROM, TO : utf8, utf16le, utf16be, utf32le, utf32be, latin1 (iso-8859-1),\n"
+            "             windows-1250 (cp1250), windows-1251 (cp1251), windows-1252 (cp1252),\n"
+            "             iso-8859-2, iso-8859-5, iso-8859-15, koi8-r, koi8-u, gb18030 or gbk (cp936)\n"
+            "  INPUT, OUTPUT : file names, standard input / output if missing or \"-\"\n"
+            "  -v : report the throughput on the standard error\n");
+}
+
+int main(int argc, char **argv) {
+    const char *from = NULL, *to = NULL;
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:vh")) != -1) {
+        switch (opt) {
+        case 'f':
+            from = optarg;
+            break;
+        case 't':
+            to = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+            usage(stdout);
+            return 0;
+        default:
+            usage(stderr);
+            return 2;
+        }
+    }
+    if (!from || !to || argc - optind > 2) {
+        usage(stderr);
+        return 2;
+    }
+    TranscodeFunc func = transcoder(normalize_name(from), normalize_name(to));
+    if (!func) {
+        fprintf(stderr, "utfconv: unsupported conversion from %s to %s\n", from, to);
+        return 2;
+    }
+
+    const char *in_name = optind < argc ? argv[optind] : "-";
+    const char *out_name = optind + 1 < argc ? argv[optind + 1] : "-";
+    int in_fd = STDIN_FILENO, out_fd = STDOUT_FILENO;
+    if (strcmp(in_name, "-") != 0) {
+        in_fd = open(in_name, O_RDONLY);
+        if (in_fd < 0) {
+            fprintf(stderr, "utfconv: %s: %s\n", in_name, strerror(errno));
+            return 1;
+        }
+    }
+    if (strcmp(out_name, "-") != 0) {
+        // read-write : the output is memory-mapped
+        out_fd = open(out_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (out_fd < 0) {
+            fprintf(stderr, "utfconv: %s: %s\n", out_name, strerror(errno));
+            return 1;
+        }
+    }
+
+    Stats stats = {0, 0};
+    auto start = std::chrono::steady_clock::now();
+    int ret = func(in_fd, out_fd, &stats);
+    auto end = std::chrono::steady_clock::now();
+
+    if (out_fd != STDOUT_FILENO && close(out_fd) != 0) {
+        perror("utfconv: close");
+        ret = 1;
+    }
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+
+    if (verbose) {
+        double seconds = std::chrono::duration<double>(end - start).count();
+        fprintf(stderr, "utfconv: %zu bytes -> %zu bytes in %.3f ms (%.3f GB/s)\n",
+                stats.bytes_in, stats.bytes_out, seconds * 1e3, seconds > 0 ? stats.bytes_in / seconds / 1e9 : 0.);
+    }
+    return ret;
+}